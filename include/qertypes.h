@@ -474,6 +474,11 @@ typedef struct brush_s
 	bool bFiltered;
 	bool bCamCulled;
 	bool bBrushDef;
+
+	// retained geometry for the camera and 2D views, owned by queuedraw.cpp
+	void *pRenderCache;
+	// leaf in the picking tree while the brush is on active_brushes, owned by brushtree.cpp
+	void *pTreeLeaf;
 } brush_t;
 
 #define MAX_FLAGS   16
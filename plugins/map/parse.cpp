@@ -29,6 +29,10 @@
 
 #include "plugin.h"
 
+#if !GLIB_CHECK_VERSION( 2, 36, 0 ) && !defined( _WIN32 )
+#include <unistd.h>
+#endif
+
 // cmdlib
 extern void ExtractFileName( const char *path, char *dest );
 
@@ -190,120 +194,314 @@ char *SearchWadsForTextureName( const char *cleantexturename ){
 }
 // End of half-life specific stuff
 
-void Patch_Parse( patchMesh_t *pPatch ){
+// re-entrant tokenizer
+// the .map is read in two passes: Map_Read scans the entities and records where
+// each brush/patch block starts, then the blocks are parsed independently (on worker
+// threads for big maps). The core's GetToken works on a single global script, so
+// the map module carries its own copy of it here, with the same rules.
+
+#define MAP_MAXTOKEN 1024
+
+// primitives below this count are not worth spinning up threads for
+#define MAP_MIN_THREADED_PRIMITIVES 256
+#define MAP_MAX_THREADS 16
+
+typedef struct mapMessage_s
+{
+	int flag;
+	char *text;
+} mapMessage_t;
+
+typedef struct mapPrimitive_s
+{
+	char *start;            // just past the opening {
+	int line;
+	entity_t *owner;
+	brush_t *brush;
+	bool valid;             // false if the brush has to be thrown away
+	char *patchShader;      // patch shaders are resolved on the main thread
+	int abortcode;
+	GSList *messages;       // printed in file order once all blocks are parsed
+} mapPrimitive_t;
+
+typedef struct mapScript_s
+{
+	char *script_p;
+	int scriptline;
+	bool unget;
+	mapPrimitive_t *prim;   // NULL for the entity scan on the main thread
+	char token[MAP_MAXTOKEN];
+} mapScript_t;
+
+static void Script_Start( mapScript_t *script, char *data, int line, mapPrimitive_t *prim ){
+	script->script_p = data;
+	script->scriptline = line;
+	script->unget = false;
+	script->prim = prim;
+	script->token[0] = '\0';
+}
+
+static void Script_Printf( mapScript_t *script, int flag, const char *text, ... ){
+	char buf[1024];
+	va_list args;
+
+	va_start( args, text );
+	vsnprintf( buf, sizeof( buf ), text, args );
+	va_end( args );
+	buf[sizeof( buf ) - 1] = '\0';
+
+	if ( !script->prim ) {
+		Sys_FPrintf( flag, "%s", buf );
+		return;
+	}
+
+	mapMessage_t *msg = new mapMessage_t;
+	msg->flag = flag;
+	msg->text = strdup( buf );
+	script->prim->messages = g_slist_prepend( script->prim->messages, msg );
+}
+
+// the scan pass sees every token before any worker does, so it is the one
+// that trips over a broken token and takes the editor down like the core parser.
+// a worker can only get here if the scan didn't, just drop the map in that case
+static bool Script_Error( mapScript_t *script, const char *msg ){
+	if ( !script->prim ) {
+		Error( "%s on line %i", msg, script->scriptline );
+		return false;
+	}
+	Script_Printf( script, SYS_ERR, "ERROR: %s (line %i)\n", msg, script->scriptline );
+	script->prim->abortcode = MAP_ABORTED;
+	return false;
+}
+
+static bool Script_GetToken( mapScript_t *script, bool crossline ){
+	char *token_p;
+	char *script_p;
+
+	if ( script->unget ) { // is a token already waiting?
+		script->unget = false;
+		return true;
+	}
+
+	script_p = script->script_p;
+
+	//
+	// skip space
+	//
+skipspace:
+	while ( *script_p <= 32 )
+	{
+		if ( !*script_p ) {
+			if ( !crossline ) {
+				Script_Printf( script, SYS_WRN, "Warning: Line %i is incomplete [01]\n", script->scriptline );
+			}
+			script->script_p = script_p;
+			return false;
+		}
+		if ( *script_p++ == '\n' ) {
+			if ( !crossline ) {
+				Script_Printf( script, SYS_WRN, "Warning: Line %i is incomplete [02]\n", script->scriptline );
+			}
+			script->scriptline++;
+		}
+	}
+
+	if ( script_p[0] == '/' && script_p[1] == '/' ) { // comment field
+		if ( !crossline ) {
+			Script_Printf( script, SYS_WRN, "Warning: Line %i is incomplete [03]\n", script->scriptline );
+		}
+		while ( *script_p++ != '\n' )
+			if ( !*script_p ) {
+				if ( !crossline ) {
+					Script_Printf( script, SYS_WRN, "Warning: Line %i is incomplete [04]\n", script->scriptline );
+				}
+				script->script_p = script_p;
+				return false;
+			}
+		script->scriptline++;
+		goto skipspace;
+	}
+
+	//
+	// copy token
+	//
+	token_p = script->token;
+
+	if ( *script_p == '"' ) {
+		script_p++;
+		while ( *script_p != '"' )
+		{
+			if ( !*script_p ) {
+				script->script_p = script_p;
+				return Script_Error( script, "EOF inside quoted token" );
+			}
+			*token_p++ = *script_p++;
+			if ( token_p == &script->token[MAP_MAXTOKEN] ) {
+				script->script_p = script_p;
+				return Script_Error( script, "Token too large" );
+			}
+		}
+		script_p++;
+	}
+	else
+	{
+		while ( *script_p > 32 )
+		{
+			*token_p++ = *script_p++;
+			if ( token_p == &script->token[MAP_MAXTOKEN] ) {
+				script->script_p = script_p;
+				return Script_Error( script, "Token too large" );
+			}
+		}
+	}
+
+	*token_p = 0;
+	script->script_p = script_p;
+
+	return true;
+}
+
+static void Script_UnGetToken( mapScript_t *script ){
+	script->unget = true;
+}
+
+// returns true if there is another token on the line
+static bool Script_TokenAvailable( mapScript_t *script ){
+	char *search_p;
+
+	search_p = script->script_p;
+
+	while ( *search_p <= 32 )
+	{
+		if ( *search_p == '\n' ) {
+			return false;
+		}
+		if ( *search_p == 0 ) {
+			return false;
+		}
+		search_p++;
+	}
+
+	if ( *search_p == ';' ) {
+		return false;
+	}
+
+	return true;
+}
+
+static void Patch_Parse( mapScript_t *script, patchMesh_t *pPatch ){
 	int i, j;
 	char *str;
 
-	char *token = Token();
+	char *token = script->token;
 
-	GetToken( true ); //{
+	Script_GetToken( script, true ); //{
 
 	// parse shader name
-	GetToken( true );
+	Script_GetToken( script, true );
+	// the shader manager isn't thread safe, Map_Read looks this up once the block is done
 	str = new char[strlen( token ) + 10];
 	strcpy( str, "textures/" );
 	strcpy( str + 9, token );
-	pPatch->pShader = QERApp_Shader_ForName( str );
-	pPatch->d_texture = pPatch->pShader->getTexture();
-	delete [] str;
+	script->prim->patchShader = str;
 
-	GetToken( true ); //(
+	Script_GetToken( script, true ); //(
 
 	// parse matrix dimensions
-	GetToken( false );
+	Script_GetToken( script, false );
 	pPatch->width = atoi( token );
 	if ( pPatch->width > MAX_PATCH_WIDTH ) {
-		Syn_Printf( "ERROR: patch has too many planes, patch width > MAX_PATCH_WIDTH (%i > %i)\n", pPatch->width, MAX_PATCH_WIDTH );
+		Script_Printf( script, SYS_ERR, "ERROR: patch has too many planes, patch width > MAX_PATCH_WIDTH (%i > %i)\n", pPatch->width, MAX_PATCH_WIDTH );
 		pPatch->width = MAX_PATCH_WIDTH;
-		abortcode = MAP_ABORTED;
+		script->prim->abortcode = MAP_ABORTED;
 	}
-	GetToken( false );
+	Script_GetToken( script, false );
 	pPatch->height = atoi( token );
 	if ( pPatch->height > MAX_PATCH_HEIGHT ) {
-		Syn_Printf( "ERROR: patch has too many plane points, patch height > MAX_PATCH_HEIGHT (%i > %i)\n", pPatch->height, MAX_PATCH_HEIGHT );
+		Script_Printf( script, SYS_ERR, "ERROR: patch has too many plane points, patch height > MAX_PATCH_HEIGHT (%i > %i)\n", pPatch->height, MAX_PATCH_HEIGHT );
 		pPatch->height = MAX_PATCH_HEIGHT;
-		abortcode = MAP_ABORTED;
+		script->prim->abortcode = MAP_ABORTED;
 	}
 
 	// ignore contents/flags/value
-	GetToken( false );
-	GetToken( false );
-	GetToken( false );
+	Script_GetToken( script, false );
+	Script_GetToken( script, false );
+	Script_GetToken( script, false );
 
-	GetToken( false ); //)
+	Script_GetToken( script, false ); //)
 
 	// parse matrix
-	GetToken( true ); //(
+	Script_GetToken( script, true ); //(
 	for ( i = 0; i < pPatch->width; i++ )
 	{
-		GetToken( true ); //(
+		Script_GetToken( script, true ); //(
 		for ( j = 0; j < pPatch->height; j++ )
 		{
-			GetToken( false ); //(
+			Script_GetToken( script, false ); //(
 
-			GetToken( false );
+			Script_GetToken( script, false );
 			pPatch->ctrl[i][j].xyz[0] = atof( token );
-			GetToken( false );
+			Script_GetToken( script, false );
 			pPatch->ctrl[i][j].xyz[1] = atof( token );
-			GetToken( false );
+			Script_GetToken( script, false );
 			pPatch->ctrl[i][j].xyz[2] = atof( token );
-			GetToken( false );
+			Script_GetToken( script, false );
 			pPatch->ctrl[i][j].st[0] = atof( token );
-			GetToken( false );
+			Script_GetToken( script, false );
 			pPatch->ctrl[i][j].st[1] = atof( token );
 
-			GetToken( false ); //)
+			Script_GetToken( script, false ); //)
 		}
-		GetToken( false ); //)
+		Script_GetToken( script, false ); //)
 	}
-	GetToken( true ); //)
+	Script_GetToken( script, true ); //)
 
-	GetToken( true ); //}
+	Script_GetToken( script, true ); //}
 }
 
-void Face_Parse( face_t *face, bool bAlternateTexdef = false ){
+static void Face_Parse( mapScript_t *script, face_t *face, bool bAlternateTexdef = false ){
 	int i, j;
 	char *str;
 	bool bworldcraft = false;
 
-	char *token = Token();
+	char *token = script->token;
 
 	// parse planepts
 	str = NULL;
 	for ( i = 0; i < 3; i++ )
 	{
-		GetToken( true ); //(
+		Script_GetToken( script, true ); //(
 		for ( j = 0; j < 3; j++ )
 		{
-			GetToken( false );
+			Script_GetToken( script, false );
 			face->planepts[i][j] = atof( token );
 		}
-		GetToken( false ); //)
+		Script_GetToken( script, false ); //)
 	}
 
 	if ( bAlternateTexdef ) {
 		// parse alternate texdef
-		GetToken( false ); // (
-		GetToken( false ); // (
+		Script_GetToken( script, false ); // (
+		Script_GetToken( script, false ); // (
 		for ( i = 0; i < 3; i++ )
 		{
-			GetToken( false );
+			Script_GetToken( script, false );
 			face->brushprimit_texdef.coords[0][i] = atof( token );
 		}
-		GetToken( false ); // )
-		GetToken( false ); // (
+		Script_GetToken( script, false ); // )
+		Script_GetToken( script, false ); // (
 		for ( i = 0; i < 3; i++ )
 		{
-			GetToken( false );
+			Script_GetToken( script, false );
 			face->brushprimit_texdef.coords[1][i] = atof( token );
 		}
-		GetToken( false ); // )
-		GetToken( false ); // )
+		Script_GetToken( script, false ); // )
+		Script_GetToken( script, false ); // )
 	}
 
 
 	// parse shader name
-	GetToken( false ); // shader
+	Script_GetToken( script, false ); // shader
 
 	// if we're loading a halflife map then we don't have a relative texture name
 	// we just get <texturename>.  So we need to convert this to a relative name
@@ -348,7 +546,7 @@ void Face_Parse( face_t *face, bool bAlternateTexdef = false ){
 		else
 		{
 			// using the cache below means that this message is only ever printed out once!
-			Sys_FPrintf( SYS_WRN, "WARNING: could not find \"%s\" in any listed wad files, searching all wad files instead!\n",token );
+			Script_Printf( script, SYS_WRN, "WARNING: could not find \"%s\" in any listed wad files, searching all wad files instead!\n",token );
 		}
 		// end of half-life specific bit.
 
@@ -400,7 +598,7 @@ void Face_Parse( face_t *face, bool bAlternateTexdef = false ){
 			}
 			else
 			{
-				Sys_FPrintf( SYS_WRN, "WARNING: could not find \"%s\" in the vfs search path\n",token );
+				Script_Printf( script, SYS_WRN, "WARNING: could not find \"%s\" in the vfs search path\n",token );
 				str = new char[strlen( token ) + 10];
 				strcpy( str, "textures/" );
 				strcpy( str + 9, token );
@@ -421,165 +619,179 @@ void Face_Parse( face_t *face, bool bAlternateTexdef = false ){
 
 	if ( !bAlternateTexdef ) {
 		if ( g_MapVersion == MAPVERSION_HL ) { // Q1 as well ?
-			GetToken( false );
+			Script_GetToken( script, false );
 			if ( token[0] == '[' && token[1] == '\0' ) {
 				bworldcraft = true;
 
-				GetToken( false ); // UAxis[0]
-				GetToken( false ); // UAxis[1]
-				GetToken( false ); // UAxis[2]
+				Script_GetToken( script, false ); // UAxis[0]
+				Script_GetToken( script, false ); // UAxis[1]
+				Script_GetToken( script, false ); // UAxis[2]
 
-				GetToken( false ); // shift
+				Script_GetToken( script, false ); // shift
 				face->texdef.shift[0] = atof( token );
 
-				GetToken( false ); // ]
+				Script_GetToken( script, false ); // ]
 
-				GetToken( false ); // [
-				GetToken( false ); // VAxis[0]
-				GetToken( false ); // VAxis[1]
-				GetToken( false ); // VAxis[2]
+				Script_GetToken( script, false ); // [
+				Script_GetToken( script, false ); // VAxis[0]
+				Script_GetToken( script, false ); // VAxis[1]
+				Script_GetToken( script, false ); // VAxis[2]
 
-				GetToken( false ); // shift
+				Script_GetToken( script, false ); // shift
 				face->texdef.shift[1] = atof( token );
 
-				GetToken( false ); // ]
+				Script_GetToken( script, false ); // ]
 
 				// rotation is derived from the U and V axes.
 				// ZHLT ignores this setting even if present in a .map file.
-				GetToken( false );
+				Script_GetToken( script, false );
 				face->texdef.rotate = atof( token );
 
 				// Scales
-				GetToken( false );
+				Script_GetToken( script, false );
 				face->texdef.scale[0] = atof( token );
-				GetToken( false );
+				Script_GetToken( script, false );
 				face->texdef.scale[1] = atof( token );
 			}
 			else
 			{
-				UnGetToken();
+				Script_UnGetToken( script );
 			}
 		}
 
 		if ( !bworldcraft ) { // !MAPVERSION_HL
 			// parse texdef
-			GetToken( false );
+			Script_GetToken( script, false );
 			face->texdef.shift[0] = atof( token );
-			GetToken( false );
+			Script_GetToken( script, false );
 			face->texdef.shift[1] = atof( token );
-			GetToken( false );
+			Script_GetToken( script, false );
 			face->texdef.rotate = atof( token );
-			GetToken( false );
+			Script_GetToken( script, false );
 			face->texdef.scale[0] = atof( token );
-			GetToken( false );
+			Script_GetToken( script, false );
 			face->texdef.scale[1] = atof( token );
 		}
 	}
 	// parse the optional contents/flags/value
-	if ( !bworldcraft && TokenAvailable() ) {
-		GetToken( true );
+	if ( !bworldcraft && Script_TokenAvailable( script ) ) {
+		Script_GetToken( script, true );
 		if ( isdigit( token[0] ) ) {
 			face->texdef.contents = atoi( token );
-			GetToken( false );
+			Script_GetToken( script, false );
 			face->texdef.flags = atoi( token );
-			GetToken( false );
+			Script_GetToken( script, false );
 			face->texdef.value = atoi( token );
 		}
 		else
 		{
-			UnGetToken();
+			Script_UnGetToken( script );
 		}
 	}
 }
 
-bool Primitive_Parse( brush_t *pBrush ){
-	char *token = Token();
+static bool Primitive_Parse( mapScript_t *script, brush_t *pBrush ){
+	char *token = script->token;
 
-	GetToken( true );
+	Script_GetToken( script, true );
 	if ( !strcmp( token, "patchDef2" ) ) {
 		pBrush->patchBrush = true;
 		pBrush->pPatch = Patch_Alloc();
 		pBrush->pPatch->pSymbiot = pBrush;
-		Patch_Parse( pBrush->pPatch );
-		GetToken( true ); //}
+		Patch_Parse( script, pBrush->pPatch );
+		Script_GetToken( script, true ); //}
 
 		// A patchdef should never be loaded from a quake2 map file
 		// so we just return false and the brush+patch gets freed
 		// and the user gets told.
 		if ( g_MapVersion != MAPVERSION_Q3 ) {
-			// FIXME: Hydra - I wanted to write out a line number here, but I can't because there's no API to access the core's "scriptline" variable.
-			Syn_Printf( "ERROR: patchDef2's are not supported in Quake%d format .map files!\n",g_MapVersion );
-			abortcode = MAP_WRONGVERSION;
+			Script_Printf( script, SYS_ERR, "ERROR: patchDef2's are not supported in Quake%d format .map files! (line %i)\n",g_MapVersion, script->scriptline );
+			script->prim->abortcode = MAP_WRONGVERSION;
 			return false;
 		}
 	}
 	else if ( !strcmp( token, "brushDef" ) ) {
 		pBrush->bBrushDef = true;
-		GetToken( true ); // {
+		Script_GetToken( script, true ); // {
 		while ( 1 )
 		{
 			face_t    *f = pBrush->brush_faces;
 			pBrush->brush_faces = Face_Alloc();
-			Face_Parse( pBrush->brush_faces, true );
+			Face_Parse( script, pBrush->brush_faces, true );
 			pBrush->brush_faces->next = f;
 			// check for end of brush
-			GetToken( true );
+			Script_GetToken( script, true );
 			if ( strcmp( token,"}" ) == 0 ) {
 				break;
 			}
-			UnGetToken();
+			Script_UnGetToken( script );
 		}
-		GetToken( true ); // }
+		Script_GetToken( script, true ); // }
 	}
 	else
 	{
-		UnGetToken();
+		Script_UnGetToken( script );
 		while ( 1 )
 		{
 			face_t    *f = pBrush->brush_faces;
 			pBrush->brush_faces = Face_Alloc();
-			Face_Parse( pBrush->brush_faces );
+			Face_Parse( script, pBrush->brush_faces );
 			pBrush->brush_faces->next = f;
 
 			// check for end of brush
-			GetToken( true );
+			Script_GetToken( script, true );
 			if ( strcmp( token,"}" ) == 0 ) {
 				break;
 			}
-			UnGetToken();
+			Script_UnGetToken( script );
 		}
 	}
 	return true;
 }
 
-void Entity_Parse( entity_t *pEntity ){
-	brush_t *pBrush;
-//  CPtrArray *brushes = NULL;
+// records the primitive blocks for later and applies the key/value pairs right away,
+// Face_Parse needs the worldspawn "wad" key before any halflife brush is parsed
+static void Entity_Scan( mapScript_t *script, entity_t *pEntity, GArray *primitives ){
+	mapPrimitive_t prim;
 	char temptoken[1024];
+	int depth;
 
-	char *token = Token();
+	char *token = script->token;
 
 	while ( 1 )
 	{
-		GetToken( true ); // { or } or epair
+		if ( !Script_GetToken( script, true ) ) { // { or } or epair
+			break;
+		}
 		if ( !strcmp( token, "}" ) ) {
 			break;
 		}
 		else if ( !strcmp( token, "{" ) ) {
 
-			pBrush = Brush_Alloc();
-			if ( Primitive_Parse( pBrush ) ) {
-				( (CPtrArray*)pEntity->pData )->Add( pBrush );
-			}
-			else {
-				Brush_Free( pBrush, true );
+			memset( &prim, 0, sizeof( prim ) );
+			prim.start = script->script_p;
+			prim.line = script->scriptline;
+			prim.owner = pEntity;
+			prim.abortcode = MAP_NOERROR;
+			g_array_append_val( primitives, prim );
+
+			// skip to the matching brace, patches and brushDef nest one level deeper
+			depth = 1;
+			while ( depth > 0 && Script_GetToken( script, true ) )
+			{
+				if ( !strcmp( token, "{" ) ) {
+					depth++;
+				}
+				else if ( !strcmp( token, "}" ) ) {
+					depth--;
+				}
 			}
 
 		}
 		else {
 
 			strcpy( temptoken, token );
-			GetToken( false );
+			Script_GetToken( script, false );
 
 			SetKeyValue( pEntity, temptoken, token );
 
@@ -594,28 +806,186 @@ void Entity_Parse( entity_t *pEntity ){
 	}
 }
 
+static void Primitive_ParseBlock( mapPrimitive_t *prim ){
+	mapScript_t script;
+
+	Script_Start( &script, prim->start, prim->line, prim );
+	prim->brush = Brush_Alloc();
+	prim->valid = Primitive_Parse( &script, prim->brush );
+}
+
+typedef struct mapWork_s
+{
+	mapPrimitive_t *primitives;
+	gint numPrimitives;
+	gint next;
+} mapWork_t;
+
+// the threading API moved around between glib versions, the win32 gtk bundle ships an old one
+static gint Map_NextPrimitive( mapWork_t *work ){
+#if GLIB_CHECK_VERSION( 2, 30, 0 )
+	return g_atomic_int_add( &work->next, 1 );
+#else
+	return g_atomic_int_exchange_and_add( &work->next, 1 );
+#endif
+}
+
+static int Map_NumProcessors(){
+#if GLIB_CHECK_VERSION( 2, 36, 0 )
+	return g_get_num_processors();
+#elif defined( _WIN32 )
+	SYSTEM_INFO info;
+
+	GetSystemInfo( &info );
+	return info.dwNumberOfProcessors;
+#else
+	return sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+}
+
+static gpointer Primitive_ParseThread( gpointer data ){
+	mapWork_t *work = (mapWork_t *)data;
+	gint i;
+
+	while ( ( i = Map_NextPrimitive( work ) ) < work->numPrimitives )
+		Primitive_ParseBlock( &work->primitives[i] );
+
+	return NULL;
+}
+
+static GThread *Map_StartThread( mapWork_t *work ){
+#if GLIB_CHECK_VERSION( 2, 32, 0 )
+	return g_thread_new( "map", Primitive_ParseThread, work );
+#else
+	// old glib wants the thread system up before the first thread
+	if ( !g_thread_supported() ) {
+		g_thread_init( NULL );
+	}
+	return g_thread_create( Primitive_ParseThread, work, TRUE, NULL );
+#endif
+}
+
+// parses the recorded blocks, each one only touches its own brush so the order doesn't matter here
+static void Map_ParsePrimitives( mapPrimitive_t *primitives, int numPrimitives ){
+	mapWork_t work;
+	GThread *threads[MAP_MAX_THREADS];
+	int i, numThreads;
+
+	work.primitives = primitives;
+	work.numPrimitives = numPrimitives;
+	work.next = 0;
+
+	// the halflife texture lookup goes through the vfs and a shared cache, keep that on this thread
+	numThreads = 0;
+	if ( g_MapVersion != MAPVERSION_HL && numPrimitives >= MAP_MIN_THREADED_PRIMITIVES ) {
+		numThreads = Map_NumProcessors() - 1;
+		if ( numThreads > MAP_MAX_THREADS ) {
+			numThreads = MAP_MAX_THREADS;
+		}
+	}
+
+	for ( i = 0; i < numThreads; i++ )
+	{
+		threads[i] = Map_StartThread( &work );
+		if ( threads[i] == NULL ) {
+			break;
+		}
+	}
+	numThreads = i;
+
+	Primitive_ParseThread( &work );
+
+	for ( i = 0; i < numThreads; i++ )
+		g_thread_join( threads[i] );
+}
+
+static void Primitive_FreeMessages( mapPrimitive_t *prim, bool print ){
+	GSList *l;
+	mapMessage_t *msg;
+
+	prim->messages = g_slist_reverse( prim->messages );
+	for ( l = prim->messages; l != NULL; l = l->next )
+	{
+		msg = (mapMessage_t *)l->data;
+		if ( print ) {
+			Sys_FPrintf( msg->flag, "%s", msg->text );
+		}
+		free( msg->text );
+		delete msg;
+	}
+	g_slist_free( prim->messages );
+	prim->messages = NULL;
+}
+
 void Map_Read( IDataStream *in, CPtrArray *map ){
-	entity_t *pEntity;
+	entity_t *pEntity, *abortEntity;
+	mapScript_t *script;
+	mapPrimitive_t *prim;
+	GArray *primitives;
 	char *buf;
+	guint i;
 
 	unsigned long len = in->GetLength();
 	buf = new char[len + 1];
 	in->Read( buf, len );
 	buf[len] = '\0';
-	StartTokenParsing( buf );
 	abortcode = MAP_NOERROR;
 
-	while ( abortcode == MAP_NOERROR )
+	// pass 1: entities and their key/values, brush and patch blocks are only located
+	script = new mapScript_t;
+	Script_Start( script, buf, 1, NULL );
+	primitives = g_array_new( FALSE, FALSE, sizeof( mapPrimitive_t ) );
+
+	while ( 1 )
 	{
-		if ( !GetToken( true ) ) { // { or NULL
+		if ( !Script_GetToken( script, true ) ) { // { or NULL
 			break;
 		}
 		pEntity = Entity_Alloc();
 		pEntity->pData = new CPtrArray;
-		Entity_Parse( pEntity );
+		Entity_Scan( script, pEntity, primitives );
 		map->Add( pEntity );
 	}
 
+	delete script;
+
+	// pass 2: the blocks themselves
+	Map_ParsePrimitives( (mapPrimitive_t *)primitives->data, primitives->len );
+
+	// hand the brushes over in file order, an error drops the whole map after the entity it was in
+	abortEntity = NULL;
+	for ( i = 0; i < primitives->len; i++ )
+	{
+		prim = &g_array_index( primitives, mapPrimitive_t, i );
+
+		if ( abortEntity && prim->owner != abortEntity ) {
+			Primitive_FreeMessages( prim, false );
+			Brush_Free( prim->brush, true );
+			delete [] prim->patchShader;
+			continue;
+		}
+
+		Primitive_FreeMessages( prim, true );
+		if ( prim->abortcode != MAP_NOERROR ) {
+			abortcode = prim->abortcode;
+			abortEntity = prim->owner;
+		}
+
+		if ( prim->patchShader ) {
+			prim->brush->pPatch->pShader = QERApp_Shader_ForName( prim->patchShader );
+			prim->brush->pPatch->d_texture = prim->brush->pPatch->pShader->getTexture();
+			delete [] prim->patchShader;
+		}
+
+		if ( prim->valid ) {
+			( (CPtrArray*)prim->owner->pData )->Add( prim->brush );
+		}
+		else {
+			Brush_Free( prim->brush, true );
+		}
+	}
+
+	g_array_free( primitives, TRUE );
 	delete [] buf;
 
 	if ( abortcode != MAP_NOERROR ) {
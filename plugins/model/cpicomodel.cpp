@@ -22,23 +22,53 @@
 #include "cpicomodel.h"
 #include "cpicosurface.h"
 
+#include <algorithm>
+
+// bounding volume tree over every triangle of the model, so picking a dense model
+// does not test each triangle in turn
+#define TRITREE_LEAF_TRIS   4
+
+typedef struct
+{
+	vec3_t mins, maxs;
+	int first;          // interior nodes: index of the first child, the second follows it
+	int numTris;        // 0 for interior nodes, leaves own tris[first .. first + numTris - 1]
+} picoTriNode_t;
+
+struct picoTriTree_s
+{
+	vec3_t *verts;      // three per triangle, already in the order ray_intersect_triangle wants
+	int numTris;
+	picoTriNode_t *nodes;
+	int numNodes;
+};
+
+struct TriCentroidLess
+{
+	const vec3_t *centroids;
+	int axis;
+	bool operator()( int a, int b ) const {
+		return centroids[a][axis] < centroids[b][axis];
+	}
+};
+
 CPicoModel::CPicoModel( const PicoModelKey& key )
-	: m_refcount( 1 ){
+	: m_refcount( 1 ), m_pTriTree( NULL ){
 	load( key.first.GetBuffer(), key.second );
 }
 
 CPicoModel::CPicoModel( const Str& name )
-	: m_refcount( 1 ){
+	: m_refcount( 1 ), m_pTriTree( NULL ){
 	load( name.GetBuffer(), 0 );
 }
 
 CPicoModel::CPicoModel( const Str& name, const int frame )
-	: m_refcount( 1 ){
+	: m_refcount( 1 ), m_pTriTree( NULL ){
 	load( name.GetBuffer(), frame );
 }
 
 CPicoModel::CPicoModel( const char *name, const int frame )
-	: m_refcount( 1 ){
+	: m_refcount( 1 ), m_pTriTree( NULL ){
 	load( name, frame );
 }
 
@@ -94,6 +124,7 @@ CPicoModel::~CPicoModel(){
 	}
 	g_ptr_array_free( m_parents, FALSE );
 	delete [] m_name;
+	FreeTriTree();
 }
 
 void CPicoModel::AddParent( CPicoParent *parent ){
@@ -116,6 +147,7 @@ void CPicoModel::Reload( void ){
 	unsigned int j;
 
 	// Get rid of the old model
+	FreeTriTree();
 	if ( m_pModel ) {
 		for ( j = 0; j < m_children->len; j++ ) {
 			( (CPicoSurface*)m_children->pdata[j] )->DecRef();
@@ -162,10 +194,169 @@ void CPicoModel::Draw( int state, int rflags ) const {
 	}
 }
 
+void CPicoModel::FreeTriTree() const {
+	if ( m_pTriTree ) {
+		delete [] m_pTriTree->verts;
+		delete [] m_pTriTree->nodes;
+		delete m_pTriTree;
+		m_pTriTree = NULL;
+	}
+}
+
+static void TriTree_Bounds( picoTriTree_t *tree, const int *tris, int numTris, picoTriNode_t *node ){
+	int i, j, k;
+
+	VectorCopy( tree->verts[tris[0] * 3], node->mins );
+	VectorCopy( tree->verts[tris[0] * 3], node->maxs );
+	for ( i = 0; i < numTris; i++ )
+		for ( j = 0; j < 3; j++ )
+			for ( k = 0; k < 3; k++ )
+			{
+				vec_t v = tree->verts[tris[i] * 3 + j][k];
+				if ( v < node->mins[k] ) {
+					node->mins[k] = v;
+				}
+				if ( v > node->maxs[k] ) {
+					node->maxs[k] = v;
+				}
+			}
+}
+
+// splits tris at the centroid median of the longest axis until the leaves are small enough
+static void TriTree_Split( picoTriTree_t *tree, const vec3_t *centroids, int *tris, int first, int numTris, int nodeNum ){
+	picoTriNode_t *node = &tree->nodes[nodeNum];
+	TriCentroidLess less;
+	vec3_t size;
+	int half, children;
+
+	TriTree_Bounds( tree, tris + first, numTris, node );
+	if ( numTris <= TRITREE_LEAF_TRIS ) {
+		node->first = first;
+		node->numTris = numTris;
+		return;
+	}
+
+	VectorSubtract( node->maxs, node->mins, size );
+	less.centroids = centroids;
+	less.axis = ( size[0] > size[1] ) ? ( ( size[0] > size[2] ) ? 0 : 2 ) : ( ( size[1] > size[2] ) ? 1 : 2 );
+	half = numTris / 2;
+	std::nth_element( tris + first, tris + first + half, tris + first + numTris, less );
+
+	children = tree->numNodes;
+	tree->numNodes += 2;
+	node->first = children;
+	node->numTris = 0;
+
+	TriTree_Split( tree, centroids, tris, first, half, children );
+	TriTree_Split( tree, centroids, tris, first + half, numTris - half, children + 1 );
+}
+
+void CPicoModel::BuildTriTree() const {
+	picoSurface_t *pSurface;
+	vec3_t *verts, *centroids;
+	int i, j, k, numTris, *tris;
+
+	m_pTriTree = new picoTriTree_t;
+	m_pTriTree->verts = NULL;
+	m_pTriTree->nodes = NULL;
+	m_pTriTree->numTris = 0;
+	m_pTriTree->numNodes = 0;
+
+	numTris = 0;
+	for ( i = 0; i < PicoGetModelNumSurfaces( m_pModel ); i++ )
+	{
+		pSurface = PicoGetModelSurface( m_pModel, i );
+		if ( PicoGetSurfaceType( pSurface ) != PICO_TRIANGLES ) {
+			Sys_FPrintf( SYS_ERR, "ERROR: Unsupported Pico Surface Type: %i", PicoGetSurfaceType( pSurface ) );
+			continue;
+		}
+		numTris += PicoGetSurfaceNumIndexes( pSurface ) / 3;
+	}
+	if ( !numTris ) {
+		return;
+	}
+
+	verts = new vec3_t[numTris * 3];
+	centroids = new vec3_t[numTris];
+	tris = new int[numTris];
+
+	numTris = 0;
+	for ( i = 0; i < PicoGetModelNumSurfaces( m_pModel ); i++ )
+	{
+		pSurface = PicoGetModelSurface( m_pModel, i );
+		if ( PicoGetSurfaceType( pSurface ) != PICO_TRIANGLES ) {
+			continue;
+		}
+		for ( j = 0; j + 2 < PicoGetSurfaceNumIndexes( pSurface ); j += 3, numTris++ )
+		{
+			// reversed, as CPicoSurface::TestRay does
+			for ( k = 0; k < 3; k++ )
+				VectorCopy( PicoGetSurfaceXYZ( pSurface, PicoGetSurfaceIndex( pSurface, j + 2 - k ) ), verts[numTris * 3 + k] );
+			VectorAdd( verts[numTris * 3], verts[numTris * 3 + 1], centroids[numTris] );
+			VectorAdd( centroids[numTris], verts[numTris * 3 + 2], centroids[numTris] );
+			tris[numTris] = numTris;
+		}
+	}
+
+	m_pTriTree->verts = verts;
+	m_pTriTree->numTris = numTris;
+	m_pTriTree->nodes = new picoTriNode_t[2 * numTris];
+	m_pTriTree->numNodes = 1;
+	TriTree_Split( m_pTriTree, centroids, tris, 0, numTris, 0 );
+
+	// store the triangles in leaf order
+	verts = new vec3_t[numTris * 3];
+	for ( i = 0; i < numTris; i++ )
+		for ( k = 0; k < 3; k++ )
+			VectorCopy( m_pTriTree->verts[tris[i] * 3 + k], verts[i * 3 + k] );
+	delete [] m_pTriTree->verts;
+	m_pTriTree->verts = verts;
+
+	delete [] centroids;
+	delete [] tris;
+}
+
+// slab test against a node, returns false if the ray misses it or enters it beyond maxDist
+static bool TriTree_RayNode( const picoTriNode_t *node, const ray_t *ray, const vec3_t invDir, vec_t maxDist ){
+	vec_t t0, t1, tmin, tmax;
+	int i;
+
+	tmin = 0;
+	tmax = maxDist;
+	for ( i = 0; i < 3; i++ )
+	{
+		if ( ray->direction[i] == 0 ) {
+			if ( ray->origin[i] < node->mins[i] || ray->origin[i] > node->maxs[i] ) {
+				return false;
+			}
+			continue;
+		}
+		t0 = ( node->mins[i] - ray->origin[i] ) * invDir[i];
+		t1 = ( node->maxs[i] - ray->origin[i] ) * invDir[i];
+		if ( t0 > t1 ) {
+			vec_t t = t0;
+			t0 = t1;
+			t1 = t;
+		}
+		if ( t0 > tmin ) {
+			tmin = t0;
+		}
+		if ( t1 < tmax ) {
+			tmax = t1;
+		}
+		if ( tmin > tmax ) {
+			return false;
+		}
+	}
+	return true;
+}
+
 bool CPicoModel::TestRay( const ray_t *ray, vec_t *dist ) const {
 	vec_t dist_start = *dist;
 	vec_t dist_local = *dist;
 	ray_t ray_local = *ray;
+	vec3_t invDir;
+	int stack[64], sp, i;
 
 	if ( !m_pModel ) {
 		return false;
@@ -174,13 +365,41 @@ bool CPicoModel::TestRay( const ray_t *ray, vec_t *dist ) const {
 	if ( !aabb_intersect_ray( &m_BBox, &ray_local, &dist_local ) ) {
 		return false;
 	}
-	dist_local = dist_start;
 
-	for ( unsigned int i = 0; i < m_children->len; i++ )
+	if ( !m_pTriTree ) {
+		BuildTriTree();
+	}
+	if ( !m_pTriTree->numTris ) {
+		return false;
+	}
+
+	for ( i = 0; i < 3; i++ )
+		invDir[i] = ( ray->direction[i] != 0 ) ? 1.0f / ray->direction[i] : 0;
+
+	// the splits are medians, so the depth stays well inside the stack
+	sp = 0;
+	stack[sp++] = 0;
+	while ( sp )
 	{
-		if ( ( (CPicoSurface*)m_children->pdata[i] )->TestRay( &ray_local, &dist_local ) ) {
-			*dist = dist_local;
+		const picoTriNode_t *node = &m_pTriTree->nodes[stack[--sp]];
+
+		if ( !TriTree_RayNode( node, ray, invDir, *dist ) ) {
+			continue;
 		}
+
+		if ( node->numTris ) {
+			for ( i = node->first; i < node->first + node->numTris; i++ )
+			{
+				dist_local = ray_intersect_triangle( ray, true, m_pTriTree->verts[i * 3], m_pTriTree->verts[i * 3 + 1], m_pTriTree->verts[i * 3 + 2] );
+				if ( dist_local >= 0 && dist_local < *dist ) {
+					*dist = dist_local;
+				}
+			}
+			continue;
+		}
+
+		stack[sp++] = node->first + 1;
+		stack[sp++] = node->first;
 	}
 
 	return *dist < dist_start;
@@ -35,6 +35,8 @@ virtual void UpdateShaders( void ) = 0;
 
 class CModelManager;  // forward declaration
 
+typedef struct picoTriTree_s picoTriTree_t;  // TestRay acceleration, see cpicomodel.cpp
+
 //typedef std::pair<Str, int> PicoModelKey;
 typedef std::pair<Str, int> PicoModelKey;
 
@@ -77,6 +79,8 @@ char *GetShaderNameForSurface( const unsigned int surf );
 
 private:
 void AccumulateBBox();
+void BuildTriTree() const;
+void FreeTriTree() const;
 
 char *m_name;
 int m_frame;
@@ -89,6 +93,8 @@ GPtrArray *m_parents;   // array of CPicoParent
 GPtrArray* m_shaders;
 
 bool m_bReloaded;   // managed by CModelManager
+
+mutable picoTriTree_t *m_pTriTree;  // built on the first TestRay, dropped on Reload
 };
 
 #endif // _CPICOMODEL_H_
@@ -60,8 +60,6 @@ void CPicoSurface::Draw( int state, int rflags ){
 }
 
 void CPicoSurface::Draw( int state, IShader *pShader, int rflags ){
-	int j;
-
 	if ( !( rflags & ( DRAW_RF_SEL_OUTLINE | DRAW_RF_SEL_FILL | DRAW_RF_XY ) ) ) {
 		if ( state & DRAW_GL_TEXTURE_2D ) {
 			bool bTrans = ( pShader->getFlags() & QER_TRANS ) == QER_TRANS;
@@ -103,37 +101,67 @@ void CPicoSurface::Draw( int state, IShader *pShader, int rflags ){
 
 	switch ( PicoGetSurfaceType( m_pSurface ) )
 	{
-	case PICO_TRIANGLES:  g_QglTable.m_pfn_qglBegin( GL_TRIANGLES );
-		for ( j = 0; j < PicoGetSurfaceNumIndexes( m_pSurface ); j++ )
-		{
-			g_QglTable.m_pfn_qglNormal3fv( PicoGetSurfaceNormal( m_pSurface,PicoGetSurfaceIndex( m_pSurface,j ) ) );
+	case PICO_TRIANGLES:
+		if ( PicoGetSurfaceNumVertexes( m_pSurface ) > 0 && PicoGetSurfaceNumIndexes( m_pSurface ) > 0 ) {
+			GLint arrays[4];
+			void *texcoords = NULL, *colors = NULL;
 
+			// the pico arrays are tightly packed, hand them to GL as they are instead of one call per vertex
 			if ( !( rflags & ( DRAW_RF_SEL_OUTLINE | DRAW_RF_SEL_FILL | DRAW_RF_XY ) ) ) {
 				if ( state & DRAW_GL_TEXTURE_2D ) {
-					g_QglTable.m_pfn_qglTexCoord2fv( PicoGetSurfaceST( m_pSurface,0,PicoGetSurfaceIndex( m_pSurface,j ) ) );
+					texcoords = PicoGetSurfaceST( m_pSurface, 0, 0 );
 				}
-				else {
-					picoByte_t *vertexColor = PicoGetSurfaceColor( m_pSurface,0,PicoGetSurfaceIndex( m_pSurface,j ) );
-					//% g_QglTable.m_pfn_qglColor4f( vertexColor[ 0 ] / 255.f,
-					//%                              vertexColor[ 1 ] / 255.f,
-					//%                              vertexColor[ 2 ] / 255.f,
-					//%                              vertexColor[ 3 ] / 255.f );
-					g_QglTable.m_pfn_qglColor4ubv( vertexColor );
+				else{
+					colors = PicoGetSurfaceColor( m_pSurface, 0, 0 );
 				}
 			}
-			g_QglTable.m_pfn_qglVertex3fv( PicoGetSurfaceXYZ( m_pSurface, PicoGetSurfaceIndex( m_pSurface, j ) ) );
+
+			g_QglTable.m_pfn_qglGetIntegerv( GL_VERTEX_ARRAY, &arrays[0] );
+			g_QglTable.m_pfn_qglGetIntegerv( GL_NORMAL_ARRAY, &arrays[1] );
+			g_QglTable.m_pfn_qglGetIntegerv( GL_TEXTURE_COORD_ARRAY, &arrays[2] );
+			g_QglTable.m_pfn_qglGetIntegerv( GL_COLOR_ARRAY, &arrays[3] );
+
+			g_QglTable.m_pfn_qglEnableClientState( GL_VERTEX_ARRAY );
+			g_QglTable.m_pfn_qglVertexPointer( 3, GL_FLOAT, 0, PicoGetSurfaceXYZ( m_pSurface, 0 ) );
+			g_QglTable.m_pfn_qglEnableClientState( GL_NORMAL_ARRAY );
+			g_QglTable.m_pfn_qglNormalPointer( GL_FLOAT, 0, PicoGetSurfaceNormal( m_pSurface, 0 ) );
+			if ( texcoords ) {
+				g_QglTable.m_pfn_qglEnableClientState( GL_TEXTURE_COORD_ARRAY );
+				g_QglTable.m_pfn_qglTexCoordPointer( 2, GL_FLOAT, 0, texcoords );
+			}
+			else{
+				g_QglTable.m_pfn_qglDisableClientState( GL_TEXTURE_COORD_ARRAY );
+			}
+			if ( colors ) {
+				g_QglTable.m_pfn_qglEnableClientState( GL_COLOR_ARRAY );
+				g_QglTable.m_pfn_qglColorPointer( 4, GL_UNSIGNED_BYTE, 0, colors );
+			}
+			else{
+				g_QglTable.m_pfn_qglDisableClientState( GL_COLOR_ARRAY );
+			}
+
+			g_QglTable.m_pfn_qglDrawElements( GL_TRIANGLES, PicoGetSurfaceNumIndexes( m_pSurface ), GL_UNSIGNED_INT, PicoGetSurfaceIndexes( m_pSurface, 0 ) );
+
+			// put the client state back the way the caller had it
+			if ( !arrays[0] ) {
+				g_QglTable.m_pfn_qglDisableClientState( GL_VERTEX_ARRAY );
+			}
+			if ( !arrays[1] ) {
+				g_QglTable.m_pfn_qglDisableClientState( GL_NORMAL_ARRAY );
+			}
+			if ( arrays[2] ) {
+				g_QglTable.m_pfn_qglEnableClientState( GL_TEXTURE_COORD_ARRAY );
+			}
+			else{
+				g_QglTable.m_pfn_qglDisableClientState( GL_TEXTURE_COORD_ARRAY );
+			}
+			if ( arrays[3] ) {
+				g_QglTable.m_pfn_qglEnableClientState( GL_COLOR_ARRAY );
+			}
+			else{
+				g_QglTable.m_pfn_qglDisableClientState( GL_COLOR_ARRAY );
+			}
 		}
-		g_QglTable.m_pfn_qglEnd();
-		/*g_QglTable.m_pfn_qglVertexPointer( 3, GL_FLOAT, 0, PicoGetSurfaceXYZ( m_pSurface, 0 ) );
-		   g_QglTable.m_pfn_qglNormalPointer( GL_FLOAT, 0, PicoGetSurfaceNormal( m_pSurface, 0 ) );
-		   if( !(rflags & (DRAW_RF_SEL_OUTLINE|DRAW_RF_SEL_FILL|DRAW_RF_XY)) ) {
-		   if( state & DRAW_GL_TEXTURE_2D ) {
-		    g_QglTable.m_pfn_qglTexCoordPointer( 2, GL_FLOAT, 0, PicoGetSurfaceST( m_pSurface, 0, 0 ) );
-		   } else {
-		    g_QglTable.m_pfn_qglColorPointer( 4, GL_UNSIGNED_BYTE, 0, PicoGetSurfaceColor( m_pSurface, 0, 0 ) );
-		   }
-		   }
-		   g_QglTable.m_pfn_qglDrawElements( GL_TRIANGLES, PicoGetSurfaceNumIndexes( m_pSurface ), GL_UNSIGNED_INT, PicoGetSurfaceIndexes( m_pSurface, 0 ) );*/
 
 		/*g_QglTable.m_pfn_qglColor3f( 0.f, .5f, 1.f );
 		   g_QglTable.m_pfn_qglBegin( GL_LINES );
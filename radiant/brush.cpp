@@ -894,6 +894,8 @@ void Brush_Build( brush_t *b, bool bSnap, bool bMarkMap, bool bConvert, bool bFi
 		VectorSubtract( aabb->origin, aabb->extents, b->mins );
 	}
 
+	BrushTree_Update( b );
+
 	//Patch_BuildPoints (b); // does nothing but set b->patchBrush true if the texdef contains SURF_PATCH !
 
 	/*
@@ -1895,6 +1897,10 @@ void Brush_Free( brush_t *b, bool bRemoveNode ){
 		Patch_Delete( b->pPatch );
 	}
 
+	RenderCache_FreeBrush( b );
+	BrushTree_Unlink( b );
+	Undo_ForgetBrush( b );
+
 	// free faces
 	for ( f = b->brush_faces ; f ; f = next )
 	{
@@ -2348,6 +2354,10 @@ void    Brush_AddToList( brush_t *b, brush_t *blist ){
 	blist->next = b;
 	b->prev = blist;
 
+	if ( blist == &active_brushes ) {
+		BrushTree_Link( b );
+	}
+
 	// TTimo messaging
 	DispatchRadiantMsg( RADIANT_SELECTION );
 }
@@ -2363,6 +2373,8 @@ void    Brush_RemoveFromList( brush_t *b ){
 	b->next->prev = b->prev;
 	b->prev->next = b->next;
 	b->next = b->prev = NULL;
+
+	BrushTree_Unlink( b );
 }
 
 /*
@@ -2660,6 +2672,9 @@ void Brush_BuildWindings( brush_t *b, bool bSnap ){
 		Brush_SnapPlanepts( b );
 	}
 
+	// the windings are about to change, the cached copy is rebuilt on the next draw
+	RenderCache_FreeBrush( b );
+
 	// clear the mins/maxs bounds
 	b->mins[0] = b->mins[1] = b->mins[2] = 99999;
 	b->maxs[0] = b->maxs[1] = b->maxs[2] = -99999;
@@ -2759,6 +2774,8 @@ void Brush_BuildWindings( brush_t *b, bool bSnap ){
 				EmitTextureCoordinates( w->points[i], face->d_texture, face );
 		}
 	}
+
+	BrushTree_Update( b );
 }
 
 /*
@@ -87,3 +87,33 @@ const char* Brush_Name( brush_t *b );
 
 //eclass_t* HasModel(brush_t *b);
 void aabb_draw( const aabb_t *aabb, int mode );
+
+// retained brush geometry (queuedraw.cpp)
+void RenderCache_Enable( bool bEnable );
+bool RenderCache_IsEnabled();
+void RenderCache_FreeBrush( brush_t *b );
+void RenderCache_Begin();
+bool RenderCache_CanQueue( brush_t *b );
+bool RenderCache_HasTrans( brush_t *b );
+bool RenderCache_IsOpaque( brush_t *b );
+void RenderCache_QueueBrush( brush_t *b );
+void RenderCache_QueueBrushXY( brush_t *b, int nViewType );
+void RenderCache_Draw( int nGLState, int nDrawMode );
+void RenderCache_DrawXY();
+
+// picking tree over active_brushes (brushtree.cpp)
+typedef void ( *BrushTreeFunc )( brush_t *b, void *data );
+void BrushTree_Link( brush_t *b );
+void BrushTree_Unlink( brush_t *b );
+void BrushTree_Update( brush_t *b );
+void BrushTree_LinkList( brush_t *first, brush_t *end );
+void BrushTree_UnlinkList( brush_t *first, brush_t *end );
+void BrushTree_Box( const vec3_t mins, const vec3_t maxs, BrushTreeFunc func, void *data );
+void BrushTree_Ray( const vec3_t origin, const vec3_t dir, float *maxDist, BrushTreeFunc func, void *data );
+#define BT_CULL_OUT     0
+#define BT_CULL_PARTIAL 1
+#define BT_CULL_IN      2
+typedef int ( *BrushTreeCullFunc )( const vec3_t mins, const vec3_t maxs, void *data );
+void BrushTree_Cull( BrushTreeCullFunc cull, BrushTreeFunc func, void *data );
+int BrushTree_Generation();
+void BrushTree_Invalidate();
@@ -0,0 +1,537 @@
+/*
+   Copyright (C) 1999-2007 id Software, Inc. and contributors.
+   For a list of contributors, see the accompanying CONTRIBUTORS file.
+
+   This file is part of GtkRadiant.
+
+   GtkRadiant is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   GtkRadiant is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GtkRadiant; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+//
+// dynamic bounding box tree over the unselected brushes
+//
+// every brush on the active_brushes list owns a leaf, linked and unlinked by
+// Brush_AddToList / Brush_RemoveFromList (and by the few places that splice whole
+// lists around) and refitted by Brush_Build. Leaves are padded by BT_MARGIN so
+// nudging a brush around the grid does not touch the tree. Inserts pick the sibling
+// with the cheapest surface area, and rotations keep the tree height logarithmic.
+//
+
+#include "stdafx.h"
+
+#define BT_MARGIN   8.0f
+
+typedef struct btNode_s
+{
+	vec3_t mins, maxs;
+	struct btNode_s *parent;
+	struct btNode_s *children[2];
+	brush_t *brush;             // NULL for interior nodes
+	int height;                 // 0 for leaves
+} btNode_t;
+
+static btNode_t *btRoot;
+static int btNumLeaves;
+static int btGeneration;        // bumped whenever a linked brush comes, goes or changes
+
+// traversal stack shared by the queries, they do not nest
+static btNode_t **btStack;
+static int btMaxStack;
+
+static float BrushTree_Area( const vec3_t mins, const vec3_t maxs ){
+	float dx = maxs[0] - mins[0];
+	float dy = maxs[1] - mins[1];
+	float dz = maxs[2] - mins[2];
+
+	return 2.0f * ( dx * dy + dy * dz + dz * dx );
+}
+
+static void BrushTree_Union( const btNode_t *a, const btNode_t *b, vec3_t mins, vec3_t maxs ){
+	int i;
+
+	for ( i = 0; i < 3; i++ )
+	{
+		mins[i] = MIN( a->mins[i], b->mins[i] );
+		maxs[i] = MAX( a->maxs[i], b->maxs[i] );
+	}
+}
+
+static void BrushTree_Refit( btNode_t *node ){
+	BrushTree_Union( node->children[0], node->children[1], node->mins, node->maxs );
+	node->height = 1 + MAX( node->children[0]->height, node->children[1]->height );
+}
+
+// leaf bounds for a brush, brushes that were never built have inverted bounds
+static void BrushTree_LeafBounds( brush_t *b, vec3_t mins, vec3_t maxs ){
+	int i;
+
+	if ( b->mins[0] > b->maxs[0] || b->mins[1] > b->maxs[1] || b->mins[2] > b->maxs[2] ) {
+		VectorClear( mins );
+		VectorClear( maxs );
+		return;
+	}
+	for ( i = 0; i < 3; i++ )
+	{
+		mins[i] = b->mins[i] - BT_MARGIN;
+		maxs[i] = b->maxs[i] + BT_MARGIN;
+	}
+}
+
+/*
+   ==================
+   BrushTree_Rotate
+
+   if the subtree under node is out of balance, lifts the taller child up in its place
+   returns the new root of the subtree
+   ==================
+ */
+static btNode_t *BrushTree_Rotate( btNode_t *a ){
+	btNode_t *b, *c, *f, *g;
+	int side, balance;
+
+	if ( a->brush || a->height < 2 ) {
+		return a;
+	}
+
+	b = a->children[0];
+	c = a->children[1];
+	balance = c->height - b->height;
+	if ( balance >= -1 && balance <= 1 ) {
+		return a;
+	}
+
+	// c is the tall side, swap it with a
+	side = ( balance > 1 ) ? 1 : 0;
+	if ( !side ) {
+		c = b;
+		b = a->children[1];
+	}
+	f = c->children[0];
+	g = c->children[1];
+
+	c->children[0] = a;
+	c->parent = a->parent;
+	a->parent = c;
+	if ( c->parent ) {
+		if ( c->parent->children[0] == a ) {
+			c->parent->children[0] = c;
+		}
+		else{
+			c->parent->children[1] = c;
+		}
+	}
+	else{
+		btRoot = c;
+	}
+
+	// a keeps its short child and takes the shorter grandchild
+	if ( f->height > g->height ) {
+		c->children[1] = f;
+		a->children[side] = g;
+		g->parent = a;
+	}
+	else
+	{
+		c->children[1] = g;
+		a->children[side] = f;
+		f->parent = a;
+	}
+	BrushTree_Refit( a );
+	BrushTree_Refit( c );
+
+	return c;
+}
+
+static void BrushTree_FixUpwards( btNode_t *node ){
+	while ( node )
+	{
+		node = BrushTree_Rotate( node );
+		BrushTree_Refit( node );
+		node = node->parent;
+	}
+}
+
+static void BrushTree_InsertLeaf( btNode_t *leaf ){
+	btNode_t *node, *parent, *child;
+	vec3_t mins, maxs;
+	float area, cost, inherit, childCost[2];
+	int i;
+
+	if ( btRoot == NULL ) {
+		btRoot = leaf;
+		leaf->parent = NULL;
+		return;
+	}
+
+	// walk down to the sibling that grows the tree the least
+	node = btRoot;
+	while ( !node->brush )
+	{
+		area = BrushTree_Area( node->mins, node->maxs );
+		BrushTree_Union( node, leaf, mins, maxs );
+		cost = 2.0f * BrushTree_Area( mins, maxs );
+		inherit = cost - 2.0f * area;
+
+		for ( i = 0; i < 2; i++ )
+		{
+			child = node->children[i];
+			BrushTree_Union( child, leaf, mins, maxs );
+			childCost[i] = BrushTree_Area( mins, maxs ) + inherit;
+			if ( !child->brush ) {
+				childCost[i] -= BrushTree_Area( child->mins, child->maxs );
+			}
+		}
+
+		if ( cost < childCost[0] && cost < childCost[1] ) {
+			break;
+		}
+		node = ( childCost[0] < childCost[1] ) ? node->children[0] : node->children[1];
+	}
+
+	parent = (btNode_t*)malloc( sizeof( btNode_t ) );
+	parent->brush = NULL;
+	parent->parent = node->parent;
+	parent->children[0] = node;
+	parent->children[1] = leaf;
+	if ( node->parent ) {
+		if ( node->parent->children[0] == node ) {
+			node->parent->children[0] = parent;
+		}
+		else{
+			node->parent->children[1] = parent;
+		}
+	}
+	else{
+		btRoot = parent;
+	}
+	node->parent = parent;
+	leaf->parent = parent;
+
+	BrushTree_Refit( parent );
+	BrushTree_FixUpwards( parent );
+}
+
+static void BrushTree_RemoveLeaf( btNode_t *leaf ){
+	btNode_t *parent, *sibling;
+
+	if ( leaf == btRoot ) {
+		btRoot = NULL;
+		return;
+	}
+
+	parent = leaf->parent;
+	sibling = ( parent->children[0] == leaf ) ? parent->children[1] : parent->children[0];
+	sibling->parent = parent->parent;
+	if ( parent->parent ) {
+		if ( parent->parent->children[0] == parent ) {
+			parent->parent->children[0] = sibling;
+		}
+		else{
+			parent->parent->children[1] = sibling;
+		}
+		BrushTree_FixUpwards( parent->parent );
+	}
+	else{
+		btRoot = sibling;
+	}
+	free( parent );
+}
+
+/*
+   ==================
+   BrushTree_Link
+
+   adds the brush to the tree, or refits it if it is already there
+   ==================
+ */
+void BrushTree_Link( brush_t *b ){
+	btNode_t *leaf;
+
+	if ( b->pTreeLeaf ) {
+		BrushTree_Update( b );
+		return;
+	}
+
+	leaf = (btNode_t*)malloc( sizeof( btNode_t ) );
+	leaf->brush = b;
+	leaf->height = 0;
+	leaf->children[0] = leaf->children[1] = NULL;
+	BrushTree_LeafBounds( b, leaf->mins, leaf->maxs );
+	b->pTreeLeaf = leaf;
+	btNumLeaves++;
+	btGeneration++;
+
+	BrushTree_InsertLeaf( leaf );
+}
+
+void BrushTree_Unlink( brush_t *b ){
+	btNode_t *leaf = (btNode_t*)b->pTreeLeaf;
+
+	if ( leaf == NULL ) {
+		return;
+	}
+
+	BrushTree_RemoveLeaf( leaf );
+	free( leaf );
+	b->pTreeLeaf = NULL;
+	btNumLeaves--;
+	btGeneration++;
+}
+
+/*
+   ==================
+   BrushTree_Update
+
+   called when the brush bounds changed, does nothing unless they left the padded leaf
+   ==================
+ */
+void BrushTree_Update( brush_t *b ){
+	btNode_t *leaf = (btNode_t*)b->pTreeLeaf;
+	vec3_t mins, maxs;
+
+	if ( leaf == NULL ) {
+		return;
+	}
+
+	// the exact bounds or the faces may have changed even if the leaf stays put
+	btGeneration++;
+
+	BrushTree_LeafBounds( b, mins, maxs );
+	if ( mins[0] + BT_MARGIN >= leaf->mins[0] && mins[1] + BT_MARGIN >= leaf->mins[1] && mins[2] + BT_MARGIN >= leaf->mins[2]
+		 && maxs[0] - BT_MARGIN <= leaf->maxs[0] && maxs[1] - BT_MARGIN <= leaf->maxs[1] && maxs[2] - BT_MARGIN <= leaf->maxs[2] ) {
+		return;
+	}
+
+	BrushTree_RemoveLeaf( leaf );
+	VectorCopy( mins, leaf->mins );
+	VectorCopy( maxs, leaf->maxs );
+	BrushTree_InsertLeaf( leaf );
+}
+
+// links every brush on a list that was spliced into active_brushes behind Brush_AddToList's back
+void BrushTree_LinkList( brush_t *first, brush_t *end ){
+	brush_t *b;
+
+	for ( b = first; b != end; b = b->next )
+		BrushTree_Link( b );
+}
+
+void BrushTree_UnlinkList( brush_t *first, brush_t *end ){
+	brush_t *b;
+
+	for ( b = first; b != end; b = b->next )
+		BrushTree_Unlink( b );
+}
+
+/*
+   ==================
+   BrushTree_Generation
+
+   changes whenever something that was handed out by a query may be stale,
+   lets views keep query results around until then
+   ==================
+ */
+int BrushTree_Generation(){
+	return btGeneration;
+}
+
+// for state the tree does not track itself, like filtering
+void BrushTree_Invalidate(){
+	btGeneration++;
+}
+
+static void BrushTree_Push( int *sp, btNode_t *node ){
+	if ( *sp == btMaxStack ) {
+		btMaxStack = btMaxStack ? btMaxStack * 2 : 64;
+		btStack = (btNode_t**)realloc( btStack, btMaxStack * sizeof( btNode_t* ) );
+	}
+	btStack[( *sp )++] = node;
+}
+
+/*
+   ==================
+   BrushTree_Box
+
+   calls func for every brush whose padded leaf overlaps mins/maxs
+   func must not link or unlink brushes, collect them first
+   ==================
+ */
+void BrushTree_Box( const vec3_t mins, const vec3_t maxs, BrushTreeFunc func, void *data ){
+	btNode_t *node;
+	int sp;
+
+	if ( btRoot == NULL ) {
+		return;
+	}
+
+	sp = 0;
+	BrushTree_Push( &sp, btRoot );
+	while ( sp )
+	{
+		node = btStack[--sp];
+		if ( node->mins[0] > maxs[0] || node->mins[1] > maxs[1] || node->mins[2] > maxs[2]
+			 || node->maxs[0] < mins[0] || node->maxs[1] < mins[1] || node->maxs[2] < mins[2] ) {
+			continue;
+		}
+		if ( node->brush ) {
+			func( node->brush, data );
+			continue;
+		}
+		BrushTree_Push( &sp, node->children[0] );
+		BrushTree_Push( &sp, node->children[1] );
+	}
+}
+
+/*
+   ==================
+   BrushTree_Cull
+
+   hierarchical visibility walk, cull classifies a box as BT_CULL_OUT, BT_CULL_PARTIAL or BT_CULL_IN
+   subtrees that are entirely in are reported without further tests, func gets every brush
+   whose padded leaf was not culled and should test the brush bounds itself where it matters
+   ==================
+ */
+void BrushTree_Cull( BrushTreeCullFunc cull, BrushTreeFunc func, void *data ){
+	btNode_t *node;
+	int sp, base;
+
+	if ( btRoot == NULL ) {
+		return;
+	}
+
+	sp = 0;
+	BrushTree_Push( &sp, btRoot );
+	while ( sp )
+	{
+		node = btStack[--sp];
+		switch ( cull( node->mins, node->maxs, data ) )
+		{
+		case BT_CULL_OUT:
+			continue;
+		case BT_CULL_IN:
+			// flush the whole subtree on top of the stack
+			base = sp;
+			BrushTree_Push( &sp, node );
+			while ( sp > base )
+			{
+				node = btStack[--sp];
+				if ( node->brush ) {
+					func( node->brush, data );
+					continue;
+				}
+				BrushTree_Push( &sp, node->children[0] );
+				BrushTree_Push( &sp, node->children[1] );
+			}
+			continue;
+		}
+
+		if ( node->brush ) {
+			func( node->brush, data );
+			continue;
+		}
+		BrushTree_Push( &sp, node->children[0] );
+		BrushTree_Push( &sp, node->children[1] );
+	}
+}
+
+// slab test, returns the entry distance or -1 on a miss
+static float BrushTree_RayBox( const btNode_t *node, const vec3_t origin, const vec3_t invDir, float maxDist ){
+	float t0, t1, tmin, tmax;
+	int i;
+
+	tmin = 0.0f;
+	tmax = maxDist;
+	for ( i = 0; i < 3; i++ )
+	{
+		if ( invDir[i] == 0.0f ) {
+			if ( origin[i] < node->mins[i] || origin[i] > node->maxs[i] ) {
+				return -1.0f;
+			}
+			continue;
+		}
+		t0 = ( node->mins[i] - origin[i] ) * invDir[i];
+		t1 = ( node->maxs[i] - origin[i] ) * invDir[i];
+		if ( t0 > t1 ) {
+			float t = t0;
+			t0 = t1;
+			t1 = t;
+		}
+		if ( t0 > tmin ) {
+			tmin = t0;
+		}
+		if ( t1 < tmax ) {
+			tmax = t1;
+		}
+		if ( tmin > tmax ) {
+			return -1.0f;
+		}
+	}
+	return tmin;
+}
+
+/*
+   ==================
+   BrushTree_Ray
+
+   calls func for the brushes whose padded leaf the ray crosses, nearest boxes first
+   func may lower *maxDist once it has a hit, boxes starting beyond it are skipped
+   ==================
+ */
+void BrushTree_Ray( const vec3_t origin, const vec3_t dir, float *maxDist, BrushTreeFunc func, void *data ){
+	btNode_t *node, *first, *second;
+	vec3_t invDir;
+	float dFirst, dSecond;
+	int i, sp;
+
+	if ( btRoot == NULL ) {
+		return;
+	}
+
+	for ( i = 0; i < 3; i++ )
+		invDir[i] = ( dir[i] != 0.0f ) ? 1.0f / dir[i] : 0.0f;
+
+	sp = 0;
+	if ( BrushTree_RayBox( btRoot, origin, invDir, *maxDist ) >= 0.0f ) {
+		BrushTree_Push( &sp, btRoot );
+	}
+	while ( sp )
+	{
+		node = btStack[--sp];
+		if ( node->brush ) {
+			func( node->brush, data );
+			continue;
+		}
+
+		first = node->children[0];
+		second = node->children[1];
+		dFirst = BrushTree_RayBox( first, origin, invDir, *maxDist );
+		dSecond = BrushTree_RayBox( second, origin, invDir, *maxDist );
+		if ( dSecond >= 0.0f && ( dFirst < 0.0f || dSecond < dFirst ) ) {
+			btNode_t *n = first;
+			float d = dFirst;
+			first = second;
+			second = n;
+			dFirst = dSecond;
+			dSecond = d;
+		}
+		// push the far box first so the near one is walked first
+		if ( dSecond >= 0.0f ) {
+			BrushTree_Push( &sp, second );
+		}
+		if ( dFirst >= 0.0f ) {
+			BrushTree_Push( &sp, first );
+		}
+	}
+}
@@ -47,6 +47,8 @@ CamWnd::CamWnd ()
 	m_pSide_select = NULL;
 	m_bClipMode = false;
 	m_bFreeMove = false;
+	m_bCullValid = false;
+	m_nNumOccluders = 0;
 	Cam_Init();
 }
 
@@ -768,75 +770,325 @@ void CamWnd::Cam_MouseMoved( int x, int y, int buttons ){
 	}
 }
 
+/*
+   ==================
+   InitCull
+
+   pulls the six frustum planes out of projection * modelview, they face inwards
+   ==================
+ */
 void CamWnd::InitCull(){
-	int i;
+	float matrix[4][4];
+	float length;
+	int i, j;
 
-	VectorSubtract( m_Camera.vpn, m_Camera.vright, m_vCull1 );
-	VectorAdd( m_Camera.vpn, m_Camera.vright, m_vCull2 );
+	memcpy( matrix, m_Camera.projection, sizeof( m4x4_t ) );
+	m4x4_multiply_by_m4x4( &matrix[0][0], &m_Camera.modelview[0][0] );
 
-	for ( i = 0 ; i < 3 ; i++ )
+	// left, right, bottom, top, near, far: row 3 plus or minus rows 0, 1 and 2
+	for ( i = 0; i < 6; i++ )
 	{
-		if ( m_vCull1[i] > 0 ) {
-			m_nCullv1[i] = 3 + i;
-		}
-		else{
-			m_nCullv1[i] = i;
-		}
-		if ( m_vCull2[i] > 0 ) {
-			m_nCullv2[i] = 3 + i;
+		for ( j = 0; j < 4; j++ )
+		{
+			if ( i & 1 ) {
+				m_vFrustum[i][j] = matrix[j][3] - matrix[j][i >> 1];
+			}
+			else{
+				m_vFrustum[i][j] = matrix[j][3] + matrix[j][i >> 1];
+			}
 		}
-		else{
-			m_nCullv2[i] = i;
+
+		length = VectorLength( m_vFrustum[i] );
+		if ( length > 0 ) {
+			VectorScale( m_vFrustum[i], 1.0f / length, m_vFrustum[i] );
+			m_vFrustum[i][3] /= length;
 		}
 	}
 }
 
-qboolean CamWnd::CullBrush( brush_t *b ){
-	int i;
-	vec3_t point;
+/*
+   ==================
+   CullBox
+
+   classifies a box against the cubic clipping cube and the frustum
+   ==================
+ */
+int CamWnd::CullBox( const vec3_t mins, const vec3_t maxs ){
+	int i, j, result;
 	float d;
 
+	result = BT_CULL_IN;
+
 	if ( g_PrefsDlg.m_bCubicClipping ) {
 		float fLevel = g_PrefsDlg.m_nCubicScale * 64;
 
-		point[0] = m_Camera.origin[0] - fLevel;
-		point[1] = m_Camera.origin[1] - fLevel;
-		point[2] = m_Camera.origin[2] - fLevel;
-
 		for ( i = 0; i < 3; i++ )
-			if ( b->mins[i] < point[i] && b->maxs[i] < point[i] ) {
-				return true;
+		{
+			if ( maxs[i] < m_Camera.origin[i] - fLevel || mins[i] > m_Camera.origin[i] + fLevel ) {
+				return BT_CULL_OUT;
+			}
+			if ( mins[i] < m_Camera.origin[i] - fLevel || maxs[i] > m_Camera.origin[i] + fLevel ) {
+				result = BT_CULL_PARTIAL;
 			}
+		}
+	}
 
-		point[0] = m_Camera.origin[0] + fLevel;
-		point[1] = m_Camera.origin[1] + fLevel;
-		point[2] = m_Camera.origin[2] + fLevel;
+	for ( i = 0; i < 6; i++ )
+	{
+		// the corner furthest along the plane normal
+		d = m_vFrustum[i][3];
+		for ( j = 0; j < 3; j++ )
+			d += m_vFrustum[i][j] * ( ( m_vFrustum[i][j] > 0 ) ? maxs[j] : mins[j] );
+		if ( d < -1 ) {
+			return BT_CULL_OUT;
+		}
 
-		for ( i = 0; i < 3; i++ )
-			if ( b->mins[i] > point[i] && b->maxs[i] > point[i] ) {
-				return true;
+		if ( result == BT_CULL_IN ) {
+			// and the nearest one
+			d = m_vFrustum[i][3];
+			for ( j = 0; j < 3; j++ )
+				d += m_vFrustum[i][j] * ( ( m_vFrustum[i][j] > 0 ) ? mins[j] : maxs[j] );
+			if ( d < 0 ) {
+				result = BT_CULL_PARTIAL;
 			}
+		}
 	}
 
-	for ( i = 0 ; i < 3 ; i++ )
-		point[i] = b->mins[m_nCullv1[i]] - m_Camera.origin[i];
+	return result;
+}
+
+qboolean CamWnd::CullBrush( brush_t *b ){
+	return CullBox( b->mins, b->maxs ) == BT_CULL_OUT;
+}
 
-	d = DotProduct( point, m_vCull1 );
-	if ( d < -1 ) {
-		return true;
+int CamWnd::CullBoxFunc( const vec3_t mins, const vec3_t maxs, void *data ){
+	return reinterpret_cast<CamWnd*>( data )->CullBox( mins, maxs );
+}
+
+void CamWnd::CullBrushFunc( brush_t *b, void *data ){
+	CamWnd *cam = reinterpret_cast<CamWnd*>( data );
+
+	// the tree hands out padded leaves
+	if ( b->bFiltered || cam->CullBrush( b ) ) {
+		return;
 	}
+	cam->m_FrustumBrushes.Add( b );
+}
 
-	for ( i = 0 ; i < 3 ; i++ )
-		point[i] = b->mins[m_nCullv2[i]] - m_Camera.origin[i];
+#define CAM_OCCLUDER_NEAR       16.0f   // keep occluder faces clear of the near clip plane
+#define CAM_OCCLUDER_MINSCORE   0.02f   // area / distance squared, roughly the solid angle
+#define CAM_OCCLUDE_EPSILON     1.0f
+
+/*
+   ==================
+   Cam_AddOccluder
+
+   considers one camera facing side of an axial box brush, keeps the best CAM_MAX_OCCLUDERS
+   ==================
+ */
+void CamWnd::Cam_AddOccluder( brush_t *b, int axis, int side ){
+	camOccluder_t *o;
+	vec3_t corners[4], center, delta, edge[2];
+	vec4_t planes[5];
+	float area, score, length;
+	int i, u, v;
+
+	u = ( axis + 1 ) % 3;
+	v = ( axis + 2 ) % 3;
+	for ( i = 0; i < 4; i++ )
+	{
+		corners[i][axis] = side ? b->maxs[axis] : b->mins[axis];
+		corners[i][u] = ( i == 1 || i == 2 ) ? b->maxs[u] : b->mins[u];
+		corners[i][v] = ( i >= 2 ) ? b->maxs[v] : b->mins[v];
+
+		// a face cut by the near plane would leave a hole
+		VectorSubtract( corners[i], m_Camera.origin, delta );
+		if ( DotProduct( delta, m_Camera.vpn ) < CAM_OCCLUDER_NEAR ) {
+			return;
+		}
+	}
+
+	VectorAdd( b->mins, b->maxs, center );
+	VectorScale( center, 0.5f, center );
+	center[axis] = corners[0][axis];
+	VectorSubtract( center, m_Camera.origin, delta );
+	area = ( b->maxs[u] - b->mins[u] ) * ( b->maxs[v] - b->mins[v] );
+	score = area / DotProduct( delta, delta );
+	if ( score < CAM_OCCLUDER_MINSCORE ) {
+		return;
+	}
+	if ( m_nNumOccluders == CAM_MAX_OCCLUDERS && score <= m_Occluders[m_nNumOccluders - 1].score ) {
+		return;
+	}
+	if ( !RenderCache_IsOpaque( b ) ) {
+		return;
+	}
+
+	// behind the face
+	VectorClear( planes[0] );
+	planes[0][axis] = side ? -1 : 1;
+	planes[0][3] = -DotProduct( planes[0], corners[0] );
+
+	// and inside the pyramid from the camera through its edges
+	for ( i = 0; i < 4; i++ )
+	{
+		VectorSubtract( corners[i], m_Camera.origin, edge[0] );
+		VectorSubtract( corners[( i + 1 ) & 3], m_Camera.origin, edge[1] );
+		CrossProduct( edge[0], edge[1], planes[1 + i] );
+		length = VectorLength( planes[1 + i] );
+		if ( length == 0 ) {
+			return;
+		}
+		VectorScale( planes[1 + i], 1.0f / length, planes[1 + i] );
+		if ( DotProduct( planes[1 + i], delta ) < 0 ) {
+			VectorInverse( planes[1 + i] );
+		}
+		planes[1 + i][3] = -DotProduct( planes[1 + i], m_Camera.origin );
+	}
 
-	d = DotProduct( point, m_vCull2 );
-	if ( d < -1 ) {
-		return true;
+	// sorted by score, the weakest one drops off the end
+	if ( m_nNumOccluders < CAM_MAX_OCCLUDERS ) {
+		m_nNumOccluders++;
 	}
+	for ( i = m_nNumOccluders - 1; i > 0 && m_Occluders[i - 1].score < score; i-- )
+		m_Occluders[i] = m_Occluders[i - 1];
+	o = &m_Occluders[i];
+	o->brush = b;
+	o->score = score;
+	memcpy( o->planes, planes, sizeof( planes ) );
+}
+
+/*
+   ==================
+   Cam_FindOccluders
+
+   large solid axial boxes in view hide whatever sits in their shadow,
+   which is the common case of walls, floors and terrain blocks
+   ==================
+ */
+void CamWnd::Cam_FindOccluders(){
+	brush_t *b;
+	face_t *face;
+	int i, j, sides, numFaces;
+
+	m_nNumOccluders = 0;
 
+	for ( i = 0; i < m_FrustumBrushes.GetSize(); i++ )
+	{
+		b = reinterpret_cast<brush_t*>( m_FrustumBrushes.GetAt( i ) );
+		if ( b->patchBrush || b->owner->eclass->fixedsize ) {
+			continue;
+		}
+
+		// six axial faces, one per side
+		sides = numFaces = 0;
+		for ( face = b->brush_faces; face; face = face->next, numFaces++ )
+		{
+			for ( j = 0; j < 3; j++ )
+			{
+				if ( face->plane.normal[j] > 0.9999f ) {
+					sides |= 1 << ( j * 2 + 1 );
+				}
+				else if ( face->plane.normal[j] < -0.9999f ) {
+					sides |= 1 << ( j * 2 );
+				}
+			}
+		}
+		if ( numFaces != 6 || sides != 63 ) {
+			continue;
+		}
+
+		for ( j = 0; j < 3; j++ )
+		{
+			if ( m_Camera.origin[j] < b->mins[j] ) {
+				Cam_AddOccluder( b, j, 0 );
+			}
+			else if ( m_Camera.origin[j] > b->maxs[j] ) {
+				Cam_AddOccluder( b, j, 1 );
+			}
+		}
+	}
+}
+
+bool CamWnd::Cam_Occluded( brush_t *b ){
+	camOccluder_t *o;
+	float d;
+	int i, j, k;
+
+	for ( i = 0, o = m_Occluders; i < m_nNumOccluders; i++, o++ )
+	{
+		if ( o->brush == b ) {
+			continue;
+		}
+		// every corner has to be on the inside of every plane
+		for ( j = 0; j < 5; j++ )
+		{
+			d = o->planes[j][3];
+			for ( k = 0; k < 3; k++ )
+				d += o->planes[j][k] * ( ( o->planes[j][k] > 0 ) ? b->mins[k] : b->maxs[k] );
+			if ( d < CAM_OCCLUDE_EPSILON ) {
+				break;
+			}
+		}
+		if ( j == 5 ) {
+			return true;
+		}
+	}
 	return false;
 }
 
+/*
+   ==================
+   Cam_CullBrushes
+
+   builds the list of unselected brushes to draw from the brush tree, then drops the ones
+   hidden behind occluders. The list is kept until the camera or a linked brush changes
+   ==================
+ */
+void CamWnd::Cam_CullBrushes(){
+	int i, cubic;
+	bool bOcclusion;
+	brush_t *b;
+
+	cubic = g_PrefsDlg.m_bCubicClipping ? g_PrefsDlg.m_nCubicScale : 0;
+	bOcclusion = ( m_Camera.draw_mode != cd_wire );
+
+	if ( m_bCullValid
+		 && VectorCompare( m_Camera.origin, m_vCullOrigin ) && VectorCompare( m_Camera.angles, m_vCullAngles )
+		 && m_Camera.width == m_nCullWidth && m_Camera.height == m_nCullHeight
+		 && cubic == m_nCullCubic && bOcclusion == m_bCullOcclusion
+		 && BrushTree_Generation() == m_nCullGeneration ) {
+		return;
+	}
+
+	m_FrustumBrushes.RemoveAll();
+	BrushTree_Cull( CullBoxFunc, CullBrushFunc, this );
+
+	m_nNumOccluders = 0;
+	if ( bOcclusion ) {
+		Cam_FindOccluders();
+	}
+
+	m_VisibleBrushes.RemoveAll();
+	for ( i = 0; i < m_FrustumBrushes.GetSize(); i++ )
+	{
+		b = reinterpret_cast<brush_t*>( m_FrustumBrushes.GetAt( i ) );
+		if ( m_nNumOccluders && Cam_Occluded( b ) ) {
+			continue;
+		}
+		m_VisibleBrushes.Add( b );
+	}
+
+	m_bCullValid = true;
+	VectorCopy( m_Camera.origin, m_vCullOrigin );
+	VectorCopy( m_Camera.angles, m_vCullAngles );
+	m_nCullWidth = m_Camera.width;
+	m_nCullHeight = m_Camera.height;
+	m_nCullCubic = cubic;
+	m_bCullOcclusion = bOcclusion;
+	m_nCullGeneration = BrushTree_Generation();
+}
+
 // project a 3D point onto the camera space
 // we use the GL viewing matrixes
 // this is the implementation of a glu function (I realized that afterwards): gluProject
@@ -1093,12 +1345,38 @@ void CamWnd::Cam_DrawBrush( brush_t *b, int mode ){
 
 void CamWnd::Cam_DrawBrushes( int mode ){
 	brush_t *b;
+	int i;
 	brush_t *pList = ( g_bClipMode && g_pSplitList ) ? g_pSplitList : &selected_brushes;
+	bool bBlend = ( m_Camera.draw_glstate & DRAW_GL_BLEND ) != 0;
+	bool bCache = ( mode == DRAW_TEXTURED );
 
-	for ( b = active_brushes.next; b != &active_brushes; b = b->next )
-		if ( !b->bFiltered && !b->bCamCulled ) {
-			Cam_DrawBrush( b, mode );
+	// the opaque faces of unselected brushes come out of the render cache in one go per texture,
+	// only their transparent faces still go through Brush_Draw
+	if ( bCache && !bBlend ) {
+		RenderCache_Begin();
+	}
+
+	for ( i = 0; i < m_VisibleBrushes.GetSize(); i++ )
+	{
+		b = reinterpret_cast<brush_t*>( m_VisibleBrushes.GetAt( i ) );
+		if ( bCache && RenderCache_CanQueue( b ) ) {
+			if ( !bBlend ) {
+				RenderCache_QueueBrush( b );
+			}
+			else if ( RenderCache_HasTrans( b ) ) {
+				Cam_DrawBrush( b, mode );
+			}
+			continue;
 		}
+		Cam_DrawBrush( b, mode );
+	}
+
+	if ( bCache && !bBlend && RenderCache_IsEnabled() ) {
+		qglEnable( GL_CULL_FACE );
+		qglShadeModel( GL_FLAT );
+		RenderCache_Draw( m_Camera.draw_glstate, m_Camera.draw_mode );
+	}
+
 	for ( b = pList->next; b != pList; b = b->next )
 		if ( !b->bFiltered && !b->bCamCulled ) {
 			Cam_DrawBrush( b, mode );
@@ -1110,8 +1388,7 @@ void CamWnd::Cam_DrawStuff(){
 	VectorSet( identity, 0.8f, 0.8f, 0.8f );
 	brush_t *b;
 
-	for ( b = active_brushes.next; b != &active_brushes; b = b->next )
-		b->bCamCulled = CullBrush( b );
+	Cam_CullBrushes();
 
 	for ( b = selected_brushes.next; b != &selected_brushes; b = b->next )
 		b->bCamCulled = CullBrush( b );
@@ -1640,9 +1917,6 @@ void CamWnd::Cam_Draw(){
 		Sys_Printf( "Camera: %i ms\n", (int)( 1000 * ( end - start ) ) );
 	}
 
-	for ( brush = active_brushes.next ; brush != &active_brushes ; brush = brush->next )
-		brush->bCamCulled = false;
-
 	for ( brush = pList->next ; brush != pList ; brush = brush->next )
 		brush->bCamCulled = false;
 }
@@ -1678,15 +1952,27 @@ void CamWnd::BenchMark(){
 		Error( "glXMakeCurrent failed in Benchmark" );
 	}
 
+	// run the same spin once drawing the brushes face by face and once from the render cache
+	bool bCache = RenderCache_IsEnabled();
+	double dTime[2];
+
 	qglDrawBuffer( GL_FRONT );
-	double dStart = Sys_DoubleTime();
-	for ( int i = 0 ; i < 100 ; i++ )
+	for ( int pass = 0 ; pass < 2 ; pass++ )
 	{
-		m_Camera.angles[YAW] = i * 4;
-		Cam_Draw();
+		RenderCache_Enable( pass != 0 );
+		double dStart = Sys_DoubleTime();
+		for ( int i = 0 ; i < 100 ; i++ )
+		{
+			m_Camera.angles[YAW] = i * 4;
+			Cam_Draw();
+		}
+		qglFinish();
+		dTime[pass] = Sys_DoubleTime() - dStart;
 	}
 	SwapBuffers();
 	qglDrawBuffer( GL_BACK );
-	double dEnd = Sys_DoubleTime();
-	Sys_Printf( "%5.2f seconds\n", dEnd - dStart );
+	RenderCache_Enable( bCache );
+
+	Sys_Printf( "immediate: %5.2f seconds (%5.2f ms/frame)\n", dTime[0], dTime[0] * 10.0 );
+	Sys_Printf( "retained:  %5.2f seconds (%5.2f ms/frame)\n", dTime[1], dTime[1] * 10.0 );
 }
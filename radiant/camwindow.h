@@ -90,6 +90,16 @@ GtkWidget* m_widget;
 GdkGC* m_gc;
 };
 
+#define CAM_MAX_OCCLUDERS   16
+
+// a camera facing side of a solid axial box and the planes bounding the space it hides
+typedef struct
+{
+	brush_t *brush;
+	vec4_t planes[5];
+	float score;
+} camOccluder_t;
+
 class CamWnd : public GLWindow
 {
 public:
@@ -114,6 +124,13 @@ void Cam_MouseUp( int x, int y, int buttons );
 void Cam_MouseMoved( int x, int y, int buttons );
 void InitCull();
 qboolean CullBrush( brush_t *b );
+int CullBox( const vec3_t mins, const vec3_t maxs );
+void Cam_CullBrushes();
+void Cam_AddOccluder( brush_t *b, int axis, int side );
+void Cam_FindOccluders();
+bool Cam_Occluded( brush_t *b );
+static int CullBoxFunc( const vec3_t mins, const vec3_t maxs, void *data );
+static void CullBrushFunc( brush_t *b, void *data );
 void Cam_Draw();
 void Cam_DrawStuff();
 void Cam_DrawBrushes( int mode );
@@ -132,10 +149,20 @@ int m_ptCursorY;
 int m_ptLastCursorY;
 int m_ptLastCamCursorY;
 face_t* m_pSide_select;
-vec3_t m_vCull1;
-vec3_t m_vCull2;
-int m_nCullv1[3];
-int m_nCullv2[3];
+vec4_t m_vFrustum[6];
+CPtrArray m_FrustumBrushes;
+CPtrArray m_VisibleBrushes;
+camOccluder_t m_Occluders[CAM_MAX_OCCLUDERS];
+int m_nNumOccluders;
+// what m_VisibleBrushes was built for
+bool m_bCullValid;
+vec3_t m_vCullOrigin;
+vec3_t m_vCullAngles;
+int m_nCullWidth;
+int m_nCullHeight;
+int m_nCullCubic;
+int m_nCullGeneration;
+bool m_bCullOcclusion;
 bool m_bClipMode;
 guint m_FocusOutHandler_id;
 
@@ -7611,6 +7611,9 @@ void PerformFiltering(){
 
 	for ( brush = selected_brushes.next; brush != &selected_brushes; brush = brush->next )
 		brush->bFiltered = FilterBrush( brush );
+
+	// the camera keeps its visible set until the tree changes
+	BrushTree_Invalidate();
 }
 
 void MainFrame::OnFilterAreaportals(){
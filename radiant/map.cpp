@@ -1044,6 +1044,9 @@ void Map_RegionSelectedBrushes( void ){
 	}
 #endif
 
+	BrushTree_UnlinkList( active_brushes.next, &active_brushes );
+	BrushTree_LinkList( selected_brushes.next, &selected_brushes );
+
 	if ( active_brushes.next == &active_brushes ) {
 		// just have an empty filtered_brushes list
 		// this happens if you set region after selecting all the brushes in your map (some weird people do that, ask MrE!)
@@ -1633,6 +1633,7 @@ void CPlugInManager::CommitEntityHandleToMap( void* vpEntity ){
 				active_brushes.next->prev = b;
 				b->prev = &active_brushes;
 				active_brushes.next = b;
+				BrushTree_Link( b );
 			}
 
 			// handle worldspawn entities
@@ -126,6 +126,7 @@
 #define SHOWTEXDIRLIST_KEY		"ShowTextureDirectoryList"
 #define NOSTIPPLE_KEY           "NoStipple"
 #define UNDOLEVELS_KEY          "UndoLevels"
+#define UNDOSPILL_KEY           "UndoSpill"
 #define VERTEXMODE_KEY          "VertexSplit"
 #define ENGINEPATH_KEY          "EnginePath"
 #define ENGINE_KEY              "Engine"
@@ -649,6 +650,7 @@ PrefsDlg::PrefsDlg (){
 	m_bGLLighting = FALSE;
 	m_nShader = 0;
 	m_nUndoLevels = 30;
+	m_bUndoSpill = FALSE;
 	m_bTexturesShaderlistOnly = FALSE;
 	// paths to ini files
 	m_rc_path = NULL;
@@ -2406,6 +2408,12 @@ void PrefsDlg::BuildDialog(){
 	gtk_widget_show( check );
 	AddDialogData( check, &m_bPatchBBoxSelect, DLG_CHECK_BOOL );
 
+	// Spill undo to disk
+	check = gtk_check_button_new_with_label( _( "Spill old undo levels to a temp file" ) );
+	gtk_box_pack_start( GTK_BOX( vbox ), check, FALSE, FALSE, 0 );
+	gtk_widget_show( check );
+	AddDialogData( check, &m_bUndoSpill, DLG_CHECK_BOOL );
+
 	// Rotation increment
 	// container
 	table = gtk_table_new( 2, 3, FALSE );
@@ -2441,7 +2449,7 @@ void PrefsDlg::BuildDialog(){
 	gtk_widget_show( label );
 
 	// spinner (allows undo levels to be set to zero)
-	spin = gtk_spin_button_new( GTK_ADJUSTMENT( gtk_adjustment_new( 1, 0, 64, 1, 10, 0 ) ), 1, 0 );
+	spin = gtk_spin_button_new( GTK_ADJUSTMENT( gtk_adjustment_new( 1, 0, 256, 1, 10, 0 ) ), 1, 0 );
 	gtk_spin_button_set_numeric( GTK_SPIN_BUTTON( spin ), TRUE );
 	gtk_entry_set_alignment( GTK_ENTRY( spin ), 1.0 ); //right
 	gtk_table_attach( GTK_TABLE( table ), spin, 1, 2, 1, 2,
@@ -3082,6 +3090,7 @@ void PrefsDlg::LoadPrefs(){
 	mLocalPrefs.GetPref( GLLIGHTING_KEY,         &m_bGLLighting,                 FALSE );
 	mLocalPrefs.GetPref( NOSTIPPLE_KEY,          &m_bNoStipple,                  FALSE );
 	mLocalPrefs.GetPref( UNDOLEVELS_KEY,         &m_nUndoLevels,                 30 );
+	mLocalPrefs.GetPref( UNDOSPILL_KEY,          &m_bUndoSpill,                  FALSE );
 	mLocalPrefs.GetPref( VERTEXMODE_KEY,         &m_bVertexSplit,                TRUE );
 	mLocalPrefs.GetPref( RUNQ2_KEY,              &m_bRunQuake,                   RUNQ2_DEF );
 	mLocalPrefs.GetPref( LEAKSTOP_KEY,           &m_bLeakStop,                   TRUE );
@@ -3222,6 +3231,7 @@ void PrefsDlg::LoadPrefs(){
 #endif
 
 	Undo_SetMaxSize( m_nUndoLevels ); // set it internally as well / FIXME: why not just have one global value?
+	Undo_SetSpillToDisk( m_bUndoSpill );
 
 	UpdateTextureCompression();
 
@@ -3282,6 +3292,7 @@ void PrefsDlg::PostModal( int code ){
 		if ( m_nUndoLevels != 0 ) {
 			Undo_SetMaxSize( m_nUndoLevels );
 		}
+		Undo_SetSpillToDisk( m_bUndoSpill );
 	}
 }
 
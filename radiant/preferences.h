@@ -646,6 +646,7 @@ bool m_bHideEmptyDirs;
 int m_nShader;
 bool m_bNoStipple;
 int m_nUndoLevels;
+bool m_bUndoSpill;
 bool m_bVertexSplit;
 
 int m_nMouseButtons;
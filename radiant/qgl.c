@@ -493,6 +493,14 @@ void ( APIENTRY * qglMultiTexCoord4ivARB )( GLenum target, const GLint *v );
 void ( APIENTRY * qglMultiTexCoord4sARB )( GLenum target, GLshort s );
 void ( APIENTRY * qglMultiTexCoord4svARB )( GLenum target, const GLshort *v );
 
+void ( APIENTRY * qglBindBufferARB )( GLenum target, GLuint buffer );
+void ( APIENTRY * qglDeleteBuffersARB )( GLsizei n, const GLuint *buffers );
+void ( APIENTRY * qglGenBuffersARB )( GLsizei n, GLuint *buffers );
+void ( APIENTRY * qglBufferDataARB )( GLenum target, GLsizeiptrARB size, const GLvoid *data, GLenum usage );
+void ( APIENTRY * qglBufferSubDataARB )( GLenum target, GLintptrARB offset, GLsizeiptrARB size, const GLvoid *data );
+
+void ( APIENTRY * qglMultiDrawArraysEXT )( GLenum mode, const GLint *first, const GLsizei *count, GLsizei primcount );
+
 // glu stuff
 void ( APIENTRY * qgluPerspective )( GLdouble fovy, GLdouble aspect, GLdouble zNear, GLdouble zFar );
 
@@ -910,6 +918,14 @@ void QGL_Shutdown(){
 	qglMultiTexCoord4sARB = NULL;
 	qglMultiTexCoord4svARB = NULL;
 
+	qglBindBufferARB = NULL;
+	qglDeleteBuffersARB = NULL;
+	qglGenBuffersARB = NULL;
+	qglBufferDataARB = NULL;
+	qglBufferSubDataARB = NULL;
+
+	qglMultiDrawArraysEXT = NULL;
+
 #ifdef _WIN32
 	qwglCopyContext              = NULL;
 	qwglCreateContext            = NULL;
@@ -1595,6 +1611,14 @@ int QGL_Init( const char *dllname, const char* gluname ){
 	qglMultiTexCoord4sARB = NULL;
 	qglMultiTexCoord4svARB = NULL;
 
+	qglBindBufferARB = NULL;
+	qglDeleteBuffersARB = NULL;
+	qglGenBuffersARB = NULL;
+	qglBufferDataARB = NULL;
+	qglBufferSubDataARB = NULL;
+
+	qglMultiDrawArraysEXT = NULL;
+
 #ifdef _WIN32
 	qwglCopyContext              = safe_dlsym( g_hGLDLL, "wglCopyContext" );
 	qwglCreateContext            = safe_dlsym( g_hGLDLL, "wglCreateContext" );
@@ -1757,4 +1781,16 @@ void QGL_InitExtensions(){
 		qglMultiTexCoord4sARB = Sys_GLGetExtension( "glMultiTexCoord4sARB" );
 		qglMultiTexCoord4svARB = Sys_GLGetExtension( "glMultiTexCoord4svARB" );
 	}
+
+	if ( GL_ExtensionSupported( "GL_ARB_vertex_buffer_object" ) ) {
+		qglBindBufferARB = Sys_GLGetExtension( "glBindBufferARB" );
+		qglDeleteBuffersARB = Sys_GLGetExtension( "glDeleteBuffersARB" );
+		qglGenBuffersARB = Sys_GLGetExtension( "glGenBuffersARB" );
+		qglBufferDataARB = Sys_GLGetExtension( "glBufferDataARB" );
+		qglBufferSubDataARB = Sys_GLGetExtension( "glBufferSubDataARB" );
+	}
+
+	if ( GL_ExtensionSupported( "GL_EXT_multi_draw_arrays" ) ) {
+		qglMultiDrawArraysEXT = Sys_GLGetExtension( "glMultiDrawArraysEXT" );
+	}
 }
@@ -87,6 +87,15 @@
 
 #endif
 
+#ifndef GL_ARB_vertex_buffer_object
+#include <stddef.h>
+typedef ptrdiff_t GLintptrARB;
+typedef ptrdiff_t GLsizeiptrARB;
+#define GL_ARRAY_BUFFER_ARB               0x8892
+#define GL_STATIC_DRAW_ARB                0x88E4
+#define GL_DYNAMIC_DRAW_ARB               0x88E8
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -481,6 +490,14 @@ extern void ( APIENTRY * qglMultiTexCoord4ivARB )( GLenum target, const GLint *v
 extern void ( APIENTRY * qglMultiTexCoord4sARB )( GLenum target, GLshort s );
 extern void ( APIENTRY * qglMultiTexCoord4svARB )( GLenum target, const GLshort *v );
 
+extern void ( APIENTRY * qglBindBufferARB )( GLenum target, GLuint buffer );
+extern void ( APIENTRY * qglDeleteBuffersARB )( GLsizei n, const GLuint *buffers );
+extern void ( APIENTRY * qglGenBuffersARB )( GLsizei n, GLuint *buffers );
+extern void ( APIENTRY * qglBufferDataARB )( GLenum target, GLsizeiptrARB size, const GLvoid *data, GLenum usage );
+extern void ( APIENTRY * qglBufferSubDataARB )( GLenum target, GLintptrARB offset, GLsizeiptrARB size, const GLvoid *data );
+
+extern void ( APIENTRY * qglMultiDrawArraysEXT )( GLenum mode, const GLint *first, const GLsizei *count, GLsizei primcount );
+
 
 
 #ifdef _WIN32
@@ -26,6 +26,7 @@
 //
 
 #include "stdafx.h"
+#include <stddef.h>
 
 typedef struct
 {
@@ -156,3 +157,629 @@ void QueueDraw(){
 	}
 	qglBindTexture( GL_TEXTURE_2D, 0 );
 }
+
+//
+// retained brush geometry for the camera and 2D views
+//
+// every world and brush entity face is kept in one vertex array (a buffer object when
+// the driver has GL_ARB_vertex_buffer_object), each brush owning a run of it.
+// Brush_BuildWindings drops the run and it is rebuilt the next time the brush is
+// queued, so a redraw only walks the brush list, collects the face ranges per texture
+// and hands them to glMultiDrawArrays.
+//
+
+#define RC_TRANS        0x01
+#define RC_CAULK        0x02
+#define RC_CLIP         0x04
+#define RC_BOTCLIP      0x08
+
+// the per face colours Brush_Draw picks between
+#define RC_COLOR_SHADE      0   // textured, no GL lighting: d_shade
+#define RC_COLOR_SHADED     1   // flat, no GL lighting: d_color
+#define RC_COLOR_IDENTITY   2   // textured: 0.8 grey
+#define RC_COLOR_TEXTURE    3   // flat: texture colour
+#define RC_NUM_COLORS       4
+
+#define Q2_SURF_TRANS33         0x00000010
+#define Q2_SURF_TRANS66         0x00000020
+#define QUETOO_SURF_TRANS100    0x00000040
+#define QUETOO_SURF_ALPHA_TEST  0x00000400
+
+typedef struct
+{
+	float xyz[3];
+	float st[2];
+	float normal[3];
+	unsigned char color[RC_NUM_COLORS][4];
+} rcVert_t;
+
+typedef struct
+{
+	face_t *face;           // used to spot faces that changed without a Brush_BuildWindings
+	winding_t *winding;
+	IShader *pShader;
+	int firstVert;
+	int numVerts;
+	int flags;
+	int batch;
+} rcFace_t;
+
+typedef struct rcBrush_s
+{
+	struct rcBrush_s *prev, *next;  // in vertex order, for compacting
+	brush_t *brush;
+	int firstVert;
+	int numVerts;
+	int flags;                      // all face flags or'ed together
+	int numFaces;
+	rcFace_t faces[1];
+} rcBrush_t;
+
+typedef struct
+{
+	qtexture_t *texture;
+	bool notex;
+	GLint *first;
+	GLsizei *count;
+	int num, max;
+} rcBatch_t;
+
+static bool rcEnabled = true;
+
+static rcVert_t *rcVerts;
+static int rcNumVerts, rcMaxVerts, rcDeadVerts;
+static int rcDirtyMin, rcDirtyMax;
+static GLuint rcBuffer;
+static int rcBufferVerts;
+
+static rcBrush_t rcBrushes = { &rcBrushes, &rcBrushes };
+
+static rcBatch_t *rcBatches;
+static int rcNumBatches, rcMaxBatches;
+static GHashTable *rcBatchForTexture;
+static rcBatch_t rcBatchesXY[2];    // structural, detail
+
+static int rcExclude;
+
+void RenderCache_Enable( bool bEnable ){
+	rcEnabled = bEnable;
+}
+
+bool RenderCache_IsEnabled(){
+	return rcEnabled;
+}
+
+static void RenderCache_DirtyVerts( int first, int num ){
+	if ( num <= 0 ) {
+		return;
+	}
+	if ( rcDirtyMin >= rcDirtyMax ) {
+		rcDirtyMin = first;
+		rcDirtyMax = first + num;
+		return;
+	}
+	if ( first < rcDirtyMin ) {
+		rcDirtyMin = first;
+	}
+	if ( first + num > rcDirtyMax ) {
+		rcDirtyMax = first + num;
+	}
+}
+
+// squeeze out the runs of freed brushes
+static void RenderCache_Compact(){
+	rcBrush_t *rc;
+	int i, numVerts, delta;
+
+	numVerts = 0;
+	for ( rc = rcBrushes.next; rc != &rcBrushes; rc = rc->next )
+	{
+		delta = rc->firstVert - numVerts;
+		if ( delta ) {
+			memmove( &rcVerts[numVerts], &rcVerts[rc->firstVert], rc->numVerts * sizeof( rcVert_t ) );
+			rc->firstVert -= delta;
+			for ( i = 0; i < rc->numFaces; i++ )
+				rc->faces[i].firstVert -= delta;
+		}
+		numVerts += rc->numVerts;
+	}
+
+	rcNumVerts = numVerts;
+	rcDeadVerts = 0;
+	RenderCache_DirtyVerts( 0, rcNumVerts );
+}
+
+static int RenderCache_AllocVerts( int numVerts ){
+	int first;
+
+	if ( rcNumVerts + numVerts > rcMaxVerts ) {
+		if ( rcDeadVerts > ( rcNumVerts >> 1 ) ) {
+			RenderCache_Compact();
+		}
+		if ( rcNumVerts + numVerts > rcMaxVerts ) {
+			rcMaxVerts = ( rcMaxVerts < 4096 ) ? 4096 : rcMaxVerts * 2;
+			while ( rcNumVerts + numVerts > rcMaxVerts )
+				rcMaxVerts *= 2;
+			rcVerts = (rcVert_t*)realloc( rcVerts, rcMaxVerts * sizeof( rcVert_t ) );
+		}
+	}
+
+	first = rcNumVerts;
+	rcNumVerts += numVerts;
+	RenderCache_DirtyVerts( first, numVerts );
+	return first;
+}
+
+static rcBatch_t *RenderCache_BatchForTexture( qtexture_t *texture, int *index ){
+	gpointer value;
+	rcBatch_t *batch;
+
+	if ( rcBatchForTexture == NULL ) {
+		rcBatchForTexture = g_hash_table_new( g_direct_hash, g_direct_equal );
+	}
+
+	value = g_hash_table_lookup( rcBatchForTexture, texture );
+	if ( value ) {
+		*index = GPOINTER_TO_INT( value ) - 1;
+		return &rcBatches[*index];
+	}
+
+	if ( rcNumBatches == rcMaxBatches ) {
+		rcMaxBatches += 64;
+		rcBatches = (rcBatch_t*)realloc( rcBatches, rcMaxBatches * sizeof( rcBatch_t ) );
+	}
+	*index = rcNumBatches++;
+	batch = &rcBatches[*index];
+	memset( batch, 0, sizeof( *batch ) );
+	batch->texture = texture;
+	batch->notex = ( texture->name[0] == '(' );
+	g_hash_table_insert( rcBatchForTexture, texture, GINT_TO_POINTER( *index + 1 ) );
+	return batch;
+}
+
+static void RenderCache_BatchAdd( rcBatch_t *batch, int first, int count ){
+	if ( batch->num == batch->max ) {
+		batch->max = ( batch->max < 256 ) ? 256 : batch->max * 2;
+		batch->first = (GLint*)realloc( batch->first, batch->max * sizeof( GLint ) );
+		batch->count = (GLsizei*)realloc( batch->count, batch->max * sizeof( GLsizei ) );
+	}
+	batch->first[batch->num] = first;
+	batch->count[batch->num] = count;
+	batch->num++;
+}
+
+static void RenderCache_SetColor( unsigned char *out, const float *color, float alpha ){
+	int i;
+	float v;
+
+	for ( i = 0; i < 3; i++ )
+	{
+		v = color[i];
+		out[i] = ( v <= 0.0f ) ? 0 : ( v >= 1.0f ) ? 255 : (unsigned char)( v * 255.0f + 0.5f );
+	}
+	out[3] = ( alpha <= 0.0f ) ? 0 : ( alpha >= 1.0f ) ? 255 : (unsigned char)( alpha * 255.0f + 0.5f );
+}
+
+// same test as Brush_Draw
+static bool RenderCache_FaceTrans( face_t *face, float *transVal ){
+	bool bTrans = ( face->pShader->getFlags() & QER_TRANS ) != 0;
+
+	*transVal = face->pShader->getTrans();
+	if ( !bTrans ) {
+		if ( face->texdef.flags & Q2_SURF_TRANS33 ) {
+			bTrans = true;
+			*transVal = 0.33f;
+		}
+		else if ( face->texdef.flags & Q2_SURF_TRANS66 ) {
+			bTrans = true;
+			*transVal = 0.66f;
+		}
+		else if ( g_pGameDescription->mGameFile == "quetoo.game" ) {
+			if ( face->texdef.flags & ( QUETOO_SURF_TRANS100 | QUETOO_SURF_ALPHA_TEST ) ) {
+				bTrans = true;
+				*transVal = 1.f;
+			}
+		}
+	}
+	return bTrans;
+}
+
+void RenderCache_FreeBrush( brush_t *b ){
+	rcBrush_t *rc = (rcBrush_t*)b->pRenderCache;
+
+	if ( rc == NULL ) {
+		return;
+	}
+
+	// the last run can simply be handed back
+	if ( rc->next == &rcBrushes && rc->firstVert + rc->numVerts == rcNumVerts ) {
+		rcNumVerts = rc->firstVert;
+	}
+	else{
+		rcDeadVerts += rc->numVerts;
+	}
+
+	rc->prev->next = rc->next;
+	rc->next->prev = rc->prev;
+	free( rc );
+	b->pRenderCache = NULL;
+}
+
+static rcBrush_t *RenderCache_BuildBrush( brush_t *b ){
+	rcBrush_t *rc;
+	rcFace_t *rf;
+	rcVert_t *v;
+	face_t *face;
+	winding_t *w;
+	vec3_t identity, shade;
+	float transVal;
+	int i, numFaces, numVerts;
+
+	numFaces = numVerts = 0;
+	for ( face = b->brush_faces; face; face = face->next )
+	{
+		numFaces++;
+		if ( face->face_winding ) {
+			numVerts += face->face_winding->numpoints;
+		}
+	}
+
+	rc = (rcBrush_t*)malloc( sizeof( rcBrush_t ) + ( numFaces ? numFaces - 1 : 0 ) * sizeof( rcFace_t ) );
+	rc->brush = b;
+	rc->numFaces = numFaces;
+	rc->numVerts = numVerts;
+	rc->firstVert = RenderCache_AllocVerts( numVerts );
+	rc->flags = 0;
+
+	rc->prev = rcBrushes.prev;
+	rc->next = &rcBrushes;
+	rcBrushes.prev->next = rc;
+	rcBrushes.prev = rc;
+
+	VectorSet( identity, 0.8f, 0.8f, 0.8f );
+
+	numVerts = rc->firstVert;
+	for ( face = b->brush_faces, rf = rc->faces; face; face = face->next, rf++ )
+	{
+		w = face->face_winding;
+
+		rf->face = face;
+		rf->winding = w;
+		rf->pShader = face->pShader;
+		rf->firstVert = numVerts;
+		rf->numVerts = w ? w->numpoints : 0;
+		rf->flags = 0;
+		rf->batch = -1;
+
+		if ( !w ) {
+			continue;
+		}
+
+		if ( RenderCache_FaceTrans( face, &transVal ) ) {
+			rf->flags |= RC_TRANS;
+		}
+		if ( strstr( face->texdef.GetName(), "caulk" ) ) {
+			rf->flags |= RC_CAULK;
+		}
+		if ( strstr( face->texdef.GetName(), "botclip" ) || strstr( face->texdef.GetName(), "clipmonster" ) ) {
+			rf->flags |= RC_BOTCLIP;
+		}
+		if ( strstr( face->texdef.GetName(), "clip" ) ) {
+			rf->flags |= RC_CLIP;
+		}
+		rc->flags |= rf->flags;
+
+		RenderCache_BatchForTexture( face->d_texture, &rf->batch );
+		VectorSet( shade, face->d_shade, face->d_shade, face->d_shade );
+
+		for ( i = 0, v = &rcVerts[numVerts]; i < w->numpoints; i++, v++ )
+		{
+			VectorCopy( w->points[i], v->xyz );
+			v->st[0] = w->points[i][3];
+			v->st[1] = w->points[i][4];
+			VectorCopy( face->plane.normal, v->normal );
+			RenderCache_SetColor( v->color[RC_COLOR_SHADE], shade, transVal );
+			RenderCache_SetColor( v->color[RC_COLOR_SHADED], face->d_color, transVal );
+			RenderCache_SetColor( v->color[RC_COLOR_IDENTITY], identity, transVal );
+			RenderCache_SetColor( v->color[RC_COLOR_TEXTURE], face->pShader->getTexture()->color, transVal );
+		}
+		numVerts += w->numpoints;
+	}
+
+	b->pRenderCache = rc;
+	return rc;
+}
+
+// rebuilds the brush's run if anything about its faces changed behind our back
+static rcBrush_t *RenderCache_ForBrush( brush_t *b ){
+	rcBrush_t *rc = (rcBrush_t*)b->pRenderCache;
+	rcFace_t *rf;
+	face_t *face;
+	int i;
+
+	if ( rc ) {
+		for ( face = b->brush_faces, i = 0, rf = rc->faces; face && i < rc->numFaces; face = face->next, i++, rf++ )
+		{
+			if ( rf->face != face || rf->winding != face->face_winding || rf->pShader != face->pShader ) {
+				break;
+			}
+			if ( rf->batch >= 0 && rcBatches[rf->batch].texture != face->d_texture ) {
+				break;
+			}
+		}
+		if ( face == NULL && i == rc->numFaces ) {
+			return rc;
+		}
+		RenderCache_FreeBrush( b );
+	}
+
+	return RenderCache_BuildBrush( b );
+}
+
+/*
+   ==================
+   RenderCache_Begin
+
+   clears the batches for a new pass
+   ==================
+ */
+static int RenderCache_ExcludeFlags(){
+	int exclude = 0;
+
+	if ( g_qeglobals.d_savedinfo.exclude & EXCLUDE_CAULK ) {
+		exclude |= RC_CAULK;
+	}
+	if ( g_qeglobals.d_savedinfo.exclude & EXCLUDE_BOTCLIP ) {
+		exclude |= RC_BOTCLIP;
+	}
+	if ( g_qeglobals.d_savedinfo.exclude & EXCLUDE_CLIP ) {
+		exclude |= RC_CLIP;
+	}
+	return exclude;
+}
+
+void RenderCache_Begin(){
+	int i;
+
+	for ( i = 0; i < rcNumBatches; i++ )
+		rcBatches[i].num = 0;
+	rcBatchesXY[0].num = rcBatchesXY[1].num = 0;
+
+	rcExclude = RenderCache_ExcludeFlags();
+}
+
+// the cache only knows about plain brush faces, patches and fixed size entities draw themselves
+bool RenderCache_CanQueue( brush_t *b ){
+	return rcEnabled && !b->patchBrush && !b->owner->eclass->fixedsize;
+}
+
+// true if the brush still has to go through Brush_Draw in the transparent pass
+bool RenderCache_HasTrans( brush_t *b ){
+	return ( RenderCache_ForBrush( b )->flags & RC_TRANS ) != 0;
+}
+
+// true if every face of the brush is drawn solid in the camera, used to pick occluders
+bool RenderCache_IsOpaque( brush_t *b ){
+	rcBrush_t *rc = RenderCache_ForBrush( b );
+	int i;
+
+	if ( rc->flags & ( RC_TRANS | RenderCache_ExcludeFlags() ) ) {
+		return false;
+	}
+	for ( i = 0; i < rc->numFaces; i++ )
+		if ( !rc->faces[i].numVerts ) {
+			return false;
+		}
+	return true;
+}
+
+void RenderCache_QueueBrush( brush_t *b ){
+	rcBrush_t *rc = RenderCache_ForBrush( b );
+	rcFace_t *rf;
+	int i;
+
+	for ( i = 0, rf = rc->faces; i < rc->numFaces; i++, rf++ )
+	{
+		if ( !rf->numVerts || ( rf->flags & ( RC_TRANS | rcExclude ) ) ) {
+			continue;
+		}
+		RenderCache_BatchAdd( &rcBatches[rf->batch], rf->firstVert, rf->numVerts );
+	}
+}
+
+void RenderCache_QueueBrushXY( brush_t *b, int nViewType ){
+	rcBrush_t *rc = RenderCache_ForBrush( b );
+	rcBatch_t *batch;
+	rcFace_t *rf;
+	float *normal;
+	int i;
+
+	batch = &rcBatchesXY[( b->brush_faces->texdef.contents & CONTENTS_DETAIL ) ? 1 : 0];
+
+	for ( i = 0, rf = rc->faces; i < rc->numFaces; i++, rf++ )
+	{
+		if ( !rf->numVerts ) {
+			continue;
+		}
+
+		// only draw polygons facing in a direction we care about, see Brush_DrawXY
+		normal = rf->face->plane.normal;
+		if ( nViewType == XY ) {
+			if ( normal[2] <= 0 ) {
+				continue;
+			}
+		}
+		else if ( nViewType == XZ ) {
+			if ( normal[1] >= 0 ) {
+				continue;
+			}
+		}
+		else if ( normal[0] <= 0 ) {
+			continue;
+		}
+
+		RenderCache_BatchAdd( batch, rf->firstVert, rf->numVerts );
+	}
+}
+
+// uploads what changed since the last frame and points the arrays at the cache
+static char *RenderCache_Bind(){
+	if ( qglGenBuffersARB == NULL ) {
+		return (char*)rcVerts;
+	}
+
+	if ( rcBuffer == 0 ) {
+		qglGenBuffersARB( 1, &rcBuffer );
+	}
+	qglBindBufferARB( GL_ARRAY_BUFFER_ARB, rcBuffer );
+
+	if ( rcBufferVerts < rcMaxVerts ) {
+		qglBufferDataARB( GL_ARRAY_BUFFER_ARB, rcMaxVerts * sizeof( rcVert_t ), NULL, GL_DYNAMIC_DRAW_ARB );
+		rcBufferVerts = rcMaxVerts;
+		rcDirtyMin = 0;
+		rcDirtyMax = rcNumVerts;
+	}
+	if ( rcDirtyMin < rcDirtyMax ) {
+		qglBufferSubDataARB( GL_ARRAY_BUFFER_ARB, rcDirtyMin * sizeof( rcVert_t ), ( rcDirtyMax - rcDirtyMin ) * sizeof( rcVert_t ), &rcVerts[rcDirtyMin] );
+	}
+	rcDirtyMin = rcDirtyMax = 0;
+
+	return NULL;
+}
+
+static void RenderCache_Unbind(){
+	if ( qglBindBufferARB != NULL ) {
+		qglBindBufferARB( GL_ARRAY_BUFFER_ARB, 0 );
+	}
+}
+
+static void RenderCache_DrawBatch( GLenum mode, rcBatch_t *batch ){
+	int i;
+
+	if ( qglMultiDrawArraysEXT != NULL ) {
+		qglMultiDrawArraysEXT( mode, batch->first, batch->count, batch->num );
+		return;
+	}
+	for ( i = 0; i < batch->num; i++ )
+		qglDrawArrays( mode, batch->first[i], batch->count[i] );
+}
+
+/*
+   ==================
+   RenderCache_Draw
+
+   draws the queued opaque faces one texture at a time, with the state Brush_Draw would use
+   ==================
+ */
+void RenderCache_Draw( int nGLState, int nDrawMode ){
+	char *base;
+	int i, color;
+	bool bBind, bNoTex;
+	GLenum mode;
+
+	if ( !rcNumVerts ) {
+		return;
+	}
+
+	qglPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+	base = RenderCache_Bind();
+
+	qglEnableClientState( GL_VERTEX_ARRAY );
+	qglVertexPointer( 3, GL_FLOAT, sizeof( rcVert_t ), base + offsetof( rcVert_t, xyz ) );
+
+	if ( nGLState & DRAW_GL_TEXTURE_2D ) {
+		qglEnableClientState( GL_TEXTURE_COORD_ARRAY );
+		qglTexCoordPointer( 2, GL_FLOAT, sizeof( rcVert_t ), base + offsetof( rcVert_t, st ) );
+	}
+	else{
+		qglDisableClientState( GL_TEXTURE_COORD_ARRAY );
+	}
+
+	if ( ( nGLState & DRAW_GL_LIGHTING ) && g_PrefsDlg.m_bGLLighting ) {
+		qglEnableClientState( GL_NORMAL_ARRAY );
+		qglNormalPointer( GL_FLOAT, sizeof( rcVert_t ), base + offsetof( rcVert_t, normal ) );
+	}
+	else{
+		qglDisableClientState( GL_NORMAL_ARRAY );
+	}
+
+	if ( ( nGLState & DRAW_GL_LIGHTING ) && !g_PrefsDlg.m_bGLLighting ) {
+		color = ( nGLState & DRAW_GL_TEXTURE_2D ) ? RC_COLOR_SHADE : RC_COLOR_SHADED;
+	}
+	else{
+		color = ( nGLState & DRAW_GL_TEXTURE_2D ) ? RC_COLOR_IDENTITY : RC_COLOR_TEXTURE;
+	}
+	qglEnableClientState( GL_COLOR_ARRAY );
+	qglColorPointer( 4, GL_UNSIGNED_BYTE, sizeof( rcVert_t ), base + offsetof( rcVert_t, color ) + color * 4 );
+
+	mode = ( nGLState & DRAW_GL_FILL ) ? GL_TRIANGLE_FAN : GL_POLYGON;
+	bBind = ( nGLState & DRAW_GL_TEXTURE_2D ) && ( nDrawMode == cd_texture || nDrawMode == cd_light );
+	bNoTex = false;
+
+	for ( i = 0; i < rcNumBatches; i++ )
+	{
+		if ( !rcBatches[i].num ) {
+			continue;
+		}
+
+		if ( nGLState & DRAW_GL_TEXTURE_2D ) {
+			if ( rcBatches[i].notex != bNoTex ) {
+				bNoTex = rcBatches[i].notex;
+				if ( bNoTex ) {
+					qglDisable( GL_TEXTURE_2D );
+				}
+				else{
+					qglEnable( GL_TEXTURE_2D );
+				}
+			}
+			if ( bBind && !bNoTex ) {
+				qglBindTexture( GL_TEXTURE_2D, rcBatches[i].texture->texture_number );
+			}
+		}
+
+		RenderCache_DrawBatch( mode, &rcBatches[i] );
+	}
+
+	if ( bNoTex ) {
+		qglEnable( GL_TEXTURE_2D );
+	}
+
+	RenderCache_Unbind();
+	qglPopClientAttrib();
+}
+
+/*
+   ==================
+   RenderCache_DrawXY
+
+   outlines of the queued world brushes for the 2D views
+   ==================
+ */
+void RenderCache_DrawXY(){
+	char *base;
+
+	if ( !rcNumVerts || ( !rcBatchesXY[0].num && !rcBatchesXY[1].num ) ) {
+		return;
+	}
+
+	qglPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+	base = RenderCache_Bind();
+
+	qglEnableClientState( GL_VERTEX_ARRAY );
+	qglDisableClientState( GL_TEXTURE_COORD_ARRAY );
+	qglDisableClientState( GL_NORMAL_ARRAY );
+	qglDisableClientState( GL_COLOR_ARRAY );
+	qglVertexPointer( 3, GL_FLOAT, sizeof( rcVert_t ), base + offsetof( rcVert_t, xyz ) );
+
+	if ( rcBatchesXY[0].num ) {
+		qglColor3fv( g_qeglobals.d_savedinfo.colors[COLOR_BRUSHES] );
+		RenderCache_DrawBatch( GL_LINE_LOOP, &rcBatchesXY[0] );
+	}
+	if ( rcBatchesXY[1].num ) {
+		qglColor3fv( g_qeglobals.d_savedinfo.colors[COLOR_DETAIL] );
+		RenderCache_DrawBatch( GL_LINE_LOOP, &rcBatchesXY[1] );
+	}
+
+	RenderCache_Unbind();
+	qglPopClientAttrib();
+}
@@ -36,46 +36,108 @@ CPtrArray& g_ptrSelectedFaceBrushes = g_SelectedFaceBrushes;
    ===========
  */
 #define DIST_START  999999
+
+typedef struct
+{
+	vec3_t origin, dir;
+	int flags;
+	float maxDist;      // the tree skips boxes starting past this, kept just behind the best hit
+	trace_t *trace;
+	CPtrArray *hits;    // SF_CYCLE wants every brush the ray goes through
+} rayTest_t;
+
+static bool Test_RayFilter( brush_t *brush, int flags ){
+	if ( ( flags & SF_ENTITIES_FIRST ) && ( brush->owner == world_entity || !brush->owner->eclass->fixedsize ) ) {
+		return false;
+	}
+
+	if ( brush->bFiltered ) {
+		return false;
+	}
+
+	if ( !g_PrefsDlg.m_bSelectCurves && brush->patchBrush ) {
+		return false;
+	}
+
+	if ( !g_PrefsDlg.m_bSelectModels && ( brush->owner->eclass->nShowFlags & ECLASS_MISCMODEL ) ) {
+		return false;
+	}
+
+	//if (!g_bShowPatchBounds && brush->patchBrush)
+	//  return false;
+
+	return true;
+}
+
+static void Test_RayBrush( brush_t *brush, void *data ){
+	rayTest_t *test = (rayTest_t*)data;
+	face_t *face;
+	float dist;
+
+	if ( !Test_RayFilter( brush, test->flags ) ) {
+		return;
+	}
+
+	face = Brush_Ray( test->origin, test->dir, brush, &dist, test->flags );
+
+	if ( test->hits ) {
+		if ( face ) {
+			test->hits->Add( brush );
+		}
+		return;
+	}
+
+	if ( face && dist > 0 && dist < test->trace->dist ) {
+		test->trace->dist = dist;
+		test->trace->brush = brush;
+		test->trace->face = face;
+		test->trace->selected = false;
+		test->maxDist = dist + 1.0f;
+	}
+}
+
+static void Test_RayStart( rayTest_t *test, vec3_t origin, vec3_t dir, int flags, trace_t *trace ){
+	VectorCopy( origin, test->origin );
+	VectorCopy( dir, test->dir );
+	test->flags = flags;
+	test->maxDist = 2 * g_MaxWorldCoord;    // same reach as Brush_Ray
+	test->trace = trace;
+	test->hits = NULL;
+}
+
 trace_t Test_Ray( vec3_t origin, vec3_t dir, int flags ){
 	brush_t *brush;
 	face_t  *face;
 	float dist;
 	trace_t t;
+	rayTest_t test;
 
 	memset( &t, 0, sizeof( t ) );
 	t.dist = DIST_START;
 
 	if ( flags & SF_CYCLE ) {
-		CPtrArray array;
+		CPtrArray hits, array;
 		brush_t *pToSelect = ( selected_brushes.next != &selected_brushes ) ? selected_brushes.next : NULL;
 		Select_Deselect();
 
-		// go through active brushes and accumulate all "hit" brushes
-		for ( brush = active_brushes.next ; brush != &active_brushes ; brush = brush->next )
-		{
-			//if ( (flags & SF_ENTITIES_FIRST) && brush->owner == world_entity)
-			//  continue;
-
-			if ( brush->bFiltered ) {
-				continue;
-			}
-
-			if ( !g_PrefsDlg.m_bSelectCurves && brush->patchBrush ) {
-				continue;
-			}
-
-			if ( !g_PrefsDlg.m_bSelectModels && ( brush->owner->eclass->nShowFlags & ECLASS_MISCMODEL ) ) {
-				continue;
-			}
-
-			//if (!g_bShowPatchBounds && brush->patchBrush)
-			//  continue;
-
-			face = Brush_Ray( origin, dir, brush, &dist, flags );
-
-			if ( face ) {
-				array.Add( brush );
-			}
+		// accumulate all "hit" brushes from the tree
+		Test_RayStart( &test, origin, dir, flags & ~SF_ENTITIES_FIRST, &t );
+		test.hits = &hits;
+		BrushTree_Ray( origin, dir, &test.maxDist, Test_RayBrush, &test );
+
+		// cycle through them in active_brushes order, as the full scan did
+		if ( hits.GetSize() > 1 ) {
+			GHashTable *hit = g_hash_table_new( g_direct_hash, g_direct_equal );
+			for ( int i = 0; i < hits.GetSize(); i++ )
+				g_hash_table_insert( hit, hits.GetAt( i ), hits.GetAt( i ) );
+			for ( brush = active_brushes.next ; brush != &active_brushes ; brush = brush->next )
+				if ( g_hash_table_lookup( hit, brush ) ) {
+					array.Add( brush );
+				}
+			g_hash_table_destroy( hit );
+		}
+		else if ( hits.GetSize() == 1 ) {
+			array.Add( hits.GetAt( 0 ) );
 		}
 
 		int nSize = array.GetSize();
@@ -108,53 +170,15 @@ trace_t Test_Ray( vec3_t origin, vec3_t dir, int flags ){
 	}
 
 	if ( !( flags & SF_SELECTED_ONLY ) ) {
-		for ( brush = active_brushes.next ; brush != &active_brushes ; brush = brush->next )
-		{
-			if ( ( flags & SF_ENTITIES_FIRST ) && ( brush->owner == world_entity || !brush->owner->eclass->fixedsize ) ) {
-				continue;
-			}
-
-			if ( brush->bFiltered ) {
-				continue;
-			}
-
-			if ( !g_PrefsDlg.m_bSelectCurves && brush->patchBrush ) {
-				continue;
-			}
-
-			if ( !g_PrefsDlg.m_bSelectModels && ( brush->owner->eclass->nShowFlags & ECLASS_MISCMODEL ) ) {
-				continue;
-			}
-
-			//if (!g_bShowPatchBounds && brush->patchBrush)
-			//  continue;
-
-			face = Brush_Ray( origin, dir, brush, &dist, flags );
-			if ( face && dist > 0 && dist < t.dist ) {
-				t.dist = dist;
-				t.brush = brush;
-				t.face = face;
-				t.selected = false;
-			}
-		}
+		// nearest boxes first, anything starting behind the best hit is skipped
+		Test_RayStart( &test, origin, dir, flags, &t );
+		BrushTree_Ray( origin, dir, &test.maxDist, Test_RayBrush, &test );
 	}
 
 
 	for ( brush = selected_brushes.next ; brush != &selected_brushes ; brush = brush->next )
 	{
-		if ( ( flags & SF_ENTITIES_FIRST ) && ( brush->owner == world_entity || !brush->owner->eclass->fixedsize ) ) {
-			continue;
-		}
-
-		if ( brush->bFiltered ) {
-			continue;
-		}
-
-		if ( !g_PrefsDlg.m_bSelectCurves && brush->patchBrush ) {
-			continue;
-		}
-
-		if ( !g_PrefsDlg.m_bSelectModels && ( brush->owner->eclass->nShowFlags & ECLASS_MISCMODEL ) ) {
+		if ( !Test_RayFilter( brush, flags ) ) {
 			continue;
 		}
 
@@ -467,6 +491,7 @@ void Select_Deselect( bool bDeselectFaces ){
 
 	UpdateWorkzone_ForBrush( b );
 
+	BrushTree_LinkList( selected_brushes.next, &selected_brushes );
 	selected_brushes.next->prev = &active_brushes;
 	selected_brushes.prev->next = active_brushes.next;
 	active_brushes.next->prev = selected_brushes.prev;
@@ -1143,17 +1168,39 @@ void Select_RotateAxis( int axis, float deg, bool bPaint, bool bMouse ){
    ================================================================
  */
 
+static void Select_CollectBrush( brush_t *b, void *data ){
+	reinterpret_cast<CPtrArray*>( data )->Add( b );
+}
+
+// unselected brushes whose bounds may overlap mins/maxs, in the two axis of the active XY view if bTall
+// collected up front, selecting them unlinks them from the tree
+static void Select_BrushesInBox( vec3_t mins, vec3_t maxs, bool bTall, CPtrArray &array ){
+	vec3_t boxMins, boxMaxs;
+
+	VectorCopy( mins, boxMins );
+	VectorCopy( maxs, boxMaxs );
+	if ( bTall ) {
+		int nDim = g_pParentWnd->ActiveXY()->GetViewType();  // YZ, XZ, XY look down x, y and z
+		boxMins[nDim] = -FLT_MAX;
+		boxMaxs[nDim] = FLT_MAX;
+	}
+
+	BrushTree_Box( boxMins, boxMaxs, Select_CollectBrush, &array );
+}
+
 void Select_RealCompleteTall( vec3_t mins, vec3_t maxs ){
-	brush_t *b, *next;
+	brush_t *b;
+	CPtrArray array;
 
 	int nDim1 = ( g_pParentWnd->ActiveXY()->GetViewType() == YZ ) ? 1 : 0;
 	int nDim2 = ( g_pParentWnd->ActiveXY()->GetViewType() == XY ) ? 1 : 2;
 
 	g_qeglobals.d_select_mode = sel_brush;
 
-	for ( b = active_brushes.next ; b != &active_brushes ; b = next )
+	Select_BrushesInBox( mins, maxs, true, array );
+	for ( int n = 0; n < array.GetSize(); n++ )
 	{
-		next = b->next;
+		b = reinterpret_cast<brush_t*>( array.GetAt( n ) );
 
 		if ( b->bFiltered ) {
 			continue;
@@ -1189,8 +1236,9 @@ void Select_CompleteTall( void ){
 }
 
 void Select_PartialTall( void ){
-	brush_t *b, *next;
+	brush_t *b;
 	vec3_t mins, maxs;
+	CPtrArray array;
 
 	if ( !QE_SingleBrush() ) {
 		return;
@@ -1209,9 +1257,10 @@ void Select_PartialTall( void ){
 	int nDim1 = ( g_pParentWnd->ActiveXY()->GetViewType() == YZ ) ? 1 : 0;
 	int nDim2 = ( g_pParentWnd->ActiveXY()->GetViewType() == XY ) ? 1 : 2;
 
-	for ( b = active_brushes.next ; b != &active_brushes ; b = next )
+	Select_BrushesInBox( mins, maxs, true, array );
+	for ( int n = 0; n < array.GetSize(); n++ )
 	{
-		next = b->next;
+		b = reinterpret_cast<brush_t*>( array.GetAt( n ) );
 
 		if ( b->bFiltered ) {
 			continue;
@@ -1231,9 +1280,10 @@ void Select_PartialTall( void ){
 }
 
 void Select_Touching( void ){
-	brush_t *b, *next;
+	brush_t *b;
 	int i;
 	vec3_t mins, maxs;
+	CPtrArray array;
 
 	if ( !QE_SingleBrush() ) {
 		return;
@@ -1244,9 +1294,10 @@ void Select_Touching( void ){
 	VectorCopy( selected_brushes.next->mins, mins );
 	VectorCopy( selected_brushes.next->maxs, maxs );
 
-	for ( b = active_brushes.next ; b != &active_brushes ; b = next )
+	Select_BrushesInBox( mins, maxs, false, array );
+	for ( int n = 0; n < array.GetSize(); n++ )
 	{
-		next = b->next;
+		b = reinterpret_cast<brush_t*>( array.GetAt( n ) );
 
 		if ( b->bFiltered ) {
 			continue;
@@ -1267,9 +1318,10 @@ void Select_Touching( void ){
 }
 
 void Select_Inside( void ){
-	brush_t *b, *next;
+	brush_t *b;
 	int i;
 	vec3_t mins, maxs;
+	CPtrArray array;
 
 	if ( !QE_SingleBrush() ) {
 		return;
@@ -1285,9 +1337,10 @@ void Select_Inside( void ){
 	VectorCopy( selected_brushes.next->maxs, maxs );
 	Select_Delete();
 
-	for ( b = active_brushes.next ; b != &active_brushes ; b = next )
+	Select_BrushesInBox( mins, maxs, false, array );
+	for ( int n = 0; n < array.GetSize(); n++ )
 	{
-		next = b->next;
+		b = reinterpret_cast<brush_t*>( array.GetAt( n ) );
 
 		if ( b->bFiltered ) {
 			continue;
@@ -1924,6 +1977,8 @@ void Select_ShowAllHidden(){
 			b->bFiltered = FilterBrush( b );
 		}
 	}
+	// unhidden brushes are back in the filter, drop the camera visible set
+	BrushTree_Invalidate();
 	Sys_UpdateWindows( W_ALL );
 }
 
@@ -1938,6 +1993,9 @@ void Select_Invert( void ){
 
 	Sys_Printf( "inverting selection...\n" );
 
+	BrushTree_UnlinkList( active_brushes.next, &active_brushes );
+	BrushTree_LinkList( selected_brushes.next, &selected_brushes );
+
 	next = active_brushes.next;
 	prev = active_brushes.prev;
 	if ( selected_brushes.next != &selected_brushes ) {
@@ -35,10 +35,102 @@
 
    FIXME: maybe reset the Undo system at map load
          maybe also reset the entityId at map load
+
+
+   brush journal:
+
+   brushes are not cloned into the undo anymore. Undo_AddBrush writes a compact record of
+   the brush (plane points, texdefs, patch control points and epairs) to a scratch journal,
+   and Undo_End keeps only what changed for the brushes that are still around, deleted brushes
+   keep their whole record. Undo_Undo rebuilds the old brushes from the records and from the
+   brushes it moves to the redo, which are exactly the state the changes were taken against.
+
+   the records of an undo live in one buffer, old buffers can be spilled to a temp file
+   instead of dropping the undo when the undo memory runs out.
+   the brushlist of an undo still takes whole brushes, redo moves them there.
  */
 
 #include "stdafx.h"
 
+#define UNDO_BRUSH_FULL     1       //everything needed to rebuild the brush
+#define UNDO_BRUSH_DELTA    2       //what changed since, applied to the brush it became
+
+//undoBrush_t flags
+#define UB_PATCH            0x01
+#define UB_HIDDEN           0x02
+#define UB_BRUSHDEF         0x04
+#define UB_EPAIRS           0x08    //epair list follows
+#define UB_PATCHHEAD        0x10    //patch shader and flags follow
+
+//undoFace_t fields
+#define UF_PLANE            0x01
+#define UF_TEXDEF           0x02
+#define UF_BPRIMIT          0x04
+#define UF_ALL              ( UF_PLANE | UF_TEXDEF | UF_BPRIMIT )
+
+#define UNDO_SPILL_FACTOR   32      //the temp file may grow to this many times the undo memory
+
+typedef struct
+{
+	byte *data;
+	int size, max;
+} undoJournal_t;
+
+//records are a header followed by faces, patch head, control point runs and epairs,
+//each piece padded to 4 bytes
+typedef struct
+{
+	int size;                   //bytes in the record, including what follows
+	int kind;                   //UNDO_BRUSH_FULL or UNDO_BRUSH_DELTA
+	int numberId;               //brush the delta applies to
+	int ownerId;                //entityId of the owner entity
+	int undoId;                 //undo ID to give back to the brush
+	int flags;                  //UB_*
+	int numFaces;               //faces on the brush
+	int numFaceRecords;         //undoFace_t records that follow
+	int patchWidth, patchHeight;
+	int numRanges;              //undoRange_t runs that follow
+} undoBrush_t;
+
+typedef struct
+{
+	int face;                   //index in the brush face list
+	int fields;                 //UF_*, followed by plane points, texdef and name, brush primitive texdef
+} undoFace_t;
+
+typedef struct
+{
+	float shift[2];
+	float rotate;
+	float scale[2];
+	int contents, flags, value;
+} undoTexdef_t;
+
+typedef struct
+{
+	int contents, flags, value, type;   //followed by the shader name
+} undoPatchHead_t;
+
+typedef struct
+{
+	int first, count;           //control points in width * height order, followed by count drawVert_t
+} undoRange_t;
+
+typedef struct
+{
+	const undoFace_t *face;
+	const vec3_t *planepts;
+	const undoTexdef_t *texdef;
+	const char *name;
+	const brushprimit_texdef_t *bprimit;
+} undoFaceData_t;
+
+typedef struct
+{
+	brush_t *brush;             //NULL once the brush is freed
+	int offset;                 //full record in g_undoScratch
+} undoPending_t;
+
 typedef struct undo_s
 {
 	double time;                //time operation was performed
@@ -47,6 +139,11 @@ typedef struct undo_s
 	const char *operation;          //name of the operation
 	brush_t brushlist;          //deleted brushes
 	entity_t entitylist;        //deleted entities
+	undoJournal_t journal;      //brush records
+	int numRecords;             //number of brush records in the journal
+	int spilled;                //true when the journal went to the spill file
+	long spillOffset;           //where in the spill file
+	int spillSize;              //and how much
 	struct undo_s *prev, *next; //next and prev undo in list
 } undo_t;
 
@@ -61,6 +158,770 @@ int g_undoMemorySize = 0;               //memory size of undo buffer
 int g_undoId = 1;                       //current undo ID (zero is invalid id)
 int g_redoId = 1;                       //current redo ID (zero is invalid id)
 
+static undoJournal_t g_undoScratch;     //full records of the brushes the open undo has seen
+static undoPending_t *g_undoPending;    //which brush each of them belongs to
+static int g_undoNumPending;
+static int g_undoMaxPending;
+static GHashTable *g_undoPendingTable;  //brush_t* -> index in g_undoPending + 1
+static undo_t *g_undoPendingUndo;       //undo the pending records belong to
+static bool g_undoSpill = false;        //spill old journals to a temp file
+static FILE *g_undoSpillFile;
+static long g_undoSpillSize;
+
+/*
+   =============
+   Undo_JournalWrite
+
+   appends to the journal, returns the offset of the data
+   =============
+ */
+static int Undo_JournalWrite( undoJournal_t *j, const void *data, int size ){
+	int offset, padded;
+
+	offset = j->size;
+	padded = ( size + 3 ) & ~3;
+	if ( j->size + padded > j->max ) {
+		j->max = j->max * 2 + padded + 4096;
+		j->data = (byte*)realloc( j->data, j->max );
+	}
+	memcpy( j->data + offset, data, size );
+	memset( j->data + offset + size, 0, padded - size );
+	j->size += padded;
+	return offset;
+}
+
+static void Undo_JournalWriteString( undoJournal_t *j, const char *s ){
+	int len = strlen( s ) + 1;
+
+	Undo_JournalWrite( j, &len, sizeof( int ) );
+	Undo_JournalWrite( j, s, len );
+}
+
+static const void *Undo_JournalRead( const byte **p, int size ){
+	const void *data = *p;
+
+	*p += ( size + 3 ) & ~3;
+	return data;
+}
+
+static const char *Undo_JournalReadString( const byte **p ){
+	int len = *(const int*)Undo_JournalRead( p, sizeof( int ) );
+
+	return (const char*)Undo_JournalRead( p, len );
+}
+
+static void Undo_JournalFree( undoJournal_t *j ){
+	free( j->data );
+	j->data = NULL;
+	j->size = j->max = 0;
+}
+
+static void Undo_WriteFace( undoJournal_t *j, int index, int fields, const undoFaceData_t *fd ){
+	undoFace_t uf;
+
+	uf.face = index;
+	uf.fields = fields;
+	Undo_JournalWrite( j, &uf, sizeof( uf ) );
+	if ( fields & UF_PLANE ) {
+		Undo_JournalWrite( j, fd->planepts, sizeof( vec3_t ) * 3 );
+	}
+	if ( fields & UF_TEXDEF ) {
+		Undo_JournalWrite( j, fd->texdef, sizeof( undoTexdef_t ) );
+		Undo_JournalWriteString( j, fd->name );
+	}
+	if ( fields & UF_BPRIMIT ) {
+		Undo_JournalWrite( j, fd->bprimit, sizeof( brushprimit_texdef_t ) );
+	}
+}
+
+static void Undo_ReadFace( const byte **p, undoFaceData_t *fd ){
+	memset( fd, 0, sizeof( *fd ) );
+	fd->face = (const undoFace_t*)Undo_JournalRead( p, sizeof( undoFace_t ) );
+	if ( fd->face->fields & UF_PLANE ) {
+		fd->planepts = (const vec3_t*)Undo_JournalRead( p, sizeof( vec3_t ) * 3 );
+	}
+	if ( fd->face->fields & UF_TEXDEF ) {
+		fd->texdef = (const undoTexdef_t*)Undo_JournalRead( p, sizeof( undoTexdef_t ) );
+		fd->name = Undo_JournalReadString( p );
+	}
+	if ( fd->face->fields & UF_BPRIMIT ) {
+		fd->bprimit = (const brushprimit_texdef_t*)Undo_JournalRead( p, sizeof( brushprimit_texdef_t ) );
+	}
+}
+
+static void Undo_GetTexdef( const texdef_t *texdef, undoTexdef_t *td ){
+	td->shift[0] = texdef->shift[0];
+	td->shift[1] = texdef->shift[1];
+	td->rotate = texdef->rotate;
+	td->scale[0] = texdef->scale[0];
+	td->scale[1] = texdef->scale[1];
+	td->contents = texdef->contents;
+	td->flags = texdef->flags;
+	td->value = texdef->value;
+}
+
+static const char *Undo_TexName( const face_t *f ){
+	const char *name = f->texdef.GetName();
+
+	return name ? name : "";
+}
+
+static void Undo_WriteEpairs( undoJournal_t *j, epair_t *epairs ){
+	epair_t *ep;
+	int count;
+
+	for ( count = 0, ep = epairs; ep; ep = ep->next )
+		count++;
+	Undo_JournalWrite( j, &count, sizeof( int ) );
+	for ( ep = epairs; ep; ep = ep->next )
+	{
+		Undo_JournalWriteString( j, ep->key );
+		Undo_JournalWriteString( j, ep->value );
+	}
+}
+
+/*
+   =============
+   Undo_WriteBrush
+
+   writes a full record of the brush, returns its offset in the journal
+   =============
+ */
+static int Undo_WriteBrush( undoJournal_t *j, brush_t *b ){
+	undoBrush_t ub, *header;
+	undoFaceData_t fd;
+	undoTexdef_t td;
+	face_t *f;
+	int offset, i;
+
+	memset( &ub, 0, sizeof( ub ) );
+	ub.kind = UNDO_BRUSH_FULL;
+	ub.numberId = b->numberId;
+	ub.ownerId = b->owner->entityId;
+	ub.undoId = b->undoId;
+	if ( b->hiddenBrush ) {
+		ub.flags |= UB_HIDDEN;
+	}
+	if ( b->bBrushDef ) {
+		ub.flags |= UB_BRUSHDEF;
+	}
+	if ( b->epairs ) {
+		ub.flags |= UB_EPAIRS;
+	}
+	offset = Undo_JournalWrite( j, &ub, sizeof( ub ) );
+
+	if ( b->patchBrush ) {
+		// the faces of a patch brush are only its bounds, they are rebuilt from the control points
+		patchMesh_t *p = b->pPatch;
+		undoPatchHead_t head;
+		undoRange_t range;
+
+		ub.flags |= UB_PATCH | UB_PATCHHEAD;
+		ub.patchWidth = p->width;
+		ub.patchHeight = p->height;
+		ub.numRanges = 1;
+
+		head.contents = p->contents;
+		head.flags = p->flags;
+		head.value = p->value;
+		head.type = p->type;
+		Undo_JournalWrite( j, &head, sizeof( head ) );
+		Undo_JournalWriteString( j, p->pShader->getName() );
+
+		range.first = 0;
+		range.count = p->width * p->height;
+		Undo_JournalWrite( j, &range, sizeof( range ) );
+		for ( i = 0; i < p->width; i++ )
+			Undo_JournalWrite( j, p->ctrl[i], p->height * sizeof( drawVert_t ) );
+	}
+	else
+	{
+		for ( f = b->brush_faces; f; f = f->next, ub.numFaces++ )
+		{
+			Undo_GetTexdef( &f->texdef, &td );
+			fd.planepts = f->planepts;
+			fd.texdef = &td;
+			fd.name = Undo_TexName( f );
+			fd.bprimit = &f->brushprimit_texdef;
+			Undo_WriteFace( j, ub.numFaces, UF_ALL, &fd );
+		}
+		ub.numFaceRecords = ub.numFaces;
+	}
+
+	if ( b->epairs ) {
+		Undo_WriteEpairs( j, b->epairs );
+	}
+
+	// the journal may have moved
+	header = (undoBrush_t*)( j->data + offset );
+	ub.size = j->size - offset;
+	*header = ub;
+	return offset;
+}
+
+/*
+   =============
+   Undo_CanDelta
+
+   a delta needs the brush to still have the same shape of data
+   =============
+ */
+static bool Undo_CanDelta( const undoBrush_t *rec, brush_t *b ){
+	face_t *f;
+	int numFaces;
+
+	if ( ( ( rec->flags & UB_PATCH ) != 0 ) != ( b->patchBrush != 0 ) ) {
+		return false;
+	}
+	if ( b->patchBrush ) {
+		return b->pPatch->width == rec->patchWidth && b->pPatch->height == rec->patchHeight;
+	}
+	for ( numFaces = 0, f = b->brush_faces; f; f = f->next )
+		numFaces++;
+	return numFaces == rec->numFaces;
+}
+
+static bool Undo_EpairsDiffer( const byte *p, epair_t *epairs ){
+	const char *key, *value;
+	int i, count;
+
+	count = *(const int*)Undo_JournalRead( &p, sizeof( int ) );
+	for ( i = 0; i < count; i++, epairs = epairs->next )
+	{
+		key = Undo_JournalReadString( &p );
+		value = Undo_JournalReadString( &p );
+		if ( !epairs || strcmp( key, epairs->key ) || strcmp( value, epairs->value ) ) {
+			return true;
+		}
+	}
+	return epairs != NULL;
+}
+
+/*
+   =============
+   Undo_WriteBrushDelta
+
+   writes the parts of the full record rec that differ from the brush it became
+   =============
+ */
+static void Undo_WriteBrushDelta( undoJournal_t *j, const undoBrush_t *rec, brush_t *b ){
+	undoBrush_t ub, *header;
+	undoFaceData_t fd;
+	undoTexdef_t td;
+	const byte *p;
+	face_t *f;
+	int offset, i;
+
+	ub = *rec;
+	ub.kind = UNDO_BRUSH_DELTA;
+	ub.flags &= ~( UB_EPAIRS | UB_PATCHHEAD );
+	ub.numFaceRecords = 0;
+	ub.numRanges = 0;
+	offset = Undo_JournalWrite( j, &ub, sizeof( ub ) );
+
+	p = (const byte*)rec;
+	Undo_JournalRead( &p, sizeof( undoBrush_t ) );
+
+	// full records have every face, in order
+	for ( i = 0, f = b->brush_faces; i < rec->numFaceRecords; i++, f = f->next )
+	{
+		int fields = 0;
+
+		Undo_ReadFace( &p, &fd );
+		if ( memcmp( fd.planepts, f->planepts, sizeof( f->planepts ) ) ) {
+			fields |= UF_PLANE;
+		}
+		Undo_GetTexdef( &f->texdef, &td );
+		if ( memcmp( fd.texdef, &td, sizeof( td ) ) || strcmp( fd.name, Undo_TexName( f ) ) ) {
+			fields |= UF_TEXDEF;
+		}
+		if ( memcmp( fd.bprimit, &f->brushprimit_texdef, sizeof( brushprimit_texdef_t ) ) ) {
+			fields |= UF_BPRIMIT;
+		}
+		if ( fields ) {
+			Undo_WriteFace( j, i, fields, &fd );
+			ub.numFaceRecords++;
+		}
+	}
+
+	if ( rec->flags & UB_PATCH ) {
+		patchMesh_t *pm = b->pPatch;
+		const undoPatchHead_t *head;
+		const undoRange_t *range;
+		const drawVert_t *verts;
+		const char *name;
+		undoRange_t run;
+		int k, h;
+
+		head = (const undoPatchHead_t*)Undo_JournalRead( &p, sizeof( undoPatchHead_t ) );
+		name = Undo_JournalReadString( &p );
+		if ( head->contents != pm->contents || head->flags != pm->flags || head->value != pm->value
+			 || head->type != pm->type || strcmp( name, pm->pShader->getName() ) ) {
+			Undo_JournalWrite( j, head, sizeof( undoPatchHead_t ) );
+			Undo_JournalWriteString( j, name );
+			ub.flags |= UB_PATCHHEAD;
+		}
+
+		// runs of changed control points
+		range = (const undoRange_t*)Undo_JournalRead( &p, sizeof( undoRange_t ) );
+		verts = (const drawVert_t*)Undo_JournalRead( &p, range->count * sizeof( drawVert_t ) );
+		h = pm->height;
+		for ( k = 0; k < range->count; )
+		{
+			if ( !memcmp( &verts[k], &pm->ctrl[k / h][k % h], sizeof( drawVert_t ) ) ) {
+				k++;
+				continue;
+			}
+			run.first = k;
+			while ( k < range->count && memcmp( &verts[k], &pm->ctrl[k / h][k % h], sizeof( drawVert_t ) ) )
+				k++;
+			run.count = k - run.first;
+			Undo_JournalWrite( j, &run, sizeof( run ) );
+			Undo_JournalWrite( j, &verts[run.first], run.count * sizeof( drawVert_t ) );
+			ub.numRanges++;
+		}
+	}
+
+	// epairs go back whole if anything in them changed
+	if ( rec->flags & UB_EPAIRS ) {
+		if ( Undo_EpairsDiffer( p, b->epairs ) ) {
+			int count = *(const int*)p;
+
+			Undo_JournalWrite( j, p, sizeof( int ) );
+			Undo_JournalRead( &p, sizeof( int ) );
+			for ( i = 0; i < count * 2; i++ )
+				Undo_JournalWriteString( j, Undo_JournalReadString( &p ) );
+			ub.flags |= UB_EPAIRS;
+		}
+	}
+	else if ( b->epairs ) {
+		Undo_WriteEpairs( j, NULL );
+		ub.flags |= UB_EPAIRS;
+	}
+
+	header = (undoBrush_t*)( j->data + offset );
+	ub.size = j->size - offset;
+	*header = ub;
+}
+
+/*
+   =============
+   Undo_FlushPending
+
+   turns the full records of the open undo into its journal, deltas for the brushes that survived
+   =============
+ */
+static void Undo_FlushPending( void ){
+	undo_t *undo = g_undoPendingUndo;
+	undoBrush_t *rec;
+	brush_t *b;
+	int i, size;
+
+	if ( !undo ) {
+		return;
+	}
+
+	size = undo->journal.size;
+	for ( i = 0; i < g_undoNumPending; i++ )
+	{
+		rec = (undoBrush_t*)( g_undoScratch.data + g_undoPending[i].offset );
+		b = g_undoPending[i].brush;
+		// the brush has to be what Undo_Undo will move to the redo
+		if ( b && b->undoId == undo->id && b->numberId == rec->numberId && Undo_CanDelta( rec, b ) ) {
+			Undo_WriteBrushDelta( &undo->journal, rec, b );
+		}
+		else{
+			Undo_JournalWrite( &undo->journal, rec, rec->size );
+		}
+		undo->numRecords++;
+	}
+	if ( undo->journal.size && undo->journal.size < undo->journal.max ) {
+		undo->journal.data = (byte*)realloc( undo->journal.data, undo->journal.size );
+		undo->journal.max = undo->journal.size;
+	}
+	g_undoMemorySize += undo->journal.size - size;
+
+	g_undoScratch.size = 0;
+	g_undoNumPending = 0;
+	g_hash_table_remove_all( g_undoPendingTable );
+	g_undoPendingUndo = NULL;
+}
+
+static void Undo_DiscardPending( void ){
+	Undo_JournalFree( &g_undoScratch );
+	free( g_undoPending );
+	g_undoPending = NULL;
+	g_undoNumPending = g_undoMaxPending = 0;
+	if ( g_undoPendingTable ) {
+		g_hash_table_remove_all( g_undoPendingTable );
+	}
+	g_undoPendingUndo = NULL;
+}
+
+/*
+   =============
+   Undo_RecordBrush
+   =============
+ */
+static void Undo_RecordBrush( brush_t *pBrush ){
+	int size;
+
+	if ( g_lastundo->done ) {
+		// too late for a delta, the record goes straight into the journal
+		size = g_lastundo->journal.size;
+		Undo_WriteBrush( &g_lastundo->journal, pBrush );
+		g_lastundo->numRecords++;
+		g_undoMemorySize += g_lastundo->journal.size - size;
+		return;
+	}
+
+	if ( g_undoPendingUndo != g_lastundo ) {
+		Undo_FlushPending();
+		g_undoPendingUndo = g_lastundo;
+	}
+	if ( !g_undoPendingTable ) {
+		g_undoPendingTable = g_hash_table_new( g_direct_hash, g_direct_equal );
+	}
+	if ( g_undoNumPending == g_undoMaxPending ) {
+		g_undoMaxPending = g_undoMaxPending ? g_undoMaxPending * 2 : 256;
+		g_undoPending = (undoPending_t*)realloc( g_undoPending, g_undoMaxPending * sizeof( undoPending_t ) );
+	}
+	g_undoPending[g_undoNumPending].brush = pBrush;
+	g_undoPending[g_undoNumPending].offset = Undo_WriteBrush( &g_undoScratch, pBrush );
+	g_undoNumPending++;
+	g_hash_table_insert( g_undoPendingTable, pBrush, GINT_TO_POINTER( g_undoNumPending ) );
+}
+
+/*
+   =============
+   Undo_ForgetBrush
+
+   called when a brush is freed, its record can not become a delta anymore
+   =============
+ */
+void Undo_ForgetBrush( brush_t *pBrush ){
+	gpointer index;
+
+	if ( !g_undoNumPending ) {
+		return;
+	}
+	index = g_hash_table_lookup( g_undoPendingTable, pBrush );
+	if ( index ) {
+		g_undoPending[GPOINTER_TO_INT( index ) - 1].brush = NULL;
+		g_hash_table_remove( g_undoPendingTable, pBrush );
+	}
+}
+
+/*
+   =============
+   Undo_CloneBrush
+
+   copies what a record applies to, keeping the face order
+   =============
+ */
+static brush_t *Undo_CloneBrush( brush_t *b ){
+	brush_t *n;
+	face_t *f, *nf, **tail;
+	epair_t *ep, **eptail;
+
+	if ( b->patchBrush ) {
+		patchMesh_t *p = Patch_Duplicate( b->pPatch );
+		n = p->pSymbiot;
+		Brush_RemoveFromList( n );
+		Entity_UnlinkBrush( n );
+	}
+	else
+	{
+		n = Brush_Alloc();
+		tail = &n->brush_faces;
+		for ( f = b->brush_faces; f; f = f->next )
+		{
+			nf = Face_Clone( f );
+			*tail = nf;
+			tail = &nf->next;
+		}
+	}
+
+	eptail = &n->epairs;
+	for ( ep = b->epairs; ep; ep = ep->next )
+	{
+		*eptail = Entity_AllocateEpair( ep->key, ep->value );
+		eptail = &( *eptail )->next;
+	}
+	return n;
+}
+
+/*
+   =============
+   Undo_RestoreBrush
+
+   rebuilds the brush a record was taken from, the result is not linked to anything
+   and still has to be built once it has an owner
+   =============
+ */
+static brush_t *Undo_RestoreBrush( const undoBrush_t *rec, GHashTable *bases ){
+	patchMesh_t *pm = NULL;
+	brush_t *b = NULL, *base;
+	undoFaceData_t fd;
+	face_t *f, **tail;
+	const byte *p;
+	int i, fi;
+
+	p = (const byte*)rec;
+	Undo_JournalRead( &p, sizeof( undoBrush_t ) );
+
+	if ( rec->kind == UNDO_BRUSH_DELTA ) {
+		base = (brush_t*)g_hash_table_lookup( bases, GINT_TO_POINTER( rec->numberId ) );
+		if ( !base ) {
+			Sys_FPrintf( SYS_WRN, "WARNING: undo lost track of brush %i\n", rec->numberId );
+			return NULL;
+		}
+		if ( !Undo_CanDelta( rec, base ) ) {
+			Sys_FPrintf( SYS_WRN, "WARNING: brush %i changed shape outside of undo\n", rec->numberId );
+			return NULL;
+		}
+		b = Undo_CloneBrush( base );
+		pm = b->pPatch;
+	}
+	else if ( rec->flags & UB_PATCH ) {
+		pm = MakeNewPatch();
+		pm->width = rec->patchWidth;
+		pm->height = rec->patchHeight;
+	}
+	else
+	{
+		b = Brush_Alloc();
+		tail = &b->brush_faces;
+		for ( i = 0; i < rec->numFaces; i++ )
+		{
+			*tail = Face_Alloc();
+			tail = &( *tail )->next;
+		}
+	}
+
+	// face records come in face order
+	for ( i = 0, fi = 0, f = b ? b->brush_faces : NULL; i < rec->numFaceRecords; i++ )
+	{
+		Undo_ReadFace( &p, &fd );
+		for ( ; f && fi < fd.face->face; fi++ )
+			f = f->next;
+		if ( !f ) {
+			break;
+		}
+		if ( fd.face->fields & UF_PLANE ) {
+			memcpy( f->planepts, fd.planepts, sizeof( f->planepts ) );
+		}
+		if ( fd.face->fields & UF_TEXDEF ) {
+			f->texdef.SetName( fd.name );
+			f->texdef.shift[0] = fd.texdef->shift[0];
+			f->texdef.shift[1] = fd.texdef->shift[1];
+			f->texdef.rotate = fd.texdef->rotate;
+			f->texdef.scale[0] = fd.texdef->scale[0];
+			f->texdef.scale[1] = fd.texdef->scale[1];
+			f->texdef.contents = fd.texdef->contents;
+			f->texdef.flags = fd.texdef->flags;
+			f->texdef.value = fd.texdef->value;
+		}
+		if ( fd.face->fields & UF_BPRIMIT ) {
+			f->brushprimit_texdef = *fd.bprimit;
+		}
+	}
+
+	if ( rec->flags & UB_PATCHHEAD ) {
+		const undoPatchHead_t *head = (const undoPatchHead_t*)Undo_JournalRead( &p, sizeof( undoPatchHead_t ) );
+
+		pm->contents = head->contents;
+		pm->flags = head->flags;
+		pm->value = head->value;
+		pm->type = head->type;
+		// Patch_Duplicate shares the shader without a reference, so the old one is not released
+		pm->pShader = QERApp_Shader_ForName( Undo_JournalReadString( &p ) );
+		pm->pShader->IncRef();
+		pm->d_texture = pm->pShader->getTexture();
+	}
+	for ( i = 0; i < rec->numRanges; i++ )
+	{
+		const undoRange_t *range = (const undoRange_t*)Undo_JournalRead( &p, sizeof( undoRange_t ) );
+		const drawVert_t *verts = (const drawVert_t*)Undo_JournalRead( &p, range->count * sizeof( drawVert_t ) );
+		int k;
+
+		for ( k = 0; k < range->count; k++ )
+			pm->ctrl[( range->first + k ) / pm->height][( range->first + k ) % pm->height] = verts[k];
+	}
+	if ( !b ) {
+		b = AddBrushForPatch( pm, false );
+	}
+
+	if ( rec->flags & UB_EPAIRS ) {
+		epair_t *ep, *next, **eptail;
+		const char *key;
+		int count;
+
+		for ( ep = b->epairs; ep; ep = next )
+		{
+			next = ep->next;
+			free( ep->key );
+			free( ep->value );
+			free( ep );
+		}
+		b->epairs = NULL;
+		eptail = &b->epairs;
+		count = *(const int*)Undo_JournalRead( &p, sizeof( int ) );
+		for ( i = 0; i < count; i++ )
+		{
+			key = Undo_JournalReadString( &p );
+			*eptail = Entity_AllocateEpair( key, Undo_JournalReadString( &p ) );
+			eptail = &( *eptail )->next;
+		}
+	}
+
+	b->numberId = rec->numberId;
+	b->ownerId = rec->ownerId;
+	b->undoId = rec->undoId;
+	b->hiddenBrush = ( rec->flags & UB_HIDDEN ) != 0;
+	b->bBrushDef = ( rec->flags & UB_BRUSHDEF ) != 0;
+	return b;
+}
+
+/*
+   =============
+   Undo_SpillJournal
+
+   moves the oldest journal still in memory to the spill file
+   =============
+ */
+static bool Undo_SpillJournal( void ){
+	undo_t *undo;
+
+	for ( undo = g_undolist; undo && undo != g_lastundo; undo = undo->next )
+	{
+		if ( undo->spilled || !undo->journal.size ) {
+			continue;
+		}
+		if ( g_undoSpillSize + undo->journal.size > (long)g_undoMaxMemorySize * UNDO_SPILL_FACTOR ) {
+			return false;
+		}
+		if ( !g_undoSpillFile ) {
+			g_undoSpillFile = tmpfile();
+			if ( !g_undoSpillFile ) {
+				Sys_FPrintf( SYS_WRN, "WARNING: could not open a temp file for undo, not spilling\n" );
+				g_undoSpill = false;
+				return false;
+			}
+		}
+		fseek( g_undoSpillFile, 0, SEEK_END );
+		undo->spillOffset = ftell( g_undoSpillFile );
+		if ( fwrite( undo->journal.data, 1, undo->journal.size, g_undoSpillFile ) != (size_t)undo->journal.size ) {
+			Sys_FPrintf( SYS_WRN, "WARNING: could not write the undo temp file, not spilling\n" );
+			g_undoSpill = false;
+			return false;
+		}
+		undo->spillSize = undo->journal.size;
+		undo->spilled = true;
+		g_undoSpillSize += undo->spillSize;
+		g_undoMemorySize -= undo->spillSize;
+		Undo_JournalFree( &undo->journal );
+		return true;
+	}
+	return false;
+}
+
+static bool Undo_LoadJournal( undo_t *undo ){
+	undo->journal.data = (byte*)malloc( undo->spillSize );
+	undo->journal.size = undo->journal.max = undo->spillSize;
+	if ( fseek( g_undoSpillFile, undo->spillOffset, SEEK_SET )
+		 || fread( undo->journal.data, 1, undo->spillSize, g_undoSpillFile ) != (size_t)undo->spillSize ) {
+		Sys_FPrintf( SYS_ERR, "ERROR: could not read back \"%s\" from the undo temp file\n", undo->operation );
+		Undo_JournalFree( &undo->journal );
+		return false;
+	}
+	return true;
+}
+
+static void Undo_FreeJournal( undo_t *undo ){
+	if ( !undo->spilled ) {
+		g_undoMemorySize -= undo->journal.size;
+	}
+	Undo_JournalFree( &undo->journal );
+	undo->numRecords = 0;
+}
+
+/*
+   =============
+   Undo_RestoreJournal
+
+   rebuilds the brushes of the journal into restored, must run while the brushes
+   the deltas apply to are still linked
+   =============
+ */
+static void Undo_RestoreJournal( undo_t *undo, brush_t *restored ){
+	GHashTable *bases;
+	brush_t *b;
+	const byte *p;
+	int i;
+
+	if ( !undo->numRecords ) {
+		return;
+	}
+	if ( undo->spilled && !Undo_LoadJournal( undo ) ) {
+		return;
+	}
+
+	bases = g_hash_table_new( g_direct_hash, g_direct_equal );
+	for ( b = active_brushes.next; b != NULL && b != &active_brushes; b = b->next )
+	{
+		if ( b->undoId == undo->id ) {
+			g_hash_table_insert( bases, GINT_TO_POINTER( b->numberId ), b );
+		}
+	}
+
+	p = undo->journal.data;
+	for ( i = 0; i < undo->numRecords; i++ )
+	{
+		const undoBrush_t *rec = (const undoBrush_t*)p;
+
+		b = Undo_RestoreBrush( rec, bases );
+		if ( b ) {
+			Brush_AddToList( b, restored );
+		}
+		p += rec->size;
+	}
+
+	g_hash_table_destroy( bases );
+	Undo_FreeJournal( undo );
+}
+
+// entityId -> entity, the first one wins like the list walks it replaces
+static GHashTable *Undo_OwnerTable( void ){
+	GHashTable *owners = g_hash_table_new( g_direct_hash, g_direct_equal );
+	entity_t *pEntity;
+
+	for ( pEntity = entities.next; pEntity != NULL && pEntity != &entities; pEntity = pEntity->next )
+	{
+		if ( !g_hash_table_lookup( owners, GINT_TO_POINTER( pEntity->entityId ) ) ) {
+			g_hash_table_insert( owners, GINT_TO_POINTER( pEntity->entityId ), pEntity );
+		}
+	}
+	return owners;
+}
+
+static void Undo_LinkOwner( brush_t *pBrush, GHashTable *owners ){
+	entity_t *pEntity = (entity_t*)g_hash_table_lookup( owners, GINT_TO_POINTER( pBrush->ownerId ) );
+
+	//if the brush is not linked then it should be linked into the world entity
+	//++timo FIXME: maybe not, maybe we've lost this entity's owner!
+	Entity_LinkBrush( pEntity ? pEntity : world_entity, pBrush );
+}
+
+/*
+   =============
+   Undo_SetSpillToDisk
+   =============
+ */
+void Undo_SetSpillToDisk( bool bSpill ){
+	g_undoSpill = bSpill;
+}
+
 /*
    =============
    Undo_MemorySize
@@ -113,9 +974,11 @@ void Undo_Clear( void ){
 	entity_t *pEntity, *pNextEntity;
 
 	Undo_ClearRedo();
+	Undo_DiscardPending();
 	for ( undo = g_undolist; undo; undo = nextundo )
 	{
 		nextundo = undo->next;
+		Undo_FreeJournal( undo );
 		for ( pBrush = undo->brushlist.next ; pBrush != NULL && pBrush != &undo->brushlist ; pBrush = pNextBrush )
 		{
 			pNextBrush = pBrush->next;
@@ -136,6 +999,11 @@ void Undo_Clear( void ){
 	g_undoSize = 0;
 	g_undoMemorySize = 0;
 	g_undoId = 1;
+	if ( g_undoSpillFile ) {
+		fclose( g_undoSpillFile );
+		g_undoSpillFile = NULL;
+	}
+	g_undoSpillSize = 0;
 }
 
 /*
@@ -197,6 +1065,7 @@ void Undo_FreeFirstUndo( void ){
 	g_undolist = g_undolist->next;
 	g_undolist->prev = NULL;
 	//
+	Undo_FreeJournal( undo );
 	for ( pBrush = undo->brushlist.next ; pBrush != NULL && pBrush != &undo->brushlist ; pBrush = pNextBrush )
 	{
 		pNextBrush = pBrush->next;
@@ -230,6 +1099,7 @@ void Undo_GeneralStart( const char *operation ){
 			Sys_FPrintf( SYS_WRN, "WARNING last undo not finished.\n" );
 		}
 	}
+	Undo_FlushPending();
 
 	undo = (undo_t *) malloc( sizeof( undo_t ) );
 	if ( !undo ) {
@@ -295,16 +1165,11 @@ void Undo_GeneralStart( const char *operation ){
    =============
  */
 int Undo_BrushInUndo( undo_t *undo, brush_t *brush ){
-/*	brush_t *b;
-
-    for (b = undo->brushlist.next; b != &undo->brushlist; b = b->next)
-    {
-    // Arnout: NOTE - can't do a pointer compare as the brushes get cloned into the undo brushlist, and not just referenced from it
-    // For entities we have a unique ID, for brushes we have numberID - but brush full clone increases that anyway so it's useless right now.
-        if (b == brush) return true;
-    }*/
-	// Arnout: function is pointless right now, see above explanation
-	return false;
+	// the brushes the open undo has recorded are still pending, and Brush_Free takes them out
+	if ( undo != g_undoPendingUndo || !g_undoNumPending ) {
+		return false;
+	}
+	return g_hash_table_lookup( g_undoPendingTable, brush ) != NULL;
 }
 
 /*
@@ -369,15 +1234,8 @@ void Undo_AddBrush( brush_t *pBrush ){
 	if ( Undo_BrushInUndo( g_lastundo, pBrush ) ) {
 		return;
 	}
-	//clone the brush
-	brush_t* pClone = Brush_FullClone( pBrush );
-	//save the ID of the owner entity
-	pClone->ownerId = pBrush->owner->entityId;
-	//save the old undo ID for previous undos
-	pClone->undoId = pBrush->undoId;
-	Brush_AddToList( pClone, &g_lastundo->brushlist );
-	//
-	g_undoMemorySize += Brush_MemorySize( pClone );
+	//record the brush, the owner entity ID and the old undo ID for previous undos go with it
+	Undo_RecordBrush( pBrush );
 }
 
 /*
@@ -423,15 +1281,8 @@ void Undo_AddBrushList( brush_t *brushlist ){
 		if ( pBrush->owner->eclass->fixedsize == 1 ) {
 			Undo_AddEntity( pBrush->owner );
 		}
-		// clone the brush
-		brush_t* pClone = Brush_FullClone( pBrush );
-		// save the ID of the owner entity
-		pClone->ownerId = pBrush->owner->entityId;
-		// save the old undo ID from previous undos
-		pClone->undoId = pBrush->undoId;
-		Brush_AddToList( pClone, &g_lastundo->brushlist );
-		// track memory size used by undo
-		g_undoMemorySize += Brush_MemorySize( pClone );
+		// record the brush, Undo_End turns it into a delta
+		Undo_RecordBrush( pBrush );
 	}
 }
 
@@ -590,6 +1441,7 @@ void Undo_End( void ){
 		//Sys_Printf("Undo_End: last undo already finished.\n");
 		return;
 	}
+	Undo_FlushPending();
 	g_lastundo->done = true;
 
 	//undo memory size is bound to a max
@@ -599,6 +1451,10 @@ void Undo_End( void ){
 		if ( g_undolist == g_lastundo ) {
 			break;
 		}
+		//older journals can go to disk before whole undos are dropped
+		if ( g_undoSpill && Undo_SpillJournal() ) {
+			continue;
+		}
 		Undo_FreeFirstUndo();
 	}
 	//
@@ -618,8 +1474,9 @@ void Undo_Undo( qboolean bSilent ){
 	}
 
 	undo_t *undo, *redo;
-	brush_t *pBrush, *pNextBrush;
+	brush_t *pBrush, *pNextBrush, restored;
 	entity_t *pEntity, *pNextEntity, *pUndoEntity;
+	GHashTable *owners;
 
 	if ( !g_lastundo ) {
 		Sys_Printf( "Nothing left to undo.\n" );
@@ -628,6 +1485,7 @@ void Undo_Undo( qboolean bSilent ){
 	if ( !g_lastundo->done ) {
 		Sys_FPrintf( SYS_WRN, "WARNING: last undo not yet finished!\n" );
 	}
+	Undo_FlushPending();
 	// get the last undo
 	undo = g_lastundo;
 	if ( g_lastundo->prev ) {
@@ -681,6 +1539,9 @@ void Undo_Undo( qboolean bSilent ){
 
 	// deselect current sutff
 	Select_Deselect();
+	// rebuild the recorded brushes while the brushes the deltas apply to are still around
+	restored.next = restored.prev = &restored;
+	Undo_RestoreJournal( undo, &restored );
 	// move "created" brushes to the redo
 	for ( pBrush = active_brushes.next; pBrush != NULL && pBrush != &active_brushes; pBrush = pNextBrush )
 	{
@@ -738,30 +1599,35 @@ void Undo_Undo( qboolean bSilent ){
 		}
 	}
 	// add the undo brushes back into the selected brushes
+	owners = Undo_OwnerTable(); // fixes broken undo on entities
 	for ( pBrush = undo->brushlist.next; pBrush != NULL && pBrush != &undo->brushlist; pBrush = undo->brushlist.next )
 	{
 		//Sys_Printf("Owner ID: %i\n",pBrush->ownerId);
 		g_undoMemorySize -= Brush_MemorySize( pBrush );
 		Brush_RemoveFromList( pBrush );
 		Brush_AddToList( pBrush, &active_brushes );
-		for ( pEntity = entities.next; pEntity != NULL && pEntity != &entities; pEntity = pEntity->next ) // fixes broken undo on entities
-		{
-			//Sys_Printf("Entity ID: %i\n",pEntity->entityId);
-			if ( pEntity->entityId == pBrush->ownerId ) {
-				Entity_LinkBrush( pEntity, pBrush );
-				break;
-			}
-		}
-		//if the brush is not linked then it should be linked into the world entity
-		//++timo FIXME: maybe not, maybe we've lost this entity's owner!
-		if ( pEntity == NULL || pEntity == &entities ) {
-			Entity_LinkBrush( world_entity, pBrush );
-		}
+		Undo_LinkOwner( pBrush, owners );
 		//build the brush
 		//Brush_Build(pBrush);
 		Select_Brush( pBrush );
 		pBrush->redoId = redo->id;
 	}
+	// the rebuilt brushes need their owner before they can be built
+	for ( pBrush = restored.next; pBrush != &restored; pBrush = restored.next )
+	{
+		Brush_RemoveFromList( pBrush );
+		Brush_AddToList( pBrush, &active_brushes );
+		Undo_LinkOwner( pBrush, owners );
+		if ( pBrush->patchBrush ) {
+			Patch_Rebuild( pBrush->pPatch );
+		}
+		else{
+			Brush_Build( pBrush, false );
+		}
+		Select_Brush( pBrush );
+		pBrush->redoId = redo->id;
+	}
+	g_hash_table_destroy( owners );
 	if ( !bSilent ) {
 		Sys_Printf( "%s undone.\n", undo->operation );
 	}
@@ -794,6 +1660,7 @@ void Undo_Redo( void ){
 	undo_t *redo;
 	brush_t *pBrush, *pNextBrush;
 	entity_t *pEntity, *pNextEntity, *pRedoEntity;
+	GHashTable *owners;
 
 	if ( !g_lastredo ) {
 		Sys_Printf( "Nothing left to redo.\n" );
@@ -869,25 +1736,17 @@ void Undo_Redo( void ){
 		}
 	}
 	// add the redo brushes back into the selected brushes
+	owners = Undo_OwnerTable(); // fixes broken undo on entities
 	for ( pBrush = redo->brushlist.next; pBrush != NULL && pBrush != &redo->brushlist; pBrush = redo->brushlist.next )
 	{
 		Brush_RemoveFromList( pBrush );
 		Brush_AddToList( pBrush, &active_brushes );
-		for ( pEntity = entities.next; pEntity != NULL && pEntity != &entities; pEntity = pEntity->next ) // fixes broken undo on entities
-		{
-			if ( pEntity->entityId == pBrush->ownerId ) {
-				Entity_LinkBrush( pEntity, pBrush );
-				break;
-			}
-		}
-		//if the brush is not linked then it should be linked into the world entity
-		if ( pEntity == NULL || pEntity == &entities ) {
-			Entity_LinkBrush( world_entity, pBrush );
-		}
+		Undo_LinkOwner( pBrush, owners );
 		//build the brush
 		//Brush_Build(pBrush);
 		Select_Brush( pBrush );
 	}
+	g_hash_table_destroy( owners );
 	//
 	Undo_End();
 	//
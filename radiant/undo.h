@@ -63,3 +63,7 @@ void Undo_SetMaxMemorySize( int size );
 int  Undo_GetMaxMemorySize( void );
 //returns the amount of memory used by undo
 int  Undo_MemorySize( void );
+//spill old undo journals to a temp file instead of dropping them
+void Undo_SetSpillToDisk( bool bSpill );
+//called when a brush is freed
+void Undo_ForgetBrush( brush_t *pBrush );
@@ -2915,6 +2915,9 @@ void XYWnd::XY_Draw(){
 		start2 = Sys_DoubleTime();
 	}
 
+	// world brush outlines are collected and drawn from the render cache after the loop
+	RenderCache_Begin();
+
 	for ( brush = active_brushes.next ; brush != &active_brushes ; brush = brush->next )
 	{
 		if ( brush->bFiltered ) {
@@ -2931,6 +2934,11 @@ void XYWnd::XY_Draw(){
 
 		drawn++;
 
+		if ( brush->owner == e && RenderCache_CanQueue( brush ) ) {
+			RenderCache_QueueBrushXY( brush, m_nViewType );
+			continue;
+		}
+
 		if ( brush->owner != e && brush->owner ) {
 			qglColor3fv( brush->owner->eclass->color );
 		}
@@ -2953,6 +2961,8 @@ void XYWnd::XY_Draw(){
 		Brush_DrawXY( brush, m_nViewType );
 	}
 
+	RenderCache_DrawXY();
+
 	if ( m_bTiming ) {
 		end2 = Sys_DoubleTime();
 	}
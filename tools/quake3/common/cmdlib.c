@@ -47,6 +47,9 @@
 
 #if defined( __linux__ ) || defined( __BSD__ ) || defined( __APPLE__ )
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#define HAVE_MMAP
 #endif
 
 #ifdef NeXT
@@ -295,6 +298,31 @@ double I_FloatTime( void ){
 #endif
 }
 
+/*
+   ================
+   I_PreciseTime
+
+   monotonic seconds with sub-millisecond resolution, for timing stages
+   ================
+ */
+double I_PreciseTime( void ){
+#ifdef _WIN32
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER count;
+
+	if ( frequency.QuadPart == 0 ) {
+		QueryPerformanceFrequency( &frequency );
+	}
+	QueryPerformanceCounter( &count );
+	return (double) count.QuadPart / (double) frequency.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+#endif
+}
+
 void Q_getwd( char *out ){
 	int i = 0;
 
@@ -616,6 +644,88 @@ int    LoadFile( const char *filename, void **bufferptr ){
 }
 
 
+/*
+   ==============
+   MapFile
+
+   maps a file copy-on-write, so pages are only read when touched and
+   writes to the buffer never reach the file. release with UnmapFile
+   ==============
+ */
+int    MapFile( const char *filename, void **bufferptr ){
+	int length;
+	void    *buffer;
+#if defined( HAVE_MMAP )
+	int fd;
+	struct stat st;
+
+	fd = open( filename, O_RDONLY );
+	if ( fd < 0 || fstat( fd, &st ) < 0 ) {
+		Error( "Error opening %s: %s", filename, strerror( errno ) );
+	}
+	length = st.st_size;
+	if ( length == 0 ) {
+		buffer = safe_malloc( 1 );
+	}
+	else
+	{
+		buffer = mmap( NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+		if ( buffer == MAP_FAILED ) {
+			Error( "Error mapping %s: %s", filename, strerror( errno ) );
+		}
+	}
+	close( fd );
+#elif defined( _WIN32 )
+	HANDLE file, mapping;
+
+	file = CreateFileA( filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( file == INVALID_HANDLE_VALUE ) {
+		Error( "Error opening %s", filename );
+	}
+	length = GetFileSize( file, NULL );
+	if ( length == 0 ) {
+		buffer = safe_malloc( 1 );
+	}
+	else
+	{
+		mapping = CreateFileMappingA( file, NULL, PAGE_WRITECOPY, 0, 0, NULL );
+		buffer = mapping != NULL ? MapViewOfFile( mapping, FILE_MAP_COPY, 0, 0, 0 ) : NULL;
+		if ( buffer == NULL ) {
+			Error( "Error mapping %s", filename );
+		}
+		CloseHandle( mapping );
+	}
+	CloseHandle( file );
+#else
+	length = LoadFile( filename, &buffer );
+#endif
+
+	*bufferptr = buffer;
+	return length;
+}
+
+
+/*
+   ==============
+   UnmapFile
+   ==============
+ */
+void    UnmapFile( void *buffer, int length ){
+#if defined( HAVE_MMAP )
+	if ( length > 0 ) {
+		munmap( buffer, length );
+		return;
+	}
+#elif defined( _WIN32 )
+	if ( length > 0 ) {
+		UnmapViewOfFile( buffer );
+		return;
+	}
+#endif
+	free( buffer );
+}
+
+
 /*
    ==============
    LoadFileBlock
@@ -89,6 +89,7 @@ void ExpandWildcards( int *argc, char ***argv );
 
 
 double I_FloatTime( void );
+double I_PreciseTime( void );
 
 void    Error( const char *error, ... );
 int     CheckParm( const char *check );
@@ -101,6 +102,8 @@ void    SafeWrite( FILE *f, const void *buffer, int count );
 int     LoadFile( const char *filename, void **bufferptr );
 int   LoadFileBlock( const char *filename, void **bufferptr );
 int     TryLoadFile( const char *filename, void **bufferptr );
+int     MapFile( const char *filename, void **bufferptr );
+void    UnmapFile( void *buffer, int length );
 void    SaveFile( const char *filename, const void *buffer, int count );
 qboolean    FileExists( const char *filename );
 
@@ -28,14 +28,14 @@
 #include "qfiles.h"
 
 
-extern int numthreads;
+#include "qthreads.h"
 
-// counters are only bumped when running single threaded,
-// because they are an awefull coherence problem
-int c_active_windings;
-int c_peak_windings;
-int c_winding_allocs;
-int c_winding_points;
+
+#ifdef _MSC_VER
+	#define WINDING_THREAD_LOCAL    __declspec( thread )
+#else
+	#define WINDING_THREAD_LOCAL    __thread
+#endif
 
 #define BOGUS_RANGE WORLD_SIZE
 
@@ -46,6 +46,196 @@ void pw( winding_t *w ){
 }
 
 
+/*
+   windings are carved from slabs in power of two size classes and recycled through
+   per thread free lists, so allocating one takes no lock. a thread that frees more
+   than it allocates hands batches of blocks to a shared list the others refill from
+ */
+
+#define WINDING_CLASSES         6
+#define WINDING_CLASS_BYTES     64                  /* class c blocks are 64 << c bytes, the largest fits MAX_POINTS_ON_WINDING accu points */
+#define WINDING_SLAB_BYTES      ( 256 * 1024 )
+#define WINDING_BATCH_BYTES     ( 16 * 1024 )       /* blocks moved to or from the shared list at a time */
+
+typedef union windingBlock_u
+{
+	union windingBlock_u    *next;                  /* while free */
+	int sizeClass;                                  /* while in use */
+	double align[ 2 ];                              /* keeps the winding after it aligned */
+}
+windingBlock_t;
+
+typedef struct windingPool_s
+{
+	struct windingPool_s    *next;                  /* every thread's pool, for the statistics */
+	windingBlock_t          *free[ WINDING_CLASSES ];
+	int numFree[ WINDING_CLASSES ];
+	byte                    *slab;
+	int slabBytes;
+	windingStats_t stats;
+}
+windingPool_t;
+
+static WINDING_THREAD_LOCAL windingPool_t *windingPool;
+static windingPool_t        *windingPools;
+static windingBlock_t       *sharedWindingBlocks[ WINDING_CLASSES ];   /* under ThreadLock */
+static volatile int numSharedWindingBlocks[ WINDING_CLASSES ];
+
+static windingPool_t *GetWindingPool( void ){
+	if ( windingPool == NULL ) {
+		windingPool = safe_malloc( sizeof( *windingPool ) );
+		memset( windingPool, 0, sizeof( *windingPool ) );
+		ThreadLock();
+		windingPool->next = windingPools;
+		windingPools = windingPool;
+		ThreadUnlock();
+	}
+	return windingPool;
+}
+
+static int WindingBatch( int sizeClass ){
+	return WINDING_BATCH_BYTES / ( WINDING_CLASS_BYTES << sizeClass );
+}
+
+/*
+   =============
+   AllocWindingBlock
+   =============
+ */
+static void *AllocWindingBlock( int size, int points ){
+	windingPool_t   *pool;
+	windingBlock_t  *block;
+	int c, i, bytes;
+
+	pool = GetWindingPool();
+	bytes = size + sizeof( *block );
+	for ( c = 0; ( WINDING_CLASS_BYTES << c ) < bytes; c++ ) ;
+	if ( c >= WINDING_CLASSES ) {
+		Error( "AllocWindingBlock: %d bytes is too large", size );
+	}
+
+	/* refill from the blocks other threads handed back */
+	if ( pool->free[ c ] == NULL && numSharedWindingBlocks[ c ] > 0 ) {
+		ThreadLock();
+		for ( i = 0; i < WindingBatch( c ) && sharedWindingBlocks[ c ] != NULL; i++ )
+		{
+			block = sharedWindingBlocks[ c ];
+			sharedWindingBlocks[ c ] = block->next;
+			block->next = pool->free[ c ];
+			pool->free[ c ] = block;
+		}
+		numSharedWindingBlocks[ c ] -= i;
+		pool->numFree[ c ] += i;
+		ThreadUnlock();
+	}
+
+	/* reuse a free block or carve a new one */
+	block = pool->free[ c ];
+	if ( block != NULL ) {
+		pool->free[ c ] = block->next;
+		pool->numFree[ c ]--;
+	}
+	else
+	{
+		if ( pool->slabBytes < ( WINDING_CLASS_BYTES << c ) ) {
+			pool->slab = safe_malloc( WINDING_SLAB_BYTES );
+			pool->slabBytes = WINDING_SLAB_BYTES;
+		}
+		block = (windingBlock_t*) pool->slab;
+		pool->slab += WINDING_CLASS_BYTES << c;
+		pool->slabBytes -= WINDING_CLASS_BYTES << c;
+	}
+	block->sizeClass = c;
+
+	pool->stats.allocs++;
+	pool->stats.points += points;
+	pool->stats.active++;
+	if ( pool->stats.active > pool->stats.peak ) {
+		pool->stats.peak = pool->stats.active;
+	}
+
+	memset( block + 1, 0, size );
+	return block + 1;
+}
+
+/*
+   =============
+   FreeWindingBlock
+   =============
+ */
+static void FreeWindingBlock( void *w ){
+	windingPool_t   *pool;
+	windingBlock_t  *block, *last;
+	int c, i;
+
+	pool = GetWindingPool();
+	block = (windingBlock_t*) w - 1;
+	c = block->sizeClass;
+	block->next = pool->free[ c ];
+	pool->free[ c ] = block;
+	pool->numFree[ c ]++;
+	pool->stats.active--;
+
+	/* hand a batch to the other threads if this one keeps too many */
+	if ( pool->numFree[ c ] > 2 * WindingBatch( c ) ) {
+		last = pool->free[ c ];
+		for ( i = 1; i < WindingBatch( c ); i++ )
+			last = last->next;
+		ThreadLock();
+		block = pool->free[ c ];
+		pool->free[ c ] = last->next;
+		last->next = sharedWindingBlocks[ c ];
+		sharedWindingBlocks[ c ] = block;
+		numSharedWindingBlocks[ c ] += i;
+		ThreadUnlock();
+		pool->numFree[ c ] -= i;
+	}
+}
+
+/*
+   =============
+   WindingCapacity
+   number of points a winding can hold without being reallocated
+   =============
+ */
+int WindingCapacity( winding_t *w ){
+	windingBlock_t  *block;
+
+	block = (windingBlock_t*) w - 1;
+	return ( ( WINDING_CLASS_BYTES << block->sizeClass ) - sizeof( *block ) - offsetof( winding_t, p ) ) / sizeof( *w->p );
+}
+
+static int WindingAccuCapacity( winding_accu_t *w ){
+	windingBlock_t  *block;
+
+	block = (windingBlock_t*) w - 1;
+	return ( ( WINDING_CLASS_BYTES << block->sizeClass ) - sizeof( *block ) - offsetof( winding_accu_t, p ) ) / sizeof( *w->p );
+}
+
+/*
+   =============
+   GetWindingStats
+   adds up the statistics of every thread, the peak is the sum of the
+   per thread peaks so it is an upper bound
+   =============
+ */
+void GetWindingStats( windingStats_t *stats ){
+	windingPool_t   *pool;
+
+	memset( stats, 0, sizeof( *stats ) );
+	ThreadLock();
+	for ( pool = windingPools; pool != NULL; pool = pool->next )
+	{
+		stats->allocs += pool->stats.allocs;
+		stats->points += pool->stats.points;
+		stats->active += pool->stats.active;
+		stats->peak += pool->stats.peak;
+		stats->removed += pool->stats.removed;
+	}
+	ThreadUnlock();
+}
+
+
 /*
    =============
    AllocWinding
@@ -53,24 +243,12 @@ void pw( winding_t *w ){
  */
 winding_t   *AllocWinding( int points ){
 	winding_t   *w;
-	int s;
 
 	if ( points >= MAX_POINTS_ON_WINDING ) {
 		Error( "AllocWinding failed: MAX_POINTS_ON_WINDING exceeded" );
 	}
 
-	if ( numthreads == 1 ) {
-		c_winding_allocs++;
-		c_winding_points += points;
-		c_active_windings++;
-		if ( c_active_windings > c_peak_windings ) {
-			c_peak_windings = c_active_windings;
-		}
-	}
-	s = sizeof( *w ) + points * sizeof( *w->p );
-	w = safe_malloc( s );
-	memset( w, 0, s );
-	return w;
+	return AllocWindingBlock( sizeof( *w ) + points * sizeof( *w->p ), points );
 }
 
 /*
@@ -80,25 +258,12 @@ winding_t   *AllocWinding( int points ){
  */
 winding_accu_t *AllocWindingAccu( int points ){
 	winding_accu_t  *w;
-	int s;
 
 	if ( points >= MAX_POINTS_ON_WINDING ) {
 		Error( "AllocWindingAccu failed: MAX_POINTS_ON_WINDING exceeded" );
 	}
 
-	if ( numthreads == 1 ) {
-		// At the time of this writing, these statistics were not used in any way.
-		c_winding_allocs++;
-		c_winding_points += points;
-		c_active_windings++;
-		if ( c_active_windings > c_peak_windings ) {
-			c_peak_windings = c_active_windings;
-		}
-	}
-	s = sizeof( *w ) + points * sizeof( *w->p );
-	w = safe_malloc( s );
-	memset( w, 0, s );
-	return w;
+	return AllocWindingBlock( sizeof( *w ) + points * sizeof( *w->p ), points );
 }
 
 /*
@@ -116,10 +281,7 @@ void FreeWinding( winding_t *w ){
 	}
 	*(unsigned *)w = 0xdeaddead;
 
-	if ( numthreads == 1 ) {
-		c_active_windings--;
-	}
-	free( w );
+	FreeWindingBlock( w );
 }
 
 /*
@@ -137,10 +299,7 @@ void FreeWindingAccu( winding_accu_t *w ){
 	}
 	*( (unsigned *) w ) = 0xdeaddead;
 
-	if ( numthreads == 1 ) {
-		c_active_windings--;
-	}
-	free( w );
+	FreeWindingBlock( w );
 }
 
 /*
@@ -148,8 +307,6 @@ void FreeWindingAccu( winding_accu_t *w ){
    RemoveColinearPoints
    ============
  */
-int c_removed;
-
 void    RemoveColinearPoints( winding_t *w ){
 	int i, j, k;
 	vec3_t v1, v2;
@@ -175,9 +332,7 @@ void    RemoveColinearPoints( winding_t *w ){
 		return;
 	}
 
-	if ( numthreads == 1 ) {
-		c_removed += w->numpoints - nump;
-	}
+	GetWindingPool()->stats.removed += w->numpoints - nump;
 	w->numpoints = nump;
 	memcpy( w->p, p, nump * sizeof( p[0] ) );
 }
@@ -547,7 +702,7 @@ void    ClipWindingEpsilon( winding_t *in, vec3_t normal, vec_t dist,
 	vec_t dists[MAX_POINTS_ON_WINDING + 4];
 	int sides[MAX_POINTS_ON_WINDING + 4];
 	int counts[3];
-	static vec_t dot;           // VC 4.2 optimizer bug if not static
+	vec_t dot;
 	int i, j;
 	vec_t   *p1, *p2;
 	vec3_t mid;
@@ -664,8 +819,8 @@ void ChopWindingInPlaceAccu( winding_accu_t **inout, vec3_t normal, vec_t dist,
 	int i, j;
 	vec_accu_t dists[MAX_POINTS_ON_WINDING + 1];
 	int sides[MAX_POINTS_ON_WINDING + 1];
-	int maxpts;
-	winding_accu_t  *f;
+	int numPoints;
+	vec3_accu_t points[MAX_POINTS_ON_WINDING];
 	vec_accu_t  *p1, *p2;
 	vec_accu_t w;
 	vec3_accu_t mid, normalAccu;
@@ -742,24 +897,19 @@ void ChopWindingInPlaceAccu( winding_accu_t **inout, vec3_t normal, vec_t dist,
 	// NOTE: The least number of points that a winding can have at this point is 2.
 	// In that case, one point is SIDE_FRONT and the other is SIDE_BACK.
 
-	maxpts = counts[SIDE_FRONT] + 2; // We dynamically expand if this is too small.
-	f = AllocWindingAccu( maxpts );
+	// The chopped points are gathered on the stack so the input can be reused for them.
+	numPoints = 0;
 
 	for ( i = 0; i < in->numpoints; i++ )
 	{
 		p1 = in->p[i];
 
 		if ( sides[i] == SIDE_ON || sides[i] == SIDE_FRONT ) {
-			if ( f->numpoints >= MAX_POINTS_ON_WINDING ) {
+			if ( numPoints >= MAX_POINTS_ON_WINDING ) {
 				Error( "ChopWindingInPlaceAccu: MAX_POINTS_ON_WINDING" );
 			}
-			if ( f->numpoints >= maxpts ) { // This will probably never happen.
-				Sys_FPrintf( SYS_VRB, "WARNING: estimate on chopped winding size incorrect (no problem)\n" );
-				f = CopyWindingAccuIncreaseSizeAndFreeOld( f );
-				maxpts++;
-			}
-			VectorCopyAccu( p1, f->p[f->numpoints] );
-			f->numpoints++;
+			VectorCopyAccu( p1, points[numPoints] );
+			numPoints++;
 			if ( sides[i] == SIDE_ON ) {
 				continue;
 			}
@@ -786,20 +936,21 @@ void ChopWindingInPlaceAccu( winding_accu_t **inout, vec3_t normal, vec_t dist,
 			}
 			else{mid[j] = p1[j] + ( w * ( p2[j] - p1[j] ) ); }
 		}
-		if ( f->numpoints >= MAX_POINTS_ON_WINDING ) {
+		if ( numPoints >= MAX_POINTS_ON_WINDING ) {
 			Error( "ChopWindingInPlaceAccu: MAX_POINTS_ON_WINDING" );
 		}
-		if ( f->numpoints >= maxpts ) { // This will probably never happen.
-			Sys_FPrintf( SYS_VRB, "WARNING: estimate on chopped winding size incorrect (no problem)\n" );
-			f = CopyWindingAccuIncreaseSizeAndFreeOld( f );
-			maxpts++;
-		}
-		VectorCopyAccu( mid, f->p[f->numpoints] );
-		f->numpoints++;
+		VectorCopyAccu( mid, points[numPoints] );
+		numPoints++;
 	}
 
-	FreeWindingAccu( in );
-	*inout = f;
+	// Only reallocate when the input block is too small for the chopped winding.
+	if ( numPoints > WindingAccuCapacity( in ) ) {
+		FreeWindingAccu( in );
+		in = AllocWindingAccu( numPoints );
+		*inout = in;
+	}
+	in->numpoints = numPoints;
+	memcpy( in->p, points, numPoints * sizeof( *points ) );
 }
 
 /*
@@ -812,12 +963,12 @@ void ChopWindingInPlace( winding_t **inout, vec3_t normal, vec_t dist, vec_t eps
 	vec_t dists[MAX_POINTS_ON_WINDING + 4];
 	int sides[MAX_POINTS_ON_WINDING + 4];
 	int counts[3];
-	static vec_t dot;           // VC 4.2 optimizer bug if not static
+	vec_t dot;
 	int i, j;
 	vec_t   *p1, *p2;
 	vec3_t mid;
-	winding_t   *f;
-	int maxpts;
+	vec3_t points[MAX_POINTS_ON_WINDING + 4];
+	int numPoints, maxpts;
 
 	in = *inout;
 	counts[0] = counts[1] = counts[2] = 0;
@@ -855,21 +1006,22 @@ void ChopWindingInPlace( winding_t **inout, vec3_t normal, vec_t dist, vec_t eps
 	maxpts = in->numpoints + 4;   // cant use counts[0]+2 because
 	                              // of fp grouping errors
 
-	f = AllocWinding( maxpts );
+	// clip into scratch space so the input can be reused for the result
+	numPoints = 0;
 
 	for ( i = 0 ; i < in->numpoints ; i++ )
 	{
 		p1 = in->p[i];
 
 		if ( sides[i] == SIDE_ON ) {
-			VectorCopy( p1, f->p[f->numpoints] );
-			f->numpoints++;
+			VectorCopy( p1, points[numPoints] );
+			numPoints++;
 			continue;
 		}
 
 		if ( sides[i] == SIDE_FRONT ) {
-			VectorCopy( p1, f->p[f->numpoints] );
-			f->numpoints++;
+			VectorCopy( p1, points[numPoints] );
+			numPoints++;
 		}
 
 		if ( sides[i + 1] == SIDE_ON || sides[i + 1] == sides[i] ) {
@@ -893,19 +1045,25 @@ void ChopWindingInPlace( winding_t **inout, vec3_t normal, vec_t dist, vec_t eps
 			}
 		}
 
-		VectorCopy( mid, f->p[f->numpoints] );
-		f->numpoints++;
+		VectorCopy( mid, points[numPoints] );
+		numPoints++;
 	}
 
-	if ( f->numpoints > maxpts ) {
+	if ( numPoints > maxpts ) {
 		Error( "ClipWinding: points exceeded estimate" );
 	}
-	if ( f->numpoints > MAX_POINTS_ON_WINDING ) {
+	if ( numPoints > MAX_POINTS_ON_WINDING ) {
 		Error( "ClipWinding: MAX_POINTS_ON_WINDING" );
 	}
 
-	FreeWinding( in );
-	*inout = f;
+	// only reallocate when the input block is too small
+	if ( numPoints > WindingCapacity( in ) ) {
+		FreeWinding( in );
+		in = AllocWinding( numPoints );
+		*inout = in;
+	}
+	in->numpoints = numPoints;
+	memcpy( in->p, points, numPoints * sizeof( *points ) );
 }
 
 
@@ -918,14 +1076,8 @@ void ChopWindingInPlace( winding_t **inout, vec3_t normal, vec_t dist, vec_t eps
    =================
  */
 winding_t   *ChopWinding( winding_t *in, vec3_t normal, vec_t dist ){
-	winding_t   *f, *b;
-
-	ClipWindingEpsilon( in, normal, dist, ON_EPSILON, &f, &b );
-	FreeWinding( in );
-	if ( b ) {
-		FreeWinding( b );
-	}
-	return f;
+	ChopWindingInPlace( &in, normal, dist, ON_EPSILON );
+	return in;
 }
 
 
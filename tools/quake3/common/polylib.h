@@ -52,7 +52,21 @@ void    WindingBounds( winding_t *w, vec3_t mins, vec3_t maxs );
 void    AddWindingToConvexHull( winding_t *w, winding_t **hull, vec3_t normal );
 
 void    ChopWindingInPlace( winding_t **w, vec3_t normal, vec_t dist, vec_t epsilon );
-// frees the original if clipped
+// reuses the original for the result when it fits, frees it otherwise
+
+int     WindingCapacity( winding_t *w );
+
+// winding allocator statistics, kept per thread and summed by GetWindingStats
+typedef struct windingStats_s
+{
+	int allocs;
+	int points;
+	int active;
+	int peak;
+	int removed;
+} windingStats_t;
+
+void    GetWindingStats( windingStats_t *stats );
 
 void pw( winding_t *w );
 
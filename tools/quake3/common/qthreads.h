@@ -26,5 +26,9 @@ void ThreadSetDefault( void );
 int GetThreadWork( void );
 void RunThreadsOnIndividual( int workcnt, qboolean showpacifier, void ( *func )( int ) );
 void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) );
+// ThreadLock is recursive on every platform: the thread holding it may take it
+// again, and each ThreadLock needs its own ThreadUnlock
 void ThreadLock( void );
 void ThreadUnlock( void );
+double ThreadBusyTime( int threadnum );
+double ThreadJobTime( void );
@@ -33,7 +33,12 @@
 #include "inout.h"
 #include "qthreads.h"
 
-#define MAX_THREADS 64
+#define MAX_THREADS 256
+
+/* linux and bsd use a persistent work-stealing pool, see the pthreads section below */
+#if defined( __linux__ ) || defined( __BSD__ )
+	#define THREAD_POOL
+#endif
 
 int dispatch;
 int workcount;
@@ -42,6 +47,20 @@ qboolean pacifier;
 
 qboolean threaded;
 
+/* seconds each thread spent running work, and the wall time of all the jobs */
+static double threadBusyTime[ MAX_THREADS ];
+static double threadJobTime;
+
+double ThreadBusyTime( int threadnum ){
+	return threadnum >= 0 && threadnum < MAX_THREADS ? threadBusyTime[ threadnum ] : 0.0;
+}
+
+double ThreadJobTime( void ){
+	return threadJobTime;
+}
+
+#ifndef THREAD_POOL
+
 /*
    =============
    GetThreadWork
@@ -100,6 +119,8 @@ void RunThreadsOnIndividual( int workcnt, qboolean showpacifier, void ( *func )(
 	RunThreadsOn( workcnt, showpacifier, ThreadWorkerFunction );
 }
 
+#endif
+
 
 /*
    ===================================================================
@@ -116,7 +137,16 @@ void RunThreadsOnIndividual( int workcnt, qboolean showpacifier, void ( *func )(
 
 int numthreads = -1;
 CRITICAL_SECTION crit;
-static int enter;
+static int enter;               // lock depth, ThreadLock nests
+static void ( *threadfunction )( int );
+
+static DWORD WINAPI ThreadTimedFunction( LPVOID param ){
+	double start = I_PreciseTime();
+
+	threadfunction( (int) (size_t) param );
+	threadBusyTime[ (int) (size_t) param ] += I_PreciseTime() - start;
+	return 0;
+}
 
 void ThreadSetDefault( void ){
 	SYSTEM_INFO info;
@@ -138,20 +168,17 @@ void ThreadLock( void ){
 		return;
 	}
 	EnterCriticalSection( &crit );
-	if ( enter ) {
-		Error( "Recursive ThreadLock\n" );
-	}
-	enter = 1;
+	enter++;
 }
 
 void ThreadUnlock( void ){
 	if ( !threaded ) {
 		return;
 	}
-	if ( !enter ) {
+	if ( enter <= 0 ) {
 		Error( "ThreadUnlock without lock\n" );
 	}
-	enter = 0;
+	enter--;
 	LeaveCriticalSection( &crit );
 }
 
@@ -165,13 +192,16 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 	HANDLE threadhandle[MAX_THREADS];
 	int i;
 	int start, end;
+	double jobStart;
 
 	start = I_FloatTime();
+	jobStart = I_PreciseTime();
 	dispatch = 0;
 	workcount = workcnt;
 	oldf = -1;
 	pacifier = showpacifier;
 	threaded = qtrue;
+	threadfunction = func;
 
 	//
 	// run threads in parallel
@@ -179,7 +209,7 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 	InitializeCriticalSection( &crit );
 
 	if ( numthreads == 1 ) { // use same thread
-		func( 0 );
+		ThreadTimedFunction( 0 );
 	}
 	else
 	{
@@ -192,7 +222,7 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 			    /* ydnar: cranking stack size to eliminate radiosity crash with 1MB stack on win32 */
 				( 4096 * 1024 ),
 
-				(LPTHREAD_START_ROUTINE)func,   // LPTHREAD_START_ROUTINE lpStartAddr,
+				ThreadTimedFunction,    // LPTHREAD_START_ROUTINE lpStartAddr,
 				(LPVOID)i,  // LPVOID lpvThreadParm,
 				0,          //   DWORD fdwCreate,
 				&threadid[i] );
@@ -204,6 +234,7 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 	DeleteCriticalSection( &crit );
 
 	threaded = qfalse;
+	threadJobTime += I_PreciseTime() - jobStart;
 	end = I_FloatTime();
 	if ( pacifier ) {
 		Sys_Printf( " (%i)\n", end - start );
@@ -279,7 +310,7 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 		if ( pthread_mutexattr_create( &mattrib ) == -1 ) {
 			Error( "pthread_mutex_attr_create failed" );
 		}
-		if ( pthread_mutexattr_setkind_np( &mattrib, MUTEX_FAST_NP ) == -1 ) {
+		if ( pthread_mutexattr_setkind_np( &mattrib, MUTEX_RECURSIVE_NP ) == -1 ) {
 			Error( "pthread_mutexattr_setkind_np failed" );
 		}
 		if ( pthread_mutex_init( my_mutex, mattrib ) == -1 ) {
@@ -413,165 +444,405 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 
    Linux pthreads
 
+   a persistent pool of worker threads is created on first use and parked
+   on a condition variable between jobs. work items are handed out from
+   per-thread ranges that are claimed and stolen with atomic compare-and-swap,
+   so dispatch never takes a lock. the calling thread only waits for the
+   workers and prints the pacifier.
+
    =======================================================================
  */
 
 #if defined( __linux__ ) || defined( __BSD__ )
 #define USED
 
-int numthreads = 4;
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+int numthreads = -1;
 
 void ThreadSetDefault( void ){
 	if ( numthreads == -1 ) { // not set manually
-		/* default to one thread, only multi-thread when specifically told to */
+		/* default to one thread per online core */
+		numthreads = sysconf( _SC_NPROCESSORS_ONLN );
+	}
+
+	if ( numthreads < 1 ) {
 		numthreads = 1;
 	}
+	if ( numthreads > MAX_THREADS ) {
+		numthreads = MAX_THREADS;
+	}
 
 	if ( numthreads > 1 ) {
 		Sys_Printf( "threads: %d\n", numthreads );
 	}
 }
 
-#include <pthread.h>
+static pthread_mutex_t global_lock;
+static pthread_once_t global_lock_once = PTHREAD_ONCE_INIT;
 
-typedef struct pt_mutex_s
-{
-	pthread_t       *owner;
-	pthread_mutex_t a_mutex;
-	pthread_cond_t cond;
-	unsigned int lock;
-} pt_mutex_t;
+static void ThreadLockInit( void ){
+	pthread_mutexattr_t mattrib;
 
-pt_mutex_t global_lock;
+	if ( pthread_mutexattr_init( &mattrib ) != 0 ) {
+		Error( "pthread_mutexattr_init failed" );
+	}
+	if ( pthread_mutexattr_settype( &mattrib, PTHREAD_MUTEX_RECURSIVE ) != 0 ) {
+		Error( "pthread_mutexattr_settype failed" );
+	}
+	if ( pthread_mutex_init( &global_lock, &mattrib ) != 0 ) {
+		Error( "pthread_mutex_init failed" );
+	}
+	pthread_mutexattr_destroy( &mattrib );
+}
 
 void ThreadLock( void ){
-	pt_mutex_t *pt_mutex = &global_lock;
-
 	if ( !threaded ) {
 		return;
 	}
+	pthread_once( &global_lock_once, ThreadLockInit );
+	pthread_mutex_lock( &global_lock );
+}
 
-	pthread_mutex_lock( &pt_mutex->a_mutex );
-	if ( pthread_equal( pthread_self(), (pthread_t)&pt_mutex->owner ) ) {
-		pt_mutex->lock++;
+void ThreadUnlock( void ){
+	if ( !threaded ) {
+		return;
 	}
-	else
+	pthread_mutex_unlock( &global_lock );
+}
+
+
+
+/*
+   work ranges
+
+   each thread owns a [begin, end) range of work items packed into one 64-bit word.
+   ranges stride by the job's thread count, so thread n starts out with items
+   n, n + numthreads, n + 2 * numthreads... and the pool as a whole still walks
+   the work in roughly ascending order (vis relies on that to finish small portals first).
+   the owner claims adaptive chunks off the front, idle threads steal the back half.
+ */
+
+#define THREAD_CHUNK_MAX        64
+
+#define RANGE_PACK( b, e )      ( ( (uint64_t) ( e ) << 32 ) | (uint32_t) ( b ) )
+#define RANGE_BEGIN( r )        ( (uint32_t) ( r ) )
+#define RANGE_END( r )          ( (uint32_t) ( ( r ) >> 32 ) )
+
+typedef struct threadQueue_s
+{
+	uint64_t range;
+	char pad[ 64 - sizeof( uint64_t ) ];    /* keep each range on its own cache line */
+}
+threadQueue_t;
+
+static threadQueue_t threadQueues[ MAX_THREADS ];
+static uint32_t threadStride;
+static int threadDispatched;
+
+static __thread int threadNum;
+static __thread uint32_t threadChunkNext, threadChunkLeft;
+
+static void SetupThreadWork( int workcnt, int threads ){
+	int i;
+
+	threadStride = threads;
+	threadDispatched = 0;
+	for ( i = 0; i < threads; i++ )
+		threadQueues[ i ].range = RANGE_PACK( i, i < workcnt ? workcnt : i );
+}
+
+static uint32_t RangeCount( uint32_t b, uint32_t e ){
+	return b < e ? ( e - b + threadStride - 1 ) / threadStride : 0;
+}
+
+/*
+   ClaimThreadWork()
+   takes a chunk of work items off this thread's range, stealing from other threads
+   once it runs dry. returns qfalse when there is no work left anywhere
+ */
+
+static qboolean ClaimThreadWork( int num, uint32_t *first, uint32_t *count ){
+	threadQueue_t   *q = &threadQueues[ num ], *vq;
+	uint64_t r;
+	uint32_t b, e, n, chunk, split;
+	int i;
+
+
+	for ( ;; )
 	{
-		if ( ( !pt_mutex->owner ) && ( pt_mutex->lock == 0 ) ) {
-			pt_mutex->owner = (pthread_t *)pthread_self();
-			pt_mutex->lock  = 1;
+		/* claim from the front of our own range, smaller chunks as it drains */
+		r = __atomic_load_n( &q->range, __ATOMIC_ACQUIRE );
+		while ( ( n = RangeCount( RANGE_BEGIN( r ), RANGE_END( r ) ) ) > 0 )
+		{
+			b = RANGE_BEGIN( r );
+			e = RANGE_END( r );
+			chunk = 1 + n / 16;
+			if ( chunk > THREAD_CHUNK_MAX ) {
+				chunk = THREAD_CHUNK_MAX;
+			}
+			split = chunk < n ? b + chunk * threadStride : e;
+			if ( __atomic_compare_exchange_n( &q->range, &r, RANGE_PACK( split, e ), qfalse, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) ) {
+				*first = b;
+				*count = chunk;
+				__atomic_fetch_add( &threadDispatched, (int) chunk, __ATOMIC_RELAXED );
+				return qtrue;
+			}
 		}
-		else
+
+		/* steal the back half of the first non-empty range we find */
+		for ( i = 1; i < (int) threadStride; i++ )
 		{
-			while ( 1 )
+			vq = &threadQueues[ ( num + i ) % threadStride ];
+			r = __atomic_load_n( &vq->range, __ATOMIC_ACQUIRE );
+			while ( ( n = RangeCount( RANGE_BEGIN( r ), RANGE_END( r ) ) ) > 0 )
 			{
-				pthread_cond_wait( &pt_mutex->cond, &pt_mutex->a_mutex );
-				if ( ( !pt_mutex->owner ) && ( pt_mutex->lock == 0 ) ) {
-					pt_mutex->owner = (pthread_t *)pthread_self();
-					pt_mutex->lock  = 1;
+				b = RANGE_BEGIN( r );
+				e = RANGE_END( r );
+				split = b + ( n / 2 ) * threadStride;
+				if ( __atomic_compare_exchange_n( &vq->range, &r, RANGE_PACK( b, split ), qfalse, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) ) {
+					/* our range is empty, so no other thread will touch it until this store */
+					__atomic_store_n( &q->range, RANGE_PACK( split, e ), __ATOMIC_RELEASE );
 					break;
 				}
 			}
+			if ( n > 0 ) {
+				break;
+			}
+		}
+
+		/* nothing left to steal */
+		if ( i >= (int) threadStride ) {
+			return qfalse;
 		}
 	}
-	pthread_mutex_unlock( &pt_mutex->a_mutex );
 }
 
-void ThreadUnlock( void ){
-	pt_mutex_t *pt_mutex = &global_lock;
+/*
+   GetThreadWork()
+   hands out single work items to RunThreadsOn() callbacks
+ */
 
-	if ( !threaded ) {
+int GetThreadWork( void ){
+	int r;
+
+	if ( threadChunkLeft == 0 && !ClaimThreadWork( threadNum, &threadChunkNext, &threadChunkLeft ) ) {
+		return -1;
+	}
+	r = threadChunkNext;
+	threadChunkNext += threadStride;
+	threadChunkLeft--;
+	return r;
+}
+
+
+
+/*
+   thread pool
+ */
+
+static pthread_mutex_t poolMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolWake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t poolDone = PTHREAD_COND_INITIALIZER;
+static pthread_t poolThreads[ MAX_THREADS ];
+static int poolSize;
+static int poolJob;
+static int poolBusy;
+static int poolThreadCount;
+static qboolean poolIndividual;
+static void ( *poolFunc )( int );
+
+static void RunPoolJob( int num ){
+	uint32_t first, count;
+
+	threadChunkLeft = 0;
+	if ( num >= poolThreadCount ) {
 		return;
 	}
 
-	pthread_mutex_lock( &pt_mutex->a_mutex );
-	pt_mutex->lock--;
+	/* RunThreadsOn() callbacks pull their own work through GetThreadWork() */
+	if ( !poolIndividual ) {
+		poolFunc( num );
+		return;
+	}
 
-	if ( pt_mutex->lock == 0 ) {
-		pt_mutex->owner = NULL;
-		pthread_cond_signal( &pt_mutex->cond );
+	while ( ClaimThreadWork( num, &first, &count ) )
+	{
+		for ( ; count > 0; count--, first += threadStride )
+			poolFunc( first );
 	}
+}
+
+static void *ThreadPoolWorker( void *arg ){
+	int job = 0;
+	double start;
+
+	threadNum = (int) (size_t) arg;
+
+	for ( ;; )
+	{
+		pthread_mutex_lock( &poolMutex );
+		while ( poolJob == job )
+			pthread_cond_wait( &poolWake, &poolMutex );
+		job = poolJob;
+		pthread_mutex_unlock( &poolMutex );
+
+		start = I_PreciseTime();
+		RunPoolJob( threadNum );
+		threadBusyTime[ threadNum ] += I_PreciseTime() - start;
+
+		pthread_mutex_lock( &poolMutex );
+		if ( --poolBusy == 0 ) {
+			pthread_cond_signal( &poolDone );
+		}
+		pthread_mutex_unlock( &poolMutex );
+	}
+
+	return NULL;
+}
+
+static void ThreadPacifier( int workcnt ){
+	int f;
 
-	pthread_mutex_unlock( &pt_mutex->a_mutex );
+	if ( !pacifier || workcnt <= 0 ) {
+		return;
+	}
+	f = 10 * __atomic_load_n( &threadDispatched, __ATOMIC_RELAXED ) / workcnt;
+	if ( f > 9 ) {
+		f = 9;
+	}
+	while ( oldf < f )
+	{
+		oldf++;
+		Sys_Printf( "%i...", oldf );
+	}
 }
 
-void recursive_mutex_init( pthread_mutexattr_t attribs ){
-	pt_mutex_t *pt_mutex = &global_lock;
+static void RunThreadPool( int workcnt, qboolean individual, void ( *func )( int ) ){
+	struct timespec ts;
 
-	pt_mutex->owner = NULL;
-	if ( pthread_mutex_init( &pt_mutex->a_mutex, &attribs ) != 0 ) {
-		Error( "pthread_mutex_init failed\n" );
+	/* grow the pool on first use (or if the thread count was raised) */
+	while ( poolSize < numthreads )
+	{
+		if ( pthread_create( &poolThreads[ poolSize ], NULL, ThreadPoolWorker, (void*) (size_t) poolSize ) != 0 ) {
+			Error( "pthread_create failed" );
+		}
+		poolSize++;
 	}
-	if ( pthread_cond_init( &pt_mutex->cond, NULL ) != 0 ) {
-		Error( "pthread_cond_init failed\n" );
+
+	SetupThreadWork( workcnt, numthreads );
+	threaded = qtrue;
+
+	/* wake the workers */
+	pthread_mutex_lock( &poolMutex );
+	poolFunc = func;
+	poolIndividual = individual;
+	poolThreadCount = numthreads;
+	poolBusy = poolSize;
+	poolJob++;
+	pthread_cond_broadcast( &poolWake );
+
+	/* wait for them, printing progress along the way */
+	while ( poolBusy > 0 )
+	{
+		if ( pacifier ) {
+			clock_gettime( CLOCK_REALTIME, &ts );
+			ts.tv_nsec += 100 * 1000 * 1000;
+			if ( ts.tv_nsec >= 1000 * 1000 * 1000 ) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000 * 1000 * 1000;
+			}
+			pthread_cond_timedwait( &poolDone, &poolMutex, &ts );
+			ThreadPacifier( workcnt );
+		}
+		else{
+			pthread_cond_wait( &poolDone, &poolMutex );
+		}
 	}
+	pthread_mutex_unlock( &poolMutex );
 
-	pt_mutex->lock = 0;
+	threaded = qfalse;
 }
 
 /*
    =============
-   RunThreadsOn
+   RunThreadsOnIndividual
    =============
  */
-void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
-	pthread_mutexattr_t mattrib;
-	pthread_t work_threads[MAX_THREADS];
+void RunThreadsOnIndividual( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
+	int i, start, end;
+	double jobStart;
 
-	int start, end;
-	int i = 0;
-	void *exit_value;
+	if ( numthreads == -1 ) {
+		ThreadSetDefault();
+	}
 
 	start     = I_FloatTime();
+	jobStart  = I_PreciseTime();
 	pacifier  = showpacifier;
-
-	dispatch  = 0;
 	oldf      = -1;
 	workcount = workcnt;
 
-	if ( numthreads == 1 ) {
-		func( 0 );
+	if ( pacifier ) {
+		setbuf( stdout, NULL );
 	}
-	else
-	{
-		threaded  = qtrue;
 
-		if ( pacifier ) {
-			setbuf( stdout, NULL );
+	if ( numthreads == 1 || workcnt <= 1 ) {
+		threadStride = 1;
+		for ( i = 0; i < workcnt; i++ )
+		{
+			threadDispatched = i;
+			ThreadPacifier( workcnt );
+			func( i );
 		}
+		threadBusyTime[ 0 ] += I_PreciseTime() - jobStart;
+	}
+	else{
+		RunThreadPool( workcnt, qtrue, func );
+	}
 
-		if ( pthread_mutexattr_init( &mattrib ) != 0 ) {
-			Error( "pthread_mutexattr_init failed" );
-		}
-#if __GLIBC_MINOR__ == 1
-		if ( pthread_mutexattr_settype( &mattrib, PTHREAD_MUTEX_FAST_NP ) != 0 )
-#else
-#if defined(__OpenBSD__)
-    if ( pthread_mutexattr_settype( &mattrib, PTHREAD_MUTEX_STRICT_NP) != 0 )
-#else
-    if ( pthread_mutexattr_settype( &mattrib, PTHREAD_MUTEX_ADAPTIVE_NP ) != 0 )
-#endif
-#endif
-		{ Error( "pthread_mutexattr_settype failed" ); }
-		recursive_mutex_init( mattrib );
+	threadJobTime += I_PreciseTime() - jobStart;
+	ThreadPacifier( workcnt );
+	end = I_FloatTime();
+	if ( pacifier ) {
+		Sys_Printf( " (%i)\n", end - start );
+	}
+}
 
-		for ( i = 0 ; i < numthreads ; i++ )
-		{
-			/* Default pthread attributes: joinable & non-realtime scheduling */
-			if ( pthread_create( &work_threads[i], NULL, (void*)func, (void*)(size_t)i ) != 0 ) {
-				Error( "pthread_create failed" );
-			}
-		}
-		for ( i = 0 ; i < numthreads ; i++ )
-		{
-			if ( pthread_join( work_threads[i], &exit_value ) != 0 ) {
-				Error( "pthread_join failed" );
-			}
-		}
-		pthread_mutexattr_destroy( &mattrib );
-		threaded = qfalse;
+/*
+   =============
+   RunThreadsOn
+   =============
+ */
+void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
+	int start, end;
+	double jobStart;
+
+	start     = I_FloatTime();
+	jobStart  = I_PreciseTime();
+	pacifier  = showpacifier;
+	oldf      = -1;
+	workcount = workcnt;
+
+	if ( pacifier ) {
+		setbuf( stdout, NULL );
+	}
+
+	if ( numthreads == 1 ) {
+		SetupThreadWork( workcnt, 1 );
+		threadNum = 0;
+		threadChunkLeft = 0;
+		func( 0 );
+		threadBusyTime[ 0 ] += I_PreciseTime() - jobStart;
+	}
+	else{
+		RunThreadPool( workcnt, qfalse, func );
 	}
 
+	threadJobTime += I_PreciseTime() - jobStart;
+	ThreadPacifier( workcnt );
 	end = I_FloatTime();
 	if ( pacifier ) {
 		Sys_Printf( " (%i)\n", end - start );
@@ -609,13 +880,17 @@ void ThreadUnlock( void ){
  */
 void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 	int start, end;
+	double jobStart;
 
 	dispatch = 0;
 	workcount = workcnt;
 	oldf = -1;
 	pacifier = showpacifier;
 	start = I_FloatTime();
+	jobStart = I_PreciseTime();
 	func( 0 );
+	threadBusyTime[ 0 ] += I_PreciseTime() - jobStart;
+	threadJobTime += I_PreciseTime() - jobStart;
 
 	end = I_FloatTime();
 	if ( pacifier ) {
@@ -76,13 +76,22 @@ typedef struct
 	unz_s zipinfo;
 	unzFile zipfile;
 	guint32 size;
+	guint32 hash;
+	int next;                   // next file in the same hash bucket, in load order
 } VFS_PAKFILE;
 
 // =============================================================================
 // Global variables
 
 static GSList*  g_unzFiles;
-static GSList*  g_pakFiles;
+
+// every file in every pak, in load order, indexed by lowercased name
+static VFS_PAKFILE* g_pakFiles;
+static int g_numPakFiles;
+static int g_maxPakFiles;
+static int* g_pakHashHead;
+static int* g_pakHashTail;
+static int g_pakHashSize;
 static char g_strDirs[VFS_MAXDIRS][PATH_MAX];
 static int g_numDirs;
 static gboolean g_bUsePak = TRUE;
@@ -116,6 +125,89 @@ static void vfsFixDOSName( char *src ){
 //!\todo Define globally or use heap-allocated string.
 #define NAME_MAX 255
 
+#define VFS_MIN_PAK_HASH 4096
+
+static guint32 vfsHashName( const char *name ){
+	guint32 hash = 2166136261u;
+
+	while ( *name )
+	{
+		hash = ( hash ^ (unsigned char) *name++ ) * 16777619u;
+	}
+	return hash;
+}
+
+// links a pak file into the name index, keeping each bucket in load order
+static void vfsHashPakFile( int num ){
+	VFS_PAKFILE* file = &g_pakFiles[num];
+	int bucket = file->hash & ( g_pakHashSize - 1 );
+
+	file->next = -1;
+	if ( g_pakHashTail[bucket] < 0 ) {
+		g_pakHashHead[bucket] = num;
+	}
+	else{
+		g_pakFiles[g_pakHashTail[bucket]].next = num;
+	}
+	g_pakHashTail[bucket] = num;
+}
+
+// keeps the index at most one file per bucket on average
+static void vfsGrowPakHash( int numFiles ){
+	int i, size;
+
+	if ( numFiles <= g_pakHashSize ) {
+		return;
+	}
+
+	size = g_pakHashSize > 0 ? g_pakHashSize : VFS_MIN_PAK_HASH;
+	while ( size < numFiles )
+		size <<= 1;
+
+	free( g_pakHashHead );
+	free( g_pakHashTail );
+	g_pakHashSize = size;
+	g_pakHashHead = (int*)safe_malloc( size * sizeof( int ) );
+	g_pakHashTail = (int*)safe_malloc( size * sizeof( int ) );
+	memset( g_pakHashHead, 0xFF, size * sizeof( int ) );
+	memset( g_pakHashTail, 0xFF, size * sizeof( int ) );
+
+	for ( i = 0; i < g_numPakFiles; i++ )
+		vfsHashPakFile( i );
+}
+
+// returns the first pak file with this lowercased name, or -1
+static int vfsFindPakFile( const char *lower ){
+	int num;
+	guint32 hash;
+
+	if ( g_pakHashSize == 0 ) {
+		return -1;
+	}
+
+	hash = vfsHashName( lower );
+	for ( num = g_pakHashHead[hash & ( g_pakHashSize - 1 )]; num >= 0; num = g_pakFiles[num].next )
+	{
+		if ( g_pakFiles[num].hash == hash && strcmp( g_pakFiles[num].name, lower ) == 0 ) {
+			return num;
+		}
+	}
+	return -1;
+}
+
+// returns the next pak file with the same name as num, or -1
+static int vfsNextPakFile( int num ){
+	int next;
+
+	for ( next = g_pakFiles[num].next; next >= 0; next = g_pakFiles[next].next )
+	{
+		if ( g_pakFiles[next].hash == g_pakFiles[num].hash && strcmp( g_pakFiles[next].name, g_pakFiles[num].name ) == 0 ) {
+			return next;
+		}
+	}
+	return -1;
+}
+
 static void vfsInitPakFile( const char *filename ){
 	unz_global_info gi;
 	unzFile uf;
@@ -135,6 +227,20 @@ static void vfsInitPakFile( const char *filename ){
 	}
 	unzGoToFirstFile( uf );
 
+	// make room for the whole central directory up front
+	if ( g_numPakFiles + (int)gi.number_entry > g_maxPakFiles ) {
+		VFS_PAKFILE* files;
+
+		g_maxPakFiles = ( g_numPakFiles + gi.number_entry ) * 2;
+		files = (VFS_PAKFILE*)safe_malloc( g_maxPakFiles * sizeof( VFS_PAKFILE ) );
+		if ( g_pakFiles != NULL ) {
+			memcpy( files, g_pakFiles, g_numPakFiles * sizeof( VFS_PAKFILE ) );
+			free( g_pakFiles );
+		}
+		g_pakFiles = files;
+	}
+	vfsGrowPakHash( g_numPakFiles + gi.number_entry );
+
 	for ( i = 0; i < gi.number_entry; i++ )
 	{
 		char filename_inzip[NAME_MAX];
@@ -147,8 +253,7 @@ static void vfsInitPakFile( const char *filename ){
 			break;
 		}
 
-		file = (VFS_PAKFILE*)safe_malloc( sizeof( VFS_PAKFILE ) );
-		g_pakFiles = g_slist_append( g_pakFiles, file );
+		file = &g_pakFiles[g_numPakFiles];
 
 		vfsFixDOSName( filename_inzip );
 		//-1 null terminated string
@@ -158,6 +263,9 @@ static void vfsInitPakFile( const char *filename ){
 		file->size = file_info.uncompressed_size;
 		file->zipfile = uf;
 		memcpy( &file->zipinfo, uf, sizeof( unz_s ) );
+		file->hash = vfsHashName( file->name );
+		vfsHashPakFile( g_numPakFiles );
+		g_numPakFiles++;
 
 		if ( ( i + 1 ) < gi.number_entry ) {
 			err = unzGoToNextFile( uf );
@@ -292,13 +400,19 @@ void vfsShutdown(){
 		g_unzFiles = g_slist_remove( g_unzFiles, g_unzFiles->data );
 	}
 
-	while ( g_pakFiles )
+	while ( g_numPakFiles > 0 )
 	{
-		VFS_PAKFILE* file = (VFS_PAKFILE*)g_pakFiles->data;
-		free( file->name );
-		free( file );
-		g_pakFiles = g_slist_remove( g_pakFiles, file );
+		g_numPakFiles--;
+		free( g_pakFiles[g_numPakFiles].name );
 	}
+	free( g_pakFiles );
+	free( g_pakHashHead );
+	free( g_pakHashTail );
+	g_pakFiles = NULL;
+	g_pakHashHead = NULL;
+	g_pakHashTail = NULL;
+	g_maxPakFiles = 0;
+	g_pakHashSize = 0;
 }
 
 // return the number of files that match
@@ -306,20 +420,14 @@ int vfsGetFileCount( const char *filename ){
 	int i, count = 0;
 	char fixed[NAME_MAX], tmp[NAME_MAX];
 	char *lower;
-	GSList *lst;
+	int num;
 
 	strcpy( fixed, filename );
 	vfsFixDOSName( fixed );
 	lower = g_ascii_strdown( fixed, -1 );
 
-	for ( lst = g_pakFiles; lst != NULL; lst = g_slist_next( lst ) )
-	{
-		VFS_PAKFILE* file = (VFS_PAKFILE*)lst->data;
-
-		if ( strcmp( file->name, lower ) == 0 ) {
-			count++;
-		}
-	}
+	for ( num = vfsFindPakFile( lower ); num >= 0; num = vfsNextPakFile( num ) )
+		count++;
 
 	for ( i = 0; i < g_numDirs; i++ )
 	{
@@ -338,7 +446,7 @@ int vfsLoadFile( const char *filename, void **bufferptr, int index ){
 	int i, count = 0;
 	char tmp[NAME_MAX], fixed[NAME_MAX];
 	char *lower;
-	GSList *lst;
+	int num;
 
 	// filename is a full path
 	if ( index == -1 ) {
@@ -417,13 +525,9 @@ int vfsLoadFile( const char *filename, void **bufferptr, int index ){
 		}
 	}
 
-	for ( lst = g_pakFiles; lst != NULL; lst = g_slist_next( lst ) )
+	for ( num = vfsFindPakFile( lower ); num >= 0; num = vfsNextPakFile( num ) )
 	{
-		VFS_PAKFILE* file = (VFS_PAKFILE*)lst->data;
-
-		if ( strcmp( file->name, lower ) != 0 ) {
-			continue;
-		}
+		VFS_PAKFILE* file = &g_pakFiles[num];
 
 		if ( count == index ) {
 			memcpy( file->zipfile, &file->zipinfo, sizeof( unz_s ) );
@@ -679,98 +679,176 @@ void WriteBSPBrushMap( char *name, brush_t *list ){
 
 
 
+/*
+   AddBrushToLeaf()
+   adds a brush fragment to a leaf and classifies the leaf by it
+ */
+
+static void AddBrushToLeaf( brush_t *b, node_t *node ){
+	/* something somewhere is hammering brushlist */
+	b->next = node->brushlist;
+	node->brushlist = b;
+
+	/* classify the leaf by the structural brush */
+	if ( !b->detail ) {
+		if ( b->opaque ) {
+			node->opaque = qtrue;
+			node->areaportal = qfalse;
+		}
+		else if ( b->compileFlags & C_AREAPORTAL ) {
+			if ( !node->opaque ) {
+				node->areaportal = qtrue;
+			}
+		}
+	}
+}
+
+
+
+/* brush fragments and the leafs they ended up in */
+typedef struct brushFragment_s
+{
+	struct brushFragment_s  *next;
+	brush_t                 *brush;
+	node_t                  *leaf;
+}
+brushFragment_t;
+
+static brush_t          **filterBrushes;
+static brushFragment_t  **filterFragments;
+static int numFilterBrushes, allocatedFilterBrushes, allocatedFilterFragments;
+static node_t           *filterHeadNode;
+
+
+
 /*
    FilterBrushIntoTree_r()
-   adds brush reference to any intersecting bsp leafnode
+   splits a brush down to every intersecting bsp leafnode, the fragments are
+   appended to a list with their leafs instead of being added to the leafs
+   so brushes can be filtered in parallel. returns the new list tail
  */
 
-int FilterBrushIntoTree_r( brush_t *b, node_t *node ){
+static brushFragment_t **FilterBrushIntoTree_r( brush_t *b, node_t *node, brushFragment_t **tail ){
 	brush_t     *front, *back;
-	int c;
+	brushFragment_t *fragment;
 
 
 	/* dummy check */
 	if ( b == NULL ) {
-		return 0;
+		return tail;
 	}
 
 	/* add it to the leaf list */
 	if ( node->planenum == PLANENUM_LEAF ) {
-		/* something somewhere is hammering brushlist */
-		b->next = node->brushlist;
-		node->brushlist = b;
-
-		/* classify the leaf by the structural brush */
-		if ( !b->detail ) {
-			if ( b->opaque ) {
-				node->opaque = qtrue;
-				node->areaportal = qfalse;
-			}
-			else if ( b->compileFlags & C_AREAPORTAL ) {
-				if ( !node->opaque ) {
-					node->areaportal = qtrue;
-				}
-			}
-		}
-
-		return 1;
+		fragment = safe_malloc( sizeof( *fragment ) );
+		fragment->next = NULL;
+		fragment->brush = b;
+		fragment->leaf = node;
+		*tail = fragment;
+		return &fragment->next;
 	}
 
 	/* split it by the node plane */
-	c = b->numsides;
 	SplitBrush( b, node->planenum, &front, &back );
 	FreeBrush( b );
 
-	c = 0;
-	c += FilterBrushIntoTree_r( front, node->children[ 0 ] );
-	c += FilterBrushIntoTree_r( back, node->children[ 1 ] );
+	tail = FilterBrushIntoTree_r( front, node->children[ 0 ], tail );
+	return FilterBrushIntoTree_r( back, node->children[ 1 ], tail );
+}
 
-	return c;
+
+
+/*
+   FilterBrushTask()
+   threaded worker, fragments one brush into the tree
+ */
+
+static void FilterBrushTask( int num ){
+	filterFragments[ num ] = NULL;
+	FilterBrushIntoTree_r( CopyBrush( filterBrushes[ num ] ), filterHeadNode, &filterFragments[ num ] );
 }
 
 
 
 /*
-   FilterDetailBrushesIntoTree
-   fragment all the detail brushes into the structural leafs
+   FilterBrushesIntoTree()
+   fragments copies of the detail or structural brushes of an entity into the tree.
+   the brushes are split in parallel and then added to the leafs serially in entity
+   order, so every leaf gets the same brush list as a serial filter would give it
  */
 
-void FilterDetailBrushesIntoTree( entity_t *e, tree_t *tree ){
-	brush_t             *b, *newb;
+static int FilterBrushesIntoTree( entity_t *e, tree_t *tree, qboolean detail ){
+	brush_t             *b;
+	brushFragment_t     *fragment, *next;
 	int r;
-	int c_unique, c_clusters;
-	int i;
-
+	int c_clusters;
+	int i, j;
 
-	/* note it */
-	Sys_FPrintf( SYS_VRB,  "--- FilterDetailBrushesIntoTree ---\n" );
 
-	/* walk the list of brushes */
-	c_unique = 0;
-	c_clusters = 0;
+	/* gather the brushes */
+	numFilterBrushes = 0;
 	for ( b = e->brushes; b; b = b->next )
 	{
-		if ( !b->detail ) {
+		if ( !b->detail != !detail ) {
 			continue;
 		}
-		c_unique++;
-		newb = CopyBrush( b );
-		r = FilterBrushIntoTree_r( newb, tree->headnode );
+		AUTOEXPAND_BY_REALLOC( filterBrushes, numFilterBrushes, allocatedFilterBrushes, 1024 );
+		filterBrushes[ numFilterBrushes++ ] = b;
+	}
+	AUTOEXPAND_BY_REALLOC( filterFragments, numFilterBrushes, allocatedFilterFragments, 1024 );
+
+	/* split them */
+	filterHeadNode = tree->headnode;
+	RunThreadsOnIndividual( numFilterBrushes, qfalse, FilterBrushTask );
+
+	/* add the fragments to the leafs */
+	c_clusters = 0;
+	for ( i = 0; i < numFilterBrushes; i++ )
+	{
+		b = filterBrushes[ i ];
+		r = 0;
+		for ( fragment = filterFragments[ i ]; fragment != NULL; fragment = next )
+		{
+			next = fragment->next;
+			AddBrushToLeaf( fragment->brush, fragment->leaf );
+			free( fragment );
+			r++;
+		}
 		c_clusters += r;
 
 		/* mark all sides as visible so drawsurfs are created */
 		if ( r ) {
-			for ( i = 0; i < b->numsides; i++ )
+			for ( j = 0; j < b->numsides; j++ )
 			{
-				if ( b->sides[ i ].winding ) {
-					b->sides[ i ].visible = qtrue;
+				if ( b->sides[ j ].winding ) {
+					b->sides[ j ].visible = qtrue;
 				}
 			}
 		}
 	}
 
+	return c_clusters;
+}
+
+
+
+/*
+   FilterDetailBrushesIntoTree
+   fragment all the detail brushes into the structural leafs
+ */
+
+void FilterDetailBrushesIntoTree( entity_t *e, tree_t *tree ){
+	int c_clusters;
+
+
+	/* note it */
+	Sys_FPrintf( SYS_VRB,  "--- FilterDetailBrushesIntoTree ---\n" );
+
+	/* filter the detail brushes */
+	c_clusters = FilterBrushesIntoTree( e, tree, qtrue );
+
 	/* emit some statistics */
-	Sys_FPrintf( SYS_VRB, "%9d detail brushes\n", c_unique );
+	Sys_FPrintf( SYS_VRB, "%9d detail brushes\n", numFilterBrushes );
 	Sys_FPrintf( SYS_VRB, "%9d cluster references\n", c_clusters );
 }
 
@@ -782,36 +860,14 @@ void FilterDetailBrushesIntoTree( entity_t *e, tree_t *tree ){
    =====================
  */
 void FilterStructuralBrushesIntoTree( entity_t *e, tree_t *tree ) {
-	brush_t         *b, *newb;
-	int r;
-	int c_unique, c_clusters;
-	int i;
+	int c_clusters;
 
 	Sys_FPrintf( SYS_VRB, "--- FilterStructuralBrushesIntoTree ---\n" );
 
-	c_unique = 0;
-	c_clusters = 0;
-	for ( b = e->brushes ; b ; b = b->next ) {
-		if ( b->detail ) {
-			continue;
-		}
-		c_unique++;
-		newb = CopyBrush( b );
-		r = FilterBrushIntoTree_r( newb, tree->headnode );
-		c_clusters += r;
-
-		// mark all sides as visible so drawsurfs are created
-		if ( r ) {
-			for ( i = 0 ; i < b->numsides ; i++ ) {
-				if ( b->sides[i].winding ) {
-					b->sides[i].visible = qtrue;
-				}
-			}
-		}
-	}
+	c_clusters = FilterBrushesIntoTree( e, tree, qfalse );
 
 	/* emit some statistics */
-	Sys_FPrintf( SYS_VRB, "%9d structural brushes\n", c_unique );
+	Sys_FPrintf( SYS_VRB, "%9d structural brushes\n", numFilterBrushes );
 	Sys_FPrintf( SYS_VRB, "%9d cluster references\n", c_clusters );
 }
 
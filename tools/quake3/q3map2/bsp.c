@@ -313,25 +313,38 @@ void ProcessWorldModel( void ){
 	PatchMapDrawSurfs( e );
 
 	/* build an initial bsp tree using all of the sides of all of the structural brushes */
+	ProfileBegin( "FaceBSP" );
 	faces = MakeStructuralBSPFaceList( entities[ 0 ].brushes );
 	tree = FaceBSP( faces );
+	ProfileEnd();
+	ProfileBegin( "MakeTreePortals" );
 	MakeTreePortals( tree );
 	FilterStructuralBrushesIntoTree( e, tree );
+	ProfileEnd();
 
 	/* see if the bsp is completely enclosed */
-	if ( FloodEntities( tree ) || ignoreLeaks ) {
+	ProfileBegin( "FloodEntities" );
+	leaked = !FloodEntities( tree );
+	ProfileEnd();
+	if ( !leaked || ignoreLeaks ) {
 		/* rebuild a better bsp tree using only the sides that are visible from the inside */
 		FillOutside( tree->headnode );
 
 		/* chop the sides to the convex hull of their visible fragments, giving us the smallest polygons */
+		ProfileBegin( "ClipSidesIntoTree" );
 		ClipSidesIntoTree( e, tree );
+		ProfileEnd();
 
 		/* build a visible face tree */
+		ProfileBegin( "FaceBSP" );
 		faces = MakeVisibleBSPFaceList( entities[ 0 ].brushes );
 		FreeTree( tree );
 		tree = FaceBSP( faces );
+		ProfileEnd();
+		ProfileBegin( "MakeTreePortals" );
 		MakeTreePortals( tree );
 		FilterStructuralBrushesIntoTree( e, tree );
+		ProfileEnd();
 		leaked = qfalse;
 
 		/* ydnar: flood again for skybox */
@@ -390,25 +403,39 @@ void ProcessWorldModel( void ){
 
 	/* subdivide each drawsurf as required by shader tesselation */
 	if ( !nosubdivide ) {
+		ProfileBegin( "SubdivideFaceSurfaces" );
 		SubdivideFaceSurfaces( e, tree );
+		ProfileEnd();
 	}
 
 	/* add in any vertexes required to fix t-junctions */
 	if ( !notjunc ) {
+		ProfileBegin( "FixTJunctions" );
 		FixTJunctions( e );
+		ProfileEnd();
 	}
 
 	/* ydnar: classify the surfaces */
+	ProfileBegin( "ClassifyEntitySurfaces" );
 	ClassifyEntitySurfaces( e );
+	ProfileEnd();
 
 	/* ydnar: project decals */
 	MakeEntityDecals( e );
 
 	/* ydnar: meta surfaces */
+	ProfileBegin( "MakeEntityMetaTriangles" );
 	MakeEntityMetaTriangles( e );
+	ProfileEnd();
+	ProfileBegin( "SmoothMetaTriangles" );
 	SmoothMetaTriangles();
+	ProfileEnd();
+	ProfileBegin( "FixMetaTJunctions" );
 	FixMetaTJunctions();
+	ProfileEnd();
+	ProfileBegin( "MergeMetaTriangles" );
 	MergeMetaTriangles();
+	ProfileEnd();
 
 	/* ydnar: debug portals */
 	if ( debugPortals ) {
@@ -470,7 +497,9 @@ void ProcessWorldModel( void ){
 	}
 
 	/* add references to the final drawsurfs in the apropriate clusters */
+	ProfileBegin( "FilterDrawsurfsIntoTree" );
 	FilterDrawsurfsIntoTree( e, tree );
+	ProfileEnd();
 
 	/* match drawsurfaces back to original brushsides (sof2) */
 	FixBrushSides( e );
@@ -512,7 +541,9 @@ void ProcessSubModel( void ){
 	tree->headnode = node;
 
 	/* add the sides to the tree */
+	ProfileBegin( "ClipSidesIntoTree" );
 	ClipSidesIntoTree( e, tree );
+	ProfileEnd();
 
 	/* ydnar: create drawsurfs for triangle models */
 	AddTriangleModels( e );
@@ -533,28 +564,44 @@ void ProcessSubModel( void ){
 
 	/* subdivide each drawsurf as required by shader tesselation */
 	if ( !nosubdivide ) {
+		ProfileBegin( "SubdivideFaceSurfaces" );
 		SubdivideFaceSurfaces( e, tree );
+		ProfileEnd();
 	}
 
 	/* add in any vertexes required to fix t-junctions */
 	if ( !notjunc ) {
+		ProfileBegin( "FixTJunctions" );
 		FixTJunctions( e );
+		ProfileEnd();
 	}
 
 	/* ydnar: classify the surfaces and project lightmaps */
+	ProfileBegin( "ClassifyEntitySurfaces" );
 	ClassifyEntitySurfaces( e );
+	ProfileEnd();
 
 	/* ydnar: project decals */
 	MakeEntityDecals( e );
 
 	/* ydnar: meta surfaces */
+	ProfileBegin( "MakeEntityMetaTriangles" );
 	MakeEntityMetaTriangles( e );
+	ProfileEnd();
+	ProfileBegin( "SmoothMetaTriangles" );
 	SmoothMetaTriangles();
+	ProfileEnd();
+	ProfileBegin( "FixMetaTJunctions" );
 	FixMetaTJunctions();
+	ProfileEnd();
+	ProfileBegin( "MergeMetaTriangles" );
 	MergeMetaTriangles();
+	ProfileEnd();
 
 	/* add references to the final drawsurfs in the apropriate clusters */
+	ProfileBegin( "FilterDrawsurfsIntoTree" );
 	FilterDrawsurfsIntoTree( e, tree );
+	ProfileEnd();
 
 	/* match drawsurfaces back to original brushsides (sof2) */
 	FixBrushSides( e );
@@ -597,10 +644,14 @@ void ProcessModels( void ){
 		/* process the model */
 		Sys_FPrintf( SYS_VRB, "############### model %i ###############\n", numBSPModels );
 		if ( mapEntityNum == 0 ) {
+			ProfileBegin( "ProcessWorldModel" );
 			ProcessWorldModel();
+			ProfileEnd();
 		}
 		else{
+			ProfileBegin( "ProcessSubModel" );
 			ProcessSubModel();
+			ProfileEnd();
 		}
 
 		/* potentially turn off the deluge of text */
@@ -654,6 +705,7 @@ int BSPMain( int argc, char **argv ){
 	int i;
 	char path[ 1024 ], tempSource[ 1024 ];
 	qboolean onlyents = qfalse;
+	windingStats_t windingStats;
 
 
 	/* note it */
@@ -897,24 +949,32 @@ int BSPMain( int argc, char **argv ){
 	}
 
 	/* load shaders */
+	ProfileBegin( "LoadShaderInfo" );
 	LoadShaderInfo();
+	ProfileEnd();
 
 	/* load original file from temp spot in case it was renamed by the editor on the way in */
+	ProfileBegin( "LoadMapFile" );
 	if ( strlen( tempSource ) > 0 ) {
 		LoadMapFile( tempSource, qfalse );
 	}
 	else{
 		LoadMapFile( name, qfalse );
 	}
+	ProfileEnd();
 
 	/* ydnar: decal setup */
+	ProfileBegin( "ProcessDecals" );
 	ProcessDecals();
+	ProfileEnd();
 
 	/* ydnar: cloned brush model entities */
 	SetCloneModelNumbers();
 
 	/* process world and submodels */
+	ProfileBegin( "ProcessModels" );
 	ProcessModels();
+	ProfileEnd();
 
 	/* set light styles from targetted light entities */
 	SetLightStyles();
@@ -923,13 +983,22 @@ int BSPMain( int argc, char **argv ){
 	ProcessAdvertisements();
 
 	/* finish and write bsp */
+	ProfileBegin( "EndBSPFile" );
 	EndBSPFile();
+	ProfileEnd();
 
 	/* remove temp map source file if appropriate */
 	if ( strlen( tempSource ) > 0 ) {
 		remove( tempSource );
 	}
 
+	/* emit winding allocator stats */
+	GetWindingStats( &windingStats );
+	Sys_FPrintf( SYS_VRB, "%9d windings allocated\n", windingStats.allocs );
+	Sys_FPrintf( SYS_VRB, "%9d winding points allocated\n", windingStats.points );
+	Sys_FPrintf( SYS_VRB, "%9d peak windings\n", windingStats.peak );
+	Sys_FPrintf( SYS_VRB, "%9d colinear points removed\n", windingStats.removed );
+
 	/* return to sender */
 	return 0;
 }
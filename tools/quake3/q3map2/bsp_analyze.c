@@ -103,7 +103,7 @@ int AnalyzeBSPMain( int argc, char **argv ){
 	Sys_Printf( "Loading %s\n", source );
 
 	/* load the file */
-	size = LoadFile( source, (void**) &header );
+	size = MapFile( source, (void**) &header );
 	if ( size == 0 || header == NULL ) {
 		Sys_Printf( "Unable to load %s.\n", source );
 		return -1;
@@ -134,12 +134,18 @@ int AnalyzeBSPMain( int argc, char **argv ){
 			length = LittleLong( header->lumps[ i ].length );
 		}
 
-		/* extract data */
-		lump = (byte*) header + offset;
-		lumpInt = LittleLong( (int) *( (int*) lump ) );
-		lumpFloat = LittleFloat( (float) *( (float*) lump ) );
-		memcpy( lumpString, (char*) lump, ( length < 1024 ? length : 1024 ) );
-		lumpString[ 1023 ] = '\0';
+		/* extract data (the file is mapped, so stay inside it) */
+		lumpInt = 0;
+		lumpFloat = 0.0f;
+		memset( lumpString, 0, sizeof( lumpString ) );
+		if ( offset >= 0 && length >= 0 && offset + length <= size ) {
+			lump = (byte*) header + offset;
+			if ( length >= 4 ) {
+				lumpInt = LittleLong( (int) *( (int*) lump ) );
+				lumpFloat = LittleFloat( (float) *( (float*) lump ) );
+			}
+			memcpy( lumpString, (char*) lump, ( length < 1023 ? length : 1023 ) );
+		}
 
 		/* print basic lump info */
 		Sys_Printf( "Lump:          %d\n", i );
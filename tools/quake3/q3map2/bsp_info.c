@@ -77,7 +77,7 @@ int BSPInfoMain( int count, char **fileNames ){
 
 		/* load the bsp file and print lump sizes */
 		Sys_Printf( "%s\n", source );
-		LoadBSPFile( source );
+		LoadBSPFileEntities( source );
 		PrintBSPFileSizes();
 
 		/* print sizes */
@@ -36,6 +36,16 @@
 /* dependencies */
 #include "q3map2.h"
 
+#ifndef WIN32
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/uio.h>
+	#include <limits.h>
+	#ifndef IOV_MAX
+		#define IOV_MAX     16      /* _XOPEN_IOV_MAX, the least posix allows */
+	#endif
+#endif
+
 
 
 
@@ -55,6 +65,44 @@
 
 
 
+/*
+   ExpandArray()
+   grows a dynamically sized lump so that reqitem is a valid index, doubling its allocation.
+   new items are zeroed like the static arrays this replaced
+ */
+
+void *ExpandArray( void *ptr, int reqitem, int *allocated, int def, size_t size, const char *name ){
+	int oldAllocated;
+	byte        *temp;
+
+
+	/* pick the new size */
+	oldAllocated = *allocated > 0 ? *allocated : 0;
+	if ( *allocated <= 0 ) {
+		*allocated = def > 0 ? def : 1;
+	}
+	while ( reqitem >= *allocated )
+	{
+		if ( *allocated > 0x3FFFFFFF ) {
+			Error( "%s: array too large (%d items)", name, reqitem );
+		}
+		*allocated *= 2;
+	}
+	if ( (size_t) *allocated > ( (size_t) -1 ) / size ) {
+		Error( "%s: array too large (%d items)", name, reqitem );
+	}
+
+	/* reallocate */
+	temp = realloc( ptr, *allocated * size );
+	if ( temp == NULL ) {
+		Error( "%s: out of memory (%d items)", name, *allocated );
+	}
+	memset( temp + oldAllocated * size, 0, ( *allocated - oldAllocated ) * size );
+	return temp;
+}
+
+
+
 /* FIXME: remove the functions below that handle memory management of bsp file chunks */
 
 int numBSPDrawVertsBuffer = 0;
@@ -142,6 +190,30 @@ void BSPFilesCleanup(){
 	if ( bspGridPoints != 0 ) {
 		free( bspGridPoints );
 	}
+
+	/* free the growable lumps */
+	free( bspPlanes );
+	free( bspLeafs );
+	free( bspNodes );
+	free( bspLeafSurfaces );
+	free( bspLeafBrushes );
+	free( bspBrushes );
+	free( bspBrushSides );
+	free( bspVisBytes );
+	free( bspDrawIndexes );
+	bspPlanes = NULL;
+	bspLeafs = NULL;
+	bspNodes = NULL;
+	bspLeafSurfaces = NULL;
+	bspLeafBrushes = NULL;
+	bspBrushes = NULL;
+	bspBrushSides = NULL;
+	bspVisBytes = NULL;
+	bspDrawIndexes = NULL;
+	allocatedBSPPlanes = allocatedBSPLeafs = allocatedBSPNodes = 0;
+	allocatedBSPLeafSurfaces = allocatedBSPLeafBrushes = 0;
+	allocatedBSPBrushes = allocatedBSPBrushSides = 0;
+	allocatedBSPVisBytes = allocatedBSPDrawIndexes = 0;
 }
 
 
@@ -180,6 +252,11 @@ void SwapBSPFile( void ){
 	int i, j;
 
 
+	/* the file layout is little endian, so there is nothing to do on little endian hosts */
+	if ( LittleLong( 1 ) == 1 ) {
+		return;
+	}
+
 	/* models */
 	SwapBlock( (int*) bspModels, numBSPModels * sizeof( bspModels[ 0 ] ) );
 
@@ -212,8 +289,10 @@ void SwapBSPFile( void ){
 	SwapBlock( (int*) bspBrushSides, numBSPBrushSides * sizeof( bspBrushSides[ 0 ] ) );
 
 	// vis
-	( (int*) &bspVisBytes )[ 0 ] = LittleLong( ( (int*) &bspVisBytes )[ 0 ] );
-	( (int*) &bspVisBytes )[ 1 ] = LittleLong( ( (int*) &bspVisBytes )[ 1 ] );
+	if ( bspVisBytes != NULL ) {
+		( (int*) bspVisBytes )[ 0 ] = LittleLong( ( (int*) bspVisBytes )[ 0 ] );
+		( (int*) bspVisBytes )[ 1 ] = LittleLong( ( (int*) bspVisBytes )[ 1 ] );
+	}
 
 	/* drawverts (don't swap colors) */
 	for ( i = 0; i < numBSPDrawVerts; i++ )
@@ -336,22 +415,184 @@ int CopyLump( bspHeader_t *header, int lump, void *dest, int size ){
 
 
 
+/*
+   CopyLump_Allocate()
+   copies a bsp file lump into a growable array, making room for it first
+ */
+
+int CopyLump_Allocate( bspHeader_t *header, int lump, void **dest, int size, int *allocated ){
+	int count;
+
+
+	/* make room */
+	count = header->lumps[ lump ].length / size;
+	if ( count >= *allocated ) {
+		*dest = ExpandArray( *dest, count, allocated, count + 1, size, "CopyLump_Allocate" );
+	}
+
+	/* copy it */
+	return CopyLump( header, lump, *dest, size );
+}
+
+
+
+/*
+   outgoing lumps
+   the format writers lay out the whole file with AddLump first, so the header is
+   complete before anything is written and WriteBSPLumps can stream the header
+   and every lump out in file order with vectored writes
+ */
+
+#define MAX_OUT_LUMPS   128
+
+typedef struct outLump_s
+{
+	const void          *data;
+	int length;
+	qboolean owned;                                 /* freed once written */
+}
+outLump_t;
+
+static outLump_t outLumps[ MAX_OUT_LUMPS ];
+static int numOutLumps = 0;
+static int outLumpsSize = 0;
+
+
+
+/*
+   BeginBSPLumps()
+   starts laying out a bsp file, the lumps follow a header of headerSize bytes
+ */
+
+void BeginBSPLumps( int headerSize ){
+	numOutLumps = 0;
+	outLumpsSize = headerSize;
+}
+
+
+
 /*
    AddLump()
-   adds a lump to an outgoing bsp file
+   adds a lump to an outgoing bsp file. the data is not copied and has to stay
+   valid until WriteBSPLumps
  */
 
-void AddLump( FILE *file, bspHeader_t *header, int lumpNum, const void *data, int length ){
+void AddLump( bspHeader_t *header, int lumpNum, const void *data, int length ){
 	bspLump_t   *lump;
 
 
 	/* add lump to bsp file header */
 	lump = &header->lumps[ lumpNum ];
-	lump->offset = LittleLong( ftell( file ) );
+	lump->offset = LittleLong( outLumpsSize );
 	lump->length = LittleLong( length );
 
-	/* write lump to file */
-	SafeWrite( file, data, ( length + 3 ) & ~3 );
+	/* queue it */
+	if ( numOutLumps >= MAX_OUT_LUMPS ) {
+		Error( "AddLump: MAX_OUT_LUMPS exceeded" );
+	}
+	outLumps[ numOutLumps ].data = data;
+	outLumps[ numOutLumps ].length = length;
+	outLumps[ numOutLumps ].owned = qfalse;
+	numOutLumps++;
+	outLumpsSize += ( length + 3 ) & ~3;
+}
+
+
+
+/*
+   AddLumpBuffer()
+   adds a lump the writer converted into a temporary buffer, which is freed once written
+ */
+
+void AddLumpBuffer( bspHeader_t *header, int lumpNum, void *buffer, int length ){
+	AddLump( header, lumpNum, buffer, length );
+	outLumps[ numOutLumps - 1 ].owned = qtrue;
+}
+
+
+
+/*
+   WriteBSPLumps()
+   writes the header and the queued lumps, padding each lump to 4 bytes.
+   returns the file size
+ */
+
+int WriteBSPLumps( const char *filename, const void *header, int headerSize ){
+	static const byte pad[ 4 ] = { 0, 0, 0, 0 };
+	int i, padding, size;
+#ifdef WIN32
+	FILE            *file;
+
+
+	/* write it */
+	file = SafeOpenWrite( filename );
+	SafeWrite( file, header, headerSize );
+	for ( i = 0; i < numOutLumps; i++ )
+	{
+		SafeWrite( file, outLumps[ i ].data, outLumps[ i ].length );
+		padding = ( ( outLumps[ i ].length + 3 ) & ~3 ) - outLumps[ i ].length;
+		SafeWrite( file, pad, padding );
+	}
+	fclose( file );
+#else
+	int fd, numIov, first;
+	ssize_t written;
+	struct iovec iov[ MAX_OUT_LUMPS * 2 + 1 ];
+
+
+	/* gather header, lumps and padding */
+	numIov = 0;
+	iov[ numIov ].iov_base = (void*) header;
+	iov[ numIov++ ].iov_len = headerSize;
+	for ( i = 0; i < numOutLumps; i++ )
+	{
+		if ( outLumps[ i ].length > 0 ) {
+			iov[ numIov ].iov_base = (void*) outLumps[ i ].data;
+			iov[ numIov++ ].iov_len = outLumps[ i ].length;
+		}
+		padding = ( ( outLumps[ i ].length + 3 ) & ~3 ) - outLumps[ i ].length;
+		if ( padding > 0 ) {
+			iov[ numIov ].iov_base = (void*) pad;
+			iov[ numIov++ ].iov_len = padding;
+		}
+	}
+
+	/* write it, picking up where a short write stopped */
+	fd = open( filename, O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+	if ( fd < 0 ) {
+		Error( "Error opening %s: %s", filename, strerror( errno ) );
+	}
+	for ( first = 0; first < numIov; )
+	{
+		written = writev( fd, &iov[ first ], ( numIov - first ) < IOV_MAX ? ( numIov - first ) : IOV_MAX );
+		if ( written < 0 ) {
+			if ( errno == EINTR ) {
+				continue;
+			}
+			Error( "File write failure: %s", strerror( errno ) );
+		}
+		for ( ; first < numIov && written >= (ssize_t) iov[ first ].iov_len; first++ )
+			written -= iov[ first ].iov_len;
+		if ( first < numIov ) {
+			iov[ first ].iov_base = (byte*) iov[ first ].iov_base + written;
+			iov[ first ].iov_len -= written;
+		}
+	}
+	close( fd );
+#endif
+
+	/* release converted lumps */
+	size = outLumpsSize;
+	for ( i = 0; i < numOutLumps; i++ )
+	{
+		if ( outLumps[ i ].owned ) {
+			free( (void*) outLumps[ i ].data );
+		}
+	}
+	numOutLumps = 0;
+	outLumpsSize = 0;
+
+	return size;
 }
 
 
@@ -374,6 +615,51 @@ void LoadBSPFile( const char *filename ){
 
 
 
+/*
+   LoadBSPFileEntities()
+   loads only the entity string and the lump sizes of a bsp file, for tools
+   that inspect a bsp without touching its geometry. the lump arrays are left alone
+ */
+
+void LoadBSPFileEntities( const char *filename ){
+	/* dummy check */
+	if ( game == NULL || game->load == NULL ) {
+		Error( "LoadBSPFileEntities: unsupported BSP file format" );
+	}
+
+	/* entity text needs no byte swapping */
+	bspEntitiesOnly = qtrue;
+	game->load( filename );
+	bspEntitiesOnly = qfalse;
+}
+
+
+
+/*
+   CheckBSPLimits()
+   the lumps grow as needed while compiling, so the format limits are checked here
+ */
+
+static void CheckBSPLimit( const char *name, int count, int max ){
+	if ( count > max ) {
+		Error( "%s exceeded (%d > %d)", name, count, max );
+	}
+}
+
+static void CheckBSPLimits( void ){
+	CheckBSPLimit( "MAX_MAP_PLANES", numBSPPlanes, MAX_MAP_PLANES );
+	CheckBSPLimit( "MAX_MAP_NODES", numBSPNodes, MAX_MAP_NODES );
+	CheckBSPLimit( "MAX_MAP_LEAFS", numBSPLeafs, MAX_MAP_LEAFS );
+	CheckBSPLimit( "MAX_MAP_LEAFFACES", numBSPLeafSurfaces, MAX_MAP_LEAFFACES );
+	CheckBSPLimit( "MAX_MAP_LEAFBRUSHES", numBSPLeafBrushes, MAX_MAP_LEAFBRUSHES );
+	CheckBSPLimit( "MAX_MAP_BRUSHES", numBSPBrushes, MAX_MAP_BRUSHES );
+	CheckBSPLimit( "MAX_MAP_BRUSHSIDES", numBSPBrushSides, MAX_MAP_BRUSHSIDES );
+	CheckBSPLimit( "MAX_MAP_VISIBILITY", numBSPVisBytes, MAX_MAP_VISIBILITY );
+	CheckBSPLimit( "MAX_MAP_DRAW_INDEXES", numBSPDrawIndexes, MAX_MAP_DRAW_INDEXES );
+}
+
+
+
 /*
    WriteBSPFile()
    writes a bsp file
@@ -389,6 +675,9 @@ void WriteBSPFile( const char *filename ){
 		Error( "WriteBSPFile: unsupported BSP file format" );
 	}
 
+	/* make sure the target format can hold it */
+	CheckBSPLimits();
+
 	/* make fake temp name so existing bsp file isn't damaged in case write process fails */
 	time( &tm );
 	sprintf( tempname, "%s.%08X", filename, (int) tm );
@@ -490,6 +779,49 @@ void StripTrailing( char *e ){
 
 
 
+/*
+   EPairKeyHash()
+   hashes an epair key, folding case the same way EPAIR_STRCMP compares keys
+ */
+
+unsigned int EPairKeyHash( const char *key ){
+	unsigned int hash;
+	int c;
+
+
+	hash = 2166136261u;
+	for ( ; *key != '\0'; key++ )
+	{
+		c = *key;
+		#if CASE_INSENSITIVE_EPAIRS
+		if ( c >= 'a' && c <= 'z' ) {
+			c -= ( 'a' - 'A' );
+		}
+		#endif
+		hash = ( hash ^ (unsigned int) c ) * 16777619u;
+	}
+	return hash;
+}
+
+
+
+/*
+   AddEPair()
+   links an epair into an entity, every epair an entity owns must be added
+   through here (or SetKeyValue) so its key bits and the target index stay valid
+ */
+
+static int entityKeyGeneration = 0;
+
+void AddEPair( entity_t *ent, epair_t *ep ){
+	ep->next = ent->epairs;
+	ent->epairs = ep;
+	ent->epairKeyBits |= EPAIR_KEY_BIT( ep->keyHash );
+	entityKeyGeneration++;
+}
+
+
+
 /*
    ParseEpair()
    parses a single quoted "key" "value" pair into an epair struct
@@ -520,6 +852,7 @@ epair_t *ParseEPair( void ){
 	/* strip trailing spaces that sometimes get accidentally added in the editor */
 	StripTrailing( e->key );
 	StripTrailing( e->value );
+	e->keyHash = EPairKeyHash( e->key );
 
 	/* return it */
 	return e;
@@ -543,9 +876,7 @@ qboolean ParseEntity( void ){
 	if ( strcmp( token, "{" ) ) {
 		Error( "ParseEntity: { not found" );
 	}
-	if ( numEntities == MAX_MAP_ENTITIES ) {
-		Error( "numEntities == MAX_MAP_ENTITIES" );
-	}
+	AUTOEXPAND_BY_REALLOC( entities, numEntities, allocatedEntities, 64 );
 
 	/* create new entity */
 	mapEnt = &entities[ numEntities ];
@@ -561,8 +892,7 @@ qboolean ParseEntity( void ){
 			break;
 		}
 		e = ParseEPair();
-		e->next = mapEnt->epairs;
-		mapEnt->epairs = e;
+		AddEPair( mapEnt, e );
 	}
 
 	/* return to sender */
@@ -577,6 +907,9 @@ qboolean ParseEntity( void ){
  */
 
 void ParseEntities( void ){
+	/* keep worldspawn addressable even if the bsp has no entities */
+	AUTOEXPAND_BY_REALLOC( entities, 0, allocatedEntities, 64 );
+
 	numEntities = 0;
 	ParseFromMemory( bspEntData, bspEntDataSize );
 	while ( ParseEntity() ) ;
@@ -684,24 +1017,29 @@ void PrintEntity( const entity_t *ent ){
 
 void SetKeyValue( entity_t *ent, const char *key, const char *value ){
 	epair_t *ep;
+	unsigned int hash;
 
 
 	/* check for existing epair */
-	for ( ep = ent->epairs; ep != NULL; ep = ep->next )
-	{
-		if ( !EPAIR_STRCMP( ep->key, key ) ) {
-			free( ep->value );
-			ep->value = copystring( value );
-			return;
+	hash = EPairKeyHash( key );
+	if ( ent->epairKeyBits & EPAIR_KEY_BIT( hash ) ) {
+		for ( ep = ent->epairs; ep != NULL; ep = ep->next )
+		{
+			if ( ep->keyHash == hash && !EPAIR_STRCMP( ep->key, key ) ) {
+				free( ep->value );
+				ep->value = copystring( value );
+				entityKeyGeneration++;
+				return;
+			}
 		}
 	}
 
 	/* create new epair */
 	ep = safe_malloc( sizeof( *ep ) );
-	ep->next = ent->epairs;
-	ent->epairs = ep;
 	ep->key = copystring( key );
 	ep->value = copystring( value );
+	ep->keyHash = hash;
+	AddEPair( ent, ep );
 }
 
 
@@ -713,6 +1051,7 @@ void SetKeyValue( entity_t *ent, const char *key, const char *value ){
 
 const char *ValueForKey( const entity_t *ent, const char *key ){
 	epair_t *ep;
+	unsigned int hash;
 
 
 	/* dummy check */
@@ -720,10 +1059,16 @@ const char *ValueForKey( const entity_t *ent, const char *key ){
 		return "";
 	}
 
+	/* most lookups are for optional keys the entity does not have */
+	hash = EPairKeyHash( key );
+	if ( !( ent->epairKeyBits & EPAIR_KEY_BIT( hash ) ) ) {
+		return "";
+	}
+
 	/* walk epair list */
 	for ( ep = ent->epairs; ep != NULL; ep = ep->next )
 	{
-		if ( !EPAIR_STRCMP( ep->key, key ) ) {
+		if ( ep->keyHash == hash && !EPAIR_STRCMP( ep->key, key ) ) {
 			return ep->value;
 		}
 	}
@@ -787,27 +1132,119 @@ void GetVectorForKey( const entity_t *ent, const char *key, vec3_t vec ){
 
 
 
+/*
+   targetname index
+   open addressed table of entity numbers by targetname, rebuilt when the entity
+   list or any entity's keys changed since it was built. entities that lose their
+   epairs without going through here simply stop matching
+ */
+
+typedef struct targetIndexEntry_s
+{
+	unsigned int hash;
+	int entityNum;                                  /* -1 = empty */
+}
+targetIndexEntry_t;
+
+static targetIndexEntry_t   *targetIndex = NULL;
+static int targetIndexSize = 0;
+static int targetIndexGeneration = -1;
+static int targetIndexNumEntities = 0;
+static entity_t             *targetIndexEntities = NULL;
+
+static unsigned int HashTargetName( const char *name ){
+	unsigned int hash;
+
+
+	hash = 2166136261u;
+	for ( ; *name != '\0'; name++ )
+		hash = ( hash ^ (unsigned char) *name ) * 16777619u;
+	return hash;
+}
+
+static void BuildTargetIndex( void ){
+	int i, slot;
+	unsigned int hash;
+	const char  *n;
+
+
+	/* size to at most half full */
+	for ( targetIndexSize = 64; targetIndexSize < numEntities * 2; targetIndexSize <<= 1 ) ;
+	free( targetIndex );
+	targetIndex = safe_malloc( targetIndexSize * sizeof( *targetIndex ) );
+	memset( targetIndex, 0xFF, targetIndexSize * sizeof( *targetIndex ) );
+
+	/* every named entity goes in, so a lookup can still pick the first match */
+	for ( i = 0; i < numEntities; i++ )
+	{
+		n = ValueForKey( &entities[ i ], "targetname" );
+		if ( n[ 0 ] == '\0' ) {
+			continue;
+		}
+		hash = HashTargetName( n );
+		for ( slot = hash & ( targetIndexSize - 1 );
+			  targetIndex[ slot ].entityNum >= 0;
+			  slot = ( slot + 1 ) & ( targetIndexSize - 1 ) ) ;
+		targetIndex[ slot ].hash = hash;
+		targetIndex[ slot ].entityNum = i;
+	}
+
+	targetIndexGeneration = entityKeyGeneration;
+	targetIndexNumEntities = numEntities;
+	targetIndexEntities = entities;
+}
+
+
+
 /*
    FindTargetEntity()
    finds an entity target
  */
 
 entity_t *FindTargetEntity( const char *target ){
-	int i;
+	int i, slot, best;
+	unsigned int hash;
 	const char  *n;
 
 
-	/* walk entity list */
-	for ( i = 0; i < numEntities; i++ )
+	/* an empty target matches the first entity without a targetname */
+	if ( target[ 0 ] == '\0' ) {
+		for ( i = 0; i < numEntities; i++ )
+		{
+			n = ValueForKey( &entities[ i ], "targetname" );
+			if ( n[ 0 ] == '\0' ) {
+				return &entities[ i ];
+			}
+		}
+		return NULL;
+	}
+
+	/* rebuild the index if it is stale */
+	if ( targetIndexGeneration != entityKeyGeneration ||
+		 targetIndexNumEntities != numEntities ||
+		 targetIndexEntities != entities ) {
+		BuildTargetIndex();
+	}
+
+	/* find the lowest numbered entity with this name */
+	best = -1;
+	hash = HashTargetName( target );
+	for ( slot = hash & ( targetIndexSize - 1 );
+		  targetIndex[ slot ].entityNum >= 0;
+		  slot = ( slot + 1 ) & ( targetIndexSize - 1 ) )
 	{
+		i = targetIndex[ slot ].entityNum;
+		if ( targetIndex[ slot ].hash != hash || ( best >= 0 && i > best ) ) {
+			continue;
+		}
 		n = ValueForKey( &entities[ i ], "targetname" );
 		if ( !strcmp( n, target ) ) {
-			return &entities[ i ];
+			best = i;
 		}
 	}
 
 	/* nada */
-	return NULL;
+	return best >= 0 ? &entities[ best ] : NULL;
 }
 
 
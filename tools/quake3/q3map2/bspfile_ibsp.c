@@ -97,6 +97,7 @@ static void CopyBrushSidesLump( ibspHeader_t *header ){
 
 	/* get count */
 	numBSPBrushSides = GetLumpElements( (bspHeader_t*) header, LUMP_BRUSHSIDES, sizeof( *in ) );
+	AUTOEXPAND_BY_REALLOC_BSP( BrushSides, numBSPBrushSides + 1 );
 
 	/* copy */
 	in = GetLump( (bspHeader_t*) header, LUMP_BRUSHSIDES );
@@ -112,7 +113,7 @@ static void CopyBrushSidesLump( ibspHeader_t *header ){
 }
 
 
-static void AddBrushSidesLump( FILE *file, ibspHeader_t *header ){
+static void AddBrushSidesLump( ibspHeader_t *header ){
 	int i, size;
 	bspBrushSide_t  *in;
 	ibspBrushSide_t *buffer, *out;
@@ -135,10 +136,7 @@ static void AddBrushSidesLump( FILE *file, ibspHeader_t *header ){
 	}
 
 	/* write lump */
-	AddLump( file, (bspHeader_t*) header, LUMP_BRUSHSIDES, buffer, size );
-
-	/* free buffer */
-	free( buffer );
+	AddLumpBuffer( (bspHeader_t*) header, LUMP_BRUSHSIDES, buffer, size );
 }
 
 
@@ -224,7 +222,7 @@ static void CopyDrawSurfacesLump( ibspHeader_t *header ){
 }
 
 
-static void AddDrawSurfacesLump( FILE *file, ibspHeader_t *header ){
+static void AddDrawSurfacesLump( ibspHeader_t *header ){
 	int i, size;
 	bspDrawSurface_t    *in;
 	ibspDrawSurface_t   *buffer, *out;
@@ -267,10 +265,7 @@ static void AddDrawSurfacesLump( FILE *file, ibspHeader_t *header ){
 	}
 
 	/* write lump */
-	AddLump( file, (bspHeader_t*) header, LUMP_SURFACES, buffer, size );
-
-	/* free buffer */
-	free( buffer );
+	AddLumpBuffer( (bspHeader_t*) header, LUMP_SURFACES, buffer, size );
 }
 
 
@@ -322,7 +317,7 @@ static void CopyDrawVertsLump( ibspHeader_t *header ){
 }
 
 
-static void AddDrawVertsLump( FILE *file, ibspHeader_t *header ){
+static void AddDrawVertsLump( ibspHeader_t *header ){
 	int i, size;
 	bspDrawVert_t   *in;
 	ibspDrawVert_t  *buffer, *out;
@@ -357,10 +352,7 @@ static void AddDrawVertsLump( FILE *file, ibspHeader_t *header ){
 	}
 
 	/* write lump */
-	AddLump( file, (bspHeader_t*) header, LUMP_DRAWVERTS, buffer, size );
-
-	/* free buffer */
-	free( buffer );
+	AddLumpBuffer( (bspHeader_t*) header, LUMP_DRAWVERTS, buffer, size );
 }
 
 
@@ -411,7 +403,7 @@ static void CopyLightGridLumps( ibspHeader_t *header ){
 }
 
 
-static void AddLightGridLumps( FILE *file, ibspHeader_t *header ){
+static void AddLightGridLumps( ibspHeader_t *header ){
 	int i;
 	bspGridPoint_t  *in;
 	ibspGridPoint_t *buffer, *out;
@@ -440,13 +432,42 @@ static void AddLightGridLumps( FILE *file, ibspHeader_t *header ){
 		out++;
 	}
 
-	/* write lumps */
-	AddLump( file, (bspHeader_t*) header, LUMP_LIGHTGRID, buffer, ( numBSPGridPoints * sizeof( *out ) ) );
+	/* write lumps (the buffer is freed once written) */
+	AddLumpBuffer( (bspHeader_t*) header, LUMP_LIGHTGRID, buffer, ( numBSPGridPoints * sizeof( *out ) ) );
+}
 
-	/* free buffer (ydnar 2002-10-22: [bug 641] thanks Rap70r! */
-	free( buffer );
+/*
+   CountIBSPLumps()
+   sets the lump element counts without loading the lumps
+ */
+
+static void CountIBSPLumps( ibspHeader_t *header ){
+	numBSPShaders = GetLumpElements( (bspHeader_t*) header, LUMP_SHADERS, sizeof( bspShader_t ) );
+	numBSPModels = GetLumpElements( (bspHeader_t*) header, LUMP_MODELS, sizeof( bspModel_t ) );
+	numBSPPlanes = GetLumpElements( (bspHeader_t*) header, LUMP_PLANES, sizeof( bspPlane_t ) );
+	numBSPLeafs = GetLumpElements( (bspHeader_t*) header, LUMP_LEAFS, sizeof( bspLeaf_t ) );
+	numBSPNodes = GetLumpElements( (bspHeader_t*) header, LUMP_NODES, sizeof( bspNode_t ) );
+	numBSPLeafSurfaces = GetLumpElements( (bspHeader_t*) header, LUMP_LEAFSURFACES, sizeof( bspLeafSurfaces[ 0 ] ) );
+	numBSPLeafBrushes = GetLumpElements( (bspHeader_t*) header, LUMP_LEAFBRUSHES, sizeof( bspLeafBrushes[ 0 ] ) );
+	numBSPBrushes = GetLumpElements( (bspHeader_t*) header, LUMP_BRUSHES, sizeof( bspBrush_t ) );
+	numBSPBrushSides = GetLumpElements( (bspHeader_t*) header, LUMP_BRUSHSIDES, sizeof( ibspBrushSide_t ) );
+	numBSPDrawVerts = GetLumpElements( (bspHeader_t*) header, LUMP_DRAWVERTS, sizeof( ibspDrawVert_t ) );
+	numBSPDrawSurfaces = GetLumpElements( (bspHeader_t*) header, LUMP_SURFACES, sizeof( ibspDrawSurface_t ) );
+	numBSPFogs = GetLumpElements( (bspHeader_t*) header, LUMP_FOGS, sizeof( bspFog_t ) );
+	numBSPDrawIndexes = GetLumpElements( (bspHeader_t*) header, LUMP_DRAWINDEXES, sizeof( bspDrawIndexes[ 0 ] ) );
+	numBSPVisBytes = GetLumpElements( (bspHeader_t*) header, LUMP_VISIBILITY, 1 );
+	numBSPLightBytes = GetLumpElements( (bspHeader_t*) header, LUMP_LIGHTMAPS, 1 );
+	numBSPGridPoints = GetLumpElements( (bspHeader_t*) header, LUMP_LIGHTGRID, sizeof( ibspGridPoint_t ) );
+	if ( header->version == 47 ) { // quake live's bsp version
+		numBSPAds = GetLumpElements( (bspHeader_t*) header, LUMP_ADVERTISEMENTS, sizeof( bspAdvertisement_t ) );
+	}
+	else{
+		numBSPAds = 0;
+	}
 }
 
+
+
 /*
    LoadIBSPFile()
    loads a quake 3 bsp file into memory
@@ -454,10 +475,11 @@ static void AddLightGridLumps( FILE *file, ibspHeader_t *header ){
 
 void LoadIBSPFile( const char *filename ){
 	ibspHeader_t    *header;
+	int size;
 
 
-	/* load the file header */
-	LoadFile( filename, (void**) &header );
+	/* map the file, only the pages of lumps that get copied are read */
+	size = MapFile( filename, (void**) &header );
 
 	/* swap the header (except the first 4 bytes) */
 	SwapBlock( (int*) ( (byte*) header + sizeof( int ) ), sizeof( *header ) - sizeof( int ) );
@@ -470,22 +492,30 @@ void LoadIBSPFile( const char *filename ){
 		Error( "%s is version %d, not %d", filename, header->version, game->bspVersion );
 	}
 
+	/* inspection tools only need the lump sizes and the entities */
+	if ( bspEntitiesOnly ) {
+		CountIBSPLumps( header );
+		bspEntDataSize = CopyLump( (bspHeader_t*) header, LUMP_ENTITIES, bspEntData, 1 );
+		UnmapFile( header, size );
+		return;
+	}
+
 	/* load/convert lumps */
 	numBSPShaders = CopyLump( (bspHeader_t*) header, LUMP_SHADERS, bspShaders, sizeof( bspShader_t ) );
 
 	numBSPModels = CopyLump( (bspHeader_t*) header, LUMP_MODELS, bspModels, sizeof( bspModel_t ) );
 
-	numBSPPlanes = CopyLump( (bspHeader_t*) header, LUMP_PLANES, bspPlanes, sizeof( bspPlane_t ) );
+	numBSPPlanes = CopyLump_Allocate( (bspHeader_t*) header, LUMP_PLANES, (void **) &bspPlanes, sizeof( bspPlane_t ), &allocatedBSPPlanes );
 
-	numBSPLeafs = CopyLump( (bspHeader_t*) header, LUMP_LEAFS, bspLeafs, sizeof( bspLeaf_t ) );
+	numBSPLeafs = CopyLump_Allocate( (bspHeader_t*) header, LUMP_LEAFS, (void **) &bspLeafs, sizeof( bspLeaf_t ), &allocatedBSPLeafs );
 
-	numBSPNodes = CopyLump( (bspHeader_t*) header, LUMP_NODES, bspNodes, sizeof( bspNode_t ) );
+	numBSPNodes = CopyLump_Allocate( (bspHeader_t*) header, LUMP_NODES, (void **) &bspNodes, sizeof( bspNode_t ), &allocatedBSPNodes );
 
-	numBSPLeafSurfaces = CopyLump( (bspHeader_t*) header, LUMP_LEAFSURFACES, bspLeafSurfaces, sizeof( bspLeafSurfaces[ 0 ] ) );
+	numBSPLeafSurfaces = CopyLump_Allocate( (bspHeader_t*) header, LUMP_LEAFSURFACES, (void **) &bspLeafSurfaces, sizeof( bspLeafSurfaces[ 0 ] ), &allocatedBSPLeafSurfaces );
 
-	numBSPLeafBrushes = CopyLump( (bspHeader_t*) header, LUMP_LEAFBRUSHES, bspLeafBrushes, sizeof( bspLeafBrushes[ 0 ] ) );
+	numBSPLeafBrushes = CopyLump_Allocate( (bspHeader_t*) header, LUMP_LEAFBRUSHES, (void **) &bspLeafBrushes, sizeof( bspLeafBrushes[ 0 ] ), &allocatedBSPLeafBrushes );
 
-	numBSPBrushes = CopyLump( (bspHeader_t*) header, LUMP_BRUSHES, bspBrushes, sizeof( bspBrush_t ) );
+	numBSPBrushes = CopyLump_Allocate( (bspHeader_t*) header, LUMP_BRUSHES, (void **) &bspBrushes, sizeof( bspBrush_t ), &allocatedBSPBrushes );
 
 	CopyBrushSidesLump( header );
 
@@ -495,9 +525,9 @@ void LoadIBSPFile( const char *filename ){
 
 	numBSPFogs = CopyLump( (bspHeader_t*) header, LUMP_FOGS, bspFogs, sizeof( bspFog_t ) );
 
-	numBSPDrawIndexes = CopyLump( (bspHeader_t*) header, LUMP_DRAWINDEXES, bspDrawIndexes, sizeof( bspDrawIndexes[ 0 ] ) );
+	numBSPDrawIndexes = CopyLump_Allocate( (bspHeader_t*) header, LUMP_DRAWINDEXES, (void **) &bspDrawIndexes, sizeof( bspDrawIndexes[ 0 ] ), &allocatedBSPDrawIndexes );
 
-	numBSPVisBytes = CopyLump( (bspHeader_t*) header, LUMP_VISIBILITY, bspVisBytes, 1 );
+	numBSPVisBytes = CopyLump_Allocate( (bspHeader_t*) header, LUMP_VISIBILITY, (void **) &bspVisBytes, 1, &allocatedBSPVisBytes );
 
 	numBSPLightBytes = GetLumpElements( (bspHeader_t*) header, LUMP_LIGHTMAPS, 1 );
 	bspLightBytes = safe_malloc( numBSPLightBytes );
@@ -515,8 +545,8 @@ void LoadIBSPFile( const char *filename ){
 		numBSPAds = 0;
 	}
 
-	/* free the file buffer */
-	free( header );
+	/* release the file */
+	UnmapFile( header, size );
 }
 
 
@@ -528,7 +558,6 @@ void LoadIBSPFile( const char *filename ){
 
 void WriteIBSPFile( const char *filename ){
 	ibspHeader_t outheader, *header;
-	FILE            *file;
 	time_t t;
 	char marker[ 1024 ];
 	int size;
@@ -544,45 +573,39 @@ void WriteIBSPFile( const char *filename ){
 	*( (int*) (bspHeader_t*) header->ident ) = *( (int*) game->bspIdent );
 	header->version = LittleLong( game->bspVersion );
 
-	/* write initial header */
-	file = SafeOpenWrite( filename );
-	SafeWrite( file, (bspHeader_t*) header, sizeof( *header ) );    /* overwritten later */
+	/* lay out the lumps after the header */
+	BeginBSPLumps( sizeof( *header ) );
 
 	/* add marker lump */
 	time( &t );
 	sprintf( marker, "I LOVE MY Q3MAP2 %s on %s)", Q3MAP_VERSION, asctime( localtime( &t ) ) );
-	AddLump( file, (bspHeader_t*) header, 0, marker, strlen( marker ) + 1 );
+	AddLump( (bspHeader_t*) header, 0, marker, strlen( marker ) + 1 );
 
 	/* add lumps */
-	AddLump( file, (bspHeader_t*) header, LUMP_SHADERS, bspShaders, numBSPShaders * sizeof( bspShader_t ) );
-	AddLump( file, (bspHeader_t*) header, LUMP_PLANES, bspPlanes, numBSPPlanes * sizeof( bspPlane_t ) );
-	AddLump( file, (bspHeader_t*) header, LUMP_LEAFS, bspLeafs, numBSPLeafs * sizeof( bspLeaf_t ) );
-	AddLump( file, (bspHeader_t*) header, LUMP_NODES, bspNodes, numBSPNodes * sizeof( bspNode_t ) );
-	AddLump( file, (bspHeader_t*) header, LUMP_BRUSHES, bspBrushes, numBSPBrushes * sizeof( bspBrush_t ) );
-	AddBrushSidesLump( file, header );
-	AddLump( file, (bspHeader_t*) header, LUMP_LEAFSURFACES, bspLeafSurfaces, numBSPLeafSurfaces * sizeof( bspLeafSurfaces[ 0 ] ) );
-	AddLump( file, (bspHeader_t*) header, LUMP_LEAFBRUSHES, bspLeafBrushes, numBSPLeafBrushes * sizeof( bspLeafBrushes[ 0 ] ) );
-	AddLump( file, (bspHeader_t*) header, LUMP_MODELS, bspModels, numBSPModels * sizeof( bspModel_t ) );
-	AddDrawVertsLump( file, header );
-	AddDrawSurfacesLump( file, header );
-	AddLump( file, (bspHeader_t*) header, LUMP_VISIBILITY, bspVisBytes, numBSPVisBytes );
-	AddLump( file, (bspHeader_t*) header, LUMP_LIGHTMAPS, bspLightBytes, numBSPLightBytes );
-	AddLightGridLumps( file, header );
-	AddLump( file, (bspHeader_t*) header, LUMP_ENTITIES, bspEntData, bspEntDataSize );
-	AddLump( file, (bspHeader_t*) header, LUMP_FOGS, bspFogs, numBSPFogs * sizeof( bspFog_t ) );
-	AddLump( file, (bspHeader_t*) header, LUMP_DRAWINDEXES, bspDrawIndexes, numBSPDrawIndexes * sizeof( bspDrawIndexes[ 0 ] ) );
+	AddLump( (bspHeader_t*) header, LUMP_SHADERS, bspShaders, numBSPShaders * sizeof( bspShader_t ) );
+	AddLump( (bspHeader_t*) header, LUMP_PLANES, bspPlanes, numBSPPlanes * sizeof( bspPlane_t ) );
+	AddLump( (bspHeader_t*) header, LUMP_LEAFS, bspLeafs, numBSPLeafs * sizeof( bspLeaf_t ) );
+	AddLump( (bspHeader_t*) header, LUMP_NODES, bspNodes, numBSPNodes * sizeof( bspNode_t ) );
+	AddLump( (bspHeader_t*) header, LUMP_BRUSHES, bspBrushes, numBSPBrushes * sizeof( bspBrush_t ) );
+	AddBrushSidesLump( header );
+	AddLump( (bspHeader_t*) header, LUMP_LEAFSURFACES, bspLeafSurfaces, numBSPLeafSurfaces * sizeof( bspLeafSurfaces[ 0 ] ) );
+	AddLump( (bspHeader_t*) header, LUMP_LEAFBRUSHES, bspLeafBrushes, numBSPLeafBrushes * sizeof( bspLeafBrushes[ 0 ] ) );
+	AddLump( (bspHeader_t*) header, LUMP_MODELS, bspModels, numBSPModels * sizeof( bspModel_t ) );
+	AddDrawVertsLump( header );
+	AddDrawSurfacesLump( header );
+	AddLump( (bspHeader_t*) header, LUMP_VISIBILITY, bspVisBytes, numBSPVisBytes );
+	AddLump( (bspHeader_t*) header, LUMP_LIGHTMAPS, bspLightBytes, numBSPLightBytes );
+	AddLightGridLumps( header );
+	AddLump( (bspHeader_t*) header, LUMP_ENTITIES, bspEntData, bspEntDataSize );
+	AddLump( (bspHeader_t*) header, LUMP_FOGS, bspFogs, numBSPFogs * sizeof( bspFog_t ) );
+	AddLump( (bspHeader_t*) header, LUMP_DRAWINDEXES, bspDrawIndexes, numBSPDrawIndexes * sizeof( bspDrawIndexes[ 0 ] ) );
 
 	/* advertisements */
-	AddLump( file, (bspHeader_t*) header, LUMP_ADVERTISEMENTS, bspAds, numBSPAds * sizeof( bspAdvertisement_t ) );
+	AddLump( (bspHeader_t*) header, LUMP_ADVERTISEMENTS, bspAds, numBSPAds * sizeof( bspAdvertisement_t ) );
+
+	/* write the completed header and the lumps */
+	size = WriteBSPLumps( filename, header, sizeof( *header ) );
 
 	/* emit bsp size */
-	size = ftell( file );
 	Sys_Printf( "Wrote %.1f MB (%d bytes)\n", (float) size / ( 1024 * 1024 ), size );
-
-	/* write the completed header */
-	fseek( file, 0, SEEK_SET );
-	SafeWrite( file, header, sizeof( *header ) );
-
-	/* close the file */
-	fclose( file );
 }
@@ -112,7 +112,7 @@ static void CopyLightGridLumps( rbspHeader_t *header ){
 }
 
 
-static void AddLightGridLumps( FILE *file, rbspHeader_t *header ){
+static void AddLightGridLumps( rbspHeader_t *header ){
 	int i, j, k, c, d;
 	int numGridPoints, maxGridPoints;
 	bspGridPoint_t  *gridPoints, *in, *out;
@@ -196,12 +196,34 @@ static void AddLightGridLumps( FILE *file, rbspHeader_t *header ){
 		gridArray[ i ] = LittleShort( gridArray[ i ] );
 
 	/* write lumps */
-	AddLump( file, (bspHeader_t*) header, LUMP_LIGHTGRID, gridPoints, ( numGridPoints * sizeof( *gridPoints ) ) );
-	AddLump( file, (bspHeader_t*) header, LUMP_LIGHTARRAY, gridArray, ( numGridArray * sizeof( *gridArray ) ) );
+	AddLumpBuffer( (bspHeader_t*) header, LUMP_LIGHTGRID, gridPoints, ( numGridPoints * sizeof( *gridPoints ) ) );
+	AddLumpBuffer( (bspHeader_t*) header, LUMP_LIGHTARRAY, gridArray, ( numGridArray * sizeof( *gridArray ) ) );
+}
+
 
-	/* free buffers */
-	free( gridPoints );
-	free( gridArray );
+
+/*
+   CountRBSPLumps()
+   sets the lump element counts without loading the lumps
+ */
+
+static void CountRBSPLumps( rbspHeader_t *header ){
+	numBSPShaders = GetLumpElements( (bspHeader_t*) header, LUMP_SHADERS, sizeof( bspShader_t ) );
+	numBSPModels = GetLumpElements( (bspHeader_t*) header, LUMP_MODELS, sizeof( bspModel_t ) );
+	numBSPPlanes = GetLumpElements( (bspHeader_t*) header, LUMP_PLANES, sizeof( bspPlane_t ) );
+	numBSPLeafs = GetLumpElements( (bspHeader_t*) header, LUMP_LEAFS, sizeof( bspLeaf_t ) );
+	numBSPNodes = GetLumpElements( (bspHeader_t*) header, LUMP_NODES, sizeof( bspNode_t ) );
+	numBSPLeafSurfaces = GetLumpElements( (bspHeader_t*) header, LUMP_LEAFSURFACES, sizeof( bspLeafSurfaces[ 0 ] ) );
+	numBSPLeafBrushes = GetLumpElements( (bspHeader_t*) header, LUMP_LEAFBRUSHES, sizeof( bspLeafBrushes[ 0 ] ) );
+	numBSPBrushes = GetLumpElements( (bspHeader_t*) header, LUMP_BRUSHES, sizeof( bspBrush_t ) );
+	numBSPBrushSides = GetLumpElements( (bspHeader_t*) header, LUMP_BRUSHSIDES, sizeof( bspBrushSide_t ) );
+	numBSPDrawVerts = GetLumpElements( (bspHeader_t*) header, LUMP_DRAWVERTS, sizeof( bspDrawVerts[ 0 ] ) );
+	numBSPDrawSurfaces = GetLumpElements( (bspHeader_t*) header, LUMP_SURFACES, sizeof( bspDrawSurfaces[ 0 ] ) );
+	numBSPFogs = GetLumpElements( (bspHeader_t*) header, LUMP_FOGS, sizeof( bspFogs[ 0 ] ) );
+	numBSPDrawIndexes = GetLumpElements( (bspHeader_t*) header, LUMP_DRAWINDEXES, sizeof( bspDrawIndexes[ 0 ] ) );
+	numBSPVisBytes = GetLumpElements( (bspHeader_t*) header, LUMP_VISIBILITY, 1 );
+	numBSPLightBytes = GetLumpElements( (bspHeader_t*) header, LUMP_LIGHTMAPS, 1 );
+	numBSPGridPoints = GetLumpElements( (bspHeader_t*) header, LUMP_LIGHTARRAY, sizeof( unsigned short ) );
 }
 
 
@@ -213,10 +235,11 @@ static void AddLightGridLumps( FILE *file, rbspHeader_t *header ){
 
 void LoadRBSPFile( const char *filename ){
 	rbspHeader_t    *header;
+	int size;
 
 
-	/* load the file header */
-	LoadFile( filename, (void**) &header );
+	/* map the file, only the pages of lumps that get copied are read */
+	size = MapFile( filename, (void**) &header );
 
 	/* swap the header (except the first 4 bytes) */
 	SwapBlock( (int*) ( (byte*) header + sizeof( int ) ), sizeof( *header ) - sizeof( int ) );
@@ -229,24 +252,32 @@ void LoadRBSPFile( const char *filename ){
 		Error( "%s is version %d, not %d", filename, header->version, game->bspVersion );
 	}
 
+	/* inspection tools only need the lump sizes and the entities */
+	if ( bspEntitiesOnly ) {
+		CountRBSPLumps( header );
+		bspEntDataSize = CopyLump( (bspHeader_t*) header, LUMP_ENTITIES, bspEntData, 1 );
+		UnmapFile( header, size );
+		return;
+	}
+
 	/* load/convert lumps */
 	numBSPShaders = CopyLump( (bspHeader_t*) header, LUMP_SHADERS, bspShaders, sizeof( bspShader_t ) );
 
 	numBSPModels = CopyLump( (bspHeader_t*) header, LUMP_MODELS, bspModels, sizeof( bspModel_t ) );
 
-	numBSPPlanes = CopyLump( (bspHeader_t*) header, LUMP_PLANES, bspPlanes, sizeof( bspPlane_t ) );
+	numBSPPlanes = CopyLump_Allocate( (bspHeader_t*) header, LUMP_PLANES, (void **) &bspPlanes, sizeof( bspPlane_t ), &allocatedBSPPlanes );
 
-	numBSPLeafs = CopyLump( (bspHeader_t*) header, LUMP_LEAFS, bspLeafs, sizeof( bspLeaf_t ) );
+	numBSPLeafs = CopyLump_Allocate( (bspHeader_t*) header, LUMP_LEAFS, (void **) &bspLeafs, sizeof( bspLeaf_t ), &allocatedBSPLeafs );
 
-	numBSPNodes = CopyLump( (bspHeader_t*) header, LUMP_NODES, bspNodes, sizeof( bspNode_t ) );
+	numBSPNodes = CopyLump_Allocate( (bspHeader_t*) header, LUMP_NODES, (void **) &bspNodes, sizeof( bspNode_t ), &allocatedBSPNodes );
 
-	numBSPLeafSurfaces = CopyLump( (bspHeader_t*) header, LUMP_LEAFSURFACES, bspLeafSurfaces, sizeof( bspLeafSurfaces[ 0 ] ) );
+	numBSPLeafSurfaces = CopyLump_Allocate( (bspHeader_t*) header, LUMP_LEAFSURFACES, (void **) &bspLeafSurfaces, sizeof( bspLeafSurfaces[ 0 ] ), &allocatedBSPLeafSurfaces );
 
-	numBSPLeafBrushes = CopyLump( (bspHeader_t*) header, LUMP_LEAFBRUSHES, bspLeafBrushes, sizeof( bspLeafBrushes[ 0 ] ) );
+	numBSPLeafBrushes = CopyLump_Allocate( (bspHeader_t*) header, LUMP_LEAFBRUSHES, (void **) &bspLeafBrushes, sizeof( bspLeafBrushes[ 0 ] ), &allocatedBSPLeafBrushes );
 
-	numBSPBrushes = CopyLump( (bspHeader_t*) header, LUMP_BRUSHES, bspBrushes, sizeof( bspBrush_t ) );
+	numBSPBrushes = CopyLump_Allocate( (bspHeader_t*) header, LUMP_BRUSHES, (void **) &bspBrushes, sizeof( bspBrush_t ), &allocatedBSPBrushes );
 
-	numBSPBrushSides = CopyLump( (bspHeader_t*) header, LUMP_BRUSHSIDES, bspBrushSides, sizeof( bspBrushSide_t ) );
+	numBSPBrushSides = CopyLump_Allocate( (bspHeader_t*) header, LUMP_BRUSHSIDES, (void **) &bspBrushSides, sizeof( bspBrushSide_t ), &allocatedBSPBrushSides );
 
 	numBSPDrawVerts = GetLumpElements( (bspHeader_t*) header, LUMP_DRAWVERTS, sizeof( bspDrawVerts[ 0 ] ) );
 	SetDrawVerts( numBSPDrawVerts );
@@ -258,9 +289,9 @@ void LoadRBSPFile( const char *filename ){
 
 	numBSPFogs = CopyLump( (bspHeader_t*) header, LUMP_FOGS, bspFogs, sizeof( bspFogs[ 0 ] ) );
 
-	numBSPDrawIndexes = CopyLump( (bspHeader_t*) header, LUMP_DRAWINDEXES, bspDrawIndexes, sizeof( bspDrawIndexes[ 0 ] ) );
+	numBSPDrawIndexes = CopyLump_Allocate( (bspHeader_t*) header, LUMP_DRAWINDEXES, (void **) &bspDrawIndexes, sizeof( bspDrawIndexes[ 0 ] ), &allocatedBSPDrawIndexes );
 
-	numBSPVisBytes = CopyLump( (bspHeader_t*) header, LUMP_VISIBILITY, bspVisBytes, 1 );
+	numBSPVisBytes = CopyLump_Allocate( (bspHeader_t*) header, LUMP_VISIBILITY, (void **) &bspVisBytes, 1, &allocatedBSPVisBytes );
 
 	numBSPLightBytes = GetLumpElements( (bspHeader_t*) header, LUMP_LIGHTMAPS, 1 );
 	bspLightBytes = safe_malloc( numBSPLightBytes );
@@ -270,8 +301,8 @@ void LoadRBSPFile( const char *filename ){
 
 	CopyLightGridLumps( header );
 
-	/* free the file buffer */
-	free( header );
+	/* release the file */
+	UnmapFile( header, size );
 }
 
 
@@ -283,7 +314,6 @@ void LoadRBSPFile( const char *filename ){
 
 void WriteRBSPFile( const char *filename ){
 	rbspHeader_t outheader, *header;
-	FILE            *file;
 	time_t t;
 	char marker[ 1024 ];
 	int size;
@@ -299,42 +329,36 @@ void WriteRBSPFile( const char *filename ){
 	*( (int*) (bspHeader_t*) header->ident ) = *( (int*) game->bspIdent );
 	header->version = LittleLong( game->bspVersion );
 
-	/* write initial header */
-	file = SafeOpenWrite( filename );
-	SafeWrite( file, (bspHeader_t*) header, sizeof( *header ) );    /* overwritten later */
+	/* lay out the lumps after the header */
+	BeginBSPLumps( sizeof( *header ) );
 
 	/* add marker lump */
 	time( &t );
 	sprintf( marker, "I LOVE MY Q3MAP2 %s on %s)", Q3MAP_VERSION, asctime( localtime( &t ) ) );
-	AddLump( file, (bspHeader_t*) header, 0, marker, strlen( marker ) + 1 );
+	AddLump( (bspHeader_t*) header, 0, marker, strlen( marker ) + 1 );
 
 	/* add lumps */
-	AddLump( file, (bspHeader_t*) header, LUMP_SHADERS, bspShaders, numBSPShaders * sizeof( bspShader_t ) );
-	AddLump( file, (bspHeader_t*) header, LUMP_PLANES, bspPlanes, numBSPPlanes * sizeof( bspPlane_t ) );
-	AddLump( file, (bspHeader_t*) header, LUMP_LEAFS, bspLeafs, numBSPLeafs * sizeof( bspLeaf_t ) );
-	AddLump( file, (bspHeader_t*) header, LUMP_NODES, bspNodes, numBSPNodes * sizeof( bspNode_t ) );
-	AddLump( file, (bspHeader_t*) header, LUMP_BRUSHES, bspBrushes, numBSPBrushes * sizeof( bspBrush_t ) );
-	AddLump( file, (bspHeader_t*) header, LUMP_BRUSHSIDES, bspBrushSides, numBSPBrushSides * sizeof( bspBrushSides[ 0 ] ) );
-	AddLump( file, (bspHeader_t*) header, LUMP_LEAFSURFACES, bspLeafSurfaces, numBSPLeafSurfaces * sizeof( bspLeafSurfaces[ 0 ] ) );
-	AddLump( file, (bspHeader_t*) header, LUMP_LEAFBRUSHES, bspLeafBrushes, numBSPLeafBrushes * sizeof( bspLeafBrushes[ 0 ] ) );
-	AddLump( file, (bspHeader_t*) header, LUMP_MODELS, bspModels, numBSPModels * sizeof( bspModel_t ) );
-	AddLump( file, (bspHeader_t*) header, LUMP_DRAWVERTS, bspDrawVerts, numBSPDrawVerts * sizeof( bspDrawVerts[ 0 ] ) );
-	AddLump( file, (bspHeader_t*) header, LUMP_SURFACES, bspDrawSurfaces, numBSPDrawSurfaces * sizeof( bspDrawSurfaces[ 0 ] ) );
-	AddLump( file, (bspHeader_t*) header, LUMP_VISIBILITY, bspVisBytes, numBSPVisBytes );
-	AddLump( file, (bspHeader_t*) header, LUMP_LIGHTMAPS, bspLightBytes, numBSPLightBytes );
-	AddLightGridLumps( file, header );
-	AddLump( file, (bspHeader_t*) header, LUMP_ENTITIES, bspEntData, bspEntDataSize );
-	AddLump( file, (bspHeader_t*) header, LUMP_FOGS, bspFogs, numBSPFogs * sizeof( bspFog_t ) );
-	AddLump( file, (bspHeader_t*) header, LUMP_DRAWINDEXES, bspDrawIndexes, numBSPDrawIndexes * sizeof( bspDrawIndexes[ 0 ] ) );
+	AddLump( (bspHeader_t*) header, LUMP_SHADERS, bspShaders, numBSPShaders * sizeof( bspShader_t ) );
+	AddLump( (bspHeader_t*) header, LUMP_PLANES, bspPlanes, numBSPPlanes * sizeof( bspPlane_t ) );
+	AddLump( (bspHeader_t*) header, LUMP_LEAFS, bspLeafs, numBSPLeafs * sizeof( bspLeaf_t ) );
+	AddLump( (bspHeader_t*) header, LUMP_NODES, bspNodes, numBSPNodes * sizeof( bspNode_t ) );
+	AddLump( (bspHeader_t*) header, LUMP_BRUSHES, bspBrushes, numBSPBrushes * sizeof( bspBrush_t ) );
+	AddLump( (bspHeader_t*) header, LUMP_BRUSHSIDES, bspBrushSides, numBSPBrushSides * sizeof( bspBrushSides[ 0 ] ) );
+	AddLump( (bspHeader_t*) header, LUMP_LEAFSURFACES, bspLeafSurfaces, numBSPLeafSurfaces * sizeof( bspLeafSurfaces[ 0 ] ) );
+	AddLump( (bspHeader_t*) header, LUMP_LEAFBRUSHES, bspLeafBrushes, numBSPLeafBrushes * sizeof( bspLeafBrushes[ 0 ] ) );
+	AddLump( (bspHeader_t*) header, LUMP_MODELS, bspModels, numBSPModels * sizeof( bspModel_t ) );
+	AddLump( (bspHeader_t*) header, LUMP_DRAWVERTS, bspDrawVerts, numBSPDrawVerts * sizeof( bspDrawVerts[ 0 ] ) );
+	AddLump( (bspHeader_t*) header, LUMP_SURFACES, bspDrawSurfaces, numBSPDrawSurfaces * sizeof( bspDrawSurfaces[ 0 ] ) );
+	AddLump( (bspHeader_t*) header, LUMP_VISIBILITY, bspVisBytes, numBSPVisBytes );
+	AddLump( (bspHeader_t*) header, LUMP_LIGHTMAPS, bspLightBytes, numBSPLightBytes );
+	AddLightGridLumps( header );
+	AddLump( (bspHeader_t*) header, LUMP_ENTITIES, bspEntData, bspEntDataSize );
+	AddLump( (bspHeader_t*) header, LUMP_FOGS, bspFogs, numBSPFogs * sizeof( bspFog_t ) );
+	AddLump( (bspHeader_t*) header, LUMP_DRAWINDEXES, bspDrawIndexes, numBSPDrawIndexes * sizeof( bspDrawIndexes[ 0 ] ) );
+
+	/* write the completed header and the lumps */
+	size = WriteBSPLumps( filename, header, sizeof( *header ) );
 
 	/* emit bsp size */
-	size = ftell( file );
 	Sys_Printf( "Wrote %.1f MB (%d bytes)\n", (float) size / ( 1024 * 1024 ), size );
-
-	/* write the completed header */
-	fseek( file, 0, SEEK_SET );
-	SafeWrite( file, header, sizeof( *header ) );
-
-	/* close the file */
-	fclose( file );
 }
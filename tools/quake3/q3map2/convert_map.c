@@ -297,12 +297,12 @@ static void ConvertModel( FILE *f, bspModel_t *model, int modelNum, vec3_t origi
 
 	/* convert bsp planes to map planes */
 	nummapplanes = numBSPPlanes;
+	AUTOEXPAND_BY_REALLOC( mapplanes, nummapplanes, allocatedmapplanes, 1024 );
 	for ( i = 0; i < numBSPPlanes; i++ )
 	{
 		VectorCopy( bspPlanes[ i ].normal, mapplanes[ i ].normal );
 		mapplanes[ i ].dist = bspPlanes[ i ].dist;
 		mapplanes[ i ].type = PlaneTypeForNormal( mapplanes[ i ].normal );
-		mapplanes[ i ].hash_chain = NULL;
 	}
 
 	/* allocate a build brush */
@@ -102,7 +102,7 @@ int ExportEntitiesMain( int argc, char **argv ){
 		
         /* load the bsp */
         Sys_Printf( "Loading %s\n", source );
-        LoadBSPFile( source );
+        LoadBSPFileEntities( source );
 		
         /* export the lightmaps */
         ExportEntities();
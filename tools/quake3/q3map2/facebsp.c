@@ -71,6 +71,34 @@ void    FreeBspFace( face_t *f ) {
 
 
 
+/*
+   BlockSplitAxis()
+   returns the axis of the first block boundary the node crosses and the
+   boundary distance, or -1 if the node lies within a single block
+ */
+
+static int BlockSplitAxis( node_t *node, float *dist ){
+	int i;
+
+
+	/* ydnar 2002-06-24: changed this to split on z-axis as well */
+	/* ydnar 2002-09-21: changed blocksize to be a vector, so mappers can specify a 3 element value */
+	for ( i = 0; i < 3; i++ )
+	{
+		if ( blockSize[ i ] <= 0 ) {
+			continue;
+		}
+		*dist = blockSize[ i ] * ( floor( node->mins[ i ] / blockSize[ i ] ) + 1 );
+		if ( node->maxs[ i ] > *dist ) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+
+
 /*
    SelectSplitPlaneNum()
    finds the best split plane for this node
@@ -94,23 +122,14 @@ static void SelectSplitPlaneNum( node_t *node, face_t *list, int *splitPlaneNum,
 	*splitPlaneNum = -1; /* leaf */
 	*compileFlags = 0;
 
-	/* ydnar 2002-06-24: changed this to split on z-axis as well */
-	/* ydnar 2002-09-21: changed blocksize to be a vector, so mappers can specify a 3 element value */
-
 	/* if it is crossing a block boundary, force a split */
-	for ( i = 0; i < 3; i++ )
-	{
-		if ( blockSize[ i ] <= 0 ) {
-			continue;
-		}
-		dist = blockSize[ i ] * ( floor( node->mins[ i ] / blockSize[ i ] ) + 1 );
-		if ( node->maxs[ i ] > dist ) {
-			VectorClear( normal );
-			normal[ i ] = 1;
-			planenum = FindFloatPlane( normal, dist, 0, NULL );
-			*splitPlaneNum = planenum;
-			return;
-		}
+	i = BlockSplitAxis( node, &dist );
+	if ( i >= 0 ) {
+		VectorClear( normal );
+		normal[ i ] = 1;
+		planenum = FindFloatPlane( normal, dist, 0, NULL );
+		*splitPlaneNum = planenum;
+		return;
 	}
 
 	/* pick one of the face planes */
@@ -188,7 +207,10 @@ static void SelectSplitPlaneNum( node_t *node, face_t *list, int *splitPlaneNum,
 	*splitPlaneNum = bestSplit->planenum;
 	*compileFlags = bestSplit->compileFlags;
 
-	if (*splitPlaneNum>-1) mapplanes[ *splitPlaneNum ].counter++;
+	/* only the alternate weights read the counter (and then the tree is built serially) */
+	if ( bspAlternateSplitWeights && *splitPlaneNum > -1 ) {
+		mapplanes[ *splitPlaneNum ].counter++;
+	}
 }
 
 
@@ -211,25 +233,22 @@ int CountFaceList( face_t *list ){
 
 
 /*
-   BuildFaceTree_r()
-   recursively builds the bsp, splitting on face planes
+   SplitFaceNode()
+   selects the split plane for a node, partitions its face list into the two
+   child lists and allocates the children, returns qfalse if the node is a leaf
  */
 
-void BuildFaceTree_r( node_t *node, face_t *list ){
+static qboolean SplitFaceNode( node_t *node, face_t *list, face_t *childLists[ 2 ] ){
 	face_t      *split;
 	face_t      *next;
 	int side;
 	plane_t     *plane;
 	face_t      *newFace;
-	face_t      *childLists[2];
 	winding_t   *frontWinding, *backWinding;
 	int i;
 	int splitPlaneNum, compileFlags;
 
 
-	/* count faces left */
-	i = CountFaceList( list );
-
 	/* select the best split plane */
 	SelectSplitPlaneNum( node, list, &splitPlaneNum, &compileFlags );
 
@@ -237,8 +256,10 @@ void BuildFaceTree_r( node_t *node, face_t *list ){
 	if ( splitPlaneNum == -1 ) {
 		node->planenum = PLANENUM_LEAF;
 		node->has_structural_children = qfalse;
+		ThreadLock();
 		c_faceLeafs++;
-		return;
+		ThreadUnlock();
+		return qfalse;
 	}
 
 	/* partition the list */
@@ -318,6 +339,27 @@ void BuildFaceTree_r( node_t *node, face_t *list ){
 		}
 	}
 
+	return qtrue;
+}
+
+
+
+/*
+   BuildFaceTree_r()
+   recursively builds the bsp, splitting on face planes
+ */
+
+void BuildFaceTree_r( node_t *node, face_t *list ){
+	face_t      *childLists[2];
+	int i;
+
+
+	/* split the node */
+	if ( !SplitFaceNode( node, list, childLists ) ) {
+		return;
+	}
+
+	/* recursively process children */
 	for ( i = 0 ; i < 2 ; i++ ) {
 		BuildFaceTree_r( node->children[i], childLists[i] );
 		node->has_structural_children |= node->children[i]->has_structural_children;
@@ -325,6 +367,83 @@ void BuildFaceTree_r( node_t *node, face_t *list ){
 }
 
 
+
+/* subtrees queued for the worker threads */
+typedef struct faceTreeTask_s
+{
+	node_t              *node;
+	face_t              *list;
+}
+faceTreeTask_t;
+
+static faceTreeTask_t   *faceTreeTasks;
+static int numFaceTreeTasks, allocatedFaceTreeTasks;
+
+
+
+/*
+   QueueFaceTree_r()
+   splits the top levels of the tree serially and queues the subtrees below them
+   as independent tasks. block splits are kept out of the tasks as they can add
+   planes, face splits only use existing planes so the subtrees never touch shared state
+ */
+
+static void QueueFaceTree_r( node_t *node, face_t *list, int levels ){
+	face_t      *childLists[2];
+	float dist;
+	int i;
+
+
+	/* queue the subtree */
+	if ( levels <= 0 && BlockSplitAxis( node, &dist ) < 0 ) {
+		AUTOEXPAND_BY_REALLOC( faceTreeTasks, numFaceTreeTasks, allocatedFaceTreeTasks, 64 );
+		faceTreeTasks[ numFaceTreeTasks ].node = node;
+		faceTreeTasks[ numFaceTreeTasks ].list = list;
+		numFaceTreeTasks++;
+		return;
+	}
+
+	/* split the node */
+	if ( !SplitFaceNode( node, list, childLists ) ) {
+		return;
+	}
+
+	for ( i = 0 ; i < 2 ; i++ )
+		QueueFaceTree_r( node->children[i], childLists[i], levels - 1 );
+}
+
+
+
+/*
+   BuildFaceTreeTask()
+   threaded worker, builds one queued subtree
+ */
+
+static void BuildFaceTreeTask( int num ){
+	BuildFaceTree_r( faceTreeTasks[ num ].node, faceTreeTasks[ num ].list );
+}
+
+
+
+/*
+   MergeStructuralChildren_r()
+   carries has_structural_children up from the subtrees once they are built
+ */
+
+static void MergeStructuralChildren_r( node_t *node ){
+	int i;
+
+
+	if ( node->planenum == PLANENUM_LEAF ) {
+		return;
+	}
+	for ( i = 0 ; i < 2 ; i++ ) {
+		MergeStructuralChildren_r( node->children[i] );
+		node->has_structural_children |= node->children[i]->has_structural_children;
+	}
+}
+
+
 /*
    ================
    FaceBSP
@@ -337,6 +456,7 @@ tree_t *FaceBSP( face_t *list ) {
 	face_t  *face;
 	int i;
 	int count;
+	int levels;
 
 	Sys_FPrintf( SYS_VRB, "--- FaceBSP ---\n" );
 
@@ -363,7 +483,19 @@ tree_t *FaceBSP( face_t *list ) {
 	VectorCopy( tree->maxs, tree->headnode->maxs );
 	c_faceLeafs = 0;
 
-	BuildFaceTree_r( tree->headnode, list );
+	/* the alternate split weights depend on the order planes were used in, so that build stays serial */
+	if ( numthreads <= 1 || bspAlternateSplitWeights ) {
+		BuildFaceTree_r( tree->headnode, list );
+	}
+	else
+	{
+		/* split serially until there are enough subtrees to keep the threads busy, then build them in parallel */
+		for ( levels = 0; ( 1 << levels ) < numthreads * 8; levels++ ) ;
+		numFaceTreeTasks = 0;
+		QueueFaceTree_r( tree->headnode, list, levels );
+		RunThreadsOnIndividual( numFaceTreeTasks, qfalse, BuildFaceTreeTask );
+		MergeStructuralChildren_r( tree->headnode );
+	}
 
 	Sys_FPrintf( SYS_VRB, "%9d leafs\n", c_faceLeafs );
 
@@ -86,11 +86,12 @@ int FixAASMain( int argc, char **argv ){
 
 	/* load the bsp */
 	Sys_Printf( "Loading %s\n", source );
-	length = LoadFile( source, &buffer );
+	length = MapFile( source, &buffer );
 
 	/* create bsp checksum */
 	Sys_Printf( "Creating checksum...\n" );
 	checksum = LittleLong( MD4BlockChecksum( buffer, length ) );
+	UnmapFile( buffer, length );
 
 	/* write checksum to aas */
 	ext = exts;
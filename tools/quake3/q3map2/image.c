@@ -40,8 +40,8 @@
 
 /* -------------------------------------------------------------------------------
 
-   this file contains image pool management with reference counting. note: it isn't
-   reentrant, so only call it from init/shutdown code or wrap calls in a mutex
+   this file contains image pool management with reference counting. the pool is
+   guarded by ThreadLock, so images can be loaded from worker threads
 
    ------------------------------------------------------------------------------- */
 
@@ -229,6 +229,120 @@ static void LoadPNGBuffer( byte *buffer, int size, byte **pixels, int *width, in
 
 
 
+/*
+   image registry
+   images are allocated individually (shaderInfo_t keeps pointers to them) and indexed by
+   name in an open-addressed hash table. failed loads stay in the table with NULL pixels so
+   a missing image only hits the vfs once. freed images keep their struct as a tombstone
+   and are dropped from the table on the next rehash
+ */
+
+static image_t **imageTable = NULL;
+static int imageTableSize = 0;
+static int imageTableUsed = 0;
+
+
+
+/*
+   ImageNameHash()
+   fnv-1a hash of an extensionless image name
+ */
+
+static unsigned int ImageNameHash( const char *name ){
+	unsigned int hash = 2166136261u;
+
+
+	while ( *name )
+	{
+		hash ^= (byte) *name++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+
+
+/*
+   ImageTableSlot()
+   returns the table slot holding the named image, or the empty slot it would go into
+ */
+
+static image_t **ImageTableSlot( const char *name ){
+	unsigned int mask, i;
+	image_t     *image;
+
+
+	mask = imageTableSize - 1;
+	for ( i = ImageNameHash( name ) & mask; ; i = ( i + 1 ) & mask )
+	{
+		image = imageTable[ i ];
+		if ( image == NULL || ( image->name != NULL && !strcmp( image->name, name ) ) ) {
+			return &imageTable[ i ];
+		}
+	}
+}
+
+
+
+/*
+   ImageTableGrow()
+   makes room for one more image, rehashing live entries into a larger table when half full
+ */
+
+static void ImageTableGrow( void ){
+	int i, oldSize, live;
+	image_t     **oldTable;
+
+
+	if ( ( imageTableUsed + 1 ) * 2 <= imageTableSize ) {
+		return;
+	}
+
+	/* count live entries so a table full of tombstones doesn't keep doubling */
+	live = 0;
+	for ( i = 0; i < imageTableSize; i++ )
+	{
+		if ( imageTable[ i ] != NULL && imageTable[ i ]->name != NULL ) {
+			live++;
+		}
+	}
+
+	oldTable = imageTable;
+	oldSize = imageTableSize;
+	if ( imageTableSize < 256 ) {
+		imageTableSize = 256;
+	}
+	while ( ( live + 1 ) * 4 > imageTableSize )
+		imageTableSize *= 2;
+
+	imageTable = safe_malloc( imageTableSize * sizeof( *imageTable ) );
+	memset( imageTable, 0, imageTableSize * sizeof( *imageTable ) );
+	imageTableUsed = 0;
+	for ( i = 0; i < oldSize; i++ )
+	{
+		if ( oldTable[ i ] != NULL && oldTable[ i ]->name != NULL ) {
+			*ImageTableSlot( oldTable[ i ]->name ) = oldTable[ i ];
+			imageTableUsed++;
+		}
+	}
+	free( oldTable );
+}
+
+
+
+/*
+   ImageTableInsert()
+   adds a new image to the registry; caller must have checked it isn't already there
+ */
+
+static void ImageTableInsert( image_t *image ){
+	ImageTableGrow();
+	*ImageTableSlot( image->name ) = image;
+	imageTableUsed++;
+}
+
+
+
 /*
    ImageInit()
    implicitly called by every function to set up image list
@@ -236,23 +350,24 @@ static void LoadPNGBuffer( byte *buffer, int size, byte **pixels, int *width, in
 
 static void ImageInit( void ){
 	int i;
+	image_t     *image;
 
 
-	if ( numImages <= 0 ) {
-		/* clear images (fixme: this could theoretically leak) */
-		memset( images, 0, sizeof( images ) );
-
+	if ( imageTable == NULL ) {
 		/* generate *bogus image */
-		images[ 0 ].name = safe_malloc( strlen( DEFAULT_IMAGE ) + 1 );
-		strcpy( images[ 0 ].name, DEFAULT_IMAGE );
-		images[ 0 ].filename = safe_malloc( strlen( DEFAULT_IMAGE ) + 1 );
-		strcpy( images[ 0 ].filename, DEFAULT_IMAGE );
-		images[ 0 ].width = 64;
-		images[ 0 ].height = 64;
-		images[ 0 ].refCount = 1;
-		images[ 0 ].pixels = safe_malloc( 64 * 64 * 4 );
+		image = safe_malloc( sizeof( *image ) );
+		memset( image, 0, sizeof( *image ) );
+		image->name = safe_malloc( strlen( DEFAULT_IMAGE ) + 1 );
+		strcpy( image->name, DEFAULT_IMAGE );
+		image->filename = safe_malloc( strlen( DEFAULT_IMAGE ) + 1 );
+		strcpy( image->filename, DEFAULT_IMAGE );
+		image->width = 64;
+		image->height = 64;
+		image->refCount = 1;
+		image->pixels = safe_malloc( 64 * 64 * 4 );
 		for ( i = 0; i < ( 64 * 64 * 4 ); i++ )
-			images[ 0 ].pixels[ i ] = 255;
+			image->pixels[ i ] = 255;
+		ImageTableInsert( image );
 	}
 }
 
@@ -269,6 +384,8 @@ void ImageFree( image_t *image ){
 		return;
 	}
 
+	ThreadLock();
+
 	/* decrement refcount */
 	image->refCount--;
 
@@ -283,10 +400,13 @@ void ImageFree( image_t *image ){
 		}
 		image->filename = NULL;
 		free( image->pixels );
+		image->pixels = NULL;
 		image->width = 0;
 		image->height = 0;
 		numImages--;
 	}
+
+	ThreadUnlock();
 }
 
 
@@ -297,13 +417,10 @@ void ImageFree( image_t *image ){
  */
 
 image_t *ImageFind( const char *filename ){
-	int i;
+	image_t     *image;
 	char name[ 1024 ];
 
 
-	/* init */
-	ImageInit();
-
 	/* dummy check */
 	if ( filename == NULL || filename[ 0 ] == '\0' ) {
 		return NULL;
@@ -313,96 +430,62 @@ image_t *ImageFind( const char *filename ){
 	strcpy( name, filename );
 	StripExtension( name );
 
-	/* search list */
-	for ( i = 0; i < MAX_IMAGES; i++ )
-	{
-		if ( images[ i ].name != NULL && !strcmp( name, images[ i ].name ) ) {
-			return &images[ i ];
-		}
+	/* search the registry, skipping remembered misses */
+	ThreadLock();
+	ImageInit();
+	image = *ImageTableSlot( name );
+	ThreadUnlock();
+	if ( image == NULL || image->pixels == NULL ) {
+		return NULL;
 	}
-
-	/* no matching image found */
-	return NULL;
+	return image;
 }
 
 
 
 /*
-   ImageLoad()
-   loads an rgba image and returns a pointer to the image_t struct or NULL if not found
+   ImageLoadFile()
+   tries each supported extension for an image name, decoding into the passed-in
+   pixels/width/height; returns the size of the file found or 0. the vfs is serialized,
+   decoding isn't, so this can run from several threads at once
  */
 
-image_t *ImageLoad( const char *filename ){
-	int i;
-	image_t     *image;
-	char name[ 1024 ];
+static int ImageLoadFile( char *name, byte **pixels, int *width, int *height ){
 	int size;
 	byte        *buffer = NULL;
 
 
-	/* init */
-	ImageInit();
-
-	/* dummy check */
-	if ( filename == NULL || filename[ 0 ] == '\0' ) {
-		return NULL;
-	}
-
-	/* strip file extension off name */
-	strcpy( name, filename );
-	StripExtension( name );
-
-	/* try to find existing image */
-	image = ImageFind( name );
-	if ( image != NULL ) {
-		image->refCount++;
-		return image;
-	}
-
-	/* none found, so find first non-null image */
-	image = NULL;
-	for ( i = 0; i < MAX_IMAGES; i++ )
-	{
-		if ( images[ i ].name == NULL ) {
-			image = &images[ i ];
-			break;
-		}
-	}
-
-	/* too many images? */
-	if ( image == NULL ) {
-		Error( "MAX_IMAGES (%d) exceeded, there are too many image files referenced by the map.", MAX_IMAGES );
-	}
-
-	/* set it up */
-	image->name = safe_malloc( strlen( name ) + 1 );
-	strcpy( image->name, name );
-
 	/* attempt to load tga */
 	StripExtension( name );
 	strcat( name, ".tga" );
+	ThreadLock();
 	size = vfsLoadFile( (const char*) name, (void**) &buffer, 0 );
+	ThreadUnlock();
 	if ( size > 0 ) {
-		LoadTGABuffer( buffer, buffer + size, &image->pixels, &image->width, &image->height );
+		LoadTGABuffer( buffer, buffer + size, pixels, width, height );
 	}
 	else
 	{
 		/* attempt to load png */
 		StripExtension( name );
 		strcat( name, ".png" );
+		ThreadLock();
 		size = vfsLoadFile( (const char*) name, (void**) &buffer, 0 );
+		ThreadUnlock();
 		if ( size > 0 ) {
-			LoadPNGBuffer( buffer, size, &image->pixels, &image->width, &image->height );
+			LoadPNGBuffer( buffer, size, pixels, width, height );
 		}
 		else
 		{
 			/* attempt to load jpg */
 			StripExtension( name );
 			strcat( name, ".jpg" );
+			ThreadLock();
 			size = vfsLoadFile( (const char*) name, (void**) &buffer, 0 );
+			ThreadUnlock();
 			if ( size > 0 ) {
-				if ( LoadJPGBuff( buffer, size, &image->pixels, &image->width, &image->height ) == -1 && image->pixels != NULL ) {
-					Sys_FPrintf( SYS_WRN, "WARNING: LoadJPGBuff: %s\n", (unsigned char*) image->pixels );
+				if ( LoadJPGBuff( buffer, size, pixels, width, height ) == -1 && *pixels != NULL ) {
+					Sys_FPrintf( SYS_WRN, "WARNING: LoadJPGBuff: %s\n", (unsigned char*) *pixels );
 				}
 			}
 			else
@@ -410,9 +493,11 @@ image_t *ImageLoad( const char *filename ){
 				/* attempt to load dds */
 				StripExtension( name );
 				strcat( name, ".dds" );
+				ThreadLock();
 				size = vfsLoadFile( (const char*) name, (void**) &buffer, 0 );
+				ThreadUnlock();
 				if ( size > 0 ) {
-					LoadDDSBuffer( buffer, size, &image->pixels, &image->width, &image->height );
+					LoadDDSBuffer( buffer, size, pixels, width, height );
 
 					/* debug code */
 					#if 1
@@ -420,10 +505,10 @@ image_t *ImageLoad( const char *filename ){
 						ddsPF_t pf;
 						DDSGetInfo( (ddsBuffer_t*) buffer, NULL, NULL, &pf );
 						Sys_Printf( "pf = %d\n", pf );
-						if ( image->width > 0 ) {
+						if ( *width > 0 ) {
 							StripExtension( name );
 							strcat( name, "_converted.tga" );
-							WriteTGA( "C:\\games\\quake3\\baseq3\\textures\\rad\\dds_converted.tga", image->pixels, image->width, image->height );
+							WriteTGA( "C:\\games\\quake3\\baseq3\\textures\\rad\\dds_converted.tga", *pixels, *width, *height );
 						}
 					}
 					#endif
@@ -435,23 +520,99 @@ image_t *ImageLoad( const char *filename ){
 	/* free file buffer */
 	free( buffer );
 
+	return size > 0 ? size : 0;
+}
+
+
+
+/*
+   ImageLoad()
+   loads an rgba image and returns a pointer to the image_t struct or NULL if not found
+   ydnar: thread safe; two threads racing on the same image both decode it and the loser
+   throws its copy away
+ */
+
+image_t *ImageLoad( const char *filename ){
+	image_t     *image, **slot;
+	char name[ 1024 ], path[ 1024 ];
+	int size, width = 0, height = 0;
+	byte        *pixels = NULL;
+
+
+	/* dummy check */
+	if ( filename == NULL || filename[ 0 ] == '\0' ) {
+		return NULL;
+	}
+
+	/* strip file extension off name */
+	strcpy( name, filename );
+	StripExtension( name );
+
+	/* try to find existing image (or a remembered miss) */
+	ThreadLock();
+	ImageInit();
+	image = *ImageTableSlot( name );
+	if ( image != NULL ) {
+		if ( image->pixels != NULL ) {
+			image->refCount++;
+		}
+		else{
+			image = NULL;
+		}
+		ThreadUnlock();
+		return image;
+	}
+	ThreadUnlock();
+
+	/* load it outside the lock */
+	strcpy( path, name );
+	size = ImageLoadFile( path, &pixels, &width, &height );
+
 	/* make sure everything's kosher */
-	if ( size <= 0 || image->width <= 0 || image->height <= 0 || image->pixels == NULL ) {
+	if ( size <= 0 || width <= 0 || height <= 0 || pixels == NULL ) {
 		//%	Sys_Printf( "size = %d  width = %d  height = %d  pixels = 0x%08x (%s)\n",
-		//%		size, image->width, image->height, image->pixels, name );
-		free( image->name );
-		image->name = NULL;
-		return NULL;
+		//%		size, width, height, pixels, path );
+		free( pixels );
+		pixels = NULL;
+		width = height = 0;
 	}
 
-	/* set filename */
-	image->filename = safe_malloc( strlen( name ) + 1 );
-	strcpy( image->filename, name );
+	/* someone else may have loaded it meanwhile */
+	ThreadLock();
+	slot = ImageTableSlot( name );
+	image = *slot;
+	if ( image != NULL ) {
+		free( pixels );
+		if ( image->pixels != NULL ) {
+			image->refCount++;
+		}
+		else{
+			image = NULL;
+		}
+		ThreadUnlock();
+		return image;
+	}
 
-	/* set count */
-	image->refCount = 1;
-	numImages++;
+	/* set it up */
+	image = safe_malloc( sizeof( *image ) );
+	memset( image, 0, sizeof( *image ) );
+	image->name = safe_malloc( strlen( name ) + 1 );
+	strcpy( image->name, name );
+	image->pixels = pixels;
+	image->width = width;
+	image->height = height;
+	if ( pixels != NULL ) {
+		/* set filename */
+		image->filename = safe_malloc( strlen( path ) + 1 );
+		strcpy( image->filename, path );
+
+		/* set count */
+		image->refCount = 1;
+		numImages++;
+	}
+	ImageTableInsert( image );
+	ThreadUnlock();
 
-	/* return the image */
-	return image;
+	/* return the image (NULL for a miss) */
+	return pixels != NULL ? image : NULL;
 }
@@ -1396,8 +1396,9 @@ void TraceGrid( int num ){
 	trace.recvShadows = WORLDSPAWN_RECV_SHADOWS;
 	trace.numSurfaces = 0;
 	trace.surfaces = NULL;
-	trace.numLights = 0;
-	trace.lights = NULL;
+
+	/* get the lights that may reach this grid point */
+	CreateTraceLightsForPoint( trace.origin, &trace );
 
 	/* clear */
 	numCon = 0;
@@ -1405,11 +1406,14 @@ void TraceGrid( int num ){
 
 	/* trace to all the lights, find the major light direction, and divide the
 	   total light between that along the direction and the remaining in the ambient */
-	for ( trace.light = lights; trace.light != NULL; trace.light = trace.light->next )
+	for ( i = 0; i < trace.numLights; i++ )
 	{
 		float addSize;
 
 
+		/* get light */
+		trace.light = trace.lights[ i ];
+
 		/* sample light */
 		if ( !LightContributionToPoint( &trace ) ) {
 			continue;
@@ -1666,6 +1670,258 @@ void SetupGrid( void ){
 
 
 
+/*
+   TraceLightGrid()
+   traces every point of the lightgrid
+ */
+
+static void TraceLightGrid( void ){
+	/* ydnar: set up light envelopes */
+	SetupEnvelopes( qtrue, fastgrid );
+
+	Sys_Printf( "--- TraceGrid ---\n" );
+	ProfileBegin( "TraceGrid" );
+	RunThreadsOnIndividual( numRawGridPoints, qtrue, TraceGrid );
+	ProfileEnd();
+	Sys_Printf( "%d x %d x %d = %d grid\n",
+				gridBounds[ 0 ], gridBounds[ 1 ], gridBounds[ 2 ], numBSPGridPoints );
+
+	/* ydnar: emit statistics on light culling */
+	Sys_FPrintf( SYS_VRB, "%9d grid points envelope culled\n", gridEnvelopeCulled );
+	Sys_FPrintf( SYS_VRB, "%9d grid points bounds culled\n", gridBoundsCulled );
+}
+
+
+
+/*
+   LightPassFits()
+   checks if a progressive lighting pass expected to take the given
+   number of seconds still fits in the -timebudget
+ */
+
+static double lightStartTime;
+
+static qboolean LightPassFits( const char *pass, double estimate ){
+	double elapsed;
+
+
+	/* no budget */
+	if ( lightTimeBudget <= 0.0f ) {
+		return qtrue;
+	}
+
+	/* test it */
+	elapsed = I_FloatTime() - lightStartTime;
+	if ( ( elapsed + estimate ) <= lightTimeBudget ) {
+		return qtrue;
+	}
+
+	/* note it */
+	Sys_Printf( "Time budget: skipping %s, %.0f of %.0f seconds used and it would take about %.0f more\n",
+				pass, elapsed, lightTimeBudget, estimate );
+	return qfalse;
+}
+
+
+
+/*
+   TraceGridPreview()
+   traces the first grid point of a 2x2x2 block for the progressive lighting preview
+ */
+
+static void TraceGridPreview( int num ){
+	int x, y, z, blocksX, blocksY;
+
+
+	/* get block */
+	blocksX = ( gridBounds[ 0 ] + 1 ) / 2;
+	blocksY = ( gridBounds[ 1 ] + 1 ) / 2;
+	x = ( num % blocksX ) * 2;
+	y = ( ( num / blocksX ) % blocksY ) * 2;
+	z = ( num / ( blocksX * blocksY ) ) * 2;
+
+	/* trace its first point */
+	TraceGrid( ( ( z * gridBounds[ 1 ] ) + y ) * gridBounds[ 0 ] + x );
+}
+
+
+
+/*
+   LightPreview()
+   lights and writes a progressive lighting preview, tracing one grid point
+   per 2x2x2 block and one luxel per 2x2 block of lightmap pixels without
+   filtering or supersampling, then puts everything back for the full pass.
+   returns qfalse if the time budget has no room left for the full pass.
+ */
+
+static qboolean LightPreview( void ){
+	int i, x, y, z, lightmapNum, size, numSuperLuxels, numBlocks;
+	float               *savedLuxels, *luxels;
+	int                 *savedClusters, *clusters;
+	rawGridPoint_t      *savedRawGrid;
+	bspGridPoint_t      *savedBSPGrid;
+	double start, grid, illuminate, rest;
+	rawLightmap_t       *lm;
+
+
+	/* note it */
+	Sys_Printf( "--- LightPreview ---\n" );
+	ProfileBegin( "Preview" );
+
+	/* save the grid, tracing it adds to the grid points */
+	savedRawGrid = NULL;
+	savedBSPGrid = NULL;
+	grid = 0.0;
+	if ( !noGridLighting ) {
+		savedRawGrid = safe_malloc( numRawGridPoints * sizeof( *rawGridPoints ) );
+		memcpy( savedRawGrid, rawGridPoints, numRawGridPoints * sizeof( *rawGridPoints ) );
+		savedBSPGrid = safe_malloc( numBSPGridPoints * sizeof( *bspGridPoints ) );
+		memcpy( savedBSPGrid, bspGridPoints, numBSPGridPoints * sizeof( *bspGridPoints ) );
+
+		/* trace a point per block */
+		start = I_FloatTime();
+		SetupEnvelopes( qtrue, fastgrid );
+		numBlocks = ( ( gridBounds[ 0 ] + 1 ) / 2 ) * ( ( gridBounds[ 1 ] + 1 ) / 2 ) * ( ( gridBounds[ 2 ] + 1 ) / 2 );
+		ProfileBegin( "TraceGrid" );
+		RunThreadsOnIndividual( numBlocks, qtrue, TraceGridPreview );
+		ProfileEnd();
+
+		/* copy it to the rest of the block */
+		for ( i = 0; i < numBSPGridPoints; i++ )
+		{
+			x = i % gridBounds[ 0 ];
+			y = ( i / gridBounds[ 0 ] ) % gridBounds[ 1 ];
+			z = i / ( gridBounds[ 0 ] * gridBounds[ 1 ] );
+			bspGridPoints[ i ] = bspGridPoints[ ( ( ( z & ~1 ) * gridBounds[ 1 ] ) + ( y & ~1 ) ) * gridBounds[ 0 ] + ( x & ~1 ) ];
+		}
+		grid = I_FloatTime() - start;
+	}
+
+	/* save the mapped luxels, lighting and storing the preview changes them */
+	numSuperLuxels = 0;
+	for ( i = 0; i < numRawLightmaps; i++ )
+		numSuperLuxels += rawLightmaps[ i ].sw * rawLightmaps[ i ].sh;
+	savedLuxels = safe_malloc( numSuperLuxels * SUPER_LUXEL_SIZE * sizeof( float ) );
+	savedClusters = safe_malloc( numSuperLuxels * sizeof( int ) );
+	luxels = savedLuxels;
+	clusters = savedClusters;
+	for ( i = 0; i < numRawLightmaps; i++ )
+	{
+		lm = &rawLightmaps[ i ];
+		size = lm->sw * lm->sh;
+		memcpy( luxels, lm->superLuxels[ 0 ], size * SUPER_LUXEL_SIZE * sizeof( float ) );
+		memcpy( clusters, lm->superClusters, size * sizeof( int ) );
+		luxels += size * SUPER_LUXEL_SIZE;
+		clusters += size;
+	}
+
+	/* illuminate a luxel per block */
+	start = I_FloatTime();
+	SetupEnvelopes( qfalse, fast );
+	lightSampleStep = 2 * superSample;
+	ProfileBegin( "IlluminateRawLightmap" );
+	RunThreadsOnIndividual( numRawLightmaps, qtrue, IlluminateRawLightmap );
+	ProfileEnd();
+	lightSampleStep = 1;
+	illuminate = I_FloatTime() - start;
+	Sys_Printf( "%9d luxels illuminated\n", numLuxelsIlluminated );
+
+	/* finish it like the full pass */
+	start = I_FloatTime();
+	ProfileBegin( "StitchSurfaceLightmaps" );
+	StitchSurfaceLightmaps();
+	ProfileEnd();
+
+	Sys_Printf( "--- IlluminateVertexes ---\n" );
+	ProfileBegin( "IlluminateVertexes" );
+	RunThreadsOnIndividual( numBSPDrawSurfaces, qtrue, IlluminateVertexes );
+	ProfileEnd();
+	Sys_Printf( "%9d vertexes illuminated\n", numVertsIlluminated );
+
+	ProfileBegin( "StoreSurfaceLightmaps" );
+	StoreSurfaceLightmaps();
+	ProfileEnd();
+	rest = I_FloatTime() - start;
+	ProfileEnd();
+
+	/* the full pass traces every grid point and luxel of the blocks, keep the preview if it doesn't fit */
+	if ( !LightPassFits( "full lighting", grid * 8 + illuminate * 4 * superSample * superSample + rest ) ) {
+		free( savedRawGrid );
+		free( savedBSPGrid );
+		free( savedLuxels );
+		free( savedClusters );
+		return qfalse;
+	}
+
+	/* write the preview */
+	Sys_Printf( "Writing %s\n", source );
+	ProfileBegin( "WriteBSPFile" );
+	WriteBSPFile( source );
+	ProfileEnd();
+
+	/* put the grid back */
+	if ( !noGridLighting ) {
+		memcpy( rawGridPoints, savedRawGrid, numRawGridPoints * sizeof( *rawGridPoints ) );
+		memcpy( bspGridPoints, savedBSPGrid, numBSPGridPoints * sizeof( *bspGridPoints ) );
+		free( savedRawGrid );
+		free( savedBSPGrid );
+	}
+
+	/* put the raw lightmaps back the way the full pass expects them */
+	luxels = savedLuxels;
+	clusters = savedClusters;
+	for ( i = 0; i < numRawLightmaps; i++ )
+	{
+		lm = &rawLightmaps[ i ];
+		size = lm->sw * lm->sh;
+		memcpy( lm->superLuxels[ 0 ], luxels, size * SUPER_LUXEL_SIZE * sizeof( float ) );
+		memcpy( lm->superClusters, clusters, size * sizeof( int ) );
+		luxels += size * SUPER_LUXEL_SIZE;
+		clusters += size;
+		if ( lm->superDeluxels != NULL ) {
+			memset( lm->superDeluxels, 0, size * SUPER_DELUXEL_SIZE * sizeof( float ) );
+		}
+		if ( lm->bspLuxels[ 0 ] != NULL ) {
+			memset( lm->bspLuxels[ 0 ], 0, lm->w * lm->h * BSP_LUXEL_SIZE * sizeof( float ) );
+		}
+		if ( lm->bspDeluxels != NULL ) {
+			memset( lm->bspDeluxels, 0, lm->w * lm->h * BSP_DELUXEL_SIZE * sizeof( float ) );
+		}
+		for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
+		{
+			lm->twins[ lightmapNum ] = NULL;
+			if ( lightmapNum == 0 ) {
+				continue;
+			}
+			free( lm->superLuxels[ lightmapNum ] );
+			free( lm->bspLuxels[ lightmapNum ] );
+			free( lm->radLuxels[ lightmapNum ] );
+			lm->superLuxels[ lightmapNum ] = NULL;
+			lm->bspLuxels[ lightmapNum ] = NULL;
+			lm->radLuxels[ lightmapNum ] = NULL;
+			lm->styles[ lightmapNum ] = LS_NONE;
+		}
+	}
+	free( savedLuxels );
+	free( savedClusters );
+
+	/* vertex light is added up too */
+	for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
+	{
+		memset( vertexLuxels[ lightmapNum ], 0, numBSPDrawVerts * VERTEX_LUXEL_SIZE * sizeof( float ) );
+		memset( radVertexLuxels[ lightmapNum ], 0, numBSPDrawVerts * VERTEX_LUXEL_SIZE * sizeof( float ) );
+	}
+
+	/* reset the counts for the full pass */
+	gridEnvelopeCulled = 0;
+	gridBoundsCulled = 0;
+	numLuxelsIlluminated = 0;
+	numVertsIlluminated = 0;
+	return qtrue;
+}
+
+
+
 /*
    LightWorld()
    does what it says...
@@ -1675,6 +1931,7 @@ void LightWorld( void ){
 	vec3_t color;
 	float f;
 	int b, bt;
+	double passStart, passTime;
 	qboolean minVertex, minGrid;
 	const char  *value;
 
@@ -1682,7 +1939,9 @@ void LightWorld( void ){
 	/* ydnar: smooth normals */
 	if ( shade ) {
 		Sys_Printf( "--- SmoothNormals ---\n" );
+		ProfileBegin( "SmoothNormals" );
 		SmoothNormals();
+		ProfileEnd();
 	}
 
 	/* determine the number of grid points */
@@ -1735,26 +1994,18 @@ void LightWorld( void ){
 
 	/* create world lights */
 	Sys_FPrintf( SYS_VRB, "--- CreateLights ---\n" );
+	ProfileBegin( "CreateLights" );
 	CreateEntityLights();
 	CreateSurfaceLights();
+	ProfileEnd();
 	Sys_Printf( "%9d point lights\n", numPointLights );
 	Sys_Printf( "%9d spotlights\n", numSpotLights );
 	Sys_Printf( "%9d diffuse (area) lights\n", numDiffuseLights );
 	Sys_Printf( "%9d sun/sky lights\n", numSunLights );
 
-	/* calculate lightgrid */
-	if ( !noGridLighting ) {
-		/* ydnar: set up light envelopes */
-		SetupEnvelopes( qtrue, fastgrid );
-
-		Sys_Printf( "--- TraceGrid ---\n" );
-		RunThreadsOnIndividual( numRawGridPoints, qtrue, TraceGrid );
-		Sys_Printf( "%d x %d x %d = %d grid\n",
-					gridBounds[ 0 ], gridBounds[ 1 ], gridBounds[ 2 ], numBSPGridPoints );
-
-		/* ydnar: emit statistics on light culling */
-		Sys_FPrintf( SYS_VRB, "%9d grid points envelope culled\n", gridEnvelopeCulled );
-		Sys_FPrintf( SYS_VRB, "%9d grid points bounds culled\n", gridBoundsCulled );
+	/* calculate lightgrid (progressive lighting does it after the preview) */
+	if ( !noGridLighting && !progressiveLight ) {
+		TraceLightGrid();
 	}
 
 	/* slight optimization to remove a sqrt */
@@ -1762,21 +2013,36 @@ void LightWorld( void ){
 
 	/* map the world luxels */
 	Sys_Printf( "--- MapRawLightmap ---\n" );
+	ProfileBegin( "MapRawLightmap" );
 	RunThreadsOnIndividual( numRawLightmaps, qtrue, MapRawLightmap );
+	ProfileEnd();
 	Sys_Printf( "%9d luxels\n", numLuxels );
 	Sys_Printf( "%9d luxels mapped\n", numLuxelsMapped );
 	Sys_Printf( "%9d luxels occluded\n", numLuxelsOccluded );
 
+	/* progressive lighting writes a quick preview before the expensive passes */
+	if ( progressiveLight && !LightPreview() ) {
+		return;
+	}
+	passStart = I_FloatTime();
+	if ( progressiveLight && !noGridLighting ) {
+		TraceLightGrid();
+	}
+
 	/* dirty them up */
 	if ( dirty ) {
 		Sys_Printf( "--- DirtyRawLightmap ---\n" );
+		ProfileBegin( "DirtyRawLightmap" );
 		RunThreadsOnIndividual( numRawLightmaps, qtrue, DirtyRawLightmap );
+		ProfileEnd();
 	}
 
 	/* floodlight them up */
 	if ( floodlighty ) {
 		Sys_Printf( "--- FloodlightRawLightmap ---\n" );
+		ProfileBegin( "FloodLightRawLightmap" );
 		RunThreadsOnIndividual( numRawLightmaps, qtrue, FloodLightRawLightmap );
+		ProfileEnd();
 	}
 
 	/* ydnar: set up light envelopes */
@@ -1789,13 +2055,26 @@ void LightWorld( void ){
 	lightsClusterCulled = 0;
 
 	Sys_Printf( "--- IlluminateRawLightmap ---\n" );
+	ProfileBegin( "IlluminateRawLightmap" );
 	RunThreadsOnIndividual( numRawLightmaps, qtrue, IlluminateRawLightmap );
+	ProfileEnd();
 	Sys_Printf( "%9d luxels illuminated\n", numLuxelsIlluminated );
 
+	/* ydnar: store the direct lighting before it is stitched */
+	if ( lightCache ) {
+		ProfileBegin( "StoreLightCache" );
+		StoreLightCache();
+		ProfileEnd();
+	}
+
+	ProfileBegin( "StitchSurfaceLightmaps" );
 	StitchSurfaceLightmaps();
+	ProfileEnd();
 
 	Sys_Printf( "--- IlluminateVertexes ---\n" );
+	ProfileBegin( "IlluminateVertexes" );
 	RunThreadsOnIndividual( numBSPDrawSurfaces, qtrue, IlluminateVertexes );
+	ProfileEnd();
 	Sys_Printf( "%9d vertexes illuminated\n", numVertsIlluminated );
 
 	/* ydnar: emit statistics on light culling */
@@ -1803,19 +2082,31 @@ void LightWorld( void ){
 	Sys_FPrintf( SYS_VRB, "%9d lights envelope culled\n", lightsEnvelopeCulled );
 	Sys_FPrintf( SYS_VRB, "%9d lights bounds culled\n", lightsBoundsCulled );
 	Sys_FPrintf( SYS_VRB, "%9d lights cluster culled\n", lightsClusterCulled );
+	passTime = I_FloatTime() - passStart;
 
 	/* radiosity */
 	b = 1;
 	bt = bounce;
 	while ( bounce > 0 )
 	{
+		/* guess a bounce takes as long as the pass before it */
+		if ( !LightPassFits( "radiosity", passTime ) ) {
+			break;
+		}
+		passStart = I_FloatTime();
+
 		/* store off the bsp between bounces */
+		ProfileBegin( "StoreSurfaceLightmaps" );
 		StoreSurfaceLightmaps();
+		ProfileEnd();
 		Sys_Printf( "Writing %s\n", source );
+		ProfileBegin( "WriteBSPFile" );
 		WriteBSPFile( source );
+		ProfileEnd();
 
 		/* note it */
 		Sys_Printf( "\n--- Radiosity (bounce %d of %d) ---\n", b, bt );
+		ProfileBegin( "Radiosity" );
 
 		/* flag bouncing */
 		bouncing = qtrue;
@@ -1824,12 +2115,15 @@ void LightWorld( void ){
 
 		/* generate diffuse lights */
 		RadFreeLights();
+		ProfileBegin( "RadCreateDiffuseLights" );
 		RadCreateDiffuseLights();
+		ProfileEnd();
 
 		/* setup light envelopes */
 		SetupEnvelopes( qfalse, fastbounce );
 		if ( numLights == 0 ) {
 			Sys_Printf( "No diffuse light to calculate, ending radiosity.\n" );
+			ProfileEnd();
 			return;
 		}
 
@@ -1839,7 +2133,9 @@ void LightWorld( void ){
 			gridBoundsCulled = 0;
 
 			Sys_Printf( "--- BounceGrid ---\n" );
+			ProfileBegin( "TraceGrid" );
 			RunThreadsOnIndividual( numRawGridPoints, qtrue, TraceGrid );
+			ProfileEnd();
 			Sys_FPrintf( SYS_VRB, "%9d grid points envelope culled\n", gridEnvelopeCulled );
 			Sys_FPrintf( SYS_VRB, "%9d grid points bounds culled\n", gridBoundsCulled );
 		}
@@ -1851,14 +2147,20 @@ void LightWorld( void ){
 		lightsClusterCulled = 0;
 
 		Sys_Printf( "--- IlluminateRawLightmap ---\n" );
+		ProfileBegin( "IlluminateRawLightmap" );
 		RunThreadsOnIndividual( numRawLightmaps, qtrue, IlluminateRawLightmap );
+		ProfileEnd();
 		Sys_Printf( "%9d luxels illuminated\n", numLuxelsIlluminated );
 		Sys_Printf( "%9d vertexes illuminated\n", numVertsIlluminated );
 
+		ProfileBegin( "StitchSurfaceLightmaps" );
 		StitchSurfaceLightmaps();
+		ProfileEnd();
 
 		Sys_Printf( "--- IlluminateVertexes ---\n" );
+		ProfileBegin( "IlluminateVertexes" );
 		RunThreadsOnIndividual( numBSPDrawSurfaces, qtrue, IlluminateVertexes );
+		ProfileEnd();
 		Sys_Printf( "%9d vertexes illuminated\n", numVertsIlluminated );
 
 		/* ydnar: emit statistics on light culling */
@@ -1868,11 +2170,15 @@ void LightWorld( void ){
 		Sys_FPrintf( SYS_VRB, "%9d lights cluster culled\n", lightsClusterCulled );
 
 		/* interate */
+		ProfileEnd();
+		passTime = I_FloatTime() - passStart;
 		bounce--;
 		b++;
 	}
 	/* ydnar: store off lightmaps */
+	ProfileBegin( "StoreSurfaceLightmaps" );
 	StoreSurfaceLightmaps();
+	ProfileEnd();
 
 }
 
@@ -1888,10 +2194,12 @@ int LightMain( int argc, char **argv ){
 	float f;
 	char mapSource[ 1024 ];
 	const char  *value;
+	const char  **shaderNames;
 
 
 	/* note it */
 	Sys_Printf( "--- Light ---\n" );
+	lightStartTime = I_FloatTime();
 
 	/* set standard game flags */
 	wolfLight = game->wolfLight;
@@ -2257,6 +2565,26 @@ int LightMain( int argc, char **argv ){
 			loMem = qtrue;
 			Sys_Printf( "Enabling low-memory (potentially slower) lighting mode\n" );
 		}
+		else if ( !strcmp( argv[ i ], "-bvh" ) ) {
+			bvhTrace = qtrue;
+			Sys_Printf( "Tracing against a bounding volume hierarchy\n" );
+		}
+		else if ( !strcmp( argv[ i ], "-lightcache" ) ) {
+			lightCache = qtrue;
+			Sys_Printf( "Reusing unchanged lightmaps from the light cache\n" );
+		}
+		else if ( !strcmp( argv[ i ], "-progressive" ) ) {
+			progressiveLight = qtrue;
+			Sys_Printf( "Progressive lighting enabled, writing a preview before the full passes\n" );
+		}
+		else if ( !strcmp( argv[ i ], "-timebudget" ) ) {
+			lightTimeBudget = atof( argv[ i + 1 ] );
+			if ( lightTimeBudget > 0.0f ) {
+				progressiveLight = qtrue;
+				Sys_Printf( "Progressive lighting enabled with a time budget of %.0f seconds\n", lightTimeBudget );
+			}
+			i++;
+		}
 		else if ( !strcmp( argv[ i ], "-nostyle" ) || !strcmp( argv[ i ], "-nostyles" ) ) {
 			noStyles = qtrue;
 			Sys_Printf( "Disabling lightstyles\n" );
@@ -2341,16 +2669,30 @@ int LightMain( int argc, char **argv ){
 
 	/* ydnar: handle shaders */
 	BeginMapShaderFile( source );
+	ProfileBegin( "LoadShaderInfo" );
 	LoadShaderInfo();
+	ProfileEnd();
 
 	/* note loading */
 	Sys_Printf( "Loading %s\n", source );
 
-	/* ydnar: load surface file */
-	LoadSurfaceExtraFile( source );
-
 	/* load bsp file */
+	ProfileBegin( "LoadBSPFile" );
 	LoadBSPFile( source );
+	ProfileEnd();
+
+	/* ydnar: load the images of every shader in the bsp across threads (before the
+	   surface file, which looks its shaders up one by one) */
+	ProfileBegin( "PrefetchShaderImages" );
+	shaderNames = safe_malloc( numBSPShaders * sizeof( *shaderNames ) );
+	for ( i = 0; i < numBSPShaders; i++ )
+		shaderNames[ i ] = bspShaders[ i ].shader;
+	PrefetchShaderImages( shaderNames, numBSPShaders );
+	free( shaderNames );
+	ProfileEnd();
+
+	/* ydnar: load surface file */
+	LoadSurfaceExtraFile( source );
 
 	/* parse bsp entities */
 	ParseEntities();
@@ -2368,18 +2710,31 @@ int LightMain( int argc, char **argv ){
 	SetupBrushes();
 	SetupDirt();
 	SetupFloodLight();
+	ProfileBegin( "SetupSurfaceLightmaps" );
 	SetupSurfaceLightmaps();
+	ProfileEnd();
 
 	/* initialize the surface facet tracing */
+	ProfileBegin( "SetupTraceNodes" );
 	SetupTraceNodes();
+	ProfileEnd();
+
+	/* load the light cache */
+	if ( lightCache ) {
+		SetupLightCache( argc, argv );
+	}
 
 	/* light the world */
+	ProfileBegin( "LightWorld" );
 	LightWorld();
+	ProfileEnd();
 
 	/* write out the bsp */
 	UnparseEntities();
 	Sys_Printf( "Writing %s\n", source );
+	ProfileBegin( "WriteBSPFile" );
 	WriteBSPFile( source );
+	ProfileEnd();
 
 	/* ydnar: export lightmaps */
 	if ( exportLightmaps && !externalLightmaps ) {
@@ -0,0 +1,700 @@
+/* -------------------------------------------------------------------------------
+
+   Copyright (C) 1999-2007 id Software, Inc. and contributors.
+   For a list of contributors, see the accompanying CONTRIBUTORS file.
+
+   This file is part of GtkRadiant.
+
+   GtkRadiant is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   GtkRadiant is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GtkRadiant; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+   ----------------------------------------------------------------------------------
+
+   This code has been altered significantly from its original form, to support
+   several games based on the Quake III Arena engine, in the form of "Q3Map2."
+
+   ------------------------------------------------------------------------------- */
+
+
+
+/* marker */
+#define LIGHT_CACHE_C
+
+
+
+/* dependencies */
+#include "q3map2.h"
+
+
+
+/* -------------------------------------------------------------------------------
+
+   the light cache keeps the direct lighting of every raw lightmap from the last
+   -light -lightcache run in <map>.lightcache, keyed by an md5 of everything that
+   went into it: the luxel origins/normals/clusters, the surface shaders, the
+   culled lights, the pvs and the occluders between the lightmap and its lights.
+   lightmaps whose key is unchanged are copied back instead of being relit
+
+   ------------------------------------------------------------------------------- */
+
+#define LIGHTCACHE_IDENT        ( ( 'C' << 24 ) + ( 'L' << 16 ) + ( 'M' << 8 ) + 'Q' )
+#define LIGHTCACHE_VERSION      1
+
+typedef struct lightCacheHeader_s
+{
+	int ident, version;
+	byte options[ 16 ];
+	int numEntries;
+}
+lightCacheHeader_t;
+
+/* on-disk entry, followed by the luxel layers set in the layers mask,
+   the deluxels (if any) and the luxel clusters */
+typedef struct lightCacheEntry_s
+{
+	byte key[ 16 ];
+	int sw, sh;
+	int layers, deluxels;
+	byte styles[ MAX_LIGHTMAPS ];
+}
+lightCacheEntry_t;
+
+typedef struct lightCacheRecord_s
+{
+	lightCacheEntry_t   *entry;
+	float               *luxels;
+	float               *deluxels;
+	int                 *clusters;
+}
+lightCacheRecord_t;
+
+static char lightCacheFile[ 1024 ];
+static byte lightCacheOptions[ 16 ];
+static qboolean lightCacheActive = qfalse;
+
+static void                 *lightCacheBuffer = NULL;
+static int numLightCacheRecords = 0;
+static lightCacheRecord_t   *lightCacheRecords = NULL;
+
+static byte                 *lightCacheKeys = NULL;
+static byte                 *lightCacheHits = NULL;
+
+static int numShaderDigests = 0;
+static byte                 *shaderDigests = NULL;
+
+static byte                 *leafDigests = NULL;
+
+
+
+/*
+   HashImage()
+   adds an image's pixels to a digest
+ */
+
+static void HashImage( md5_state_t *mh, image_t *image ){
+	if ( image == NULL || image->pixels == NULL ) {
+		return;
+	}
+	md5_append( mh, (md5_byte_t*) &image->width, sizeof( image->width ) );
+	md5_append( mh, (md5_byte_t*) &image->height, sizeof( image->height ) );
+	md5_append( mh, image->pixels, image->width * image->height * 4 );
+}
+
+
+
+/*
+   HashShaderInfo()
+   digests the parts of a shader that change how it lights or shadows
+ */
+
+static void HashShaderInfo( shaderInfo_t *si, byte digest[ 16 ] ){
+	md5_state_t mh;
+
+
+	md5_init( &mh );
+	if ( si != NULL ) {
+		md5_append( &mh, (md5_byte_t*) si->shader, strlen( si->shader ) );
+		md5_append( &mh, (md5_byte_t*) &si->surfaceFlags, sizeof( si->surfaceFlags ) );
+		md5_append( &mh, (md5_byte_t*) &si->contentFlags, sizeof( si->contentFlags ) );
+		md5_append( &mh, (md5_byte_t*) &si->compileFlags, sizeof( si->compileFlags ) );
+		md5_append( &mh, (md5_byte_t*) &si->value, sizeof( si->value ) );
+		md5_append( &mh, (md5_byte_t*) &si->lightSubdivide, sizeof( si->lightSubdivide ) );
+		md5_append( &mh, (md5_byte_t*) &si->lightFilterRadius, sizeof( si->lightFilterRadius ) );
+		md5_append( &mh, (md5_byte_t*) &si->lightmapSampleSize, sizeof( si->lightmapSampleSize ) );
+		md5_append( &mh, (md5_byte_t*) &si->lightmapSampleOffset, sizeof( si->lightmapSampleOffset ) );
+		md5_append( &mh, (md5_byte_t*) &si->splotchFix, sizeof( si->splotchFix ) );
+		md5_append( &mh, (md5_byte_t*) &si->twoSided, sizeof( si->twoSided ) );
+		md5_append( &mh, (md5_byte_t*) &si->forceSunlight, sizeof( si->forceSunlight ) );
+		md5_append( &mh, (md5_byte_t*) &si->skyLightValue, sizeof( si->skyLightValue ) );
+		md5_append( &mh, (md5_byte_t*) &si->skyLightIterations, sizeof( si->skyLightIterations ) );
+		md5_append( &mh, (md5_byte_t*) si->color, sizeof( si->color ) );
+		md5_append( &mh, (md5_byte_t*) si->averageColor, sizeof( si->averageColor ) );
+		md5_append( &mh, (md5_byte_t*) &si->lightStyle, sizeof( si->lightStyle ) );
+		md5_append( &mh, (md5_byte_t*) &si->lmBrightness, sizeof( si->lmBrightness ) );
+		md5_append( &mh, (md5_byte_t*) &si->lmFilterRadius, sizeof( si->lmFilterRadius ) );
+		md5_append( &mh, (md5_byte_t*) si->lightImagePath, strlen( si->lightImagePath ) );
+		if ( si->shaderText != NULL ) {
+			md5_append( &mh, (md5_byte_t*) si->shaderText, strlen( si->shaderText ) );
+		}
+
+		/* alphashadow and lightfilter sample the images */
+		HashImage( &mh, si->shaderImage );
+		HashImage( &mh, si->lightImage );
+	}
+	md5_finish( &mh, digest );
+}
+
+
+
+/*
+   ShaderInfoDigest()
+   gets the light cache digest of a shader
+ */
+
+void ShaderInfoDigest( shaderInfo_t *si, byte digest[ 16 ] ){
+	int num;
+
+
+	/* use the table when the shader was known at setup time */
+	num = si != NULL ? (int) ( si - shaderInfo ) : -1;
+	if ( shaderDigests != NULL && num >= 0 && num < numShaderDigests ) {
+		memcpy( digest, &shaderDigests[ num * 16 ], 16 );
+		return;
+	}
+	HashShaderInfo( si, digest );
+}
+
+
+
+/*
+   HashLight()
+   adds a culled light to a lightmap's cache key
+ */
+
+static void HashLight( md5_state_t *mh, light_t *light ){
+	int i;
+	byte digest[ 16 ];
+
+
+	md5_append( mh, (md5_byte_t*) &light->type, sizeof( light->type ) );
+	md5_append( mh, (md5_byte_t*) &light->flags, sizeof( light->flags ) );
+	md5_append( mh, (md5_byte_t*) light->origin, sizeof( light->origin ) );
+	md5_append( mh, (md5_byte_t*) light->normal, sizeof( light->normal ) );
+	md5_append( mh, (md5_byte_t*) &light->dist, sizeof( light->dist ) );
+	md5_append( mh, (md5_byte_t*) &light->photons, sizeof( light->photons ) );
+	md5_append( mh, (md5_byte_t*) &light->style, sizeof( light->style ) );
+	md5_append( mh, (md5_byte_t*) light->color, sizeof( light->color ) );
+	md5_append( mh, (md5_byte_t*) &light->radiusByDist, sizeof( light->radiusByDist ) );
+	md5_append( mh, (md5_byte_t*) &light->fade, sizeof( light->fade ) );
+	md5_append( mh, (md5_byte_t*) &light->angleScale, sizeof( light->angleScale ) );
+	md5_append( mh, (md5_byte_t*) &light->add, sizeof( light->add ) );
+	md5_append( mh, (md5_byte_t*) &light->envelope, sizeof( light->envelope ) );
+	md5_append( mh, (md5_byte_t*) light->mins, sizeof( light->mins ) );
+	md5_append( mh, (md5_byte_t*) light->maxs, sizeof( light->maxs ) );
+	md5_append( mh, (md5_byte_t*) &light->cluster, sizeof( light->cluster ) );
+	md5_append( mh, (md5_byte_t*) light->emitColor, sizeof( light->emitColor ) );
+	md5_append( mh, (md5_byte_t*) &light->falloffTolerance, sizeof( light->falloffTolerance ) );
+	md5_append( mh, (md5_byte_t*) &light->filterRadius, sizeof( light->filterRadius ) );
+	if ( light->w != NULL ) {
+		md5_append( mh, (md5_byte_t*) &light->w->numpoints, sizeof( light->w->numpoints ) );
+		for ( i = 0; i < light->w->numpoints; i++ )
+			md5_append( mh, (md5_byte_t*) light->w->p[ i ], sizeof( vec3_t ) );
+	}
+	ShaderInfoDigest( light->si, digest );
+	md5_append( mh, digest, sizeof( digest ) );
+}
+
+
+
+/*
+   SetupLeafDigests()
+   digests each bsp leaf with the opaque brushes in it, as traces stop at solid leafs
+ */
+
+static void SetupLeafDigests( void ){
+	int i, j, k, b;
+	bspLeaf_t       *leaf;
+	bspBrush_t      *brush;
+	bspPlane_t      *plane;
+	md5_state_t mh;
+
+
+	leafDigests = safe_malloc( ( numBSPLeafs + 1 ) * 16 );
+	for ( i = 0; i < numBSPLeafs; i++ )
+	{
+		leaf = &bspLeafs[ i ];
+		md5_init( &mh );
+		md5_append( &mh, (md5_byte_t*) &leaf->cluster, sizeof( leaf->cluster ) );
+		md5_append( &mh, (md5_byte_t*) leaf->mins, sizeof( leaf->mins ) );
+		md5_append( &mh, (md5_byte_t*) leaf->maxs, sizeof( leaf->maxs ) );
+		for ( j = 0; j < leaf->numBSPLeafBrushes; j++ )
+		{
+			b = bspLeafBrushes[ leaf->firstBSPLeafBrush + j ];
+			if ( !( opaqueBrushes[ b >> 3 ] & ( 1 << ( b & 7 ) ) ) ) {
+				continue;
+			}
+			brush = &bspBrushes[ b ];
+			for ( k = 0; k < brush->numSides; k++ )
+			{
+				plane = &bspPlanes[ bspBrushSides[ brush->firstSide + k ].planeNum ];
+				md5_append( &mh, (md5_byte_t*) plane->normal, sizeof( plane->normal ) );
+				md5_append( &mh, (md5_byte_t*) &plane->dist, sizeof( plane->dist ) );
+			}
+		}
+		md5_finish( &mh, &leafDigests[ i * 16 ] );
+	}
+}
+
+
+
+/*
+   HashLeafs()
+   adds the leafs touching a box to a lightmap's cache key
+ */
+
+static void HashLeafs( md5_state_t *mh, const vec3_t mins, const vec3_t maxs ){
+	int i, numLeafs;
+	unsigned int sum[ 4 ], *digest;
+	bspLeaf_t       *leaf;
+
+
+	/* sum them so leaf order doesn't matter */
+	sum[ 0 ] = sum[ 1 ] = sum[ 2 ] = sum[ 3 ] = 0;
+	numLeafs = 0;
+	for ( i = 0; i < numBSPLeafs; i++ )
+	{
+		leaf = &bspLeafs[ i ];
+		if ( leaf->mins[ 0 ] > maxs[ 0 ] || leaf->maxs[ 0 ] < mins[ 0 ] ||
+			 leaf->mins[ 1 ] > maxs[ 1 ] || leaf->maxs[ 1 ] < mins[ 1 ] ||
+			 leaf->mins[ 2 ] > maxs[ 2 ] || leaf->maxs[ 2 ] < mins[ 2 ] ) {
+			continue;
+		}
+		digest = (unsigned int*) &leafDigests[ i * 16 ];
+		sum[ 0 ] += digest[ 0 ];
+		sum[ 1 ] += digest[ 1 ];
+		sum[ 2 ] += digest[ 2 ];
+		sum[ 3 ] += digest[ 3 ];
+		numLeafs++;
+	}
+	md5_append( mh, (md5_byte_t*) &numLeafs, sizeof( numLeafs ) );
+	md5_append( mh, (md5_byte_t*) sum, sizeof( sum ) );
+}
+
+
+
+/*
+   CompareLightCacheRecords()
+   qsort/bsearch callback, orders records by key
+ */
+
+static int CompareLightCacheRecords( const void *a, const void *b ){
+	return memcmp( ( (const lightCacheRecord_t*) a )->entry->key, ( (const lightCacheRecord_t*) b )->entry->key, 16 );
+}
+
+
+
+/*
+   LoadLightCache()
+   reads <map>.lightcache, dropping it if it was made with different options
+ */
+
+static void LoadLightCache( void ){
+	int i, j, size, length, numLayers;
+	byte                *buffer, *p, *end;
+	lightCacheHeader_t  *header;
+	lightCacheEntry_t   *entry;
+	lightCacheRecord_t  *record;
+
+
+	/* try to load it */
+	length = TryLoadFile( lightCacheFile, &lightCacheBuffer );
+	if ( length < 0 ) {
+		Sys_Printf( "No light cache %s, lighting everything\n", lightCacheFile );
+		return;
+	}
+	buffer = lightCacheBuffer;
+	end = buffer + length;
+
+	/* check the header */
+	header = (lightCacheHeader_t*) buffer;
+	if ( length < (int) sizeof( *header ) || header->ident != LIGHTCACHE_IDENT || header->version != LIGHTCACHE_VERSION ||
+		 memcmp( header->options, lightCacheOptions, sizeof( lightCacheOptions ) ) || header->numEntries < 0 ) {
+		Sys_Printf( "Light cache %s is stale, lighting everything\n", lightCacheFile );
+		free( lightCacheBuffer );
+		lightCacheBuffer = NULL;
+		return;
+	}
+
+	/* index the entries */
+	lightCacheRecords = safe_malloc( ( header->numEntries + 1 ) * sizeof( *lightCacheRecords ) );
+	numLightCacheRecords = 0;
+	p = buffer + sizeof( *header );
+	for ( i = 0; i < header->numEntries; i++ )
+	{
+		/* get entry */
+		entry = (lightCacheEntry_t*) p;
+		if ( p + sizeof( *entry ) > end || entry->sw <= 0 || entry->sh <= 0 ) {
+			break;
+		}
+		p += sizeof( *entry );
+
+		/* get its data */
+		size = entry->sw * entry->sh;
+		for ( numLayers = 0, j = 0; j < MAX_LIGHTMAPS; j++ )
+			numLayers += ( entry->layers >> j ) & 1;
+		record = &lightCacheRecords[ numLightCacheRecords ];
+		record->entry = entry;
+		record->luxels = (float*) p;
+		p += numLayers * size * SUPER_LUXEL_SIZE * sizeof( float );
+		record->deluxels = entry->deluxels ? (float*) p : NULL;
+		p += entry->deluxels ? size * SUPER_DELUXEL_SIZE * sizeof( float ) : 0;
+		record->clusters = (int*) p;
+		p += size * sizeof( int );
+		if ( p > end ) {
+			break;
+		}
+		numLightCacheRecords++;
+	}
+
+	/* truncated? */
+	if ( i < header->numEntries ) {
+		Sys_FPrintf( SYS_WRN, "WARNING: Light cache %s is corrupt, lighting everything\n", lightCacheFile );
+		numLightCacheRecords = 0;
+	}
+
+	/* sort for lookup */
+	qsort( lightCacheRecords, numLightCacheRecords, sizeof( *lightCacheRecords ), CompareLightCacheRecords );
+	Sys_Printf( "Loaded %d lightmaps from light cache %s\n", numLightCacheRecords, lightCacheFile );
+}
+
+
+
+/*
+   SetupLightCache()
+   digests the light options, shaders and occluders, and loads the light cache
+ */
+
+void SetupLightCache( int argc, char **argv ){
+	int i;
+	epair_t     *ep;
+	md5_state_t mh;
+
+
+	/* note it */
+	Sys_FPrintf( SYS_VRB, "--- SetupLightCache ---\n" );
+
+	/* the cache goes next to the bsp */
+	strcpy( lightCacheFile, source );
+	StripExtension( lightCacheFile );
+	strcat( lightCacheFile, ".lightcache" );
+
+	/* digest the global options: version, game, commandline and worldspawn */
+	md5_init( &mh );
+	md5_append( &mh, (md5_byte_t*) Q3MAP_VERSION, strlen( Q3MAP_VERSION ) );
+	md5_append( &mh, (md5_byte_t*) game->arg, strlen( game->arg ) );
+	for ( i = 1; i < ( argc - 1 ); i++ )
+	{
+		if ( !strcmp( argv[ i ], "-lightcache" ) ) {
+			continue;
+		}
+		md5_append( &mh, (md5_byte_t*) argv[ i ], strlen( argv[ i ] ) + 1 );
+	}
+	for ( ep = entities[ 0 ].epairs; ep != NULL; ep = ep->next )
+	{
+		md5_append( &mh, (md5_byte_t*) ep->key, strlen( ep->key ) + 1 );
+		md5_append( &mh, (md5_byte_t*) ep->value, strlen( ep->value ) + 1 );
+	}
+	md5_finish( &mh, lightCacheOptions );
+
+	/* digest the shaders, then everything that casts shadows */
+	numShaderDigests = numShaderInfo;
+	shaderDigests = safe_malloc( ( numShaderDigests + 1 ) * 16 );
+	for ( i = 0; i < numShaderDigests; i++ )
+		HashShaderInfo( &shaderInfo[ i ], &shaderDigests[ i * 16 ] );
+	SetupTraceOccluders();
+	SetupLeafDigests();
+
+	/* allocate the per-lightmap keys */
+	lightCacheKeys = safe_malloc( ( numRawLightmaps + 1 ) * 16 );
+	lightCacheHits = safe_malloc( numRawLightmaps + 1 );
+	memset( lightCacheHits, 0, numRawLightmaps + 1 );
+
+	/* load the old cache */
+	LoadLightCache();
+	lightCacheActive = qtrue;
+}
+
+
+
+/*
+   LightCacheLookup()
+   makes the cache key for a raw lightmap and its culled light list,
+   and restores the lightmap from the cache if it is found there
+ */
+
+qboolean LightCacheLookup( int rawLightmapNum, trace_t *trace ){
+	int i, j, size, lightmapNum, numOccluders;
+	unsigned int sum[ 4 ];
+	float               *origin, *luxels;
+	int                 *cluster;
+	qboolean sky;
+	vec3_t mins, maxs;
+	rawLightmap_t       *lm;
+	surfaceInfo_t       *info;
+	light_t             *light;
+	lightCacheEntry_t   entry;
+	lightCacheRecord_t  search, *record;
+	md5_state_t mh;
+	byte digest[ 16 ], *key;
+
+
+	/* only the direct lighting pass is cached */
+	if ( !lightCacheActive ) {
+		return qfalse;
+	}
+
+	/* get lightmap */
+	lm = &rawLightmaps[ rawLightmapNum ];
+	size = lm->sw * lm->sh;
+
+	/* hash the lightmap and its luxels */
+	md5_init( &mh );
+	md5_append( &mh, lightCacheOptions, sizeof( lightCacheOptions ) );
+	md5_append( &mh, (md5_byte_t*) &lm->sw, sizeof( lm->sw ) );
+	md5_append( &mh, (md5_byte_t*) &lm->sh, sizeof( lm->sh ) );
+	md5_append( &mh, (md5_byte_t*) &lm->sampleSize, sizeof( lm->sampleSize ) );
+	md5_append( &mh, (md5_byte_t*) &lm->actualSampleSize, sizeof( lm->actualSampleSize ) );
+	md5_append( &mh, (md5_byte_t*) &lm->filterRadius, sizeof( lm->filterRadius ) );
+	md5_append( &mh, (md5_byte_t*) &lm->splotchFix, sizeof( lm->splotchFix ) );
+	md5_append( &mh, (md5_byte_t*) &lm->recvShadows, sizeof( lm->recvShadows ) );
+	md5_append( &mh, (md5_byte_t*) lm->mins, sizeof( lm->mins ) );
+	md5_append( &mh, (md5_byte_t*) lm->maxs, sizeof( lm->maxs ) );
+	if ( lm->plane != NULL ) {
+		md5_append( &mh, (md5_byte_t*) lm->plane, 4 * sizeof( float ) );
+	}
+	md5_append( &mh, (md5_byte_t*) lm->superOrigins, size * SUPER_ORIGIN_SIZE * sizeof( float ) );
+	md5_append( &mh, (md5_byte_t*) lm->superNormals, size * SUPER_NORMAL_SIZE * sizeof( float ) );
+	md5_append( &mh, (md5_byte_t*) lm->superClusters, size * sizeof( int ) );
+	if ( lm->superFloodLight != NULL ) {
+		md5_append( &mh, (md5_byte_t*) lm->superFloodLight, size * SUPER_FLOODLIGHT_SIZE * sizeof( float ) );
+	}
+
+	/* hash the surfaces */
+	for ( i = 0; i < lm->numLightSurfaces; i++ )
+	{
+		info = &surfaceInfos[ lightSurfaces[ lm->firstLightSurface + i ] ];
+		md5_append( &mh, (md5_byte_t*) &lightSurfaces[ lm->firstLightSurface + i ], sizeof( int ) );
+		ShaderInfoDigest( info->si, digest );
+		md5_append( &mh, digest, sizeof( digest ) );
+	}
+
+	/* hash the pvs rows of the clusters the lightmap touches */
+	for ( i = 0; i < lm->numLightClusters; i++ )
+	{
+		md5_append( &mh, (md5_byte_t*) &lm->lightClusters[ i ], sizeof( int ) );
+		if ( numBSPVisBytes > VIS_HEADER_SIZE && lm->lightClusters[ i ] >= 0 && lm->lightClusters[ i ] < ( (int*) bspVisBytes )[ 0 ] ) {
+			md5_append( &mh, bspVisBytes + VIS_HEADER_SIZE + lm->lightClusters[ i ] * ( (int*) bspVisBytes )[ 1 ], ( (int*) bspVisBytes )[ 1 ] );
+		}
+	}
+
+	/* bound the luxels, padded by a luxel for subsampling */
+	VectorCopy( lm->mins, mins );
+	VectorCopy( lm->maxs, maxs );
+	for ( i = 0; i < size; i++ )
+	{
+		cluster = lm->superClusters + i;
+		origin = lm->superOrigins + i * SUPER_ORIGIN_SIZE;
+		if ( *cluster >= 0 ) {
+			AddPointToBounds( origin, mins, maxs );
+		}
+	}
+	for ( i = 0; i < 3; i++ )
+	{
+		mins[ i ] -= lm->actualSampleSize + 1.0f;
+		maxs[ i ] += lm->actualSampleSize + 1.0f;
+	}
+
+	/* hash the lights, growing the box to hold every ray cast toward them */
+	sky = qfalse;
+	md5_append( &mh, (md5_byte_t*) &trace->numLights, sizeof( trace->numLights ) );
+	for ( i = 0; i < trace->numLights; i++ )
+	{
+		light = trace->lights[ i ];
+		HashLight( &mh, light );
+
+		/* sun rays run out of the world and may trace the skybox */
+		if ( light->type == EMIT_SUN ) {
+			sky = qtrue;
+			for ( j = 0; j < 3; j++ )
+			{
+				if ( light->origin[ j ] > 0.0f ) {
+					maxs[ j ] = MAX_WORLD_COORD;
+				}
+				else if ( light->origin[ j ] < 0.0f ) {
+					mins[ j ] = MIN_WORLD_COORD;
+				}
+			}
+			continue;
+		}
+
+		/* other lights are reached within the hull of the luxels and the light */
+		AddPointToBounds( light->origin, mins, maxs );
+		if ( light->w != NULL ) {
+			for ( j = 0; j < light->w->numpoints; j++ )
+				AddPointToBounds( light->w->p[ j ], mins, maxs );
+		}
+	}
+
+	/* hash the occluders */
+	numOccluders = SumTraceOccluders( mins, maxs, sky, sum );
+	md5_append( &mh, (md5_byte_t*) &numOccluders, sizeof( numOccluders ) );
+	md5_append( &mh, (md5_byte_t*) sum, sizeof( sum ) );
+	HashLeafs( &mh, mins, maxs );
+
+	/* store the key */
+	key = &lightCacheKeys[ rawLightmapNum * 16 ];
+	md5_finish( &mh, key );
+
+	/* find it */
+	if ( numLightCacheRecords <= 0 ) {
+		return qfalse;
+	}
+	memcpy( entry.key, key, sizeof( entry.key ) );
+	search.entry = &entry;
+	record = bsearch( &search, lightCacheRecords, numLightCacheRecords, sizeof( *lightCacheRecords ), CompareLightCacheRecords );
+	if ( record == NULL || record->entry->sw != lm->sw || record->entry->sh != lm->sh ||
+		 ( record->deluxels != NULL ) != ( lm->superDeluxels != NULL ) ) {
+		return qfalse;
+	}
+
+	/* restore the luxel layers */
+	luxels = record->luxels;
+	for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
+	{
+		if ( !( record->entry->layers & ( 1 << lightmapNum ) ) ) {
+			if ( lm->superLuxels[ lightmapNum ] != NULL ) {
+				memset( lm->superLuxels[ lightmapNum ], 0, size * SUPER_LUXEL_SIZE * sizeof( float ) );
+			}
+			continue;
+		}
+		if ( lm->superLuxels[ lightmapNum ] == NULL ) {
+			lm->superLuxels[ lightmapNum ] = safe_malloc( size * SUPER_LUXEL_SIZE * sizeof( float ) );
+		}
+		memcpy( lm->superLuxels[ lightmapNum ], luxels, size * SUPER_LUXEL_SIZE * sizeof( float ) );
+		luxels += size * SUPER_LUXEL_SIZE;
+	}
+
+	/* restore the rest */
+	memcpy( lm->styles, record->entry->styles, sizeof( lm->styles ) );
+	if ( record->deluxels != NULL ) {
+		memcpy( lm->superDeluxels, record->deluxels, size * SUPER_DELUXEL_SIZE * sizeof( float ) );
+	}
+	memcpy( lm->superClusters, record->clusters, size * sizeof( int ) );
+
+	/* note it */
+	lightCacheHits[ rawLightmapNum ] = 1;
+	return qtrue;
+}
+
+
+
+/*
+   StoreLightCache()
+   writes the direct lighting of every raw lightmap to the light cache,
+   must be called before the lightmaps are stitched or bounced
+ */
+
+void StoreLightCache( void ){
+	int i, lightmapNum, size, numHits;
+	rawLightmap_t       *lm;
+	lightCacheHeader_t header;
+	lightCacheEntry_t entry;
+	FILE                *file;
+
+
+	/* dummy check */
+	if ( !lightCacheActive ) {
+		return;
+	}
+
+	/* note it */
+	Sys_FPrintf( SYS_VRB, "--- StoreLightCache ---\n" );
+
+	/* write the header */
+	file = SafeOpenWrite( lightCacheFile );
+	memset( &header, 0, sizeof( header ) );
+	header.ident = LIGHTCACHE_IDENT;
+	header.version = LIGHTCACHE_VERSION;
+	memcpy( header.options, lightCacheOptions, sizeof( header.options ) );
+	header.numEntries = numRawLightmaps;
+	SafeWrite( file, &header, sizeof( header ) );
+
+	/* write each lightmap */
+	numHits = 0;
+	for ( i = 0; i < numRawLightmaps; i++ )
+	{
+		lm = &rawLightmaps[ i ];
+		size = lm->sw * lm->sh;
+		numHits += lightCacheHits[ i ];
+
+		/* write entry */
+		memset( &entry, 0, sizeof( entry ) );
+		memcpy( entry.key, &lightCacheKeys[ i * 16 ], sizeof( entry.key ) );
+		entry.sw = lm->sw;
+		entry.sh = lm->sh;
+		for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
+		{
+			if ( lm->superLuxels[ lightmapNum ] != NULL ) {
+				entry.layers |= ( 1 << lightmapNum );
+			}
+		}
+		entry.deluxels = lm->superDeluxels != NULL;
+		memcpy( entry.styles, lm->styles, sizeof( entry.styles ) );
+		SafeWrite( file, &entry, sizeof( entry ) );
+
+		/* write data */
+		for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
+		{
+			if ( lm->superLuxels[ lightmapNum ] != NULL ) {
+				SafeWrite( file, lm->superLuxels[ lightmapNum ], size * SUPER_LUXEL_SIZE * sizeof( float ) );
+			}
+		}
+		if ( lm->superDeluxels != NULL ) {
+			SafeWrite( file, lm->superDeluxels, size * SUPER_DELUXEL_SIZE * sizeof( float ) );
+		}
+		SafeWrite( file, lm->superClusters, size * sizeof( int ) );
+	}
+	fclose( file );
+
+	/* emit some statistics */
+	Sys_Printf( "%9d raw lightmaps reused from light cache\n", numHits );
+	Sys_Printf( "%9d raw lightmaps relit\n", numRawLightmaps - numHits );
+
+	/* bounces and vertex lighting aren't cached */
+	lightCacheActive = qfalse;
+	free( lightCacheBuffer );
+	lightCacheBuffer = NULL;
+	free( lightCacheRecords );
+	lightCacheRecords = NULL;
+	numLightCacheRecords = 0;
+	free( lightCacheKeys );
+	lightCacheKeys = NULL;
+	free( lightCacheHits );
+	lightCacheHits = NULL;
+	free( shaderDigests );
+	shaderDigests = NULL;
+	numShaderDigests = 0;
+	free( leafDigests );
+	leafDigests = NULL;
+}
@@ -63,6 +63,22 @@
 #define TRACE_LEAF              -1
 #define TRACE_LEAF_SOLID        -2
 
+#define BVH_NUM_BINS            16
+#define BVH_MAX_DEPTH           64
+#define BVH_MAX_LEAF_TRIANGLES  8
+#define BVH_TRAVERSAL_COST      1.0f
+#define BVH_BOUNDS_EPSILON      0.01f
+#define BVH_SOLID_EPSILON       0.25f
+#define BVH_SEAM_EPSILON        0.25f
+#define BVH_NODE_ALIGN          64
+#define MAX_BVH_HITS            64
+
+/* sse is always available on x86_64, and on x86 when the compiler is told so */
+#if defined( __SSE__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 1 )
+	#define BVH_SSE
+	#include <xmmintrin.h>
+#endif
+
 typedef struct traceVert_s
 {
 	vec3_t xyz;
@@ -93,6 +109,14 @@ typedef struct traceTriangle_s
 }
 traceTriangle_t;
 
+typedef struct traceOccluder_s
+{
+	vec3_t mins, maxs;
+	unsigned int digest[ 4 ];
+	qboolean skybox;
+}
+traceOccluder_t;
+
 typedef struct traceNode_s
 {
 	int type;
@@ -105,6 +129,67 @@ typedef struct traceNode_s
 traceNode_t;
 
 
+/* flattened bvh node, two to a cache line. inner nodes have their left child
+   directly after them and store the right child in first, leaves store a run of
+   triangle blocks. numBlocks <= 0 is an inner node split on axis -numBlocks */
+typedef struct bvhNode_s
+{
+	float mins[ 3 ];
+	int first;
+	float maxs[ 3 ];
+	int numBlocks;
+}
+bvhNode_t;
+
+/* four triangles in structure-of-arrays form for the 4-wide intersection test,
+   unused lanes have zero edges so they fail the determinant test. epsilon holds
+   the per-triangle barycentric tolerances for u, v and u + v */
+typedef struct bvhTriBlock_s
+{
+	float v0[ 3 ][ 4 ];
+	float edge1[ 3 ][ 4 ];
+	float edge2[ 3 ][ 4 ];
+	float epsilon[ 3 ][ 4 ];
+	int triangles[ 4 ];
+}
+bvhTriBlock_t;
+
+typedef struct traceBVH_s
+{
+	int numTriangles, maxTriangles;
+	int                         *triangles;
+	int numNodes, numBlocks, depth;
+	bvhNode_t                   *nodes;
+	bvhTriBlock_t               *blocks;
+	void                        *nodeMemory, *blockMemory;
+}
+traceBVH_t;
+
+typedef struct bvhBuildTri_s
+{
+	vec3_t mins, maxs, center;
+}
+bvhBuildTri_t;
+
+/* a non-opaque hit (sky, alphashadow, lightfilter) that is applied in depth order once the nearest opaque hit is known */
+typedef struct bvhHit_s
+{
+	float depth;
+	shaderInfo_t                *si;
+	byte                        *pixel;
+}
+bvhHit_t;
+
+typedef struct bvhHits_s
+{
+	float opaqueDepth;
+	shaderInfo_t                *opaqueSi;
+	int numHits;
+	bvhHit_t hits[ MAX_BVH_HITS ];
+}
+bvhHits_t;
+
+
 int noDrawContentFlags, noDrawSurfaceFlags, noDrawCompileFlags;
 
 int numTraceInfos = 0, maxTraceInfos = 0, firstTraceInfo = 0;
@@ -120,6 +205,10 @@ int headNodeNum = 0, skyboxNodeNum = 0, maxTraceDepth = 0, numTraceLeafNodes = 0
 int numTraceNodes = 0, maxTraceNodes = 0;
 traceNode_t                     *traceNodes = NULL;
 
+traceBVH_t worldBVH, skyboxBVH;
+
+traceOccluder_t                 *traceOccluders = NULL;
+
 
 
 /* -------------------------------------------------------------------------------
@@ -385,11 +474,19 @@ static int SetupTraceNodes_r( int bspNodeNum ){
 			if ( bspLeafs[ bspLeafNum ].cluster == -1 ) {
 				traceNodes[ traceNodes[ nodeNum ].children[ i ] ].type = TRACE_LEAF_SOLID;
 			}
+
+			/* the bvh holds the triangles, so approximate the branch item count with the leaf surfaces */
+			if ( bvhTrace ) {
+				traceNodes[ nodeNum ].numItems += bspLeafs[ bspLeafNum ].numBSPLeafSurfaces;
+			}
 		}
 
 		/* normal node */
 		else{
 			traceNodes[ nodeNum ].children[ i ] = SetupTraceNodes_r( bspNode->children[ i ] );
+			if ( bvhTrace ) {
+				traceNodes[ nodeNum ].numItems += traceNodes[ traceNodes[ nodeNum ].children[ i ] ].numItems;
+			}
 		}
 	}
 
@@ -869,6 +966,406 @@ static int TriangulateTraceNode_r( int nodeNum ){
 
 
 
+/* -------------------------------------------------------------------------------
+
+   bounding volume hierarchy (-bvh)
+
+   ------------------------------------------------------------------------------- */
+
+/*
+   AddTraceWindingToBVH()
+   adds a trace winding to a bvh triangle list, bypassing the bsp filtering
+ */
+
+static void AddTraceWindingToBVH( traceWinding_t *tw, traceBVH_t *bvh ){
+	int i, num;
+	void            *temp;
+	traceTriangle_t tt;
+
+
+	/* filter out bogus windings like FilterTraceWindingIntoNodes_r does for the head node */
+	if ( bvh == &worldBVH && !PlaneFromPoints( tw->plane, tw->v[ 0 ].xyz, tw->v[ 1 ].xyz, tw->v[ 2 ].xyz ) ) {
+		return;
+	}
+
+	/* initial setup */
+	tt.infoNum = tw->infoNum;
+	tt.v[ 0 ] = tw->v[ 0 ];
+
+	/* walk vertex list */
+	for ( i = 1; i + 1 < tw->numVerts; i++ )
+	{
+		/* set verts */
+		tt.v[ 1 ] = tw->v[ i ];
+		tt.v[ 2 ] = tw->v[ i + 1 ];
+		num = AddTraceTriangle( &tt );
+
+		/* enough space? */
+		if ( bvh->numTriangles >= bvh->maxTriangles ) {
+			/* allocate more room */
+			bvh->maxTriangles += GROW_TRACE_TRIANGLES;
+			temp = safe_malloc( bvh->maxTriangles * sizeof( *bvh->triangles ) );
+			if ( bvh->triangles != NULL ) {
+				memcpy( temp, bvh->triangles, bvh->numTriangles * sizeof( *bvh->triangles ) );
+				free( bvh->triangles );
+			}
+			bvh->triangles = (int*) temp;
+		}
+
+		/* add it to the list */
+		bvh->triangles[ bvh->numTriangles++ ] = num;
+	}
+}
+
+
+
+/*
+   FilterTraceWinding()
+   sends a trace winding to the bvh or the raytracing tree
+ */
+
+static void FilterTraceWinding( traceWinding_t *tw, int nodeNum ){
+	if ( bvhTrace ) {
+		AddTraceWindingToBVH( tw, nodeNum == skyboxNodeNum ? &skyboxBVH : &worldBVH );
+	}
+	else{
+		FilterTraceWindingIntoNodes_r( tw, nodeNum );
+	}
+}
+
+
+
+/*
+   BVHTriangleEpsilons()
+   TraceTriangle grows triangles by BARY_EPSILON to close seams. the raytracing bsp
+   only ever tests small clipped fragments, while the bvh tests whole triangles,
+   so the tolerance is capped to BVH_SEAM_EPSILON units past each edge
+ */
+
+#define BARY_EPSILON            0.01f
+
+static void BVHTriangleEpsilons( traceTriangle_t *tt, float *epsilon ){
+	int i;
+	float area, length[ 3 ], height;
+	vec3_t normal, edge3;
+
+
+	/* twice the triangle area */
+	CrossProduct( tt->edge1, tt->edge2, normal );
+	area = VectorLength( normal );
+
+	/* u is measured against the edge opposite v1 (edge2), v against edge1, u + v against the third edge */
+	VectorSubtract( tt->edge2, tt->edge1, edge3 );
+	length[ 0 ] = VectorLength( tt->edge2 );
+	length[ 1 ] = VectorLength( tt->edge1 );
+	length[ 2 ] = VectorLength( edge3 );
+	for ( i = 0; i < 3; i++ )
+	{
+		epsilon[ i ] = BARY_EPSILON;
+		if ( area > 0.0f && length[ i ] > 0.0f ) {
+			height = area / length[ i ];
+			if ( height * BARY_EPSILON > BVH_SEAM_EPSILON ) {
+				epsilon[ i ] = BVH_SEAM_EPSILON / height;
+			}
+		}
+	}
+}
+
+
+
+/*
+   SetupBVHTriangle()
+   bounds a triangle for the bvh build. the bounds cover the triangle grown by its
+   barycentric tolerance the same way the hits are accepted, so none are culled early
+ */
+
+static void SetupBVHTriangle( traceTriangle_t *tt, bvhBuildTri_t *bt ){
+	int i;
+	float epsilon[ 3 ], bary[ 3 ][ 2 ];
+	vec3_t point;
+
+
+	/* corners of the grown triangle in barycentric coordinates */
+	BVHTriangleEpsilons( tt, epsilon );
+	bary[ 0 ][ 0 ] = -epsilon[ 0 ];
+	bary[ 0 ][ 1 ] = -epsilon[ 1 ];
+	bary[ 1 ][ 0 ] = 1.0f + epsilon[ 1 ] + epsilon[ 2 ];
+	bary[ 1 ][ 1 ] = -epsilon[ 1 ];
+	bary[ 2 ][ 0 ] = -epsilon[ 0 ];
+	bary[ 2 ][ 1 ] = 1.0f + epsilon[ 0 ] + epsilon[ 2 ];
+
+	ClearBounds( bt->mins, bt->maxs );
+	for ( i = 0; i < 3; i++ )
+	{
+		VectorMA( tt->v[ 0 ].xyz, bary[ i ][ 0 ], tt->edge1, point );
+		VectorMA( point, bary[ i ][ 1 ], tt->edge2, point );
+		AddPointToBounds( point, bt->mins, bt->maxs );
+	}
+	for ( i = 0; i < 3; i++ )
+	{
+		bt->mins[ i ] -= BVH_BOUNDS_EPSILON;
+		bt->maxs[ i ] += BVH_BOUNDS_EPSILON;
+		bt->center[ i ] = 0.5f * ( bt->mins[ i ] + bt->maxs[ i ] );
+	}
+}
+
+
+
+/*
+   BVHSurfaceArea()
+   half surface area of a bounding box, for the sah
+ */
+
+static float BVHSurfaceArea( vec3_t mins, vec3_t maxs ){
+	vec3_t size;
+
+
+	if ( mins[ 0 ] > maxs[ 0 ] ) {
+		return 0.0f;
+	}
+	VectorSubtract( maxs, mins, size );
+	return size[ 0 ] * size[ 1 ] + size[ 1 ] * size[ 2 ] + size[ 2 ] * size[ 0 ];
+}
+
+
+
+/*
+   BuildBVH_r()
+   recursively builds the bvh with a binned surface area heuristic. leaves are
+   temporarily stored as a range of the triangle list and packed into blocks later
+ */
+
+static void BuildBVH_r( traceBVH_t *bvh, bvhBuildTri_t *buildTris, int first, int count, int depth ){
+	int i, j, b, nodeNum, axis, bestAxis, bestBin, numLeft, temp;
+	float cost, bestCost, leafCost, area, scale;
+	float leftArea[ BVH_NUM_BINS ];
+	int leftCount[ BVH_NUM_BINS ];
+	vec3_t centerMins, centerMaxs, mins, maxs;
+	bvhNode_t       *node;
+	bvhBuildTri_t   *bt;
+	struct
+	{
+		int count;
+		vec3_t mins, maxs;
+	} bins[ BVH_NUM_BINS ];
+
+
+	/* allocate and bound the node */
+	nodeNum = bvh->numNodes++;
+	node = &bvh->nodes[ nodeNum ];
+	ClearBounds( node->mins, node->maxs );
+	ClearBounds( centerMins, centerMaxs );
+	for ( i = first; i < first + count; i++ )
+	{
+		bt = &buildTris[ bvh->triangles[ i ] ];
+		AddPointToBounds( bt->mins, node->mins, node->maxs );
+		AddPointToBounds( bt->maxs, node->mins, node->maxs );
+		AddPointToBounds( bt->center, centerMins, centerMaxs );
+	}
+
+	/* track depth for stats */
+	if ( depth > bvh->depth ) {
+		bvh->depth = depth;
+	}
+
+	/* cost of a leaf in 4-wide blocks */
+	leafCost = (float) ( ( count + 3 ) >> 2 );
+	area = BVHSurfaceArea( node->mins, node->maxs );
+
+	/* find the cheapest binned split */
+	bestCost = 1e30f;
+	bestAxis = -1;
+	bestBin = 0;
+	for ( axis = 0; axis < 3 && count > 1 && depth < BVH_MAX_DEPTH - 1; axis++ )
+	{
+		if ( centerMaxs[ axis ] - centerMins[ axis ] <= 0.0f ) {
+			continue;
+		}
+		scale = BVH_NUM_BINS / ( centerMaxs[ axis ] - centerMins[ axis ] );
+
+		/* fill the bins */
+		for ( b = 0; b < BVH_NUM_BINS; b++ )
+		{
+			bins[ b ].count = 0;
+			ClearBounds( bins[ b ].mins, bins[ b ].maxs );
+		}
+		for ( i = first; i < first + count; i++ )
+		{
+			bt = &buildTris[ bvh->triangles[ i ] ];
+			b = (int) ( ( bt->center[ axis ] - centerMins[ axis ] ) * scale );
+			if ( b >= BVH_NUM_BINS ) {
+				b = BVH_NUM_BINS - 1;
+			}
+			bins[ b ].count++;
+			AddPointToBounds( bt->mins, bins[ b ].mins, bins[ b ].maxs );
+			AddPointToBounds( bt->maxs, bins[ b ].mins, bins[ b ].maxs );
+		}
+
+		/* sweep from the left */
+		ClearBounds( mins, maxs );
+		numLeft = 0;
+		for ( b = 0; b < BVH_NUM_BINS - 1; b++ )
+		{
+			numLeft += bins[ b ].count;
+			if ( bins[ b ].count > 0 ) {
+				AddPointToBounds( bins[ b ].mins, mins, maxs );
+				AddPointToBounds( bins[ b ].maxs, mins, maxs );
+			}
+			leftCount[ b ] = numLeft;
+			leftArea[ b ] = BVHSurfaceArea( mins, maxs );
+		}
+
+		/* sweep from the right and evaluate */
+		ClearBounds( mins, maxs );
+		for ( b = BVH_NUM_BINS - 1; b > 0; b-- )
+		{
+			if ( bins[ b ].count > 0 ) {
+				AddPointToBounds( bins[ b ].mins, mins, maxs );
+				AddPointToBounds( bins[ b ].maxs, mins, maxs );
+			}
+			if ( leftCount[ b - 1 ] == 0 || leftCount[ b - 1 ] == count ) {
+				continue;
+			}
+			cost = BVH_TRAVERSAL_COST +
+				   ( leftArea[ b - 1 ] * ( ( leftCount[ b - 1 ] + 3 ) >> 2 ) +
+					 BVHSurfaceArea( mins, maxs ) * ( ( count - leftCount[ b - 1 ] + 3 ) >> 2 ) ) / area;
+			if ( cost < bestCost ) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = b;
+			}
+		}
+	}
+
+	/* make a leaf? */
+	if ( bestAxis < 0 || ( count <= BVH_MAX_LEAF_TRIANGLES && leafCost <= bestCost ) ) {
+		node->first = first;
+		node->numBlocks = count;
+		return;
+	}
+
+	/* partition the triangle list */
+	scale = BVH_NUM_BINS / ( centerMaxs[ bestAxis ] - centerMins[ bestAxis ] );
+	i = first;
+	j = first + count - 1;
+	while ( i <= j )
+	{
+		bt = &buildTris[ bvh->triangles[ i ] ];
+		b = (int) ( ( bt->center[ bestAxis ] - centerMins[ bestAxis ] ) * scale );
+		if ( b >= BVH_NUM_BINS ) {
+			b = BVH_NUM_BINS - 1;
+		}
+		if ( b < bestBin ) {
+			i++;
+		}
+		else
+		{
+			temp = bvh->triangles[ i ];
+			bvh->triangles[ i ] = bvh->triangles[ j ];
+			bvh->triangles[ j ] = temp;
+			j--;
+		}
+	}
+	numLeft = i - first;
+
+	/* build children, the left one directly follows this node */
+	BuildBVH_r( bvh, buildTris, first, numLeft, depth + 1 );
+	bvh->nodes[ nodeNum ].first = bvh->numNodes;
+	bvh->nodes[ nodeNum ].numBlocks = -bestAxis;
+	BuildBVH_r( bvh, buildTris, first + numLeft, count - numLeft, depth + 1 );
+}
+
+
+
+/*
+   BuildBVH()
+   builds a bvh from its triangle list and packs the leaf triangles into 4-wide blocks
+ */
+
+static void BuildBVH( traceBVH_t *bvh ){
+	int i, j, k, lane, numBlocks, numTriangles;
+	float epsilon[ 3 ];
+	bvhBuildTri_t   *buildTris;
+	bvhNode_t       *node;
+	bvhTriBlock_t   *block;
+	traceTriangle_t *tt;
+
+
+	/* empty? */
+	if ( bvh->numTriangles <= 0 ) {
+		return;
+	}
+
+	/* bound every triangle, indexed by trace triangle number */
+	buildTris = safe_malloc( numTraceTriangles * sizeof( *buildTris ) );
+	for ( i = 0; i < bvh->numTriangles; i++ )
+		SetupBVHTriangle( &traceTriangles[ bvh->triangles[ i ] ], &buildTris[ bvh->triangles[ i ] ] );
+
+	/* allocate cache-aligned nodes (a binary tree has at most 2n - 1) and build */
+	bvh->nodeMemory = safe_malloc( ( 2 * bvh->numTriangles ) * sizeof( bvhNode_t ) + BVH_NODE_ALIGN );
+	bvh->nodes = (bvhNode_t*) ( ( (size_t) bvh->nodeMemory + BVH_NODE_ALIGN - 1 ) & ~( (size_t) BVH_NODE_ALIGN - 1 ) );
+	bvh->numNodes = 0;
+	BuildBVH_r( bvh, buildTris, 0, bvh->numTriangles, 1 );
+	free( buildTris );
+
+	/* count blocks */
+	numBlocks = 0;
+	for ( i = 0; i < bvh->numNodes; i++ )
+	{
+		if ( bvh->nodes[ i ].numBlocks > 0 ) {
+			numBlocks += ( bvh->nodes[ i ].numBlocks + 3 ) >> 2;
+		}
+	}
+
+	/* allocate blocks */
+	bvh->blockMemory = safe_malloc( numBlocks * sizeof( bvhTriBlock_t ) + BVH_NODE_ALIGN );
+	bvh->blocks = (bvhTriBlock_t*) ( ( (size_t) bvh->blockMemory + BVH_NODE_ALIGN - 1 ) & ~( (size_t) BVH_NODE_ALIGN - 1 ) );
+	memset( bvh->blocks, 0, numBlocks * sizeof( bvhTriBlock_t ) );
+
+	/* convert leaf triangle ranges into block runs */
+	bvh->numBlocks = 0;
+	for ( i = 0; i < bvh->numNodes; i++ )
+	{
+		node = &bvh->nodes[ i ];
+		if ( node->numBlocks <= 0 ) {
+			continue;
+		}
+
+		numTriangles = node->numBlocks;
+		for ( j = 0; j < numTriangles; j++ )
+		{
+			block = &bvh->blocks[ bvh->numBlocks + ( j >> 2 ) ];
+			lane = j & 3;
+			tt = &traceTriangles[ bvh->triangles[ node->first + j ] ];
+			BVHTriangleEpsilons( tt, epsilon );
+			for ( k = 0; k < 3; k++ )
+			{
+				block->v0[ k ][ lane ] = tt->v[ 0 ].xyz[ k ];
+				block->edge1[ k ][ lane ] = tt->edge1[ k ];
+				block->edge2[ k ][ lane ] = tt->edge2[ k ];
+				block->epsilon[ k ][ lane ] = epsilon[ k ];
+			}
+			block->triangles[ lane ] = bvh->triangles[ node->first + j ];
+		}
+
+		/* pad the last block */
+		for ( lane = numTriangles & 3; lane != 0 && lane < 4; lane++ )
+			bvh->blocks[ bvh->numBlocks + ( numTriangles >> 2 ) ].triangles[ lane ] = -1;
+
+		node->first = bvh->numBlocks;
+		node->numBlocks = ( numTriangles + 3 ) >> 2;
+		bvh->numBlocks += node->numBlocks;
+	}
+
+	/* the triangle list is no longer needed */
+	free( bvh->triangles );
+	bvh->triangles = NULL;
+	bvh->maxTriangles = 0;
+}
+
+
+
+
 /* -------------------------------------------------------------------------------
 
    shadow casting item setup (triangles, patches, entities)
@@ -1000,7 +1497,7 @@ static void PopulateWithBSPModel( bspModel_t *model, m4x4_t transform ){
 					m4x4_transform_point( transform, tw.v[ 0 ].xyz );
 					m4x4_transform_point( transform, tw.v[ 1 ].xyz );
 					m4x4_transform_point( transform, tw.v[ 2 ].xyz );
-					FilterTraceWindingIntoNodes_r( &tw, nodeNum );
+					FilterTraceWinding( &tw, nodeNum );
 
 					/* make second triangle */
 					VectorCopy( verts[ pw[ r + 0 ] ].xyz, tw.v[ 0 ].xyz );
@@ -1012,7 +1509,7 @@ static void PopulateWithBSPModel( bspModel_t *model, m4x4_t transform ){
 					m4x4_transform_point( transform, tw.v[ 0 ].xyz );
 					m4x4_transform_point( transform, tw.v[ 1 ].xyz );
 					m4x4_transform_point( transform, tw.v[ 2 ].xyz );
-					FilterTraceWindingIntoNodes_r( &tw, nodeNum );
+					FilterTraceWinding( &tw, nodeNum );
 				}
 			}
 
@@ -1039,7 +1536,7 @@ static void PopulateWithBSPModel( bspModel_t *model, m4x4_t transform ){
 				m4x4_transform_point( transform, tw.v[ 0 ].xyz );
 				m4x4_transform_point( transform, tw.v[ 1 ].xyz );
 				m4x4_transform_point( transform, tw.v[ 2 ].xyz );
-				FilterTraceWindingIntoNodes_r( &tw, nodeNum );
+				FilterTraceWinding( &tw, nodeNum );
 			}
 			break;
 
@@ -1133,7 +1630,7 @@ static void PopulateWithPicoModel( int castShadows, picoModel_t *model, m4x4_t t
 				Vector2Copy( st, tw.v[ k ].st );
 				m4x4_transform_point( transform, tw.v[ k ].xyz );
 			}
-			FilterTraceWindingIntoNodes_r( &tw, headNodeNum );
+			FilterTraceWinding( &tw, headNodeNum );
 		}
 	}
 }
@@ -1298,15 +1795,28 @@ void SetupTraceNodes( void ){
 	/* populate the tree with triangles from the world and shadow casting entities */
 	PopulateTraceNodes();
 
-	/* create the raytracing bsp */
-	if ( loMem == qfalse ) {
-		SubdivideTraceNode_r( headNodeNum, 0 );
-		SubdivideTraceNode_r( skyboxNodeNum, 0 );
+	/* the bvh replaces the subdivided raytracing bsp, the bsp tree is only walked for solid leafs */
+	if ( bvhTrace ) {
+		BuildBVH( &worldBVH );
+		BuildBVH( &skyboxBVH );
+		Sys_FPrintf( SYS_VRB, "%9d bvh nodes (%.2fMB)\n", worldBVH.numNodes + skyboxBVH.numNodes,
+					 (float) ( ( worldBVH.numNodes + skyboxBVH.numNodes ) * sizeof( bvhNode_t ) ) / ( 1024.0f * 1024.0f ) );
+		Sys_FPrintf( SYS_VRB, "%9d bvh triangle blocks (%.2fMB)\n", worldBVH.numBlocks + skyboxBVH.numBlocks,
+					 (float) ( ( worldBVH.numBlocks + skyboxBVH.numBlocks ) * sizeof( bvhTriBlock_t ) ) / ( 1024.0f * 1024.0f ) );
+		Sys_FPrintf( SYS_VRB, "%9d max bvh depth\n", worldBVH.depth > skyboxBVH.depth ? worldBVH.depth : skyboxBVH.depth );
 	}
+	else
+	{
+		/* create the raytracing bsp */
+		if ( loMem == qfalse ) {
+			SubdivideTraceNode_r( headNodeNum, 0 );
+			SubdivideTraceNode_r( skyboxNodeNum, 0 );
+		}
 
-	/* create triangles from the trace windings */
-	TriangulateTraceNode_r( headNodeNum );
-	TriangulateTraceNode_r( skyboxNodeNum );
+		/* create triangles from the trace windings */
+		TriangulateTraceNode_r( headNodeNum );
+		TriangulateTraceNode_r( skyboxNodeNum );
+	}
 
 	/* emit some stats */
 	//%	Sys_FPrintf( SYS_VRB, "%9d original triangles\n", numOriginalTriangles );
@@ -1360,6 +1870,136 @@ void SetupTraceNodes( void ){
 
 
 
+/*
+   FlagSkyboxOccluders_r()
+   marks the trace triangles filtered into the skybox node
+ */
+
+static void FlagSkyboxOccluders_r( int nodeNum ){
+	int i;
+	traceNode_t     *node;
+
+
+	/* dummy check */
+	if ( nodeNum < 0 || nodeNum >= numTraceNodes ) {
+		return;
+	}
+
+	/* recurse down decision nodes */
+	node = &traceNodes[ nodeNum ];
+	if ( node->type >= 0 ) {
+		FlagSkyboxOccluders_r( node->children[ 0 ] );
+		FlagSkyboxOccluders_r( node->children[ 1 ] );
+		return;
+	}
+
+	/* flag leaf triangles */
+	for ( i = 0; i < node->numItems; i++ )
+		traceOccluders[ node->items[ i ] ].skybox = qtrue;
+}
+
+
+
+/*
+   SetupTraceOccluders()
+   bounds and digests every trace triangle so the light cache can hash the occluders near a lightmap
+ */
+
+void SetupTraceOccluders( void ){
+	int i, j, lane;
+	traceTriangle_t *tt;
+	traceInfo_t     *ti;
+	traceOccluder_t *to;
+	md5_state_t mh;
+	byte digest[ 16 ];
+
+
+	/* allocate */
+	if ( traceOccluders != NULL ) {
+		free( traceOccluders );
+	}
+	traceOccluders = safe_malloc( ( numTraceTriangles + 1 ) * sizeof( *traceOccluders ) );
+	memset( traceOccluders, 0, ( numTraceTriangles + 1 ) * sizeof( *traceOccluders ) );
+
+	/* walk triangle list */
+	for ( i = 0; i < numTraceTriangles; i++ )
+	{
+		tt = &traceTriangles[ i ];
+		ti = &traceInfos[ tt->infoNum ];
+		to = &traceOccluders[ i ];
+
+		/* bound it */
+		ClearBounds( to->mins, to->maxs );
+		for ( j = 0; j < 3; j++ )
+			AddPointToBounds( tt->v[ j ].xyz, to->mins, to->maxs );
+
+		/* digest the geometry and everything that decides how it shadows */
+		md5_init( &mh );
+		md5_append( &mh, (md5_byte_t*) tt->v, sizeof( tt->v ) );
+		md5_append( &mh, (md5_byte_t*) &ti->surfaceNum, sizeof( ti->surfaceNum ) );
+		md5_append( &mh, (md5_byte_t*) &ti->castShadows, sizeof( ti->castShadows ) );
+		ShaderInfoDigest( ti->si, digest );
+		md5_append( &mh, digest, sizeof( digest ) );
+		md5_finish( &mh, digest );
+		memcpy( to->digest, digest, sizeof( to->digest ) );
+	}
+
+	/* skybox triangles live in their own tree */
+	if ( bvhTrace ) {
+		for ( i = 0; i < skyboxBVH.numBlocks; i++ )
+		{
+			for ( lane = 0; lane < 4; lane++ )
+			{
+				if ( skyboxBVH.blocks[ i ].triangles[ lane ] >= 0 ) {
+					traceOccluders[ skyboxBVH.blocks[ i ].triangles[ lane ] ].skybox = qtrue;
+				}
+			}
+		}
+	}
+	else{
+		FlagSkyboxOccluders_r( skyboxNodeNum );
+	}
+}
+
+
+
+/*
+   SumTraceOccluders()
+   sums the digests of the trace triangles touching a box (and of the skybox, when asked),
+   so the result doesn't depend on triangle order. returns the number of triangles summed
+ */
+
+int SumTraceOccluders( const vec3_t mins, const vec3_t maxs, qboolean skybox, unsigned int sum[ 4 ] ){
+	int i, numOccluders;
+	traceOccluder_t *to;
+
+
+	/* walk the list */
+	sum[ 0 ] = sum[ 1 ] = sum[ 2 ] = sum[ 3 ] = 0;
+	numOccluders = 0;
+	for ( i = 0; i < numTraceTriangles; i++ )
+	{
+		to = &traceOccluders[ i ];
+		if ( !( skybox && to->skybox ) &&
+			 ( to->mins[ 0 ] > maxs[ 0 ] || to->maxs[ 0 ] < mins[ 0 ] ||
+			   to->mins[ 1 ] > maxs[ 1 ] || to->maxs[ 1 ] < mins[ 1 ] ||
+			   to->mins[ 2 ] > maxs[ 2 ] || to->maxs[ 2 ] < mins[ 2 ] ) ) {
+			continue;
+		}
+
+		/* add it */
+		sum[ 0 ] += to->digest[ 0 ];
+		sum[ 1 ] += to->digest[ 1 ];
+		sum[ 2 ] += to->digest[ 2 ];
+		sum[ 3 ] += to->digest[ 3 ];
+		numOccluders++;
+	}
+
+	return numOccluders;
+}
+
+
+
 /* -------------------------------------------------------------------------------
 
    raytracer
@@ -1372,7 +2012,6 @@ void SetupTraceNodes( void ){
    based on code originally written by tomas moller and ben trumbore, journal of graphics tools, 2(1):21-28, 1997
  */
 
-#define BARY_EPSILON            0.01f
 #define ASLF_EPSILON            0.0001f /* so to not get double shadows */
 #define COPLANAR_EPSILON        0.25f   //%	0.000001f
 #define NEAR_SHADOW_EPSILON     1.5f    //%	1.25f
@@ -1570,6 +2209,394 @@ qboolean TraceWinding( traceWinding_t *tw, trace_t *trace ){
 
 
 
+/*
+   IntersectBVHBlock()
+   tests a ray against four triangles at once with the same math (and the same
+   operation order) as TraceTriangle, returns a bitmask of the lanes that hit
+ */
+
+#ifdef BVH_SSE
+
+static int IntersectBVHBlock( const bvhTriBlock_t *block, const trace_t *trace, float maxDepth, float *depth, float *u, float *v ){
+	__m128 dx, dy, dz, e1x, e1y, e1z, e2x, e2y, e2z;
+	__m128 px, py, pz, tx, ty, tz, qx, qy, qz;
+	__m128 det, invDet, uu, vv, tt, mask;
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps( 1.0f );
+
+
+	dx = _mm_set1_ps( trace->direction[ 0 ] );
+	dy = _mm_set1_ps( trace->direction[ 1 ] );
+	dz = _mm_set1_ps( trace->direction[ 2 ] );
+	e1x = _mm_load_ps( block->edge1[ 0 ] );
+	e1y = _mm_load_ps( block->edge1[ 1 ] );
+	e1z = _mm_load_ps( block->edge1[ 2 ] );
+	e2x = _mm_load_ps( block->edge2[ 0 ] );
+	e2y = _mm_load_ps( block->edge2[ 1 ] );
+	e2z = _mm_load_ps( block->edge2[ 2 ] );
+
+	/* pvec = direction x edge2, det = edge1 . pvec */
+	px = _mm_sub_ps( _mm_mul_ps( dy, e2z ), _mm_mul_ps( dz, e2y ) );
+	py = _mm_sub_ps( _mm_mul_ps( dz, e2x ), _mm_mul_ps( dx, e2z ) );
+	pz = _mm_sub_ps( _mm_mul_ps( dx, e2y ), _mm_mul_ps( dy, e2x ) );
+	det = _mm_add_ps( _mm_add_ps( _mm_mul_ps( e1x, px ), _mm_mul_ps( e1y, py ) ), _mm_mul_ps( e1z, pz ) );
+	mask = _mm_cmpge_ps( _mm_andnot_ps( _mm_set1_ps( -0.0f ), det ), _mm_set1_ps( COPLANAR_EPSILON ) );
+	if ( _mm_movemask_ps( mask ) == 0 ) {
+		return 0;
+	}
+	invDet = _mm_div_ps( _mm_set1_ps( 1.0f ), det );
+
+	/* tvec = origin - v0, u = tvec . pvec */
+	tx = _mm_sub_ps( _mm_set1_ps( trace->origin[ 0 ] ), _mm_load_ps( block->v0[ 0 ] ) );
+	ty = _mm_sub_ps( _mm_set1_ps( trace->origin[ 1 ] ), _mm_load_ps( block->v0[ 1 ] ) );
+	tz = _mm_sub_ps( _mm_set1_ps( trace->origin[ 2 ] ), _mm_load_ps( block->v0[ 2 ] ) );
+	uu = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( tx, px ), _mm_mul_ps( ty, py ) ), _mm_mul_ps( tz, pz ) ), invDet );
+	mask = _mm_and_ps( mask, _mm_and_ps( _mm_cmpge_ps( uu, _mm_sub_ps( zero, _mm_load_ps( block->epsilon[ 0 ] ) ) ),
+										 _mm_cmple_ps( uu, _mm_add_ps( one, _mm_load_ps( block->epsilon[ 0 ] ) ) ) ) );
+
+	/* qvec = tvec x edge1, v = direction . qvec */
+	qx = _mm_sub_ps( _mm_mul_ps( ty, e1z ), _mm_mul_ps( tz, e1y ) );
+	qy = _mm_sub_ps( _mm_mul_ps( tz, e1x ), _mm_mul_ps( tx, e1z ) );
+	qz = _mm_sub_ps( _mm_mul_ps( tx, e1y ), _mm_mul_ps( ty, e1x ) );
+	vv = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, qx ), _mm_mul_ps( dy, qy ) ), _mm_mul_ps( dz, qz ) ), invDet );
+	mask = _mm_and_ps( mask, _mm_and_ps( _mm_cmpge_ps( vv, _mm_sub_ps( zero, _mm_load_ps( block->epsilon[ 1 ] ) ) ),
+										 _mm_cmple_ps( _mm_add_ps( uu, vv ), _mm_add_ps( one, _mm_load_ps( block->epsilon[ 2 ] ) ) ) ) );
+
+	/* depth = edge2 . qvec */
+	tt = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( e2x, qx ), _mm_mul_ps( e2y, qy ) ), _mm_mul_ps( e2z, qz ) ), invDet );
+	mask = _mm_and_ps( mask, _mm_and_ps( _mm_cmpgt_ps( tt, _mm_set1_ps( trace->inhibitRadius ) ), _mm_cmplt_ps( tt, _mm_set1_ps( maxDepth ) ) ) );
+
+	_mm_storeu_ps( depth, tt );
+	_mm_storeu_ps( u, uu );
+	_mm_storeu_ps( v, vv );
+	return _mm_movemask_ps( mask );
+}
+
+#else
+
+static int IntersectBVHBlock( const bvhTriBlock_t *block, const trace_t *trace, float maxDepth, float *depth, float *u, float *v ){
+	int i, lane, mask;
+	vec3_t edge1, edge2, tvec, pvec, qvec;
+	float det, invDet;
+
+
+	mask = 0;
+	for ( lane = 0; lane < 4; lane++ )
+	{
+		for ( i = 0; i < 3; i++ )
+		{
+			edge1[ i ] = block->edge1[ i ][ lane ];
+			edge2[ i ] = block->edge2[ i ][ lane ];
+			tvec[ i ] = trace->origin[ i ] - block->v0[ i ][ lane ];
+		}
+		CrossProduct( trace->direction, edge2, pvec );
+		det = DotProduct( edge1, pvec );
+		if ( fabs( det ) < COPLANAR_EPSILON ) {
+			continue;
+		}
+		invDet = 1.0f / det;
+		u[ lane ] = DotProduct( tvec, pvec ) * invDet;
+		if ( u[ lane ] < -block->epsilon[ 0 ][ lane ] || u[ lane ] > ( 1.0f + block->epsilon[ 0 ][ lane ] ) ) {
+			continue;
+		}
+		CrossProduct( tvec, edge1, qvec );
+		v[ lane ] = DotProduct( trace->direction, qvec ) * invDet;
+		if ( v[ lane ] < -block->epsilon[ 1 ][ lane ] || ( u[ lane ] + v[ lane ] ) > ( 1.0f + block->epsilon[ 2 ][ lane ] ) ) {
+			continue;
+		}
+		depth[ lane ] = DotProduct( edge2, qvec ) * invDet;
+		if ( depth[ lane ] <= trace->inhibitRadius || depth[ lane ] >= maxDepth ) {
+			continue;
+		}
+		mask |= ( 1 << lane );
+	}
+	return mask;
+}
+
+#endif
+
+
+
+/*
+   ShadeBVHHit()
+   the non-geometric half of TraceTriangle: applies the shadow group, self-shadow
+   and sky rules to a bvh hit and sorts it into the nearest opaque hit or the
+   list of filtering hits
+ */
+
+static void ShadeBVHHit( int triangleNum, float depth, float u, float v, trace_t *trace, bvhHits_t *hits ){
+	int i;
+	float w, s, t;
+	int is, it;
+	traceTriangle_t *tt;
+	traceInfo_t     *ti;
+	shaderInfo_t    *si;
+	bvhHit_t        *hit;
+
+
+	/* get triangle */
+	tt = &traceTriangles[ triangleNum ];
+	ti = &traceInfos[ tt->infoNum ];
+	si = ti->si;
+
+	/* don't double-trace against sky */
+	if ( trace->compileFlags & si->compileFlags & C_SKY ) {
+		return;
+	}
+
+	/* receive shadows from worldspawn group only */
+	if ( trace->recvShadows == 1 ) {
+		if ( ti->castShadows != 1 ) {
+			return;
+		}
+	}
+
+	/* receive shadows from same group and worldspawn group */
+	else if ( trace->recvShadows > 1 ) {
+		if ( ti->castShadows != 1 && abs( ti->castShadows ) != abs( trace->recvShadows ) ) {
+			return;
+		}
+	}
+
+	/* receive shadows from the same group only (< 0) */
+	else
+	{
+		if ( abs( ti->castShadows ) != abs( trace->recvShadows ) ) {
+			return;
+		}
+	}
+
+	/* if hitpoint is really close to trace origin (sample point), then check for self-shadowing */
+	if ( depth <= SELF_SHADOW_EPSILON ) {
+		/* don't self-shadow */
+		for ( i = 0; i < trace->numSurfaces; i++ )
+		{
+			if ( ti->surfaceNum == trace->surfaces[ i ] ) {
+				return;
+			}
+		}
+	}
+
+	/* most surfaces are completely opaque */
+	if ( !( si->compileFlags & C_SKY ) &&
+		 ( !( si->compileFlags & ( C_ALPHASHADOW | C_LIGHTFILTER ) ) ||
+		   si->lightImage == NULL || si->lightImage->pixels == NULL ) ) {
+		hits->opaqueDepth = depth;
+		hits->opaqueSi = si;
+		return;
+	}
+
+	/* keep the nearest filtering hits */
+	if ( hits->numHits < MAX_BVH_HITS ) {
+		hit = &hits->hits[ hits->numHits++ ];
+	}
+	else
+	{
+		hit = &hits->hits[ 0 ];
+		for ( i = 1; i < MAX_BVH_HITS; i++ )
+		{
+			if ( hits->hits[ i ].depth > hit->depth ) {
+				hit = &hits->hits[ i ];
+			}
+		}
+		if ( hit->depth <= depth ) {
+			return;
+		}
+	}
+	hit->depth = depth;
+	hit->si = si;
+	hit->pixel = NULL;
+
+	/* sky only stacks compile flags, as do filter hits close to a triangle seam (avoids double shadows) */
+	if ( ( si->compileFlags & C_SKY ) ||
+		 u < -ASLF_EPSILON || u > ( 1.0f + ASLF_EPSILON ) ||
+		 v < -ASLF_EPSILON || ( u + v ) > ( 1.0f + ASLF_EPSILON ) ) {
+		return;
+	}
+
+	/* calculate st from uvw (barycentric) coordinates */
+	w = 1.0f - ( u + v );
+	s = w * tt->v[ 0 ].st[ 0 ] + u * tt->v[ 1 ].st[ 0 ] + v * tt->v[ 2 ].st[ 0 ];
+	t = w * tt->v[ 0 ].st[ 1 ] + u * tt->v[ 1 ].st[ 1 ] + v * tt->v[ 2 ].st[ 1 ];
+	s = s - floor( s );
+	t = t - floor( t );
+	is = s * si->lightImage->width;
+	it = t * si->lightImage->height;
+
+	/* get pixel */
+	hit->pixel = si->lightImage->pixels + 4 * ( it * si->lightImage->width + is );
+}
+
+
+
+/*
+   TraceBVH()
+   walks a bvh front to back, closing in on the nearest opaque hit
+ */
+
+static void TraceBVH( traceBVH_t *bvh, trace_t *trace, float maxDepth, bvhHits_t *hits ){
+	int i, lane, mask, nodeNum, stackDepth, near, far;
+	int stack[ BVH_MAX_DEPTH ];
+	float invDir[ 3 ], tMin, tMax, t0, t1;
+	float depth[ 4 ], u[ 4 ], v[ 4 ];
+	bvhNode_t       *node;
+	bvhTriBlock_t   *block;
+
+
+	/* empty? */
+	if ( bvh->numNodes <= 0 ) {
+		return;
+	}
+
+	/* setup inverse direction, avoiding infinities on axis aligned rays */
+	for ( i = 0; i < 3; i++ )
+		invDir[ i ] = trace->direction[ i ] != 0.0f ? 1.0f / trace->direction[ i ] : ( trace->direction[ i ] < 0.0f ? -1e30f : 1e30f );
+
+	/* walk the tree */
+	stackDepth = 0;
+	nodeNum = 0;
+	for ( ;; )
+	{
+		node = &bvh->nodes[ nodeNum ];
+
+		/* clip the ray against the node bounds */
+		tMin = 0.0f;
+		tMax = maxDepth < hits->opaqueDepth ? maxDepth : hits->opaqueDepth;
+		for ( i = 0; i < 3 && tMin <= tMax; i++ )
+		{
+			t0 = ( node->mins[ i ] - trace->origin[ i ] ) * invDir[ i ];
+			t1 = ( node->maxs[ i ] - trace->origin[ i ] ) * invDir[ i ];
+			if ( t0 > t1 ) {
+				tMin = t1 > tMin ? t1 : tMin;
+				tMax = t0 < tMax ? t0 : tMax;
+			}
+			else
+			{
+				tMin = t0 > tMin ? t0 : tMin;
+				tMax = t1 < tMax ? t1 : tMax;
+			}
+		}
+
+		/* missed, or already beyond the nearest opaque hit */
+		if ( tMin > tMax ) {
+			if ( stackDepth == 0 ) {
+				return;
+			}
+			nodeNum = stack[ --stackDepth ];
+			continue;
+		}
+
+		/* inner node: visit the near child first */
+		if ( node->numBlocks <= 0 ) {
+			if ( trace->direction[ -node->numBlocks ] < 0.0f ) {
+				near = node->first;
+				far = nodeNum + 1;
+			}
+			else
+			{
+				near = nodeNum + 1;
+				far = node->first;
+			}
+			stack[ stackDepth++ ] = far;
+			nodeNum = near;
+			continue;
+		}
+
+		/* test the leaf triangles */
+		PROFILE_COUNT( PROFILE_TRACE_TRIANGLES, node->numBlocks * 4 );
+		for ( i = 0; i < node->numBlocks; i++ )
+		{
+			block = &bvh->blocks[ node->first + i ];
+			mask = IntersectBVHBlock( block, trace, maxDepth < hits->opaqueDepth ? maxDepth : hits->opaqueDepth, depth, u, v );
+			for ( lane = 0; mask != 0; lane++, mask >>= 1 )
+			{
+				if ( ( mask & 1 ) && depth[ lane ] < hits->opaqueDepth ) {
+					ShadeBVHHit( block->triangles[ lane ], depth[ lane ], u[ lane ], v[ lane ], trace, hits );
+				}
+			}
+		}
+
+		/* pop */
+		if ( stackDepth == 0 ) {
+			return;
+		}
+		nodeNum = stack[ --stackDepth ];
+	}
+}
+
+
+
+/*
+   ResolveBVHHits()
+   applies the filtering hits in front of the nearest opaque hit in depth order,
+   giving the same result as TraceTriangle does when walking the raytracing bsp
+ */
+
+static void ResolveBVHHits( trace_t *trace, bvhHits_t *hits ){
+	int i, j;
+	float shadow;
+	bvhHit_t        *hit, temp;
+	shaderInfo_t    *si;
+
+
+	/* sort the filtering hits */
+	for ( i = 1; i < hits->numHits; i++ )
+	{
+		temp = hits->hits[ i ];
+		for ( j = i; j > 0 && hits->hits[ j - 1 ].depth > temp.depth; j-- )
+			hits->hits[ j ] = hits->hits[ j - 1 ];
+		hits->hits[ j ] = temp;
+	}
+
+	/* walk them up to the opaque hit */
+	for ( i = 0; i < hits->numHits && hits->hits[ i ].depth < hits->opaqueDepth; i++ )
+	{
+		hit = &hits->hits[ i ];
+		si = hit->si;
+
+		/* stack compile flags */
+		trace->compileFlags |= si->compileFlags;
+		if ( hit->pixel == NULL ) {
+			continue;
+		}
+
+		/* ydnar: color filter */
+		if ( si->compileFlags & C_LIGHTFILTER ) {
+			/* filter by texture color */
+			trace->color[ 0 ] *= ( ( 1.0f / 255.0f ) * hit->pixel[ 0 ] );
+			trace->color[ 1 ] *= ( ( 1.0f / 255.0f ) * hit->pixel[ 1 ] );
+			trace->color[ 2 ] *= ( ( 1.0f / 255.0f ) * hit->pixel[ 2 ] );
+		}
+
+		/* ydnar: alpha filter */
+		if ( si->compileFlags & C_ALPHASHADOW ) {
+			/* filter by inverse texture alpha */
+			shadow = ( 1.0f / 255.0f ) * ( 255 - hit->pixel[ 3 ] );
+			trace->color[ 0 ] *= shadow;
+			trace->color[ 1 ] *= shadow;
+			trace->color[ 2 ] *= shadow;
+		}
+
+		/* check filter for opaque */
+		if ( trace->color[ 0 ] <= 0.001f && trace->color[ 1 ] <= 0.001f && trace->color[ 2 ] <= 0.001f ) {
+			VectorMA( trace->origin, hit->depth, trace->direction, trace->hit );
+			trace->opaque = qtrue;
+			return;
+		}
+	}
+
+	/* opaque hit */
+	if ( hits->opaqueSi != NULL ) {
+		trace->compileFlags |= hits->opaqueSi->compileFlags;
+		VectorMA( trace->origin, hits->opaqueDepth, trace->direction, trace->hit );
+		VectorClear( trace->color );
+		trace->opaque = qtrue;
+	}
+}
+
+
+
+
 /*
    TraceLine_r()
    returns qtrue if something is hit and tracing can stop
@@ -1681,9 +2708,13 @@ static qboolean TraceLine_r( int nodeNum, vec3_t origin, vec3_t end, trace_t *tr
 
 void TraceLine( trace_t *trace ){
 	int i, j;
+	qboolean traceSkybox;
+	float maxDepth;
+	vec3_t delta;
 	traceNode_t     *node;
 	traceTriangle_t *tt;
 	traceInfo_t     *ti;
+	bvhHits_t hits;
 
 
 	/* setup output (note: this code assumes the input data is completely filled out) */
@@ -1696,6 +2727,7 @@ void TraceLine( trace_t *trace ){
 	if ( !trace->recvShadows || !trace->testOcclusion || trace->distance <= 0.00001f ) {
 		return;
 	}
+	PROFILE_COUNT( PROFILE_TRACES, 1 );
 
 	/* trace through nodes */
 	TraceLine_r( headNodeNum, trace->origin, trace->end, trace );
@@ -1710,9 +2742,29 @@ void TraceLine( trace_t *trace ){
 	}
 
 	/* testall means trace through sky */
-	if ( trace->testAll && trace->numTestNodes < MAX_TRACE_TEST_NODES &&
-		 trace->compileFlags & C_SKY &&
-		 ( trace->numSurfaces == 0 || surfaceInfos[ trace->surfaces[ 0 ] ].childSurfaceNum < 0 ) ) {
+	traceSkybox = trace->testAll && trace->numTestNodes < MAX_TRACE_TEST_NODES &&
+				  trace->compileFlags & C_SKY &&
+				  ( trace->numSurfaces == 0 || surfaceInfos[ trace->surfaces[ 0 ] ].childSurfaceNum < 0 );
+
+	/* bvh tracing, stopping at the first solid leaf */
+	if ( bvhTrace ) {
+		maxDepth = trace->distance;
+		if ( trace->passSolid ) {
+			VectorSubtract( trace->hit, trace->origin, delta );
+			maxDepth = VectorLength( delta ) + BVH_SOLID_EPSILON;
+		}
+		hits.opaqueDepth = maxDepth;
+		hits.opaqueSi = NULL;
+		hits.numHits = 0;
+		TraceBVH( &worldBVH, trace, maxDepth, &hits );
+		if ( traceSkybox ) {
+			TraceBVH( &skyboxBVH, trace, maxDepth, &hits );
+		}
+		ResolveBVHHits( trace, &hits );
+		return;
+	}
+
+	if ( traceSkybox ) {
 		//%	trace->testNodes[ trace->numTestNodes++ ] = skyboxNodeNum;
 		TraceLine_r( skyboxNodeNum, trace->origin, trace->end, trace );
 	}
@@ -1729,11 +2781,13 @@ void TraceLine( trace_t *trace ){
 			tt = &traceTriangles[ node->items[ j ] ];
 			ti = &traceInfos[ tt->infoNum ];
 			if ( TraceTriangle( ti, tt, trace ) ) {
+				PROFILE_COUNT( PROFILE_TRACE_TRIANGLES, j + 1 );
 				return;
 			}
 			//%	if( TraceWinding( &traceWindings[ node->items[ j ] ], trace ) )
 			//%		return;
 		}
+		PROFILE_COUNT( PROFILE_TRACE_TRIANGLES, node->numItems );
 	}
 }
 
@@ -36,6 +36,12 @@
 /* dependencies */
 #include "q3map2.h"
 
+/* sse is always available on x86_64, and on x86 when the compiler is told so */
+#if defined( __SSE__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 1 )
+	#define LUXEL_SSE
+	#include <xmmintrin.h>
+#endif
+
 
 
 
@@ -69,8 +75,13 @@ void ColorToBytes( const float *color, byte *colorBytes, float scale ){
 			continue;
 		}
 
-		/* gamma */
-		sample[ i ] = pow( sample[ i ] / 255.0f, gamma ) * 255.0f;
+		/* gamma (pow() is the identity at 1, but not a cheap one; this rounds the same) */
+		if ( gamma == 1.0f ) {
+			sample[ i ] = ( sample[ i ] / 255.0f ) * 255.0f;
+		}
+		else{
+			sample[ i ] = pow( sample[ i ] / 255.0f, gamma ) * 255.0f;
+		}
 	}
 
 	if ( lightmapExposure == 0 ) {
@@ -1851,13 +1862,137 @@ static void SubsampleRawLuxel_r( rawLightmap_t *lm, trace_t *trace, vec3_t sampl
 
 
 /*
-   IlluminateRawLightmap()
-   illuminates the luxels
+   SampleStepLuxel()
+   finds the luxel traced for the lightSampleStep block holding a mapped luxel,
+   which is the first mapped luxel of the block in scan order
  */
 
+static void SampleStepLuxel( rawLightmap_t *lm, int x, int y, int *stepX, int *stepY ){
+	int sx, sy, bx, by, ex;
+
+
+	/* get block */
+	bx = x - ( x % lightSampleStep );
+	by = y - ( y % lightSampleStep );
+
+	/* walk it up to the luxel itself */
+	for ( sy = by; sy <= y; sy++ )
+	{
+		ex = sy == y ? x : bx + lightSampleStep - 1;
+		for ( sx = bx; sx <= ex && sx < lm->sw; sx++ )
+		{
+			if ( *SUPER_CLUSTER( sx, sy ) >= 0 ) {
+				*stepX = sx;
+				*stepY = sy;
+				return;
+			}
+		}
+	}
+
+	/* the luxel is mapped, so this can't happen */
+	*stepX = x;
+	*stepY = y;
+}
+
+
+
 #define STACK_LL_SIZE           ( SUPER_LUXEL_SIZE * 64 * 64 )
 #define LIGHT_LUXEL( x, y )     ( lightLuxels + ( ( ( ( y ) * lm->sw ) + ( x ) ) * SUPER_LUXEL_SIZE ) )
 
+/*
+   LuxelMultiplyAdd()
+   dst += src * weight over a span of floats (a multiple of 4)
+ */
+
+static void LuxelMultiplyAdd( float *dst, const float *src, float weight, int numFloats ){
+#ifdef LUXEL_SSE
+	__m128 w;
+
+
+	w = _mm_set1_ps( weight );
+	for ( ; numFloats >= 4; numFloats -= 4, dst += 4, src += 4 )
+		_mm_storeu_ps( dst, _mm_add_ps( _mm_loadu_ps( dst ), _mm_mul_ps( _mm_loadu_ps( src ), w ) ) );
+#endif
+	for ( ; numFloats > 0; numFloats--, dst++, src++ )
+		*dst += *src * weight;
+}
+
+
+
+/*
+   FilterLightLuxels()
+   box filters the mapped luxels of one light's contribution. the filter gives the
+   outermost ring of the box half weight in each direction, so it is separable: luxels are
+   first masked into (rgb, 1) quads, then summed along rows and then along columns, each
+   pass a run of shifted multiply-adds over whole spans. on return filtered holds the
+   weighted rgb sum and the summed weight of each luxel; scratch must be the same size
+ */
+
+static void FilterLightLuxels( rawLightmap_t *lm, const float *lightLuxels, int radius, float *filtered, float *scratch ){
+	int x, y, d, lo, hi, rowFloats;
+	float weight;
+	const float *lightLuxel;
+	float       *quad;
+
+
+	rowFloats = lm->sw * 4;
+
+	/* mask into filtered */
+	for ( y = 0; y < lm->sh; y++ )
+	{
+		for ( x = 0; x < lm->sw; x++ )
+		{
+			quad = filtered + ( y * rowFloats ) + ( x * 4 );
+			if ( *SUPER_CLUSTER( x, y ) < 0 ) {
+				quad[ 0 ] = quad[ 1 ] = quad[ 2 ] = quad[ 3 ] = 0.0f;
+			}
+			else
+			{
+				lightLuxel = LIGHT_LUXEL( x, y );
+				VectorCopy( lightLuxel, quad );
+				quad[ 3 ] = 1.0f;
+			}
+		}
+	}
+
+	/* rows into scratch: scratch[ x ] = sum of filtered[ x + d ] */
+	memset( scratch, 0, lm->sh * rowFloats * sizeof( float ) );
+	for ( y = 0; y < lm->sh; y++ )
+	{
+		for ( d = -radius; d <= radius; d++ )
+		{
+			weight = ( d == -radius || d == radius ) ? 0.5f : 1.0f;
+			lo = d < 0 ? -d : 0;
+			hi = d > 0 ? lm->sw - d : lm->sw;
+			if ( lo < hi ) {
+				LuxelMultiplyAdd( scratch + ( y * rowFloats ) + ( lo * 4 ),
+								  filtered + ( y * rowFloats ) + ( ( lo + d ) * 4 ), weight, ( hi - lo ) * 4 );
+			}
+		}
+	}
+
+	/* columns back into filtered: filtered[ y ] = sum of scratch[ y + d ], a whole row at a time */
+	memset( filtered, 0, lm->sh * rowFloats * sizeof( float ) );
+	for ( y = 0; y < lm->sh; y++ )
+	{
+		for ( d = -radius; d <= radius; d++ )
+		{
+			if ( y + d < 0 || y + d >= lm->sh ) {
+				continue;
+			}
+			weight = ( d == -radius || d == radius ) ? 0.5f : 1.0f;
+			LuxelMultiplyAdd( filtered + ( y * rowFloats ), scratch + ( ( y + d ) * rowFloats ), weight, rowFloats );
+		}
+	}
+}
+
+
+
+/*
+   IlluminateRawLightmap()
+   illuminates the luxels
+ */
+
 void IlluminateRawLightmap( int rawLightmapNum ){
 	int i, t, x, y, sx, sy, size, luxelFilterRadius, lightmapNum;
 	int                 *cluster, *cluster2, mapped, lighted, totalLighted;
@@ -1867,8 +2002,8 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 	qboolean filterColor, filterDir;
 	float brightness;
 	float               *origin, *normal, *dirt, *luxel, *luxel2, *deluxel, *deluxel2;
-	float               *lightLuxels, *lightLuxel, samples, filterRadius, weight;
-	vec3_t color, averageColor, averageDir, total, temp, temp2;
+	float               *lightLuxels, *lightLuxel, *filterLuxels, *filterLuxel, samples, filterRadius;
+	vec3_t averageColor, averageDir, total, temp, temp2;
 	float tests[ 4 ][ 2 ] = { { 0.0f, 0 }, { 1, 0 }, { 0, 1 }, { 1, 1 } };
 	trace_t trace;
 	float stackLightLuxels[ STACK_LL_SIZE ];
@@ -1909,6 +2044,12 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 	/* create a culled light list for this raw lightmap */
 	CreateTraceLightsForBounds( lm->mins, lm->maxs, lm->plane, lm->numLightClusters, lm->lightClusters, LIGHT_SURFACES, &trace );
 
+	/* reuse the cached lighting if nothing that lights this lightmap has changed */
+	if ( lightCache && LightCacheLookup( rawLightmapNum, &trace ) ) {
+		FreeTraceLights( &trace );
+		return;
+	}
+
 	/* -----------------------------------------------------------------
 	   fill pass
 	   ----------------------------------------------------------------- */
@@ -1990,6 +2131,7 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 		else{
 			lightLuxels = safe_malloc( llSize );
 		}
+		filterLuxels = NULL;
 
 		/* clear luxels */
 		//%	memset( lm->superLuxels[ 0 ], 0, llSize );
@@ -2077,6 +2219,16 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 					origin = SUPER_ORIGIN( x, y );
 					normal = SUPER_NORMAL( x, y );
 
+					/* progressive preview only traces one luxel per block */
+					if ( lightSampleStep > 1 ) {
+						SampleStepLuxel( lm, x, y, &sx, &sy );
+						if ( sx != x || sy != y ) {
+							VectorCopy( LIGHT_LUXEL( sx, sy ), lightLuxel );
+							lightLuxel[ 3 ] = 1.0f;
+							continue;
+						}
+					}
+
 					////////// 27's temp hack for testing edge clipping ////
 					if ( origin[0] == 0 && origin[1] == 0 && origin[2] == 0 ) {
 						lightLuxel[ 1 ] = 255;
@@ -2133,9 +2285,14 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 				luxelFilterRadius = 1;
 			}
 
+			/* the progressive preview is neither filtered nor supersampled */
+			if ( lightSampleStep > 1 ) {
+				luxelFilterRadius = 0;
+			}
+
 			/* secondary pass, adaptive supersampling (fixme: use a contrast function to determine if subsampling is necessary) */
 			/* 2003-09-27: changed it so filtering disamples supersampling, as it would waste time */
-			if ( lightSamples > 1 && luxelFilterRadius == 0 ) {
+			if ( lightSamples > 1 && luxelFilterRadius == 0 && lightSampleStep <= 1 ) {
 				/* walk luxels */
 				for ( y = 0; y < ( lm->sh - 1 ); y++ )
 				{
@@ -2242,6 +2399,14 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 				//%	Sys_Printf( "Surface %6d has lightstyle %d\n", rawLightmapNum, trace.light->style );
 			}
 
+			/* cheaper distance-based filtering, for all luxels at once */
+			if ( luxelFilterRadius ) {
+				if ( filterLuxels == NULL ) {
+					filterLuxels = safe_malloc( 2 * llSize );
+				}
+				FilterLightLuxels( lm, lightLuxels, luxelFilterRadius, filterLuxels, filterLuxels + ( llSize / sizeof( float ) ) );
+			}
+
 			/* copy to permanent luxels */
 			for ( y = 0; y < lm->sh; y++ )
 			{
@@ -2256,40 +2421,10 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 
 					/* filter? */
 					if ( luxelFilterRadius ) {
-						/* setup */
-						VectorClear( averageColor );
-						samples = 0.0f;
-
-						/* cheaper distance-based filtering */
-						for ( sy = ( y - luxelFilterRadius ); sy <= ( y + luxelFilterRadius ); sy++ )
-						{
-							if ( sy < 0 || sy >= lm->sh ) {
-								continue;
-							}
-
-							for ( sx = ( x - luxelFilterRadius ); sx <= ( x + luxelFilterRadius ); sx++ )
-							{
-								if ( sx < 0 || sx >= lm->sw ) {
-									continue;
-								}
-
-								/* get particulars */
-								cluster = SUPER_CLUSTER( sx, sy );
-								if ( *cluster < 0 ) {
-									continue;
-								}
-								lightLuxel = LIGHT_LUXEL( sx, sy );
-
-								/* create weight */
-								weight = ( abs( sx - x ) == luxelFilterRadius ? 0.5f : 1.0f );
-								weight *= ( abs( sy - y ) == luxelFilterRadius ? 0.5f : 1.0f );
-
-								/* scale luxel by filter weight */
-								VectorScale( lightLuxel, weight, color );
-								VectorAdd( averageColor, color, averageColor );
-								samples += weight;
-							}
-						}
+						/* get the filtered sum */
+						filterLuxel = filterLuxels + ( ( ( y * lm->sw ) + x ) * 4 );
+						VectorCopy( filterLuxel, averageColor );
+						samples = filterLuxel[ 3 ];
 
 						/* any samples? */
 						if ( samples <= 0.0f ) {
@@ -2345,10 +2480,27 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 			}
 		}
 
+		/* progressive preview luxels take the light direction of the luxel traced for them */
+		if ( deluxemap && lightSampleStep > 1 ) {
+			for ( y = 0; y < lm->sh; y++ )
+			{
+				for ( x = 0; x < lm->sw; x++ )
+				{
+					cluster = SUPER_CLUSTER( x, y );
+					if ( *cluster < 0 ) {
+						continue;
+					}
+					SampleStepLuxel( lm, x, y, &sx, &sy );
+					VectorCopy( SUPER_DELUXEL( sx, sy ), SUPER_DELUXEL( x, y ) );
+				}
+			}
+		}
+
 		/* free temporary luxels */
 		if ( lightLuxels != stackLightLuxels ) {
 			free( lightLuxels );
 		}
+		free( filterLuxels );
 	}
 
 	/* free light list */
@@ -2432,7 +2584,8 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 	    dirt pass
 	    ----------------------------------------------------------------- */
 
-	if ( dirty ) {
+	/* the dirt map isn't made until after the progressive preview */
+	if ( dirty && lightSampleStep <= 1 ) {
 		/* walk lightmaps */
 		for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
 		{
@@ -3339,6 +3492,305 @@ qboolean ChopBounds( vec3_t mins, vec3_t maxs, vec3_t origin, vec3_t normal ){
 
 
 
+/*
+   light index
+   a uniform grid over the light envelopes, rebuilt by SetupEnvelopes(), so
+   CreateTraceLightsForBounds() only tests the lights near its bounds. queries
+   use a per-thread buffer, which stays valid until the next query on that
+   thread or the next SetupEnvelopes()
+ */
+
+#define LIGHT_INDEX_MAX_CELLS   64          /* per axis */
+
+typedef struct lightQuery_s
+{
+	struct lightQuery_s     *next;
+	int mark;
+	int                     *marks;         /* last query each light was found by */
+	int                     *candidates;
+	light_t                 **lights;
+}
+lightQuery_t;
+
+static int numIndexLights;
+static light_t              **indexLights;  /* in light list order */
+static int numGlobalLights;
+static int                  *globalLights;  /* suns and lights covering most of the grid */
+static int lightIndexCells[ 3 ];
+static vec3_t lightIndexMins, lightIndexScale;
+static int                  *lightCellFirst;
+static int                  *lightCellLights;
+
+static int lightIndexGeneration;
+static lightQuery_t         *lightQueries;
+static Q_THREAD_LOCAL lightQuery_t *lightQuery;
+static Q_THREAD_LOCAL int lightQueryGeneration;     /* kept apart, lightQuery may already be freed */
+
+
+
+/*
+   LightIndexCellRange()
+   gets the range of grid cells a box touches, clamping to the grid so
+   anything outside it falls into the edge cells
+ */
+
+static void LightIndexCellRange( const vec3_t mins, const vec3_t maxs, int lo[ 3 ], int hi[ 3 ] ){
+	int i;
+
+
+	for ( i = 0; i < 3; i++ )
+	{
+		lo[ i ] = (int) floor( ( mins[ i ] - lightIndexMins[ i ] ) * lightIndexScale[ i ] );
+		hi[ i ] = (int) floor( ( maxs[ i ] - lightIndexMins[ i ] ) * lightIndexScale[ i ] );
+		lo[ i ] = lo[ i ] < 0 ? 0 : ( lo[ i ] >= lightIndexCells[ i ] ? lightIndexCells[ i ] - 1 : lo[ i ] );
+		hi[ i ] = hi[ i ] < 0 ? 0 : ( hi[ i ] >= lightIndexCells[ i ] ? lightIndexCells[ i ] - 1 : hi[ i ] );
+	}
+}
+
+
+
+/*
+   LightEnvelopeBounds()
+   gets the box around a light's envelope sphere
+ */
+
+static void LightEnvelopeBounds( const light_t *light, vec3_t mins, vec3_t maxs ){
+	int i;
+
+
+	for ( i = 0; i < 3; i++ )
+	{
+		mins[ i ] = light->origin[ i ] - light->envelope;
+		maxs[ i ] = light->origin[ i ] + light->envelope;
+	}
+}
+
+
+
+/*
+   SetupLightIndex()
+   buckets the lights by the grid cells their envelopes touch
+ */
+
+static void SetupLightIndex( void ){
+	int i, x, y, z, numCells, cell, lo[ 3 ], hi[ 3 ];
+	int                 *lightCells;
+	float size, extent;
+	vec3_t mins, maxs;
+	light_t             *light;
+	lightQuery_t        *query, *next;
+
+
+	/* free the old index and the query buffers that point into it */
+	free( indexLights );
+	free( globalLights );
+	free( lightCellFirst );
+	free( lightCellLights );
+	indexLights = NULL;
+	globalLights = NULL;
+	lightCellFirst = NULL;
+	lightCellLights = NULL;
+	numIndexLights = 0;
+	numGlobalLights = 0;
+	for ( query = lightQueries; query != NULL; query = next )
+	{
+		next = query->next;
+		free( query->marks );
+		free( query->candidates );
+		free( query->lights );
+		free( query );
+	}
+	lightQueries = NULL;
+	lightIndexGeneration++;
+
+	/* count and number the lights */
+	for ( light = lights; light != NULL; light = light->next )
+		numIndexLights++;
+	indexLights = safe_malloc( ( numIndexLights + 1 ) * sizeof( *indexLights ) );
+	globalLights = safe_malloc( ( numIndexLights + 1 ) * sizeof( *globalLights ) );
+	size = 0.0f;
+	for ( i = 0, light = lights; light != NULL; i++, light = light->next )
+	{
+		indexLights[ i ] = light;
+		if ( light->type != EMIT_SUN ) {
+			size += light->envelope;
+		}
+	}
+
+	/* size the cells by the average envelope, over the world model */
+	size = numIndexLights > 0 ? size / numIndexLights : 0.0f;
+	if ( size < 64.0f ) {
+		size = 64.0f;
+	}
+	VectorCopy( bspModels[ 0 ].mins, lightIndexMins );
+	numCells = 1;
+	for ( i = 0; i < 3; i++ )
+	{
+		extent = bspModels[ 0 ].maxs[ i ] - bspModels[ 0 ].mins[ i ];
+		lightIndexCells[ i ] = extent > 0.0f ? (int) ceil( extent / size ) : 1;
+		if ( lightIndexCells[ i ] > LIGHT_INDEX_MAX_CELLS ) {
+			lightIndexCells[ i ] = LIGHT_INDEX_MAX_CELLS;
+		}
+		if ( lightIndexCells[ i ] < 1 ) {
+			lightIndexCells[ i ] = 1;
+		}
+		lightIndexScale[ i ] = extent > 0.0f ? lightIndexCells[ i ] / extent : 0.0f;
+		numCells *= lightIndexCells[ i ];
+	}
+
+	/* count the lights in each cell, leaving out the ones that would be in most of them */
+	lightCellFirst = safe_malloc( ( numCells + 1 ) * sizeof( *lightCellFirst ) );
+	memset( lightCellFirst, 0, ( numCells + 1 ) * sizeof( *lightCellFirst ) );
+	lightCells = safe_malloc( ( numIndexLights + 1 ) * sizeof( *lightCells ) );
+	for ( i = 0; i < numIndexLights; i++ )
+	{
+		light = indexLights[ i ];
+		lightCells[ i ] = 0;
+		if ( light->type == EMIT_SUN ) {
+			globalLights[ numGlobalLights++ ] = i;
+			continue;
+		}
+		LightEnvelopeBounds( light, mins, maxs );
+		LightIndexCellRange( mins, maxs, lo, hi );
+		lightCells[ i ] = ( hi[ 0 ] - lo[ 0 ] + 1 ) * ( hi[ 1 ] - lo[ 1 ] + 1 ) * ( hi[ 2 ] - lo[ 2 ] + 1 );
+		if ( numCells >= 8 && lightCells[ i ] > numCells / 4 ) {
+			globalLights[ numGlobalLights++ ] = i;
+			lightCells[ i ] = 0;
+			continue;
+		}
+		for ( z = lo[ 2 ]; z <= hi[ 2 ]; z++ )
+			for ( y = lo[ 1 ]; y <= hi[ 1 ]; y++ )
+				for ( x = lo[ 0 ]; x <= hi[ 0 ]; x++ )
+					lightCellFirst[ ( ( z * lightIndexCells[ 1 ] ) + y ) * lightIndexCells[ 0 ] + x + 1 ]++;
+	}
+
+	/* fill the cells, each in light list order */
+	for ( cell = 0; cell < numCells; cell++ )
+		lightCellFirst[ cell + 1 ] += lightCellFirst[ cell ];
+	lightCellLights = safe_malloc( ( lightCellFirst[ numCells ] + 1 ) * sizeof( *lightCellLights ) );
+	for ( i = 0; i < numIndexLights; i++ )
+	{
+		if ( lightCells[ i ] == 0 ) {
+			continue;
+		}
+		LightEnvelopeBounds( indexLights[ i ], mins, maxs );
+		LightIndexCellRange( mins, maxs, lo, hi );
+		for ( z = lo[ 2 ]; z <= hi[ 2 ]; z++ )
+			for ( y = lo[ 1 ]; y <= hi[ 1 ]; y++ )
+				for ( x = lo[ 0 ]; x <= hi[ 0 ]; x++ )
+				{
+					cell = ( ( z * lightIndexCells[ 1 ] ) + y ) * lightIndexCells[ 0 ] + x;
+					lightCellLights[ lightCellFirst[ cell ]++ ] = i;
+				}
+	}
+
+	/* the fill moved each cell start to the next cell's, so shift them back */
+	for ( cell = numCells; cell > 0; cell-- )
+		lightCellFirst[ cell ] = lightCellFirst[ cell - 1 ];
+	lightCellFirst[ 0 ] = 0;
+	free( lightCells );
+
+	/* note it */
+	Sys_FPrintf( SYS_VRB, "%9d light index cells (%d x %d x %d), %d global lights\n",
+				 numCells, lightIndexCells[ 0 ], lightIndexCells[ 1 ], lightIndexCells[ 2 ], numGlobalLights );
+}
+
+
+
+/*
+   GetLightQuery()
+   gets this thread's light query buffers for the current light index
+ */
+
+static lightQuery_t *GetLightQuery( void ){
+	lightQuery_t    *query;
+
+
+	/* still good? */
+	if ( lightQuery != NULL && lightQueryGeneration == lightIndexGeneration ) {
+		return lightQuery;
+	}
+
+	/* make new ones for this index */
+	query = safe_malloc( sizeof( *query ) );
+	query->mark = 0;
+	query->marks = safe_malloc( ( numIndexLights + 1 ) * sizeof( *query->marks ) );
+	memset( query->marks, 0, ( numIndexLights + 1 ) * sizeof( *query->marks ) );
+	query->candidates = safe_malloc( ( numIndexLights + 1 ) * sizeof( *query->candidates ) );
+	query->lights = safe_malloc( ( numIndexLights + 1 ) * sizeof( *query->lights ) );
+
+	/* keep track of them so the next SetupLightIndex() can free them */
+	ThreadLock();
+	query->next = lightQueries;
+	lightQueries = query;
+	ThreadUnlock();
+
+	lightQuery = query;
+	lightQueryGeneration = lightIndexGeneration;
+	return query;
+}
+
+
+
+/*
+   CompareLightIndex()
+   compare function for qsort()
+ */
+
+static int CompareLightIndex( const void *a, const void *b ){
+	return *( (const int*) a ) - *( (const int*) b );
+}
+
+
+
+/*
+   FindIndexLights()
+   gets the lights whose envelopes may reach a box, in light list order
+ */
+
+static int FindIndexLights( const vec3_t mins, const vec3_t maxs, lightQuery_t *query ){
+	int i, x, y, z, cell, num, numCandidates, lo[ 3 ], hi[ 3 ];
+
+
+	/* new mark */
+	if ( query->mark == INT_MAX ) {
+		memset( query->marks, 0, ( numIndexLights + 1 ) * sizeof( *query->marks ) );
+		query->mark = 0;
+	}
+	query->mark++;
+
+	/* global lights always make it */
+	numCandidates = 0;
+	for ( i = 0; i < numGlobalLights; i++ )
+	{
+		query->marks[ globalLights[ i ] ] = query->mark;
+		query->candidates[ numCandidates++ ] = globalLights[ i ];
+	}
+
+	/* walk the cells */
+	LightIndexCellRange( mins, maxs, lo, hi );
+	for ( z = lo[ 2 ]; z <= hi[ 2 ]; z++ )
+		for ( y = lo[ 1 ]; y <= hi[ 1 ]; y++ )
+			for ( x = lo[ 0 ]; x <= hi[ 0 ]; x++ )
+			{
+				cell = ( ( z * lightIndexCells[ 1 ] ) + y ) * lightIndexCells[ 0 ] + x;
+				for ( i = lightCellFirst[ cell ]; i < lightCellFirst[ cell + 1 ]; i++ )
+				{
+					num = lightCellLights[ i ];
+					if ( query->marks[ num ] != query->mark ) {
+						query->marks[ num ] = query->mark;
+						query->candidates[ numCandidates++ ] = num;
+					}
+				}
+			}
+
+	/* the lights are summed in list order, so keep to it */
+	qsort( query->candidates, numCandidates, sizeof( int ), CompareLightIndex );
+	return numCandidates;
+}
+
+
+
 /*
    SetupEnvelopes()
    calculates each light's effective envelope,
@@ -3359,6 +3811,10 @@ void SetupEnvelopes( qboolean forGrid, qboolean fastFlag ){
 
 	/* early out for weird cases where there are no lights */
 	if ( lights == NULL ) {
+		/* CreateTraceLightsForBounds() lands here from the worker threads, so only empty a stale index */
+		if ( numIndexLights > 0 || lightCellFirst == NULL ) {
+			SetupLightIndex();
+		}
 		return;
 	}
 
@@ -3602,7 +4058,7 @@ void SetupEnvelopes( qboolean forGrid, qboolean fastFlag ){
 				numCulledLights++;
 				*owner = light->next;
 				if ( light->w != NULL ) {
-					free( light->w );
+					FreeWinding( light->w );
 				}
 				free( light );
 				continue;
@@ -3653,6 +4109,9 @@ void SetupEnvelopes( qboolean forGrid, qboolean fastFlag ){
 	/* emit some statistics */
 	Sys_Printf( "%9d total lights\n", numLights );
 	Sys_Printf( "%9d culled lights\n", numCulledLights );
+
+	/* index them */
+	SetupLightIndex();
 }
 
 
@@ -3663,9 +4122,10 @@ void SetupEnvelopes( qboolean forGrid, qboolean fastFlag ){
  */
 
 void CreateTraceLightsForBounds( vec3_t mins, vec3_t maxs, vec3_t normal, int numClusters, int *clusters, int flags, trace_t *trace ){
-	int i;
+	int i, c, numCandidates;
 	light_t     *light;
-	vec3_t origin, dir, nullVector = { 0.0f, 0.0f, 0.0f };
+	lightQuery_t    *query;
+	vec3_t origin, dir, sphereMins, sphereMaxs, nullVector = { 0.0f, 0.0f, 0.0f };
 	float radius, dist, length;
 
 
@@ -3677,8 +4137,9 @@ void CreateTraceLightsForBounds( vec3_t mins, vec3_t maxs, vec3_t normal, int nu
 	/* debug code */
 	//% Sys_Printf( "CTWLFB: (%4.1f %4.1f %4.1f) (%4.1f %4.1f %4.1f)\n", mins[ 0 ], mins[ 1 ], mins[ 2 ], maxs[ 0 ], maxs[ 1 ], maxs[ 2 ] );
 
-	/* allocate the light list */
-	trace->lights = safe_malloc( sizeof( light_t* ) * ( numLights + 1 ) );
+	/* use this thread's light list */
+	query = GetLightQuery();
+	trace->lights = query->lights;
 	trace->numLights = 0;
 
 	/* calculate spherical bounds */
@@ -3687,6 +4148,15 @@ void CreateTraceLightsForBounds( vec3_t mins, vec3_t maxs, vec3_t normal, int nu
 	VectorSubtract( maxs, origin, dir );
 	radius = (float) VectorLength( dir );
 
+	/* find the lights that may reach the sphere, the rest are envelope culled */
+	for ( i = 0; i < 3; i++ )
+	{
+		sphereMins[ i ] = origin[ i ] - radius;
+		sphereMaxs[ i ] = origin[ i ] + radius;
+	}
+	numCandidates = FindIndexLights( sphereMins, sphereMaxs, query );
+	lightsEnvelopeCulled += numIndexLights - numCandidates;
+
 	/* get length of normal vector */
 	if ( normal != NULL ) {
 		length = VectorLength( normal );
@@ -3699,8 +4169,10 @@ void CreateTraceLightsForBounds( vec3_t mins, vec3_t maxs, vec3_t normal, int nu
 
 	/* test each light and see if it reaches the sphere */
 	/* note: the attenuation code MUST match LightingAtSample() */
-	for ( light = lights; light; light = light->next )
+	for ( c = 0; c < numCandidates; c++ )
 	{
+		light = indexLights[ query->candidates[ c ] ];
+
 		/* check zero sized envelope */
 		if ( light->envelope <= 0 ) {
 			lightsEnvelopeCulled++;
@@ -3787,9 +4259,9 @@ void CreateTraceLightsForBounds( vec3_t mins, vec3_t maxs, vec3_t normal, int nu
 
 
 void FreeTraceLights( trace_t *trace ){
-	if ( trace->lights != NULL ) {
-		free( trace->lights );
-	}
+	/* the list belongs to the light index */
+	trace->lights = NULL;
+	trace->numLights = 0;
 }
 
 
@@ -3832,6 +4304,32 @@ void CreateTraceLightsForSurface( int num, trace_t *trace ){
 	CreateTraceLightsForBounds( mins, maxs, normal, info->numSurfaceClusters, &surfaceClusters[ info->firstSurfaceCluster ], LIGHT_SURFACES, trace );
 }
 
+
+
+/*
+   CreateTraceLightsForPoint()
+   creates a list of the lights whose envelopes may reach a light grid point,
+   leaving the rest of the tests to LightContributionToPoint()
+ */
+
+void CreateTraceLightsForPoint( vec3_t point, trace_t *trace ){
+	int i, numCandidates;
+	lightQuery_t    *query;
+
+
+	/* use this thread's light list */
+	query = GetLightQuery();
+	trace->lights = query->lights;
+
+	/* copy out the candidates */
+	numCandidates = FindIndexLights( point, point, query );
+	gridEnvelopeCulled += numIndexLights - numCandidates;
+	for ( i = 0; i < numCandidates; i++ )
+		trace->lights[ i ] = indexLights[ query->candidates[ i ] ];
+	trace->lights[ numCandidates ] = NULL;
+	trace->numLights = numCandidates;
+}
+
 /////////////////////////////////////////////////////////////
 
 #define FLOODLIGHT_CONE_ANGLE           88  /* degrees */
@@ -1939,6 +1939,12 @@ static void SetupOutLightmap( rawLightmap_t *lm, outLightmap_t *olm ){
 	olm->numShaders = 0;
 
 	/* allocate buffers */
+	olm->skyline = safe_malloc( olm->customWidth * sizeof( *olm->skyline ) );
+	memset( olm->skyline, 0, olm->customWidth * sizeof( *olm->skyline ) );
+	olm->skylineMin = 0;
+	olm->numFreeRects = 0;
+	olm->maxFreeRects = 0;
+	olm->freeRects = NULL;
 	olm->lightBits = safe_malloc( ( olm->customWidth * olm->customHeight / 8 ) + 8 );
 	memset( olm->lightBits, 0, ( olm->customWidth * olm->customHeight / 8 ) + 8 );
 	olm->bspLightBytes = safe_malloc( olm->customWidth * olm->customHeight * 3 );
@@ -1951,13 +1957,232 @@ static void SetupOutLightmap( rawLightmap_t *lm, outLightmap_t *olm ){
 
 
 
+/*
+   AddOutLightmapFreeRect()
+   remembers a free rectangle on an output lightmap
+ */
+
+static void AddOutLightmapFreeRect( outLightmap_t *olm, int x, int y, int w, int h ){
+	outLightmapRect_t   *rects;
+
+
+	/* dummy check */
+	if ( w <= 0 || h <= 0 ) {
+		return;
+	}
+
+	/* grow the list */
+	if ( olm->numFreeRects >= olm->maxFreeRects ) {
+		olm->maxFreeRects = olm->maxFreeRects > 0 ? olm->maxFreeRects * 2 : 16;
+		rects = safe_malloc( olm->maxFreeRects * sizeof( *rects ) );
+		if ( olm->freeRects != NULL ) {
+			memcpy( rects, olm->freeRects, olm->numFreeRects * sizeof( *rects ) );
+			free( olm->freeRects );
+		}
+		olm->freeRects = rects;
+	}
+
+	/* add it */
+	olm->freeRects[ olm->numFreeRects ].x = x;
+	olm->freeRects[ olm->numFreeRects ].y = y;
+	olm->freeRects[ olm->numFreeRects ].w = w;
+	olm->freeRects[ olm->numFreeRects ].h = h;
+	olm->numFreeRects++;
+}
+
+
+
+/*
+   FitOutLightmapFreeRect()
+   places a w x h stamp in the tightest free rectangle that holds it, splitting
+   off what is left over along the shorter side
+ */
+
+static qboolean FitOutLightmapFreeRect( outLightmap_t *olm, int w, int h, int *outX, int *outY ){
+	int i, best, area, bestArea;
+	outLightmapRect_t rect;
+
+
+	/* find the tightest rect */
+	best = -1;
+	bestArea = 0;
+	for ( i = 0; i < olm->numFreeRects; i++ )
+	{
+		if ( olm->freeRects[ i ].w < w || olm->freeRects[ i ].h < h ) {
+			continue;
+		}
+		area = olm->freeRects[ i ].w * olm->freeRects[ i ].h;
+		if ( best < 0 || area < bestArea ) {
+			best = i;
+			bestArea = area;
+		}
+	}
+	if ( best < 0 ) {
+		return qfalse;
+	}
+
+	/* take it out of the list */
+	rect = olm->freeRects[ best ];
+	olm->freeRects[ best ] = olm->freeRects[ --olm->numFreeRects ];
+	*outX = rect.x;
+	*outY = rect.y;
+
+	/* split the rest */
+	if ( rect.w - w < rect.h - h ) {
+		AddOutLightmapFreeRect( olm, rect.x + w, rect.y, rect.w - w, h );
+		AddOutLightmapFreeRect( olm, rect.x, rect.y + h, rect.w, rect.h - h );
+	}
+	else
+	{
+		AddOutLightmapFreeRect( olm, rect.x + w, rect.y, rect.w - w, rect.h );
+		AddOutLightmapFreeRect( olm, rect.x, rect.y + h, w, rect.h - h );
+	}
+	return qtrue;
+}
+
+
+
+/*
+   ClipOutLightmapFreeRects()
+   drops the free rectangles a stamp placed by luxel tests overlaps
+ */
+
+static void ClipOutLightmapFreeRects( outLightmap_t *olm, int x, int y, int w, int h ){
+	int i;
+	outLightmapRect_t   *rect;
+
+
+	for ( i = 0; i < olm->numFreeRects; i++ )
+	{
+		rect = &olm->freeRects[ i ];
+		if ( rect->x < x + w && x < rect->x + rect->w && rect->y < y + h && y < rect->y + rect->h ) {
+			*rect = olm->freeRects[ --olm->numFreeRects ];
+			i--;
+		}
+	}
+}
+
+
+
+/*
+   FitOutLightmapSkyline()
+   finds where a w x h stamp sits on top of the filled area of an output
+   lightmap, wasting the least space under it, then lowest. everything above
+   the skyline is free, so the stamp doesn't need to be tested luxel by luxel
+ */
+
+static qboolean FitOutLightmapSkyline( outLightmap_t *olm, int w, int h, int *outX, int *outY ){
+	int x, y, head, tail, sum, waste, bestY, bestWaste;
+	static int  *window = NULL;
+	static int windowSize = 0;
+
+
+	/* early out on the lowest column */
+	if ( w > olm->customWidth || h > ( olm->customHeight - olm->skylineMin ) ) {
+		return qfalse;
+	}
+
+	/* grow the sliding window */
+	if ( windowSize < olm->customWidth ) {
+		free( window );
+		windowSize = olm->customWidth;
+		window = safe_malloc( windowSize * sizeof( *window ) );
+	}
+
+	/* slide a w wide window across the columns, keeping its tallest column at the head */
+	head = tail = 0;
+	sum = 0;
+	bestY = olm->customHeight;
+	bestWaste = olm->customWidth * olm->customHeight;
+	for ( x = 0; x < olm->customWidth; x++ )
+	{
+		while ( tail > head && olm->skyline[ window[ tail - 1 ] ] <= olm->skyline[ x ] )
+			tail--;
+		window[ tail++ ] = x;
+		if ( window[ head ] <= x - w ) {
+			head++;
+		}
+		sum += olm->skyline[ x ];
+		if ( x >= w ) {
+			sum -= olm->skyline[ x - w ];
+		}
+
+		/* the window is full, so the stamp rests on its tallest column */
+		if ( x >= w - 1 ) {
+			y = olm->skyline[ window[ head ] ];
+			if ( y + h > olm->customHeight ) {
+				continue;
+			}
+			waste = y * w - sum;
+			if ( waste < bestWaste || ( waste == bestWaste && y < bestY ) ) {
+				bestWaste = waste;
+				bestY = y;
+				*outX = x - w + 1;
+			}
+		}
+	}
+
+	/* no room */
+	if ( bestY + h > olm->customHeight ) {
+		return qfalse;
+	}
+	*outY = bestY;
+	return qtrue;
+}
+
+
+
+/*
+   RaiseOutLightmapSkyline()
+   marks the columns under a stamp as filled up to the top luxel it uses in
+   each column, so the unmapped corners of a stamp can still be packed into
+ */
+
+static void RaiseOutLightmapSkyline( outLightmap_t *olm, rawLightmap_t *lm, int lightmapNum, int x, int y ){
+	int i, sx, sy, w;
+	float       *luxel;
+
+
+	/* raise the columns */
+	w = lm->solid[ lightmapNum ] ? 1 : lm->w;
+	for ( sx = 0; sx < w; sx++ )
+	{
+		/* find the top luxel */
+		sy = lm->solid[ lightmapNum ] ? 0 : lm->h - 1;
+		for ( ; sy > 0; sy-- )
+		{
+			luxel = BSP_LUXEL( lightmapNum, sx, sy );
+			if ( luxel[ 0 ] >= 0.0f ) {
+				break;
+			}
+		}
+
+		/* raise it */
+		i = x + sx;
+		if ( i >= 0 && i < olm->customWidth && olm->skyline[ i ] < y + sy + 1 ) {
+			olm->skyline[ i ] = y + sy + 1;
+		}
+	}
+
+	/* find the new lowest column */
+	olm->skylineMin = olm->customHeight;
+	for ( i = 0; i < olm->customWidth; i++ )
+	{
+		if ( olm->skyline[ i ] < olm->skylineMin ) {
+			olm->skylineMin = olm->skyline[ i ];
+		}
+	}
+}
+
+
+
 /*
    FindOutLightmaps()
    for a given surface lightmap, find output lightmap pages and positions for it
  */
 
 static void FindOutLightmaps( rawLightmap_t *lm ){
-	int i, j, lightmapNum, xMax, yMax, x, y, sx, sy, ox, oy, offset, temp;
+	int i, j, lightmapNum, xMax, yMax, x, y, sx, sy, ox, oy, offset, temp, w, h;
 	outLightmap_t       *olm;
 	surfaceInfo_t       *info;
 	float               *luxel, *deluxel;
@@ -1988,6 +2213,17 @@ static void FindOutLightmaps( rawLightmap_t *lm ){
 			continue;
 		}
 
+		/* solid lightmaps take a single luxel */
+		if ( lm->solid[ lightmapNum ] ) {
+			w = 1;
+			h = 1;
+		}
+		else
+		{
+			w = lm->w;
+			h = lm->h;
+		}
+
 		/* if this is a styled lightmap, try some normalized locations first */
 		ok = qfalse;
 		if ( lightmapNum > 0 && outLightmaps != NULL ) {
@@ -2049,9 +2285,14 @@ static void FindOutLightmaps( rawLightmap_t *lm ){
 					break;
 				}
 			}
+
+			/* the gaps under the skyline can't be trusted where the stamp landed */
+			if ( ok ) {
+				ClipOutLightmapFreeRects( olm, x, y, w, h );
+			}
 		}
 
-		/* try normal placement algorithm */
+		/* try normal placement algorithm, packing onto the page skylines */
 		if ( ok == qfalse ) {
 			/* reset origin */
 			x = 0;
@@ -2074,42 +2315,23 @@ static void FindOutLightmaps( rawLightmap_t *lm ){
 					continue;
 				}
 
-				/* set maxs */
-				if ( lm->solid[ lightmapNum ] ) {
-					xMax = olm->customWidth;
-					yMax = olm->customHeight;
-				}
-				else
-				{
-					xMax = ( olm->customWidth - lm->w ) + 1;
-					yMax = ( olm->customHeight - lm->h ) + 1;
+				/* find a fine tract of lauhnd, first in the gaps under the skyline */
+				ok = FitOutLightmapFreeRect( olm, w, h, &x, &y );
+				if ( ok ) {
+					break;
 				}
-
-				/* walk the origin around the lightmap */
-				for ( y = 0; y < yMax; y++ )
-				{
-					for ( x = 0; x < xMax; x++ )
+				ok = FitOutLightmapSkyline( olm, w, h, &x, &y );
+				if ( ok ) {
+					/* remember the gaps left under the stamp */
+					for ( sx = x; sx < x + w; sx = ox )
 					{
-						/* find a fine tract of lauhnd */
-						ok = TestOutLightmapStamp( lm, lightmapNum, olm, x, y );
-
-						if ( ok ) {
-							break;
-						}
+						ox = sx + 1;
+						while ( ox < x + w && olm->skyline[ ox ] == olm->skyline[ sx ] )
+							ox++;
+						AddOutLightmapFreeRect( olm, sx, olm->skyline[ sx ], ox - sx, y - olm->skyline[ sx ] );
 					}
-
-					if ( ok ) {
-						break;
-					}
-				}
-
-				if ( ok ) {
 					break;
 				}
-
-				/* reset x and y */
-				x = 0;
-				y = 0;
 			}
 		}
 
@@ -2141,8 +2363,16 @@ static void FindOutLightmaps( rawLightmap_t *lm ){
 				x = lm->lightmapX[ 0 ];
 				y = lm->lightmapY[ 0 ];
 			}
+			else
+			{
+				x = 0;
+				y = 0;
+			}
 		}
 
+		/* fill the skyline under the stamp, styled stamps may sit above or below it */
+		RaiseOutLightmapSkyline( olm, lm, lightmapNum, x, y );
+
 		/* if this is a style-using lightmap, it must be exported */
 		if ( lightmapNum > 0 && game->load != LoadRBSPFile ) {
 			olm->extLightmapNum = 0;
@@ -2303,7 +2533,11 @@ static int CompareRawLightmap( const void *a, const void *b ){
 		return diff;
 	}
 
-	/* compare size */
+	/* compare size, tallest first so the skylines stay flat */
+	diff = blm->h - alm->h;
+	if ( diff != 0 ) {
+		return diff;
+	}
 	diff = ( blm->w * blm->h ) - ( alm->w * alm->h );
 	if ( diff != 0 ) {
 		return diff;
@@ -2327,8 +2561,8 @@ void StoreSurfaceLightmaps( void ){
 	vec3_t sample, occludedSample, dirSample, colorMins, colorMaxs;
 	float               *deluxel, *bspDeluxel, *bspDeluxel2;
 	byte                *lb;
-	int numUsed, numTwins, numTwinLuxels, numStored;
-	float lmx, lmy, efficiency;
+	int numUsed, numTwins, numTwinLuxels, numStored, numPacked, numPageLuxels;
+	float lmx, lmy, efficiency, fill;
 	vec3_t color;
 	bspDrawSurface_t    *ds, *parent, dsTemp;
 	surfaceInfo_t       *info;
@@ -2790,6 +3024,8 @@ void StoreSurfaceLightmaps( void ){
 	if ( outLightmaps != NULL ) {
 		for ( i = 0; i < numOutLightmaps; i++ )
 		{
+			free( outLightmaps[ i ].skyline );
+			free( outLightmaps[ i ].freeRects );
 			free( outLightmaps[ i ].lightBits );
 			free( outLightmaps[ i ].bspLightBytes );
 		}
@@ -3210,6 +3446,19 @@ void StoreSurfaceLightmaps( void ){
 				 ? 0
 				 : (float) numUsed / (float) numStored;
 
+	/* calc how full the output lightmap pages were packed */
+	numPacked = 0;
+	numPageLuxels = 0;
+	for ( i = 0; i < numOutLightmaps; i++ )
+	{
+		olm = &outLightmaps[ i ];
+		numPageLuxels += olm->customWidth * olm->customHeight;
+		numPacked += olm->customWidth * olm->customHeight - olm->freeLuxels;
+	}
+	fill = ( numPageLuxels <= 0 )
+		   ? 0
+		   : (float) numPacked / (float) numPageLuxels;
+
 	/* print stats */
 	Sys_Printf( "%9d luxels used\n", numUsed );
 	Sys_Printf( "%9d luxels stored (%3.2f percent efficiency)\n", numStored, efficiency * 100.0f );
@@ -3219,6 +3468,7 @@ void StoreSurfaceLightmaps( void ){
 	Sys_Printf( "%9d vertex approximated surfaces\n", numSurfsVertexApproximated );
 	Sys_Printf( "%9d BSP lightmaps\n", numBSPLightmaps );
 	Sys_Printf( "%9d total lightmaps\n", numOutLightmaps );
+	Sys_Printf( "%9d luxels packed (%3.2f percent lightmap fill)\n", numPacked, fill * 100.0f );
 	Sys_Printf( "%9d unique lightmap/shader combinations\n", numLightmapShaders );
 
 	/* write map shader file */
@@ -114,6 +114,11 @@ int main( int argc, char **argv ){
 	/* set exit call */
 	atexit( ExitQ3Map );
 
+	/* keep the untouched command line around for spawning workers */
+	commandArgc = argc;
+	commandArgv = safe_malloc( ( argc + 1 ) * sizeof( *commandArgv ) );
+	memcpy( commandArgv, argv, ( argc + 1 ) * sizeof( *commandArgv ) );
+
 	/* read general options first */
 	for ( i = 1; i < argc; i++ )
 	{
@@ -155,6 +160,14 @@ int main( int argc, char **argv ){
 			numthreads = atoi( argv[ i ] );
 			argv[ i ] = NULL;
 		}
+
+		/* json timing report */
+		else if ( !strcmp( argv[ i ], "-profile" ) && i < ( argc - 1 ) ) {
+			argv[ i ] = NULL;
+			i++;
+			SetupProfile( argv[ i ] );
+			argv[ i ] = NULL;
+		}
 	}
 
 	/* init model library */
@@ -258,6 +271,9 @@ int main( int argc, char **argv ){
 		r = BSPMain( argc, argv );
 	}
 
+	/* write the -profile report */
+	WriteProfile();
+
 	/* emit time */
 	end = I_FloatTime();
 	Sys_Printf( "%9.0f seconds elapsed\n", end - start );
@@ -42,9 +42,38 @@
 
 /* undefine to make plane finding use linear sort (note: really slow) */
 #define USE_HASHING
-#define PLANE_HASHES    8192
 
-plane_t *planehash[ PLANE_HASHES ];
+/* planes are hashed by their normal and distance quantized to these cells */
+#define PLANE_NORMAL_CELLS  256             /* most cells per unit of a normal component */
+#define PLANE_DIST_CELLS    1               /* cells per unit of distance */
+#define PLANE_TABLE_SIZE    8192            /* initial slot count, always a power of two */
+
+/*
+   the plane table is a flat open addressed array, each entry carries a copy of its plane
+   so lookups never touch mapplanes. lookups take no lock, planes are added under ThreadLock
+   and published by writing the plane number last. a grown table (or mapplanes array) is
+   left allocated for threads still reading it, together they are smaller than the live one
+ */
+
+typedef struct planeEntry_s
+{
+	vec3_t normal;
+	vec_t dist;
+	unsigned int key;
+	volatile int planenum;                  /* plane number + 1, 0 if the slot is empty */
+}
+planeEntry_t;
+
+typedef struct planeTable_s
+{
+	int size;
+	volatile int count;
+	planeEntry_t entries[];
+}
+planeTable_t;
+
+static planeTable_t * volatile planeTable;
+static int planeNormalCells;                /* fewer with a large normal epsilon, so a search spans few cells */
 
 int c_boxbevels;
 int c_edgebevels;
@@ -85,18 +114,186 @@ qboolean PlaneEqual( plane_t *p, vec3_t normal, vec_t dist ){
 
 
 
+/*
+   PlaneCell()
+   quantizes a plane component to its cell, cells are centered on integers
+   so axial normals and integer distances never sit on a cell border
+ */
+
+static int PlaneCell( double value, int cells ){
+	return (int) floor( value * cells + 0.5 );
+}
+
+
+
+/*
+   PlaneKey()
+   hashes a plane cell
+ */
+
+static unsigned int PlaneKey( const int cell[ 4 ] ){
+	unsigned int key;
+
+
+	key = (unsigned int) cell[ 0 ] * 73856093u;
+	key ^= (unsigned int) cell[ 1 ] * 19349663u;
+	key ^= (unsigned int) cell[ 2 ] * 83492791u;
+	key ^= (unsigned int) cell[ 3 ] * 2654435761u;
+
+	/* mix the high bits down, the slot is taken from the low ones */
+	key ^= key >> 16;
+	key *= 0x45d9f3bu;
+	key ^= key >> 16;
+	return key;
+}
+
+
+
+/*
+   InsertPlaneEntry()
+   copies an entry into the first free slot after its key
+ */
+
+static void InsertPlaneEntry( planeTable_t *table, const vec3_t normal, vec_t dist, unsigned int key, int planenum ){
+	int slot, mask;
+	planeEntry_t    *entry;
+
+
+	mask = table->size - 1;
+	for ( slot = key & mask; table->entries[ slot ].planenum != 0; slot = ( slot + 1 ) & mask ) ;
+
+	entry = &table->entries[ slot ];
+	VectorCopy( normal, entry->normal );
+	entry->dist = dist;
+	entry->key = key;
+
+	/* publish it */
+	Q_RELEASE_FENCE();
+	entry->planenum = planenum + 1;
+	table->count++;
+}
+
+
+
 /*
    AddPlaneToHash()
+   adds a plane to the plane table, growing the table when it gets half full.
+   the caller holds ThreadLock
  */
 
 void AddPlaneToHash( plane_t *p ){
-	int hash;
+	planeTable_t    *table, *grown;
+	planeEntry_t    *entry;
+	int i, size, cell[ 4 ];
+
+
+	/* pick the normal cell size with the first plane */
+	table = planeTable;
+	if ( table == NULL ) {
+		for ( planeNormalCells = PLANE_NORMAL_CELLS; planeNormalCells > 1 && normalEpsilon * planeNormalCells > 0.25f; planeNormalCells /= 2 ) ;
+	}
+
+	/* grow the table */
+	if ( table == NULL || ( table->count + 1 ) * 2 > table->size ) {
+		size = table != NULL ? table->size * 2 : PLANE_TABLE_SIZE;
+		grown = safe_malloc( sizeof( *grown ) + size * sizeof( *grown->entries ) );
+		memset( grown, 0, sizeof( *grown ) + size * sizeof( *grown->entries ) );
+		grown->size = size;
+		if ( table != NULL ) {
+			for ( i = 0; i < table->size; i++ )
+			{
+				entry = &table->entries[ i ];
+				if ( entry->planenum != 0 ) {
+					InsertPlaneEntry( grown, entry->normal, entry->dist, entry->key, entry->planenum - 1 );
+				}
+			}
+		}
+		Q_RELEASE_FENCE();
+		planeTable = grown;
+		table = grown;
+	}
+
+	/* add the plane */
+	for ( i = 0; i < 3; i++ )
+		cell[ i ] = PlaneCell( p->normal[ i ], planeNormalCells );
+	cell[ 3 ] = PlaneCell( p->dist, PLANE_DIST_CELLS );
+	InsertPlaneEntry( table, p->normal, p->dist, PlaneKey( cell ), p - mapplanes );
+}
+
+
+
+/*
+   FindPlaneInTable()
+   returns the lowest numbered plane in the table that is within the epsilons of
+   the plane and has all the test points on it, or -1. every cell the epsilons
+   reach into is searched
+ */
+
+static int FindPlaneInTable( planeTable_t *table, vec3_t normal, vec_t dist, int numPoints, vec3_t *points ){
+	int i, j, slot, mask, planenum, best;
+	int lo[ 4 ], hi[ 4 ], cell[ 4 ];
+	unsigned int key;
+	planeEntry_t    *entry;
+	plane_t plane;
+	vec_t d;
+
+
+	/* the cell range is padded as PlaneEqual compares float differences */
+	for ( i = 0; i < 3; i++ )
+	{
+		lo[ i ] = PlaneCell( (double) normal[ i ] - 2.0 * normalEpsilon, planeNormalCells );
+		hi[ i ] = PlaneCell( (double) normal[ i ] + 2.0 * normalEpsilon, planeNormalCells );
+	}
+	lo[ 3 ] = PlaneCell( (double) dist - 2.0 * distanceEpsilon, PLANE_DIST_CELLS );
+	hi[ 3 ] = PlaneCell( (double) dist + 2.0 * distanceEpsilon, PLANE_DIST_CELLS );
+
+	best = -1;
+	mask = table->size - 1;
+	for ( cell[ 0 ] = lo[ 0 ]; cell[ 0 ] <= hi[ 0 ]; cell[ 0 ]++ )
+	for ( cell[ 1 ] = lo[ 1 ]; cell[ 1 ] <= hi[ 1 ]; cell[ 1 ]++ )
+	for ( cell[ 2 ] = lo[ 2 ]; cell[ 2 ] <= hi[ 2 ]; cell[ 2 ]++ )
+	for ( cell[ 3 ] = lo[ 3 ]; cell[ 3 ] <= hi[ 3 ]; cell[ 3 ]++ )
+	{
+		key = PlaneKey( cell );
+		for ( slot = key & mask; ( planenum = table->entries[ slot ].planenum ) != 0; slot = ( slot + 1 ) & mask )
+		{
+			Q_ACQUIRE_FENCE();
+			entry = &table->entries[ slot ];
+			planenum--;
+			if ( entry->key != key || ( best >= 0 && planenum >= best ) ) {
+				continue;
+			}
+
+			/* do standard plane compare */
+			VectorCopy( entry->normal, plane.normal );
+			plane.dist = entry->dist;
+			if ( !PlaneEqual( &plane, normal, dist ) ) {
+				continue;
+			}
 
+			/* ydnar: test supplied points against this plane */
+			for ( j = 0; j < numPoints; j++ )
+			{
+				// NOTE: When dist approaches 2^16, the resolution of 32 bit floating
+				// point number is greatly decreased.  The distanceEpsilon cannot be
+				// very small when world coordinates extend to 2^16.  Making the
+				// dot product here in 64 bit land will not really help the situation
+				// because the error will already be carried in dist.
+				d = DotProduct( points[ j ], normal ) - dist;
+				d = fabs( d );
+				if ( d != 0.0 && d >= distanceEpsilon ) {
+					break; // Point is too far from plane.
+				}
+			}
 
-	hash = ( PLANE_HASHES - 1 ) & (int) fabs( p->dist );
+			/* found a matching plane */
+			if ( j >= numPoints ) {
+				best = planenum;
+			}
+		}
+	}
 
-	p->hash_chain = planehash[hash];
-	planehash[hash] = p;
+	return best;
 }
 
 /*
@@ -105,16 +302,31 @@ void AddPlaneToHash( plane_t *p ){
    ================
  */
 int CreateNewFloatPlane( vec3_t normal, vec_t dist ){
-	plane_t *p, temp;
+	plane_t *p, temp, *planes;
+	vec3_t n;
+	int size;
 
 	if ( VectorLength( normal ) < 0.5 ) {
 		Sys_Printf( "FloatPlane: bad normal\n" );
 		return -1;
 	}
 
-	// create a new plane
-	if ( nummapplanes + 2 > MAX_MAP_PLANES ) {
-		Error( "MAX_MAP_PLANES" );
+	// create a new plane, normal may point into mapplanes so copy it first
+	VectorCopy( normal, n );
+	normal = n;
+
+	/* grow mapplanes into a copy, other threads may still be reading the old array */
+	if ( nummapplanes + 1 >= allocatedmapplanes ) {
+		size = allocatedmapplanes > 0 ? allocatedmapplanes : 1024;
+		while ( nummapplanes + 1 >= size )
+			size *= 2;
+		planes = safe_malloc( size * sizeof( *planes ) );
+		if ( nummapplanes > 0 ) {
+			memcpy( planes, mapplanes, nummapplanes * sizeof( *planes ) );
+		}
+		Q_RELEASE_FENCE();
+		mapplanes = planes;
+		allocatedmapplanes = size;
 	}
 
 	p = &mapplanes[nummapplanes];
@@ -320,56 +532,36 @@ int FindFloatPlane( vec3_t normal, vec_t dist, int numPoints, vec3_t *points ) /
 #ifdef USE_HASHING
 
 {
-	int i, j, hash, h;
-	plane_t *p;
-	vec_t d;
+	planeTable_t    *table;
+	int pidx, count;
 
 #if Q3MAP2_EXPERIMENTAL_SNAP_PLANE_FIX
 	SnapPlaneImproved( normal, &dist, numPoints, (const vec3_t *) points );
 #else
 	SnapPlane( normal, &dist );
 #endif
-	/* hash the plane */
-	hash = ( PLANE_HASHES - 1 ) & (int) fabs( dist );
-
-	/* search the border bins as well */
-	for ( i = -1; i <= 1; i++ )
-	{
-		h = ( hash + i ) & ( PLANE_HASHES - 1 );
-		for ( p = planehash[ h ]; p != NULL; p = p->hash_chain )
-		{
-			/* do standard plane compare */
-			if ( !PlaneEqual( p, normal, dist ) ) {
-				continue;
-			}
-
-			/* ydnar: uncomment the following line for old-style plane finding */
-			//%	return p - mapplanes;
-
-			/* ydnar: test supplied points against this plane */
-			for ( j = 0; j < numPoints; j++ )
-			{
-				// NOTE: When dist approaches 2^16, the resolution of 32 bit floating
-				// point number is greatly decreased.  The distanceEpsilon cannot be
-				// very small when world coordinates extend to 2^16.  Making the
-				// dot product here in 64 bit land will not really help the situation
-				// because the error will already be carried in dist.
-				d = DotProduct( points[ j ], normal ) - dist;
-				d = fabs( d );
-				if ( d != 0.0 && d >= distanceEpsilon ) {
-					break; // Point is too far from plane.
-				}
-			}
-
-			/* found a matching plane */
-			if ( j >= numPoints ) {
-				return p - mapplanes;
-			}
+	/* look the plane up without locking, most planes already exist */
+	table = planeTable;
+	count = table != NULL ? table->count : 0;
+	Q_ACQUIRE_FENCE();
+	if ( table != NULL ) {
+		pidx = FindPlaneInTable( table, normal, dist, numPoints, points );
+		if ( pidx >= 0 ) {
+			return pidx;
 		}
 	}
 
-	/* none found, so create a new one */
-	return CreateNewFloatPlane( normal, dist );
+	/* none found, so create a new one (unless another thread added it meanwhile) */
+	ThreadLock();
+	pidx = -1;
+	if ( planeTable != table || ( table != NULL && table->count != count ) ) {
+		pidx = FindPlaneInTable( planeTable, normal, dist, numPoints, points );
+	}
+	if ( pidx < 0 ) {
+		pidx = CreateNewFloatPlane( normal, dist );
+	}
+	ThreadUnlock();
+	return pidx;
 }
 
 #else
@@ -1556,6 +1748,9 @@ static qboolean ParseMapEntity( qboolean onlyLights ){
 		return qfalse;
 	}
 
+	/* make room */
+	AUTOEXPAND_BY_REALLOC( entities, numEntities, allocatedEntities, 64 );
+
 	/* conformance check */
 	if ( strcmp( token, "{" ) ) {
 		Sys_FPrintf( SYS_WRN, "WARNING: ParseEntity: { not found, found %s on line %d - last entity was at: <%4.2f, %4.2f, %4.2f>...\n"
@@ -1564,11 +1759,6 @@ static qboolean ParseMapEntity( qboolean onlyLights ){
 		return qfalse;
 	}
 
-	/* range check */
-	if ( numEntities >= MAX_MAP_ENTITIES ) {
-		Error( "numEntities == MAX_MAP_ENTITIES" );
-	}
-
 	/* setup */
 	entitySourceBrushes = 0;
 	mapEnt = &entities[ numEntities ];
@@ -1637,8 +1827,7 @@ static qboolean ParseMapEntity( qboolean onlyLights ){
 
 			/* ydnar: 2002-07-06 fixed wolf bug with empty epairs */
 			if ( ep->key[ 0 ] != '\0' && ep->value[ 0 ] != '\0' ) {
-				ep->next = mapEnt->epairs;
-				mapEnt->epairs = ep;
+				AddEPair( mapEnt, ep );
 			}
 		}
 	}
@@ -85,36 +85,73 @@ void PicoLoadFileFunc( const char *name, byte **buffer, int *bufSize ){
 
 
 /*
-   FindModel() - ydnar
-   finds an existing picoModel and returns a pointer to the picoModel_t struct or NULL if not found
+   model registry
+   loaded picomodels are indexed by name and frame in an open-addressed hash table that
+   grows as needed (models are never freed, so there are no tombstones)
  */
 
-picoModel_t *FindModel( char *name, int frame ){
-	int i;
+static picoModel_t **modelTable = NULL;
+static int modelTableSize = 0;
 
 
-	/* init */
-	if ( numPicoModels <= 0 ) {
-		memset( picoModels, 0, sizeof( picoModels ) );
-	}
 
-	/* dummy check */
-	if ( name == NULL || name[ 0 ] == '\0' ) {
-		return NULL;
+/*
+   ModelHash()
+   fnv-1a hash of a model name, mixed with the frame number
+ */
+
+static unsigned int ModelHash( const char *name, int frame ){
+	unsigned int hash = 2166136261u;
+
+
+	while ( *name )
+	{
+		hash ^= (byte) *name++;
+		hash *= 16777619u;
 	}
+	hash ^= (unsigned int) frame;
+	hash *= 16777619u;
+	return hash;
+}
+
+
+
+/*
+   ModelTableSlot()
+   returns the table slot holding the named model frame, or the empty slot it would go into
+ */
+
+static picoModel_t **ModelTableSlot( const char *name, int frame ){
+	unsigned int mask, i;
+	picoModel_t     *model;
+
 
-	/* search list */
-	for ( i = 0; i < MAX_MODELS; i++ )
+	mask = modelTableSize - 1;
+	for ( i = ModelHash( name, frame ) & mask; ; i = ( i + 1 ) & mask )
 	{
-		if ( picoModels[ i ] != NULL &&
-			 !strcmp( PicoGetModelName( picoModels[ i ] ), name ) &&
-			 PicoGetModelFrameNum( picoModels[ i ] ) == frame ) {
-			return picoModels[ i ];
+		model = modelTable[ i ];
+		if ( model == NULL ||
+			 ( PicoGetModelFrameNum( model ) == frame && !strcmp( PicoGetModelName( model ), name ) ) ) {
+			return &modelTable[ i ];
 		}
 	}
+}
+
+
 
-	/* no matching picoModel found */
-	return NULL;
+/*
+   FindModel() - ydnar
+   finds an existing picoModel and returns a pointer to the picoModel_t struct or NULL if not found
+ */
+
+picoModel_t *FindModel( char *name, int frame ){
+	/* dummy check */
+	if ( name == NULL || name[ 0 ] == '\0' || modelTable == NULL ) {
+		return NULL;
+	}
+
+	/* search the registry */
+	return *ModelTableSlot( name, frame );
 }
 
 
@@ -125,15 +162,10 @@ picoModel_t *FindModel( char *name, int frame ){
  */
 
 picoModel_t *LoadModel( char *name, int frame ){
-	int i;
-	picoModel_t     *model, **pm;
+	int i, oldSize;
+	picoModel_t     *model, **oldTable;
 
 
-	/* init */
-	if ( numPicoModels <= 0 ) {
-		memset( picoModels, 0, sizeof( picoModels ) );
-	}
-
 	/* dummy check */
 	if ( name == NULL || name[ 0 ] == '\0' ) {
 		return NULL;
@@ -145,35 +177,36 @@ picoModel_t *LoadModel( char *name, int frame ){
 		return model;
 	}
 
-	/* none found, so find first non-null picoModel */
-	pm = NULL;
-	for ( i = 0; i < MAX_MODELS; i++ )
-	{
-		if ( picoModels[ i ] == NULL ) {
-			pm = &picoModels[ i ];
-			break;
+	/* keep the registry at most half full */
+	if ( ( numPicoModels + 1 ) * 2 > modelTableSize ) {
+		oldTable = modelTable;
+		oldSize = modelTableSize;
+		modelTableSize = modelTableSize > 0 ? modelTableSize * 2 : 64;
+		modelTable = safe_malloc( modelTableSize * sizeof( *modelTable ) );
+		memset( modelTable, 0, modelTableSize * sizeof( *modelTable ) );
+		for ( i = 0; i < oldSize; i++ )
+		{
+			if ( oldTable[ i ] != NULL ) {
+				*ModelTableSlot( PicoGetModelName( oldTable[ i ] ), PicoGetModelFrameNum( oldTable[ i ] ) ) = oldTable[ i ];
+			}
 		}
-	}
-
-	/* too many picoModels? */
-	if ( pm == NULL ) {
-		Error( "MAX_MODELS (%d) exceeded, there are too many model files referenced by the map.", MAX_MODELS );
+		free( oldTable );
 	}
 
 	/* attempt to parse model */
-	*pm = PicoLoadModel( name, frame );
+	model = PicoLoadModel( name, frame );
 
 	/* if loading failed, make a bogus model to silence the rest of the warnings */
-	if ( *pm == NULL ) {
+	if ( model == NULL ) {
 		/* allocate a new model */
-		*pm = PicoNewModel();
-		if ( *pm == NULL ) {
+		model = PicoNewModel();
+		if ( model == NULL ) {
 			return NULL;
 		}
 
 		/* set data */
-		PicoSetModelName( *pm, name );
-		PicoSetModelFrameNum( *pm, frame );
+		PicoSetModelName( model, name );
+		PicoSetModelFrameNum( model, frame );
 	}
 
 	/* debug code */
@@ -184,23 +217,28 @@ picoModel_t *LoadModel( char *name, int frame ){
 
 
 		Sys_Printf( "Model %s\n", name );
-		numSurfaces = PicoGetModelNumSurfaces( *pm );
+		numSurfaces = PicoGetModelNumSurfaces( model );
 		for ( i = 0; i < numSurfaces; i++ )
 		{
-			ps = PicoGetModelSurface( *pm, i );
+			ps = PicoGetModelSurface( model, i );
 			numVertexes = PicoGetSurfaceNumVertexes( ps );
 			Sys_Printf( "Surface %d has %d vertexes\n", i, numVertexes );
 		}
 	}
 	#endif
 
-	/* set count */
-	if ( *pm != NULL ) {
-		numPicoModels++;
+	/* make sure it answers to the name and frame it is registered under */
+	if ( strcmp( PicoGetModelName( model ), name ) ) {
+		PicoSetModelName( model, name );
 	}
+	if ( PicoGetModelFrameNum( model ) != frame ) {
+		PicoSetModelFrameNum( model, frame );
+	}
+	*ModelTableSlot( name, frame ) = model;
+	numPicoModels++;
 
 	/* return the picoModel */
-	return *pm;
+	return model;
 }
 
 
@@ -607,6 +645,91 @@ void InsertModel( char *name, int frame, m4x4_t transform, remap_t *remap, shade
 
 
 
+/*
+   PrefetchModelShaders()
+   loads the misc_models targeting a brush entity and prefetches the shaders of their
+   surfaces across threads. models with _remap keys are left to InsertModel, which
+   resolves their shaders serially as before
+ */
+
+static void PrefetchModelShaders( const char *targetName ){
+	int num, s, numSurfaces, numNames, maxNames;
+	entity_t        *e2;
+	epair_t         *ep;
+	picoModel_t     *model;
+	picoSurface_t   *surface;
+	picoShader_t    *shader;
+	const char      **names;
+	char            *name;
+
+
+	numNames = 0;
+	maxNames = 0;
+	names = NULL;
+	for ( num = 1; num < numEntities; num++ )
+	{
+		/* same filter as AddTriangleModels */
+		e2 = &entities[ num ];
+		if ( Q_stricmp( "misc_model", ValueForKey( e2, "classname" ) ) ||
+			 strcmp( ValueForKey( e2, "target" ), targetName ) ||
+			 ValueForKey( e2, "model" )[ 0 ] == '\0' ) {
+			continue;
+		}
+		for ( ep = e2->epairs; ep != NULL; ep = ep->next )
+		{
+			if ( ep->key != NULL && !Q_strncasecmp( ep->key, "_remap", 6 ) ) {
+				break;
+			}
+		}
+		if ( ep != NULL ) {
+			continue;
+		}
+
+		/* load the model (serially, picomodel loaders aren't reentrant) */
+		model = LoadModel( (char*) ValueForKey( e2, "model" ), IntForKey( e2, "_frame" ) );
+		if ( model == NULL ) {
+			continue;
+		}
+
+		/* collect its shader names */
+		numSurfaces = PicoGetModelNumSurfaces( model );
+		for ( s = 0; s < numSurfaces; s++ )
+		{
+			surface = PicoGetModelSurface( model, s );
+			if ( surface == NULL || PicoGetSurfaceType( surface ) != PICO_TRIANGLES ) {
+				continue;
+			}
+			shader = PicoGetSurfaceShader( surface );
+			if ( shader == NULL ) {
+				continue;
+			}
+			AUTOEXPAND_BY_REALLOC( names, numNames, maxNames, 64 );
+
+			/* shader renaming for sof2 */
+			if ( renameModelShaders ) {
+				name = safe_malloc( MAX_QPATH );
+				strcpy( name, PicoGetShaderName( shader ) );
+				StripExtension( name );
+				strcat( name, ( IntForKey( e2, "spawnflags" ) & 1 ) ? "_RMG_BSP" : "_BSP" );
+				names[ numNames++ ] = name;
+			}
+			else{
+				names[ numNames++ ] = PicoGetShaderName( shader );
+			}
+		}
+	}
+
+	/* load them */
+	PrefetchShaderImages( names, numNames );
+	if ( renameModelShaders ) {
+		for ( num = 0; num < numNames; num++ )
+			free( (char*) names[ num ] );
+	}
+	free( names );
+}
+
+
+
 /*
    AddTriangleModels()
    adds misc_model surfaces to the bsp
@@ -650,6 +773,9 @@ void AddTriangleModels( entity_t *e ){
 		baseLightmapScale = 0.0f;
 	}
 
+	/* load the models and their shader images up front */
+	PrefetchModelShaders( targetName );
+
 	/* walk the entity list */
 	for ( num = 1; num < numEntities; num++ )
 	{
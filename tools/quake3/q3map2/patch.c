@@ -245,6 +245,7 @@ void ParsePatch( qboolean onlyLights ){
 	if ( m.width < 0 || m.width > MAX_PATCH_SIZE || m.height < 0 || m.height > MAX_PATCH_SIZE ) {
 		Error( "ParsePatch: bad size" );
 	}
+	memset( verts, 0, m.width * m.height * sizeof( m.verts[0] ) );
 
 	MatchToken( "(" );
 	for ( j = 0; j < m.width ; j++ )
@@ -0,0 +1,383 @@
+/* -------------------------------------------------------------------------------
+
+   Copyright (C) 1999-2007 id Software, Inc. and contributors.
+   For a list of contributors, see the accompanying CONTRIBUTORS file.
+
+   This file is part of GtkRadiant.
+
+   GtkRadiant is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   GtkRadiant is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GtkRadiant; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+   ----------------------------------------------------------------------------------
+
+   This code has been altered significantly from its original form, to support
+   several games based on the Quake III Arena engine, in the form of "Q3Map2."
+
+   ------------------------------------------------------------------------------- */
+
+
+
+/* marker */
+#define PROFILE_C
+
+
+
+/* dependencies */
+#include "q3map2.h"
+
+
+
+/* -------------------------------------------------------------------------------
+
+   -profile <file> times the stages of a compile and counts hot path events,
+   then writes everything to a json report when q3map2 exits. stages nest, and
+   a stage entered again under the same parent (a submodel, a bounce) adds to
+   the same record. event counters are per thread so counting never contends
+
+   ------------------------------------------------------------------------------- */
+
+#define MAX_PROFILE_STAGES      256
+#define MAX_PROFILE_DEPTH       16
+#define MAX_PROFILE_THREADS     256
+
+typedef struct profileStage_s
+{
+	const char          *name;
+	int parent, depth, calls;
+	double seconds, busy, idle;
+	long long counts[ NUM_PROFILE_COUNTERS ];
+}
+profileStage_t;
+
+typedef struct profileFrame_s
+{
+	int stage;
+	double start, busy, jobs;
+	long long counts[ NUM_PROFILE_COUNTERS ];
+}
+profileFrame_t;
+
+typedef struct profileThread_s
+{
+	struct profileThread_s  *next;
+	long long counts[ NUM_PROFILE_COUNTERS ];
+}
+profileThread_t;
+
+static const char           *profileCounterNames[ NUM_PROFILE_COUNTERS ] =
+{
+	"traces",
+	"traceTriangles",
+	"visTests",
+	"visBits"
+};
+
+Q_THREAD_LOCAL long long    *profileCounts;
+
+static char profileFile[ 1024 ];
+static double profileStart;
+
+static profileStage_t profileStages[ MAX_PROFILE_STAGES ];
+static int numProfileStages;
+
+static profileFrame_t profileStack[ MAX_PROFILE_DEPTH ];
+static int profileDepth;
+
+static profileThread_t      *profileThreads;
+
+
+
+/*
+   SetupProfile()
+   turns on profiling, the report is written to filename by WriteProfile()
+ */
+
+void SetupProfile( const char *filename ){
+	strncpy( profileFile, filename, sizeof( profileFile ) - 1 );
+	profileStart = I_PreciseTime();
+	profiling = qtrue;
+}
+
+
+
+/*
+   ProfileThreadCounts()
+   gives the calling thread its own event counters on its first count
+ */
+
+long long *ProfileThreadCounts( void ){
+	profileThread_t *pt;
+
+
+	pt = safe_malloc( sizeof( *pt ) );
+	memset( pt, 0, sizeof( *pt ) );
+	ThreadLock();
+	pt->next = profileThreads;
+	profileThreads = pt;
+	ThreadUnlock();
+
+	profileCounts = pt->counts;
+	return profileCounts;
+}
+
+
+
+/*
+   SumProfileCounts()
+   adds up the event counters of all threads
+ */
+
+static void SumProfileCounts( long long counts[ NUM_PROFILE_COUNTERS ] ){
+	int i;
+	profileThread_t *pt;
+
+
+	memset( counts, 0, NUM_PROFILE_COUNTERS * sizeof( *counts ) );
+	for ( pt = profileThreads; pt != NULL; pt = pt->next )
+	{
+		for ( i = 0; i < NUM_PROFILE_COUNTERS; i++ )
+			counts[ i ] += pt->counts[ i ];
+	}
+}
+
+
+
+/*
+   SumThreadBusyTime()
+   adds up the time the worker threads spent working
+ */
+
+static double SumThreadBusyTime( void ){
+	int i;
+	double busy;
+
+
+	busy = 0.0;
+	for ( i = 0; i < MAX_PROFILE_THREADS; i++ )
+		busy += ThreadBusyTime( i );
+	return busy;
+}
+
+
+
+/*
+   ProfileBegin()
+   starts timing a stage, must be matched by ProfileEnd()
+ */
+
+void ProfileBegin( const char *name ){
+	int i, parent;
+	profileStage_t  *stage;
+	profileFrame_t  *frame;
+
+
+	/* dummy check */
+	if ( !profiling ) {
+		return;
+	}
+	if ( profileDepth >= MAX_PROFILE_DEPTH ) {
+		Error( "ProfileBegin: stages nested too deep at %s", name );
+	}
+
+	/* find the stage under the current one */
+	parent = profileDepth > 0 ? profileStack[ profileDepth - 1 ].stage : -1;
+	for ( i = 0; i < numProfileStages; i++ )
+	{
+		if ( profileStages[ i ].parent == parent && !strcmp( profileStages[ i ].name, name ) ) {
+			break;
+		}
+	}
+
+	/* add a new one */
+	if ( i >= numProfileStages ) {
+		if ( numProfileStages >= MAX_PROFILE_STAGES ) {
+			Error( "MAX_PROFILE_STAGES (%d) exceeded", MAX_PROFILE_STAGES );
+		}
+		stage = &profileStages[ numProfileStages++ ];
+		memset( stage, 0, sizeof( *stage ) );
+		stage->name = name;
+		stage->parent = parent;
+		stage->depth = profileDepth;
+	}
+
+	/* push it */
+	frame = &profileStack[ profileDepth++ ];
+	frame->stage = i;
+	SumProfileCounts( frame->counts );
+	frame->busy = SumThreadBusyTime();
+	frame->jobs = ThreadJobTime();
+	frame->start = I_PreciseTime();
+}
+
+
+
+/*
+   ProfileEnd()
+   stops timing the innermost stage
+ */
+
+void ProfileEnd( void ){
+	int i;
+	double busy, jobs;
+	long long counts[ NUM_PROFILE_COUNTERS ];
+	profileStage_t  *stage;
+	profileFrame_t  *frame;
+
+
+	/* dummy check */
+	if ( !profiling ) {
+		return;
+	}
+	if ( profileDepth <= 0 ) {
+		Error( "ProfileEnd: no stage to end" );
+	}
+
+	/* pop it */
+	frame = &profileStack[ --profileDepth ];
+	stage = &profileStages[ frame->stage ];
+	stage->seconds += I_PreciseTime() - frame->start;
+	stage->calls++;
+
+	/* threads are busy when running work and idle for the rest of their jobs */
+	busy = SumThreadBusyTime() - frame->busy;
+	jobs = ( ThreadJobTime() - frame->jobs ) * numthreads;
+	stage->busy += busy;
+	stage->idle += jobs > busy ? jobs - busy : 0.0;
+
+	/* attribute the events */
+	SumProfileCounts( counts );
+	for ( i = 0; i < NUM_PROFILE_COUNTERS; i++ )
+		stage->counts[ i ] += counts[ i ] - frame->counts[ i ];
+}
+
+
+
+/*
+   WriteProfileString()
+   writes a quoted json string
+ */
+
+static void WriteProfileString( FILE *file, const char *string ){
+	fputc( '"', file );
+	for ( ; *string != '\0'; string++ )
+	{
+		if ( *string == '"' || *string == '\\' ) {
+			fprintf( file, "\\%c", *string );
+		}
+		else if ( (unsigned char) *string < ' ' ) {
+			fprintf( file, "\\u%04x", (unsigned char) *string );
+		}
+		else{
+			fputc( *string, file );
+		}
+	}
+	fputc( '"', file );
+}
+
+
+
+/*
+   WriteProfileCounts()
+   writes the event counters and the rates derived from them as a json object
+ */
+
+static void WriteProfileCounts( FILE *file, const long long counts[ NUM_PROFILE_COUNTERS ], double seconds ){
+	int i;
+
+
+	fprintf( file, "{ " );
+	for ( i = 0; i < NUM_PROFILE_COUNTERS; i++ )
+		fprintf( file, "\"%s\": %lld, ", profileCounterNames[ i ], counts[ i ] );
+	fprintf( file, "\"tracesPerSecond\": %.1f, ", seconds > 0.0 ? counts[ PROFILE_TRACES ] / seconds : 0.0 );
+	fprintf( file, "\"trianglesPerTrace\": %.3f, ", counts[ PROFILE_TRACES ] > 0 ? (double) counts[ PROFILE_TRACE_TRIANGLES ] / counts[ PROFILE_TRACES ] : 0.0 );
+	fprintf( file, "\"bitsPerVisTest\": %.1f }", counts[ PROFILE_VIS_TESTS ] > 0 ? (double) counts[ PROFILE_VIS_BITS ] / counts[ PROFILE_VIS_TESTS ] : 0.0 );
+}
+
+
+
+/*
+   WriteProfile()
+   writes the json report, closing any stages still open
+ */
+
+void WriteProfile( void ){
+	int i, numThreads;
+	double seconds, jobs, busy;
+	long long counts[ NUM_PROFILE_COUNTERS ];
+	profileStage_t  *stage;
+	FILE            *file;
+
+
+	/* dummy check */
+	if ( !profiling ) {
+		return;
+	}
+
+	/* close up */
+	while ( profileDepth > 0 )
+		ProfileEnd();
+	seconds = I_PreciseTime() - profileStart;
+	SumProfileCounts( counts );
+
+	/* note it */
+	Sys_Printf( "Writing profile %s\n", profileFile );
+	file = SafeOpenWrite( profileFile );
+
+	/* header */
+	fprintf( file, "{\n\t\"version\": " );
+	WriteProfileString( file, Q3MAP_VERSION );
+	fprintf( file, ",\n\t\"command\": [ " );
+	for ( i = 0; i < commandArgc; i++ )
+	{
+		if ( i > 0 ) {
+			fprintf( file, ", " );
+		}
+		WriteProfileString( file, commandArgv[ i ] );
+	}
+	fprintf( file, " ],\n\t\"threads\": %d,\n\t\"seconds\": %.6f,\n\t\"counters\": ", numthreads, seconds );
+	WriteProfileCounts( file, counts, seconds );
+
+	/* per thread busy/idle time over all threaded jobs */
+	jobs = ThreadJobTime();
+	numThreads = numthreads > 0 ? numthreads : 1;
+	fprintf( file, ",\n\t\"threadJobSeconds\": %.6f,\n\t\"threadTimes\": [", jobs );
+	for ( i = 0; i < numThreads; i++ )
+	{
+		busy = ThreadBusyTime( i );
+		fprintf( file, "%s\n\t\t{ \"thread\": %d, \"busy\": %.6f, \"idle\": %.6f }",
+				 i > 0 ? "," : "", i, busy, jobs > busy ? jobs - busy : 0.0 );
+	}
+	fprintf( file, "\n\t],\n\t\"stages\": [" );
+
+	/* stages, parents come before their children */
+	for ( i = 0; i < numProfileStages; i++ )
+	{
+		stage = &profileStages[ i ];
+		fprintf( file, "%s\n\t\t{ \"name\": ", i > 0 ? "," : "" );
+		WriteProfileString( file, stage->name );
+		fprintf( file, ", \"parent\": " );
+		if ( stage->parent >= 0 ) {
+			WriteProfileString( file, profileStages[ stage->parent ].name );
+		}
+		else{
+			fprintf( file, "null" );
+		}
+		fprintf( file, ", \"depth\": %d, \"calls\": %d, \"seconds\": %.6f, \"threadBusy\": %.6f, \"threadIdle\": %.6f, \"counters\": ",
+				 stage->depth, stage->calls, stage->seconds, stage->busy, stage->idle );
+		WriteProfileCounts( file, stage->counts, stage->seconds );
+		fprintf( file, " }" );
+	}
+	fprintf( file, "\n\t]\n}\n" );
+	fclose( file );
+}
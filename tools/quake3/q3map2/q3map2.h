@@ -124,6 +124,22 @@ int   Q_filelength( FILE *f );
 	#endif
 #endif
 
+/* thread local storage */
+#ifdef _MSC_VER
+	#define Q_THREAD_LOCAL      __declspec( thread )
+#else
+	#define Q_THREAD_LOCAL      __thread
+#endif
+
+/* ordering for data one thread publishes while others read it without a lock */
+#ifdef _MSC_VER
+	#define Q_ACQUIRE_FENCE()   MemoryBarrier()
+	#define Q_RELEASE_FENCE()   MemoryBarrier()
+#else
+	#define Q_ACQUIRE_FENCE()   __atomic_thread_fence( __ATOMIC_ACQUIRE )
+	#define Q_RELEASE_FENCE()   __atomic_thread_fence( __ATOMIC_RELEASE )
+#endif
+
 /* macro version */
 #define VectorMA( a, s, b, c )  ( ( c )[ 0 ] = ( a )[ 0 ] + ( s ) * ( b )[ 0 ], ( c )[ 1 ] = ( a )[ 1 ] + ( s ) * ( b )[ 1 ], ( c )[ 2 ] = ( a )[ 2 ] + ( s ) * ( b )[ 2 ] )
 
@@ -145,11 +161,8 @@ int   Q_filelength( FILE *f );
 /* general */
 #define MAX_QPATH               64
 
-#define MAX_IMAGES              512
 #define DEFAULT_IMAGE           "*default"
 
-#define MAX_MODELS              512
-
 #define DEF_BACKSPLASH_FRACTION 0.05f   /* 5% backsplash by default */
 #define DEF_BACKSPLASH_DISTANCE 23
 
@@ -354,6 +367,11 @@ int   Q_filelength( FILE *f );
 
 #define MAX_MAP_ADVERTISEMENTS  30
 
+/* growable lumps: the MAX_MAP_* limits above are only enforced when the bsp is written */
+#define AUTOEXPAND_BY_REALLOC( ptr, reqitem, allocated, def ) \
+	( ( reqitem ) >= ( allocated ) ? ( void ) ( ( ptr ) = ExpandArray( ( ptr ), ( reqitem ), &( allocated ), ( def ), sizeof( *( ptr ) ), # ptr ) ) : ( void ) 0 )
+#define AUTOEXPAND_BY_REALLOC_BSP( suffix, def ) AUTOEXPAND_BY_REALLOC( bsp ## suffix, numBSP ## suffix, allocatedBSP ## suffix, def )
+
 /* key / value pair sizes in the entities lump */
 #define MAX_KEY                 32
 #define MAX_VALUE               1024
@@ -833,7 +851,6 @@ typedef struct plane_s
 	vec_t dist;
 	int type;
 	int counter;
-	struct plane_s      *hash_chain;
 }
 plane_t;
 
@@ -1102,9 +1119,12 @@ typedef struct epair_s
 {
 	struct epair_s      *next;
 	char                *key, *value;
+	unsigned int keyHash;                           /* EPairKeyHash( key ), compared before the key */
 }
 epair_t;
 
+#define EPAIR_KEY_BIT( hash )   ( 1u << ( ( hash ) & 31 ) )
+
 
 typedef struct
 {
@@ -1114,6 +1134,7 @@ typedef struct
 	int mapEntityNum, firstDrawSurf;
 	int firstBrush, numBrushes;                     /* only valid during BSP compile */
 	epair_t             *epairs;
+	unsigned int epairKeyBits;                      /* EPAIR_KEY_BIT of every key added, lets lookups of absent keys skip the list */
 }
 entity_t;
 
@@ -1200,6 +1221,10 @@ typedef struct
 fixedWinding_t;
 
 
+/* portal and leaf bit vectors are padded to 64 bits and combined a word at a time */
+typedef unsigned long long visWord_t;
+
+
 typedef struct passage_s
 {
 	struct passage_s    *next;
@@ -1396,12 +1421,23 @@ clipWork_t;
 
 
 /* ydnar: new lightmap handling code */
+typedef struct outLightmapRect_s
+{
+	int x, y, w, h;
+}
+outLightmapRect_t;
+
+
 typedef struct outLightmap_s
 {
 	int lightmapNum, extLightmapNum;
 	int customWidth, customHeight;
 	int numLightmaps;
 	int freeLuxels;
+	int                 *skyline;                   /* per column height of the filled area */
+	int skylineMin;
+	int numFreeRects, maxFreeRects;
+	outLightmapRect_t   *freeRects;                 /* gaps left under the skyline */
 	int numShaders;
 	shaderInfo_t        *shaders[ MAX_LIGHTMAP_SHADERS ];
 	byte                *lightBits;
@@ -1478,6 +1514,18 @@ typedef struct surfaceInfo_s
 surfaceInfo_t;
 
 
+/* hot path events counted by -profile */
+typedef enum
+{
+	PROFILE_TRACES,
+	PROFILE_TRACE_TRIANGLES,
+	PROFILE_VIS_TESTS,
+	PROFILE_VIS_BITS,
+	NUM_PROFILE_COUNTERS
+}
+profileCounter_t;
+
+
 
 /* -------------------------------------------------------------------------------
 
@@ -1491,6 +1539,18 @@ char                        *Q_strncpyz( char *dst, const char *src, size_t len
 char                        *Q_strcat( char *dst, size_t dlen, const char *src );
 char                        *Q_strncat( char *dst, size_t dlen, const char *src, size_t slen );
 
+/* profile.c */
+void                        SetupProfile( const char *filename );
+void                        ProfileBegin( const char *name );
+void                        ProfileEnd( void );
+long long                   *ProfileThreadCounts( void );
+void                        WriteProfile( void );
+
+/* counting is a branch on a global when not profiling, and never takes a lock */
+extern Q_THREAD_LOCAL long long *profileCounts;
+#define PROFILE_COUNT( counter, n ) \
+	do { if ( profiling ) { ( profileCounts != NULL ? profileCounts : ProfileThreadCounts() )[ counter ] += ( n ); } } while ( 0 )
+
 /* path_init.c */
 game_t                      *GetGame( char *arg );
 void                        InitPaths( int *argc, char **argv );
@@ -1737,6 +1797,12 @@ void                        ComputeAxisBase( vec3_t normal, vec3_t texX, vec3_t
 fixedWinding_t              *NewFixedWinding( int points );
 int                         VisMain( int argc, char **argv );
 
+/* vis_shard.c */
+void                        SetupVisShards( const char *portalFile );
+void                        RunVisShardFlow( void ( *flow )( int portalnum ) );
+void                        RunVisShards( void );
+void                        DeleteVisShards( void );
+
 /* visflow.c */
 int                         CountBits( byte *bits, int numbits );
 void                        PassageFlow( int portalnum );
@@ -1759,10 +1825,19 @@ int                         LightMain( int argc, char **argv );
 
 /* light_trace.c */
 void                        SetupTraceNodes( void );
+void                        SetupTraceOccluders( void );
+int                         SumTraceOccluders( const vec3_t mins, const vec3_t maxs, qboolean skybox, unsigned int sum[ 4 ] );
 void                        TraceLine( trace_t *trace );
 float                       SetupTrace( trace_t *trace );
 
 
+/* light_cache.c */
+void                        ShaderInfoDigest( shaderInfo_t *si, byte digest[ 16 ] );
+void                        SetupLightCache( int argc, char **argv );
+qboolean                    LightCacheLookup( int rawLightmapNum, trace_t *trace );
+void                        StoreLightCache( void );
+
+
 /* light_bounce.c */
 qboolean RadSampleImage( byte * pixels, int width, int height, float st[ 2 ], float color[ 4 ] );
 void                        RadLightForTriangles( int num, int lightmapNum, rawLightmap_t *lm, shaderInfo_t *si, float scale, float subdivide, clipWork_t *cw );
@@ -1801,6 +1876,7 @@ void                        SetupEnvelopes( qboolean forGrid, qboolean fastFlag
 void                        FreeTraceLights( trace_t *trace );
 void                        CreateTraceLightsForBounds( vec3_t mins, vec3_t maxs, vec3_t normal, int numClusters, int *clusters, int flags, trace_t *trace );
 void                        CreateTraceLightsForSurface( int num, trace_t *trace );
+void                        CreateTraceLightsForPoint( vec3_t point, trace_t *trace );
 
 
 /* lightmaps_ydnar.c */
@@ -1845,9 +1921,11 @@ void                        EmitVertexRemapShader( char *from, char *to );
 void                        LoadShaderInfo( void );
 shaderInfo_t                *ShaderInfoForShader( const char *shader );
 shaderInfo_t                *ShaderInfoForShaderNull( const char *shader );
+void                        PrefetchShaderImages( const char **shaderNames, int numShaderNames );
 
 
 /* bspfile_abstract.c */
+void                        *ExpandArray( void *ptr, int reqitem, int *allocated, int def, size_t size, const char *name );
 void                        SetGridPoints( int n );
 void                        SetDrawVerts( int n );
 void                        IncDrawVerts();
@@ -1860,13 +1938,20 @@ void                        SwapBlock( int *block, int size );
 int                         GetLumpElements( bspHeader_t *header, int lump, int size );
 void                        *GetLump( bspHeader_t *header, int lump );
 int                         CopyLump( bspHeader_t *header, int lump, void *dest, int size );
-void                        AddLump( FILE *file, bspHeader_t *header, int lumpNum, const void *data, int length );
+int                         CopyLump_Allocate( bspHeader_t *header, int lump, void **dest, int size, int *allocated );
+void                        BeginBSPLumps( int headerSize );
+void                        AddLump( bspHeader_t *header, int lumpNum, const void *data, int length );
+void                        AddLumpBuffer( bspHeader_t *header, int lumpNum, void *buffer, int length );
+int                         WriteBSPLumps( const char *filename, const void *header, int headerSize );
 
 void                        LoadBSPFile( const char *filename );
+void                        LoadBSPFileEntities( const char *filename );
 void                        WriteBSPFile( const char *filename );
 void                        PrintBSPFileSizes( void );
 
+unsigned int                EPairKeyHash( const char *key );
 epair_t                     *ParseEPair( void );
+void                        AddEPair( entity_t *ent, epair_t *ep );
 void                        ParseEntities( void );
 void                        UnparseEntities( void );
 void                        PrintEntity( const entity_t *ent );
@@ -1949,10 +2034,7 @@ Q_EXTERN game_t             *game Q_ASSIGN( &games[ 0 ] );
 
 /* general */
 Q_EXTERN int numImages Q_ASSIGN( 0 );
-Q_EXTERN image_t images[ MAX_IMAGES ];
-
 Q_EXTERN int numPicoModels Q_ASSIGN( 0 );
-Q_EXTERN picoModel_t        *picoModels[ MAX_MODELS ];
 
 Q_EXTERN shaderInfo_t       *shaderInfo Q_ASSIGN( NULL );
 Q_EXTERN int numShaderInfo Q_ASSIGN( 0 );
@@ -1970,7 +2052,10 @@ Q_EXTERN float jitters[ MAX_JITTERS ];
 
 
 /* commandline arguments */
+Q_EXTERN int commandArgc;
+Q_EXTERN char               **commandArgv;
 Q_EXTERN qboolean verbose;
+Q_EXTERN qboolean profiling Q_ASSIGN( qfalse );
 Q_EXTERN qboolean verboseEntities Q_ASSIGN( qfalse );
 Q_EXTERN qboolean force Q_ASSIGN( qfalse );
 Q_EXTERN qboolean infoMode Q_ASSIGN( qfalse );
@@ -2054,8 +2139,9 @@ Q_EXTERN int mapEntityNum Q_ASSIGN( 0 );
 
 Q_EXTERN int entitySourceBrushes;
 
-Q_EXTERN plane_t mapplanes[ MAX_MAP_PLANES ];               /* mapplanes[ num ^ 1 ] will always be the mirror or mapplanes[ num ] */
+Q_EXTERN plane_t            *mapplanes Q_ASSIGN( NULL );   /* mapplanes[ num ^ 1 ] will always be the mirror or mapplanes[ num ] */
 Q_EXTERN int nummapplanes;                                  /* nummapplanes will always be even */
+Q_EXTERN int allocatedmapplanes Q_ASSIGN( 0 );
 Q_EXTERN int numMapPatches;
 Q_EXTERN vec3_t mapMins, mapMaxs;
 
@@ -2128,6 +2214,8 @@ Q_EXTERN qboolean			mergevisportals;
 Q_EXTERN qboolean			nosort;
 Q_EXTERN qboolean			saveprt;
 Q_EXTERN qboolean			hint;	/* ydnar */
+Q_EXTERN int numVisShards Q_ASSIGN( 0 );
+Q_EXTERN int visShard Q_ASSIGN( -1 );
 Q_EXTERN char				inbase[ MAX_QPATH ];
 Q_EXTERN char				globalCelShader[ MAX_QPATH ];
 
@@ -2174,6 +2262,10 @@ Q_EXTERN vportal_t          *sorted_portals[ MAX_MAP_PORTALS * 2 ];
 /* commandline arguments */
 Q_EXTERN qboolean wolfLight Q_ASSIGN( qfalse );
 Q_EXTERN qboolean loMem Q_ASSIGN( qfalse );
+Q_EXTERN qboolean bvhTrace Q_ASSIGN( qfalse );
+Q_EXTERN qboolean lightCache Q_ASSIGN( qfalse );
+Q_EXTERN qboolean progressiveLight Q_ASSIGN( qfalse );
+Q_EXTERN float lightTimeBudget Q_ASSIGN( 0.0f );
 Q_EXTERN qboolean noStyles Q_ASSIGN( qfalse );
 
 Q_EXTERN int sampleSize Q_ASSIGN( DEFAULT_LIGHTMAP_SAMPLE_SIZE );
@@ -2204,6 +2296,7 @@ Q_EXTERN qboolean shade Q_ASSIGN( qfalse );
 Q_EXTERN float shadeAngleDegrees Q_ASSIGN( 0.0f );
 Q_EXTERN int superSample Q_ASSIGN( 0 );
 Q_EXTERN int lightSamples Q_ASSIGN( 1 );
+Q_EXTERN int lightSampleStep Q_ASSIGN( 1 );
 Q_EXTERN qboolean filter Q_ASSIGN( qfalse );
 Q_EXTERN qboolean dark Q_ASSIGN( qfalse );
 Q_EXTERN qboolean sunOnly Q_ASSIGN( qfalse );
@@ -2390,37 +2483,46 @@ Q_EXTERN vec3_t gridSize
 
 Q_EXTERN int numEntities Q_ASSIGN( 0 );
 Q_EXTERN int numBSPEntities Q_ASSIGN( 0 );
-Q_EXTERN entity_t entities[ MAX_MAP_ENTITIES ];
+Q_EXTERN entity_t           *entities Q_ASSIGN( NULL );
+Q_EXTERN int allocatedEntities Q_ASSIGN( 0 );
 
 Q_EXTERN int numBSPModels Q_ASSIGN( 0 );
 Q_EXTERN bspModel_t bspModels[ MAX_MAP_MODELS ];
 
 Q_EXTERN int numBSPShaders Q_ASSIGN( 0 );
-Q_EXTERN bspShader_t bspShaders[ MAX_MAP_MODELS ];
+Q_EXTERN bspShader_t bspShaders[ MAX_MAP_SHADERS ];
 
 Q_EXTERN int bspEntDataSize Q_ASSIGN( 0 );
 Q_EXTERN char bspEntData[ MAX_MAP_ENTSTRING ];
+Q_EXTERN qboolean bspEntitiesOnly Q_ASSIGN( qfalse );      /* LoadBSPFileEntities: format loaders only count the other lumps */
 
 Q_EXTERN int numBSPLeafs Q_ASSIGN( 0 );
-Q_EXTERN bspLeaf_t bspLeafs[ MAX_MAP_LEAFS ];
+Q_EXTERN bspLeaf_t          *bspLeafs Q_ASSIGN( NULL );
+Q_EXTERN int allocatedBSPLeafs Q_ASSIGN( 0 );
 
 Q_EXTERN int numBSPPlanes Q_ASSIGN( 0 );
-Q_EXTERN bspPlane_t bspPlanes[ MAX_MAP_PLANES ];
+Q_EXTERN bspPlane_t         *bspPlanes Q_ASSIGN( NULL );
+Q_EXTERN int allocatedBSPPlanes Q_ASSIGN( 0 );
 
 Q_EXTERN int numBSPNodes Q_ASSIGN( 0 );
-Q_EXTERN bspNode_t bspNodes[ MAX_MAP_NODES ];
+Q_EXTERN bspNode_t          *bspNodes Q_ASSIGN( NULL );
+Q_EXTERN int allocatedBSPNodes Q_ASSIGN( 0 );
 
 Q_EXTERN int numBSPLeafSurfaces Q_ASSIGN( 0 );
-Q_EXTERN int bspLeafSurfaces[ MAX_MAP_LEAFFACES ];
+Q_EXTERN int                *bspLeafSurfaces Q_ASSIGN( NULL );
+Q_EXTERN int allocatedBSPLeafSurfaces Q_ASSIGN( 0 );
 
 Q_EXTERN int numBSPLeafBrushes Q_ASSIGN( 0 );
-Q_EXTERN int bspLeafBrushes[ MAX_MAP_LEAFBRUSHES ];
+Q_EXTERN int                *bspLeafBrushes Q_ASSIGN( NULL );
+Q_EXTERN int allocatedBSPLeafBrushes Q_ASSIGN( 0 );
 
 Q_EXTERN int numBSPBrushes Q_ASSIGN( 0 );
-Q_EXTERN bspBrush_t bspBrushes[ MAX_MAP_BRUSHES ];
+Q_EXTERN bspBrush_t         *bspBrushes Q_ASSIGN( NULL );
+Q_EXTERN int allocatedBSPBrushes Q_ASSIGN( 0 );
 
 Q_EXTERN int numBSPBrushSides Q_ASSIGN( 0 );
-Q_EXTERN bspBrushSide_t bspBrushSides[ MAX_MAP_BRUSHSIDES ];
+Q_EXTERN bspBrushSide_t     *bspBrushSides Q_ASSIGN( NULL );
+Q_EXTERN int allocatedBSPBrushSides Q_ASSIGN( 0 );
 
 Q_EXTERN int numBSPLightBytes Q_ASSIGN( 0 );
 Q_EXTERN byte *bspLightBytes Q_ASSIGN( NULL );
@@ -2432,13 +2534,15 @@ Q_EXTERN int numBSPGridPoints Q_ASSIGN( 0 );
 Q_EXTERN bspGridPoint_t     *bspGridPoints Q_ASSIGN( NULL );
 
 Q_EXTERN int numBSPVisBytes Q_ASSIGN( 0 );
-Q_EXTERN byte bspVisBytes[ MAX_MAP_VISIBILITY ];
+Q_EXTERN byte               *bspVisBytes Q_ASSIGN( NULL );
+Q_EXTERN int allocatedBSPVisBytes Q_ASSIGN( 0 );
 
 Q_EXTERN int numBSPDrawVerts Q_ASSIGN( 0 );
 Q_EXTERN bspDrawVert_t *bspDrawVerts Q_ASSIGN( NULL );
 
 Q_EXTERN int numBSPDrawIndexes Q_ASSIGN( 0 );
-Q_EXTERN int bspDrawIndexes[ MAX_MAP_DRAW_INDEXES ];
+Q_EXTERN int                *bspDrawIndexes Q_ASSIGN( NULL );
+Q_EXTERN int allocatedBSPDrawIndexes Q_ASSIGN( 0 );
 
 Q_EXTERN int numBSPDrawSurfaces Q_ASSIGN( 0 );
 Q_EXTERN bspDrawSurface_t   *bspDrawSurfaces Q_ASSIGN( NULL );
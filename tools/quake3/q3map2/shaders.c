@@ -597,6 +597,79 @@ void EmitVertexRemapShader( char *from, char *to ){
 
 
 
+/*
+   shaderInfo hash
+   case-insensitive index of shaderInfo by name, filled lazily at lookup time so that
+   every path that allocates and names a shader is covered. the first shader with a
+   given name wins, matching the old linear search
+ */
+
+#define SHADER_INFO_HASH_SIZE   ( MAX_SHADER_INFO * 2 )
+
+static int                  *shaderInfoHash = NULL;
+static int numHashedShaderInfo = 0;
+
+static unsigned int HashShaderName( const char *name ){
+	unsigned int hash;
+	int c;
+
+
+	/* fold case the same way Q_stricmp does */
+	hash = 2166136261u;
+	for ( ; *name != '\0'; name++ )
+	{
+		c = *name;
+		if ( c >= 'a' && c <= 'z' ) {
+			c -= ( 'a' - 'A' );
+		}
+		hash = ( hash ^ (unsigned int) c ) * 16777619u;
+	}
+	return hash;
+}
+
+static int FindShaderInfoHash( const char *name ){
+	int i, slot;
+
+
+	/* allocate? */
+	if ( shaderInfoHash == NULL ) {
+		shaderInfoHash = safe_malloc( SHADER_INFO_HASH_SIZE * sizeof( *shaderInfoHash ) );
+		memset( shaderInfoHash, 0xFF, SHADER_INFO_HASH_SIZE * sizeof( *shaderInfoHash ) );
+	}
+
+	/* index any shaders added since the last lookup */
+	for ( ; numHashedShaderInfo < numShaderInfo; numHashedShaderInfo++ )
+	{
+		i = numHashedShaderInfo;
+		for ( slot = HashShaderName( shaderInfo[ i ].shader ) & ( SHADER_INFO_HASH_SIZE - 1 );
+			  shaderInfoHash[ slot ] >= 0;
+			  slot = ( slot + 1 ) & ( SHADER_INFO_HASH_SIZE - 1 ) )
+		{
+			if ( !Q_stricmp( shaderInfo[ i ].shader, shaderInfo[ shaderInfoHash[ slot ] ].shader ) ) {
+				break;
+			}
+		}
+		if ( shaderInfoHash[ slot ] < 0 ) {
+			shaderInfoHash[ slot ] = i;
+		}
+	}
+
+	/* search */
+	for ( slot = HashShaderName( name ) & ( SHADER_INFO_HASH_SIZE - 1 );
+		  shaderInfoHash[ slot ] >= 0;
+		  slot = ( slot + 1 ) & ( SHADER_INFO_HASH_SIZE - 1 ) )
+	{
+		if ( !Q_stricmp( name, shaderInfo[ shaderInfoHash[ slot ] ].shader ) ) {
+			return shaderInfoHash[ slot ];
+		}
+	}
+
+	/* not found */
+	return -1;
+}
+
+
+
 /*
    AllocShaderInfo()
    allocates and initializes a new shader
@@ -824,19 +897,18 @@ shaderInfo_t *ShaderInfoForShader( const char *shaderName ){
 	StripExtension( shader );
 
 	/* search for it */
-	for ( i = 0; i < numShaderInfo; i++ )
-	{
+	i = FindShaderInfoHash( shader );
+	if ( i >= 0 ) {
 		si = &shaderInfo[ i ];
-		if ( !Q_stricmp( shader, si->shader ) ) {
-			/* load image if necessary */
-			if ( si->finished == qfalse ) {
-				LoadShaderImages( si );
-				FinishShader( si );
-			}
 
-			/* return it */
-			return si;
+		/* load image if necessary */
+		if ( si->finished == qfalse ) {
+			LoadShaderImages( si );
+			FinishShader( si );
 		}
+
+		/* return it */
+		return si;
 	}
 
 	/* allocate a default shader */
@@ -851,6 +923,94 @@ shaderInfo_t *ShaderInfoForShader( const char *shaderName ){
 
 
 
+/*
+   PrefetchShaderImages() - ydnar
+   loads the images of and finishes a list of shaders across all threads, so the
+   ShaderInfoForShader calls that follow find them done. empty names and "noshader"
+   are skipped rather than warned about; they get their warning when actually used.
+   names without a shaderInfo yet only get their image loaded: default shaders must
+   still be allocated in first-use order, surface sorting ties break on their address
+ */
+
+static shaderInfo_t **prefetchShaders;
+static const char **prefetchImages;
+static int numPrefetchShaders;
+
+static void PrefetchShaderImagesThread( int num ){
+	if ( num < numPrefetchShaders ) {
+		LoadShaderImages( prefetchShaders[ num ] );
+		FinishShader( prefetchShaders[ num ] );
+	}
+	else{
+		ImageLoad( prefetchImages[ num - numPrefetchShaders ] );
+	}
+}
+
+void PrefetchShaderImages( const char **shaderNames, int numShaderNames ){
+	int i, j, numPrefetchImages;
+	shaderInfo_t    *si;
+	byte            *queued;
+	char shader[ MAX_QPATH ];
+
+
+	if ( numShaderNames <= 0 ) {
+		return;
+	}
+
+	/* resolve names serially, the shaderInfo table isn't thread safe */
+	prefetchShaders = safe_malloc( numShaderNames * sizeof( *prefetchShaders ) );
+	prefetchImages = safe_malloc( numShaderNames * sizeof( *prefetchImages ) );
+	numPrefetchShaders = 0;
+	numPrefetchImages = 0;
+	for ( i = 0; i < numShaderNames; i++ )
+	{
+		if ( shaderNames[ i ] == NULL || shaderNames[ i ][ 0 ] == '\0' || !Q_stricmp( shaderNames[ i ], "noshader" ) ) {
+			continue;
+		}
+		strcpy( shader, shaderNames[ i ] );
+		StripExtension( shader );
+		j = FindShaderInfoHash( shader );
+		if ( j < 0 ) {
+			/* this is the first image a default shader tries */
+			prefetchImages[ numPrefetchImages++ ] = shaderNames[ i ];
+			continue;
+		}
+		si = &shaderInfo[ j ];
+		if ( si->finished == qfalse ) {
+			prefetchShaders[ numPrefetchShaders++ ] = si;
+		}
+	}
+
+	/* drop duplicates */
+	queued = safe_malloc( numShaderInfo );
+	memset( queued, 0, numShaderInfo );
+	for ( i = 0, j = 0; i < numPrefetchShaders; i++ )
+	{
+		if ( !queued[ prefetchShaders[ i ] - shaderInfo ] ) {
+			queued[ prefetchShaders[ i ] - shaderInfo ] = 1;
+			prefetchShaders[ j++ ] = prefetchShaders[ i ];
+		}
+	}
+	numPrefetchShaders = j;
+	free( queued );
+
+	/* load and finish them */
+	if ( numPrefetchShaders + numPrefetchImages > 0 ) {
+		Sys_FPrintf( SYS_VRB, "--- PrefetchShaderImages ---\n" );
+		RunThreadsOnIndividual( numPrefetchShaders + numPrefetchImages, qfalse, PrefetchShaderImagesThread );
+		Sys_FPrintf( SYS_VRB, "%9d shaders prefetched\n", numPrefetchShaders );
+		Sys_FPrintf( SYS_VRB, "%9d images loaded\n", numImages );
+	}
+
+	free( prefetchShaders );
+	free( prefetchImages );
+	prefetchShaders = NULL;
+	prefetchImages = NULL;
+	numPrefetchShaders = 0;
+}
+
+
+
 /*
    GetTokenAppend() - ydnar
    gets a token and appends its text to the specified buffer
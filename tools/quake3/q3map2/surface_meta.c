@@ -48,6 +48,7 @@
 
 #define GROW_META_VERTS     1024
 #define GROW_META_TRIANGLES 1024
+#define MIN_META_VERT_HASH  1024
 
 static int numMetaSurfaces, numPatchMetaSurfaces;
 
@@ -60,6 +61,69 @@ static int maxMetaTriangles = 0;
 static int numMetaTriangles = 0;
 static metaTriangle_t       *metaTriangles = NULL;
 
+/* open addressed index of the searchable metaverts [firstSearchMetaVert, numMetaVerts), keyed on the whole drawvert */
+static int metaVertHashSize = 0;
+static int                  *metaVertHash = NULL;
+
+/* spatial grid over the metaverts for coincident vertex searches */
+static int metaVertGridSize = 0, metaVertGridMaxVerts = 0;
+static float metaVertGridCellSize = 0.0f;
+static int                  *metaVertGrid = NULL;
+static int                  *metaVertGridNext = NULL;
+
+
+
+/*
+   HashMetaVertex()
+   hashes the raw bytes of a drawvert, matching the memcmp used to compare them
+ */
+
+static unsigned int HashMetaVertex( const bspDrawVert_t *dv ){
+	int i;
+	unsigned int hash;
+	const byte      *b;
+
+
+	hash = 2166136261u;
+	for ( i = 0, b = (const byte*) dv; i < (int) sizeof( *dv ); i++, b++ )
+		hash = ( hash ^ *b ) * 16777619u;
+	return hash;
+}
+
+
+
+/*
+   ResetMetaVertexSearch()
+   empties the metavertex hash so following searches start at the current metavertex
+ */
+
+static void ResetMetaVertexSearch( void ){
+	int i, slot, mask;
+
+
+	/* clear the searchable range */
+	if ( metaVertHash != NULL && numMetaVerts > firstSearchMetaVert ) {
+		if ( ( numMetaVerts - firstSearchMetaVert ) * 4 >= metaVertHashSize ) {
+			memset( metaVertHash, 0xFF, metaVertHashSize * sizeof( *metaVertHash ) );
+		}
+		else
+		{
+			/* remove in reverse insertion order so every probe sequence stays intact */
+			mask = metaVertHashSize - 1;
+			for ( i = numMetaVerts - 1; i >= firstSearchMetaVert; i-- )
+			{
+				slot = HashMetaVertex( &metaVerts[ i ] ) & mask;
+				while ( metaVertHash[ slot ] != i )
+					slot = ( slot + 1 ) & mask;
+				metaVertHash[ slot ] = -1;
+			}
+		}
+	}
+
+	/* speed at the expense of memory */
+	firstSearchMetaVert = numMetaVerts;
+}
+
 
 
 /*
@@ -68,7 +132,9 @@ static metaTriangle_t       *metaTriangles = NULL;
  */
 
 void ClearMetaTriangles( void ){
+	ResetMetaVertexSearch();
 	numMetaVerts = 0;
+	firstSearchMetaVert = 0;
 	numMetaTriangles = 0;
 }
 
@@ -80,22 +146,46 @@ void ClearMetaTriangles( void ){
  */
 
 static int FindMetaVertex( bspDrawVert_t *src ){
-	int i;
-	bspDrawVert_t   *v, *temp;
-
+	int i, slot, mask, size, *oldHash;
+	bspDrawVert_t   *temp;
+
+
+	/* keep the hash at most half full */
+	if ( ( numMetaVerts - firstSearchMetaVert + 1 ) * 2 > metaVertHashSize ) {
+		/* allocate a bigger table */
+		oldHash = metaVertHash;
+		size = metaVertHashSize > 0 ? metaVertHashSize * 2 : MIN_META_VERT_HASH;
+		metaVertHash = safe_malloc( size * sizeof( *metaVertHash ) );
+		memset( metaVertHash, 0xFF, size * sizeof( *metaVertHash ) );
+		metaVertHashSize = size;
+
+		/* rehash the searchable range */
+		mask = metaVertHashSize - 1;
+		for ( i = firstSearchMetaVert; i < numMetaVerts; i++ )
+		{
+			slot = HashMetaVertex( &metaVerts[ i ] ) & mask;
+			while ( metaVertHash[ slot ] >= 0 )
+				slot = ( slot + 1 ) & mask;
+			metaVertHash[ slot ] = i;
+		}
+		if ( oldHash != NULL ) {
+			free( oldHash );
+		}
+	}
 
 	/* try to find an existing drawvert */
-	for ( i = firstSearchMetaVert, v = &metaVerts[ i ]; i < numMetaVerts; i++, v++ )
+	mask = metaVertHashSize - 1;
+	for ( slot = HashMetaVertex( src ) & mask; metaVertHash[ slot ] >= 0; slot = ( slot + 1 ) & mask )
 	{
-		if ( memcmp( src, v, sizeof( bspDrawVert_t ) ) == 0 ) {
-			return i;
+		if ( memcmp( src, &metaVerts[ metaVertHash[ slot ] ], sizeof( bspDrawVert_t ) ) == 0 ) {
+			return metaVertHash[ slot ];
 		}
 	}
 
 	/* enough space? */
 	if ( numMetaVerts >= maxMetaVerts ) {
 		/* reallocate more room */
-		maxMetaVerts += GROW_META_VERTS;
+		maxMetaVerts = maxMetaVerts > GROW_META_VERTS ? maxMetaVerts * 2 : maxMetaVerts + GROW_META_VERTS;
 		temp = safe_malloc( maxMetaVerts * sizeof( bspDrawVert_t ) );
 		if ( metaVerts != NULL ) {
 			memcpy( temp, metaVerts, numMetaVerts * sizeof( bspDrawVert_t ) );
@@ -104,8 +194,9 @@ static int FindMetaVertex( bspDrawVert_t *src ){
 		metaVerts = temp;
 	}
 
-	/* add the triangle */
+	/* add the vertex */
 	memcpy( &metaVerts[ numMetaVerts ], src, sizeof( bspDrawVert_t ) );
+	metaVertHash[ slot ] = numMetaVerts;
 	numMetaVerts++;
 
 	/* return the count */
@@ -114,6 +205,182 @@ static int FindMetaVertex( bspDrawVert_t *src ){
 
 
 
+/*
+   MetaVertGridCell()
+   returns the bucket for an integer cell coordinate
+ */
+
+static int MetaVertGridCell( int x, int y, int z ){
+	return ( ( x * 73856093 ) ^ ( y * 19349663 ) ^ ( z * 83492791 ) ) & ( metaVertGridSize - 1 );
+}
+
+
+
+/*
+   AddMetaVertToGrid()
+   adds a metavertex to the spatial hash, keeping each bucket in ascending order
+ */
+
+static void AddMetaVertToGrid( int num ){
+	int                 *link, *temp;
+	float               *xyz;
+
+
+	/* grow the link table along with the metavertex list */
+	if ( num >= metaVertGridMaxVerts ) {
+		temp = safe_malloc( maxMetaVerts * sizeof( *metaVertGridNext ) );
+		memcpy( temp, metaVertGridNext, metaVertGridMaxVerts * sizeof( *metaVertGridNext ) );
+		free( metaVertGridNext );
+		metaVertGridNext = temp;
+		metaVertGridMaxVerts = maxMetaVerts;
+	}
+
+	/* find the bucket */
+	xyz = metaVerts[ num ].xyz;
+	link = &metaVertGrid[ MetaVertGridCell( (int) floor( xyz[ 0 ] / metaVertGridCellSize ),
+											(int) floor( xyz[ 1 ] / metaVertGridCellSize ),
+											(int) floor( xyz[ 2 ] / metaVertGridCellSize ) ) ];
+
+	/* link it in */
+	while ( *link >= 0 && *link < num )
+		link = &metaVertGridNext[ *link ];
+	metaVertGridNext[ num ] = *link;
+	*link = num;
+}
+
+
+
+/*
+   CreateMetaVertGrid()
+   buckets every metavertex into a spatial hash with the given cell size
+ */
+
+static void CreateMetaVertGrid( float cellSize ){
+	int i;
+
+
+	/* size the bucket table to the vertex count */
+	metaVertGridSize = MIN_META_VERT_HASH;
+	while ( metaVertGridSize < numMetaVerts )
+		metaVertGridSize <<= 1;
+	metaVertGridCellSize = cellSize;
+	metaVertGrid = safe_malloc( metaVertGridSize * sizeof( *metaVertGrid ) );
+	memset( metaVertGrid, 0xFF, metaVertGridSize * sizeof( *metaVertGrid ) );
+	metaVertGridMaxVerts = maxMetaVerts;
+	metaVertGridNext = safe_malloc( metaVertGridMaxVerts * sizeof( *metaVertGridNext ) );
+
+	/* add the verts back to front so the buckets are built by prepending */
+	for ( i = numMetaVerts - 1; i >= 0; i-- )
+		AddMetaVertToGrid( i );
+}
+
+
+
+/*
+   FreeMetaVertGrid()
+   frees the metavertex spatial hash
+ */
+
+static void FreeMetaVertGrid( void ){
+	free( metaVertGrid );
+	free( metaVertGridNext );
+	metaVertGrid = NULL;
+	metaVertGridNext = NULL;
+	metaVertGridSize = 0;
+	metaVertGridMaxVerts = 0;
+}
+
+
+
+/*
+   FindMetaVertsInBounds()
+   gathers the metaverts at or after firstVert that lie inside a box, in ascending order.
+   this is a superset filter, callers still do their own exact tests
+ */
+
+static int FindMetaVertsInBounds( vec3_t mins, vec3_t maxs, int firstVert, int **list, int *maxList ){
+	int i, j, num, x, y, z, count, cells, lo[ 3 ], hi[ 3 ];
+	int                 *temp;
+	float               *xyz;
+
+
+	/* get the cell range */
+	cells = 1;
+	for ( i = 0; i < 3; i++ )
+	{
+		lo[ i ] = (int) floor( mins[ i ] / metaVertGridCellSize );
+		hi[ i ] = (int) floor( maxs[ i ] / metaVertGridCellSize );
+		cells *= ( hi[ i ] - lo[ i ] + 1 );
+	}
+
+	/* walk the cells, or every vertex when the box covers more cells than there are buckets */
+	count = 0;
+	for ( x = lo[ 0 ]; x <= hi[ 0 ]; x++ )
+	{
+		for ( y = lo[ 1 ]; y <= hi[ 1 ]; y++ )
+		{
+			for ( z = lo[ 2 ]; z <= hi[ 2 ]; z++ )
+			{
+				for ( num = ( cells > metaVertGridSize ? firstVert : metaVertGrid[ MetaVertGridCell( x, y, z ) ] );
+					  num >= 0 && num < numMetaVerts;
+					  num = ( cells > metaVertGridSize ? num + 1 : metaVertGridNext[ num ] ) )
+				{
+					/* test it */
+					xyz = metaVerts[ num ].xyz;
+					if ( num < firstVert ||
+						 xyz[ 0 ] < mins[ 0 ] || xyz[ 0 ] > maxs[ 0 ] ||
+						 xyz[ 1 ] < mins[ 1 ] || xyz[ 1 ] > maxs[ 1 ] ||
+						 xyz[ 2 ] < mins[ 2 ] || xyz[ 2 ] > maxs[ 2 ] ) {
+						continue;
+					}
+
+					/* buckets can be shared between cells */
+					for ( j = 0; j < count && ( *list )[ j ] != num; j++ ) ;
+					if ( j < count ) {
+						continue;
+					}
+
+					/* enough space? */
+					if ( count >= *maxList ) {
+						*maxList = *maxList > 0 ? *maxList * 2 : 64;
+						temp = safe_malloc( *maxList * sizeof( int ) );
+						if ( *list != NULL ) {
+							memcpy( temp, *list, count * sizeof( int ) );
+							free( *list );
+						}
+						*list = temp;
+					}
+					( *list )[ count++ ] = num;
+				}
+
+				/* the whole list was walked */
+				if ( cells > metaVertGridSize ) {
+					break;
+				}
+			}
+			if ( cells > metaVertGridSize ) {
+				break;
+			}
+		}
+		if ( cells > metaVertGridSize ) {
+			break;
+		}
+	}
+
+	/* merge buckets into ascending order */
+	for ( i = 1; i < count; i++ )
+	{
+		num = ( *list )[ i ];
+		for ( j = i; j > 0 && ( *list )[ j - 1 ] > num; j-- )
+			( *list )[ j ] = ( *list )[ j - 1 ];
+		( *list )[ j ] = num;
+	}
+
+	return count;
+}
+
+
+
 /*
    AddMetaTriangle()
    adds a new meta triangle, allocating more memory if necessary
@@ -126,7 +393,7 @@ static int AddMetaTriangle( void ){
 	/* enough space? */
 	if ( numMetaTriangles >= maxMetaTriangles ) {
 		/* reallocate more room */
-		maxMetaTriangles += GROW_META_TRIANGLES;
+		maxMetaTriangles = maxMetaTriangles > GROW_META_TRIANGLES ? maxMetaTriangles * 2 : maxMetaTriangles + GROW_META_TRIANGLES;
 		temp = safe_malloc( maxMetaTriangles * sizeof( metaTriangle_t ) );
 		if ( metaTriangles != NULL ) {
 			memcpy( temp, metaTriangles, numMetaTriangles * sizeof( metaTriangle_t ) );
@@ -261,8 +528,8 @@ static void SurfaceToMetaTriangles( mapDrawSurface_t *ds ){
 		return;
 	}
 
-	/* speed at the expense of memory */
-	firstSearchMetaVert = numMetaVerts;
+	/* only search this surface's verts, speed at the expense of memory */
+	ResetMetaVertexSearch();
 
 	/* only handle valid surfaces */
 	if ( ds->type != SURFACE_BAD && ds->numVerts >= 3 && ds->numIndexes >= 3 ) {
@@ -741,13 +1008,16 @@ void CreateEdge( vec4_t plane, vec3_t a, vec3_t b, edge_t *edge ){
 #define TJ_EDGE_EPSILON     ( 1.0f / 8.0f )
 #define TJ_POINT_EPSILON    ( 1.0f / 8.0f )
 
+#define TJ_GRID_SIZE        64.0f
+
 void FixMetaTJunctions( void ){
-	int i, j, k, f, fOld, start, vertIndex, triIndex, numTJuncs;
+	int i, j, k, n, f, fOld, start, vertIndex, triIndex, numTJuncs;
+	int numCandidates, maxCandidates, *candidates, *newCandidates;
 	metaTriangle_t  *tri, *newTri;
 	shaderInfo_t    *si;
 	bspDrawVert_t   *a, *b, *c, junc;
 	float dist, amount;
-	vec3_t pt;
+	vec3_t pt, mins, maxs;
 	vec4_t plane;
 	edge_t edges[ 3 ];
 
@@ -762,6 +1032,15 @@ void FixMetaTJunctions( void ){
 	fOld = -1;
 	start = I_FloatTime();
 
+	/* debug code: darken verts */
+	for ( j = 0; j < numMetaVerts; j++ )
+		VectorSet( metaVerts[ j ].color[ 0 ], 8, 8, 8 );
+
+	/* bucket the verts so each triangle only tests the ones near it */
+	CreateMetaVertGrid( TJ_GRID_SIZE );
+	candidates = NULL;
+	maxCandidates = 0;
+
 	/* walk triangle list */
 	numTJuncs = 0;
 	for ( i = 0; i < numMetaTriangles; i++ )
@@ -789,17 +1068,24 @@ void FixMetaTJunctions( void ){
 		CreateEdge( plane, metaVerts[ tri->indexes[ 1 ] ].xyz, metaVerts[ tri->indexes[ 2 ] ].xyz, &edges[ 1 ] );
 		CreateEdge( plane, metaVerts[ tri->indexes[ 2 ] ].xyz, metaVerts[ tri->indexes[ 0 ] ].xyz, &edges[ 2 ] );
 
-		/* walk meta vert list */
-		for ( j = 0; j < numMetaVerts; j++ )
+		/* get the verts near the triangle (splits only shrink it, so this stays a superset) */
+		ClearBounds( mins, maxs );
+		for ( k = 0; k < 3; k++ )
+			AddPointToBounds( metaVerts[ tri->indexes[ k ] ].xyz, mins, maxs );
+		for ( k = 0; k < 3; k++ )
+		{
+			mins[ k ] -= TJ_PLANE_EPSILON + TJ_EDGE_EPSILON;
+			maxs[ k ] += TJ_PLANE_EPSILON + TJ_EDGE_EPSILON;
+		}
+		numCandidates = FindMetaVertsInBounds( mins, maxs, 0, &candidates, &maxCandidates );
+
+		/* walk nearby meta verts */
+		for ( n = 0; n < numCandidates; n++ )
 		{
 			/* get vert */
+			j = candidates[ n ];
 			VectorCopy( metaVerts[ j ].xyz, pt );
 
-			/* debug code: darken verts */
-			if ( i == 0 ) {
-				VectorSet( metaVerts[ j ].color[ 0 ], 8, 8, 8 );
-			}
-
 			/* determine if point lies in the triangle's plane */
 			dist = DotProduct( pt, plane ) - plane[ 3 ];
 			if ( fabs( dist ) > TJ_PLANE_EPSILON ) {
@@ -874,11 +1160,22 @@ void FixMetaTJunctions( void ){
 				else
 				{
 					/* find new vertex (note: a and b are invalid pointers after this) */
-					firstSearchMetaVert = numMetaVerts;
+					ResetMetaVertexSearch();
 					vertIndex = FindMetaVertex( &junc );
 					if ( vertIndex < 0 ) {
 						continue;
 					}
+
+					/* the new vert is tested against this and later triangles too */
+					AddMetaVertToGrid( vertIndex );
+					if ( numCandidates >= maxCandidates ) {
+						maxCandidates *= 2;
+						newCandidates = safe_malloc( maxCandidates * sizeof( int ) );
+						memcpy( newCandidates, candidates, numCandidates * sizeof( int ) );
+						free( candidates );
+						candidates = newCandidates;
+					}
+					candidates[ numCandidates++ ] = vertIndex;
 				}
 
 				/* make new triangle */
@@ -915,6 +1212,10 @@ void FixMetaTJunctions( void ){
 		}
 	}
 
+	/* clean up */
+	free( candidates );
+	FreeMetaVertGrid();
+
 	/* print time */
 	Sys_FPrintf( SYS_VRB, " (%d)\n", (int) ( I_FloatTime() - start ) );
 
@@ -932,14 +1233,16 @@ void FixMetaTJunctions( void ){
 #define MAX_SAMPLES             256
 #define THETA_EPSILON           0.000001
 #define EQUAL_NORMAL_EPSILON    0.01
+#define SMOOTH_GRID_SIZE        1.0f
 
 void SmoothMetaTriangles( void ){
-	int i, j, k, f, fOld, start, cs, numVerts, numVotes, numSmoothed;
+	int i, j, k, n, f, fOld, start, cs, numVerts, numVotes, numSmoothed;
+	int numCandidates, maxCandidates, *candidates;
 	float shadeAngle, defaultShadeAngle, maxShadeAngle, dot, testAngle;
 	metaTriangle_t  *tri;
 	float           *shadeAngles;
 	byte            *smoothed;
-	vec3_t average, diff;
+	vec3_t average, diff, mins, maxs;
 	int indexes[ MAX_SAMPLES ];
 	vec3_t votes[ MAX_SAMPLES ];
 
@@ -993,6 +1296,11 @@ void SmoothMetaTriangles( void ){
 		return;
 	}
 
+	/* bucket the verts so coincident ones can be found without testing every pair */
+	CreateMetaVertGrid( SMOOTH_GRID_SIZE );
+	candidates = NULL;
+	maxCandidates = 0;
+
 	/* init pacifier */
 	fOld = -1;
 	start = I_FloatTime();
@@ -1018,10 +1326,19 @@ void SmoothMetaTriangles( void ){
 		numVerts = 0;
 		numVotes = 0;
 
+		/* get the verts that could be coincident, in list order */
+		for ( k = 0; k < 3; k++ )
+		{
+			mins[ k ] = metaVerts[ i ].xyz[ k ] - 2 * EQUAL_EPSILON;
+			maxs[ k ] = metaVerts[ i ].xyz[ k ] + 2 * EQUAL_EPSILON;
+		}
+		numCandidates = FindMetaVertsInBounds( mins, maxs, i, &candidates, &maxCandidates );
+
 		/* build a table of coincident vertexes */
-		for ( j = i; j < numMetaVerts && numVerts < MAX_SAMPLES; j++ )
+		for ( n = 0; n < numCandidates && numVerts < MAX_SAMPLES; n++ )
 		{
 			/* already smoothed? */
+			j = candidates[ n ];
 			if ( smoothed[ j >> 3 ] & ( 1 << ( j & 7 ) ) ) {
 				continue;
 			}
@@ -1089,6 +1406,8 @@ void SmoothMetaTriangles( void ){
 	/* free the tables */
 	free( shadeAngles );
 	free( smoothed );
+	free( candidates );
+	FreeMetaVertGrid();
 
 	/* print time */
 	Sys_FPrintf( SYS_VRB, " (%d)\n", (int) ( I_FloatTime() - start ) );
@@ -414,6 +414,9 @@ void FixSurfaceJunctions( mapDrawSurface_t *ds ) {
 				/* copy the normal (FIXME: what about nonplanar surfaces? */
 				VectorCopy( v1->normal, verts[ numVerts ].normal );
 
+				/* the lightmap field holds the edge number, which the new vert shares (don't leave stack garbage in it) */
+				memcpy( verts[ numVerts ].lightmap, v1->lightmap, sizeof( verts[ numVerts ].lightmap ) );
+
 				/* ydnar: interpolate the color */
 				for ( k = 0; k < MAX_LIGHTMAPS; k++ )
 				{
@@ -439,8 +442,10 @@ void FixSurfaceJunctions( mapDrawSurface_t *ds ) {
 		}
 	}
 
+	ThreadLock();
 	c_addedVerts += numVerts - ds->numVerts;
 	c_totalVerts += numVerts;
+	ThreadUnlock();
 
 
 	// FIXME: check to see if the entire surface degenerated
@@ -462,7 +467,9 @@ void FixSurfaceJunctions( mapDrawSurface_t *ds ) {
 
 	if ( i == 0 ) {
 		// fine the way it is
+		ThreadLock();
 		c_natural++;
+		ThreadUnlock();
 
 		ds->numVerts = numVerts;
 		ds->verts = safe_malloc( numVerts * sizeof( *ds->verts ) );
@@ -472,7 +479,9 @@ void FixSurfaceJunctions( mapDrawSurface_t *ds ) {
 	}
 	if ( i == numVerts ) {
 		// create a vertex in the middle to start the fan
+		ThreadLock();
 		c_cant++;
+		ThreadUnlock();
 
 /*
         memset ( &verts[numVerts], 0, sizeof( verts[numVerts] ) );
@@ -491,7 +500,9 @@ void FixSurfaceJunctions( mapDrawSurface_t *ds ) {
 	}
 	else {
 		// just rotate the vertexes
+		ThreadLock();
 		c_rotate++;
+		ThreadUnlock();
 
 	}
 
@@ -624,6 +635,47 @@ int EdgeCompare( const void *elem1, const void *elem2 ) {
 
 
 
+/*
+   FixSurfaceJunctionsTask()
+   threaded worker, inserts the t-junction verts of one surface
+ */
+
+static int firstJunctionSurf;
+
+static void FixSurfaceJunctionsTask( int num ){
+	mapDrawSurface_t    *ds;
+	shaderInfo_t        *si;
+
+
+	/* get surface and early out if possible */
+	ds = &mapDrawSurfs[ firstJunctionSurf + num ];
+	si = ds->shaderInfo;
+	if ( ( si->compileFlags & C_NODRAW ) || si->autosprite || si->notjunc || ds->numVerts == 0 || ds->type != SURFACE_FACE ) {
+		return;
+	}
+
+	/* ydnar: gs mods: handle the various types of surfaces */
+	switch ( ds->type )
+	{
+	/* handle brush faces */
+	case SURFACE_FACE:
+		FixSurfaceJunctions( ds );
+		if ( FixBrokenSurface( ds ) == qfalse ) {
+			ThreadLock();
+			c_broken++;
+			ClearSurface( ds );
+			ThreadUnlock();
+		}
+		break;
+
+	/* fixme: t-junction triangle models and patches */
+	default:
+		break;
+	}
+}
+
+
+
 /*
    FixTJunctions
    call after the surface list has been pruned
@@ -694,32 +746,9 @@ void FixTJunctions( entity_t *ent ){
 	Sys_FPrintf( SYS_VRB, "%9d degenerate edges\n", c_degenerateEdges );
 
 	// insert any needed vertexes
-	for ( i = ent->firstDrawSurf; i < numMapDrawSurfs ; i++ )
-	{
-		/* get surface and early out if possible */
-		ds = &mapDrawSurfs[ i ];
-		si = ds->shaderInfo;
-		if ( ( si->compileFlags & C_NODRAW ) || si->autosprite || si->notjunc || ds->numVerts == 0 || ds->type != SURFACE_FACE ) {
-			continue;
-		}
-
-		/* ydnar: gs mods: handle the various types of surfaces */
-		switch ( ds->type )
-		{
-		/* handle brush faces */
-		case SURFACE_FACE:
-			FixSurfaceJunctions( ds );
-			if ( FixBrokenSurface( ds ) == qfalse ) {
-				c_broken++;
-				ClearSurface( ds );
-			}
-			break;
-
-		/* fixme: t-junction triangle models and patches */
-		default:
-			break;
-		}
-	}
+	// each surface only reads the edge lines, so they can go in parallel
+	firstJunctionSurf = ent->firstDrawSurf;
+	RunThreadsOnIndividual( numMapDrawSurfs - ent->firstDrawSurf, qfalse, FixSurfaceJunctionsTask );
 
 	/* emit some statistics */
 	Sys_FPrintf( SYS_VRB, "%9d verts added for T-junctions\n", c_addedVerts );
@@ -191,7 +191,7 @@ void ClusterMerge( int leafnum ){
 			Error( "portal not done" );
 		}
 		for ( j = 0 ; j < portallongs ; j++ )
-			( (long *)portalvector )[j] |= ( (long *)p->portalvis )[j];
+			( (visWord_t *)portalvector )[j] |= ( (visWord_t *)p->portalvis )[j];
 		pnum = p - portals;
 		portalvector[pnum >> 3] |= 1 << ( pnum & 7 );
 	}
@@ -216,6 +216,23 @@ void ClusterMerge( int leafnum ){
 	memcpy( bspVisBytes + VIS_HEADER_SIZE + leafnum * leafbytes, uncompressed, leafbytes );
 }
 
+/*
+   ==================
+   RunPortalFlow
+
+   runs a flow over all the sorted portals, or over this worker's
+   share of them with vis -shard
+   ==================
+ */
+static void RunPortalFlow( void ( *flow )( int portalnum ) ){
+	if ( visShard >= 0 ) {
+		RunVisShardFlow( flow );
+	}
+	else{
+		RunThreadsOnIndividual( numportals * 2, qtrue, flow );
+	}
+}
+
 /*
    ==================
    CalcPortalVis
@@ -227,7 +244,9 @@ void CalcPortalVis( void ){
 	//get rid of the counter
 	RunThreadsOnIndividual( numportals * 2, qfalse, PortalFlow );
 #else
-	RunThreadsOnIndividual( numportals * 2, qtrue, PortalFlow );
+	ProfileBegin( "PortalFlow" );
+	RunPortalFlow( PortalFlow );
+	ProfileEnd();
 #endif
 
 }
@@ -249,10 +268,14 @@ void CalcPassageVis( void ){
 	_printf( "\n" );
 #else
 	Sys_Printf( "\n--- CreatePassages (%d) ---\n", numportals * 2 );
+	ProfileBegin( "CreatePassages" );
 	RunThreadsOnIndividual( numportals * 2, qtrue, CreatePassages );
+	ProfileEnd();
 
 	Sys_Printf( "\n--- PassageFlow (%d) ---\n", numportals * 2 );
-	RunThreadsOnIndividual( numportals * 2, qtrue, PassageFlow );
+	ProfileBegin( "PassageFlow" );
+	RunPortalFlow( PassageFlow );
+	ProfileEnd();
 #endif
 }
 
@@ -273,10 +296,14 @@ void CalcPassagePortalVis( void ){
 	Sys_Printf( "\n" );
 #else
 	Sys_Printf( "\n--- CreatePassages (%d) ---\n", numportals * 2 );
+	ProfileBegin( "CreatePassages" );
 	RunThreadsOnIndividual( numportals * 2, qtrue, CreatePassages );
+	ProfileEnd();
 
 	Sys_Printf( "\n--- PassagePortalFlow (%d) ---\n", numportals * 2 );
-	RunThreadsOnIndividual( numportals * 2, qtrue, PassagePortalFlow );
+	ProfileBegin( "PassagePortalFlow" );
+	RunPortalFlow( PassagePortalFlow );
+	ProfileEnd();
 #endif
 }
 
@@ -327,31 +354,50 @@ void CalcVis( void ){
 
 
 
-	Sys_Printf( "\n--- BasePortalVis (%d) ---\n", numportals * 2 );
-	RunThreadsOnIndividual( numportals * 2, qtrue, BasePortalVis );
+	/* vis -shards: the workers do the base vis and portal flow, the master merges their portalvis */
+	if ( numVisShards > 1 && visShard < 0 ) {
+		ProfileBegin( "RunVisShards" );
+		RunVisShards();
+		ProfileEnd();
+	}
+	else
+	{
+		Sys_Printf( "\n--- BasePortalVis (%d) ---\n", numportals * 2 );
+		ProfileBegin( "BasePortalVis" );
+		RunThreadsOnIndividual( numportals * 2, qtrue, BasePortalVis );
+		ProfileEnd();
 
 //	RunThreadsOnIndividual (numportals*2, qtrue, BetterPortalVis);
 
-	SortPortals();
+		SortPortals();
 
-	if ( fastvis ) {
-		CalcFastVis();
-	}
-	else if ( noPassageVis ) {
-		CalcPortalVis();
-	}
-	else if ( passageVisOnly ) {
-		CalcPassageVis();
+		if ( fastvis ) {
+			CalcFastVis();
+		}
+		else if ( noPassageVis ) {
+			CalcPortalVis();
+		}
+		else if ( passageVisOnly ) {
+			CalcPassageVis();
+		}
+		else {
+			CalcPassagePortalVis();
+		}
 	}
-	else {
-		CalcPassagePortalVis();
+
+	/* shard workers leave the merge to the master */
+	if ( visShard >= 0 ) {
+		return;
 	}
+
 	//
 	// assemble the leaf vis lists by oring and compressing the portal lists
 	//
 	Sys_Printf( "creating leaf vis...\n" );
+	ProfileBegin( "ClusterMerge" );
 	for ( i = 0 ; i < portalclusters ; i++ )
 		ClusterMerge( i );
+	ProfileEnd();
 
 	Sys_Printf( "Total visible clusters: %i\n", totalvis );
 	Sys_Printf( "Average clusters visible: %i\n", totalvis / portalclusters );
@@ -895,12 +941,12 @@ void LoadPortals( char *name ){
 	Sys_Printf( "%6i numportals\n", numportals );
 	Sys_Printf( "%6i numfaces\n", numfaces );
 
-	// these counts should take advantage of 64 bit systems automatically
+	// padded to 64 bits so the bit vectors can be combined a visWord_t at a time
 	leafbytes = ( ( portalclusters + 63 ) & ~63 ) >> 3;
-	leaflongs = leafbytes / sizeof( long );
+	leaflongs = leafbytes / sizeof( visWord_t );
 
 	portalbytes = ( ( numportals * 2 + 63 ) & ~63 ) >> 3;
-	portallongs = portalbytes / sizeof( long );
+	portallongs = portalbytes / sizeof( visWord_t );
 
 	// each file portal is split into two memory portals
 	portals = safe_malloc( 2 * numportals * sizeof( vportal_t ) );
@@ -914,9 +960,7 @@ void LoadPortals( char *name ){
 
 	numBSPVisBytes = VIS_HEADER_SIZE + portalclusters * leafbytes;
 
-	if ( numBSPVisBytes > MAX_MAP_VISIBILITY ) {
-		Error( "MAX_MAP_VISIBILITY exceeded" );
-	}
+	AUTOEXPAND_BY_REALLOC( bspVisBytes, numBSPVisBytes, allocatedBSPVisBytes, numBSPVisBytes + 1 );
 
 	( (int *)bspVisBytes )[0] = portalclusters;
 	( (int *)bspVisBytes )[1] = leafbytes;
@@ -1106,6 +1150,20 @@ int VisMain( int argc, char **argv ){
 			Sys_Printf( "saveprt = true\n" );
 			saveprt = qtrue;
 		}
+		else if ( !strcmp( argv[ i ], "-shards" ) ) {
+			numVisShards = atoi( argv[ i + 1 ] );
+			i++;
+			Sys_Printf( "Splitting the portal flow into %d shards\n", numVisShards );
+		}
+		else if ( !strcmp( argv[ i ], "-shard" ) && i + 2 < argc - 1 ) {
+			visShard = atoi( argv[ i + 1 ] );
+			numVisShards = atoi( argv[ i + 2 ] );
+			i += 2;
+			Sys_Printf( "Computing vis shard %d of %d\n", visShard, numVisShards );
+			if ( visShard < 0 || visShard >= numVisShards ) {
+				Error( "Invalid vis shard %d of %d", visShard, numVisShards );
+			}
+		}
 		else if ( !strcmp( argv[i],"-tmpin" ) ) {
 			strcpy( inbase, "/tmp" );
 		}
@@ -1130,20 +1188,32 @@ int VisMain( int argc, char **argv ){
 		Error( "usage: vis [-threads #] [-level 0-4] [-fast] [-v] bspfile" );
 	}
 
+	/* -fast has no portal flow to split */
+	if ( fastvis && numVisShards > 1 ) {
+		Sys_FPrintf( SYS_WRN, "WARNING: -shards is ignored with -fast\n" );
+		numVisShards = 0;
+		visShard = -1;
+	}
+
 
 	/* load the bsp */
 	sprintf( source, "%s%s", inbase, ExpandArg( argv[ i ] ) );
 	StripExtension( source );
 	strcat( source, ".bsp" );
 	Sys_Printf( "Loading %s\n", source );
+	ProfileBegin( "LoadBSPFile" );
 	LoadBSPFile( source );
+	ProfileEnd();
 
 	/* load the portal file */
 	sprintf( portalfile, "%s%s", inbase, ExpandArg( argv[ i ] ) );
 	StripExtension( portalfile );
 	strcat( portalfile, ".prt" );
 	Sys_Printf( "Loading %s\n", portalfile );
+	ProfileBegin( "LoadPortals" );
 	LoadPortals( portalfile );
+	ProfileEnd();
+	SetupVisShards( portalfile );
 
 	/* ydnar: exit if no portals, hence no vis */
 	if ( numportals == 0 ) {
@@ -1167,7 +1237,14 @@ int VisMain( int argc, char **argv ){
 
 	Sys_Printf( "visdatasize:%i\n", numBSPVisBytes );
 
+	ProfileBegin( "CalcVis" );
 	CalcVis();
+	ProfileEnd();
+
+	/* shard workers leave the prt file and bsp to the master */
+	if ( visShard >= 0 ) {
+		return 0;
+	}
 
 	/* delete the prt file */
 	if ( !saveprt ) {
@@ -1176,7 +1253,12 @@ int VisMain( int argc, char **argv ){
 
 	/* write the bsp file */
 	Sys_Printf( "Writing %s\n", source );
+	ProfileBegin( "WriteBSPFile" );
 	WriteBSPFile( source );
+	ProfileEnd();
+
+	/* the merged shards aren't needed anymore */
+	DeleteVisShards();
 
 	return 0;
 }
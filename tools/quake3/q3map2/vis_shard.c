@@ -0,0 +1,684 @@
+/* -------------------------------------------------------------------------------
+
+   Copyright (C) 1999-2007 id Software, Inc. and contributors.
+   For a list of contributors, see the accompanying CONTRIBUTORS file.
+
+   This file is part of GtkRadiant.
+
+   GtkRadiant is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   GtkRadiant is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GtkRadiant; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+   ----------------------------------------------------------------------------------
+
+   This code has been altered significantly from its original form, to support
+   several games based on the Quake III Arena engine, in the form of "Q3Map2."
+
+   ------------------------------------------------------------------------------- */
+
+
+
+/* marker */
+#define VIS_SHARD_C
+
+
+
+/* dependencies */
+#include "q3map2.h"
+
+#ifdef WIN32
+	#include <process.h>
+#else
+	#include <signal.h>
+	#include <sys/types.h>
+	#include <sys/wait.h>
+	#include <unistd.h>
+#endif
+
+
+
+/* -------------------------------------------------------------------------------
+
+   vis -shards <n> splits the portal flow over n worker processes. each worker
+   (vis -shard <i> <n>) loads the same .prt and does its own base vis and
+   passages, then flows the sorted portals in rounds: every n-th portal of a
+   round starting at i is its own, and the portalvis it computes is appended to
+   <map>.vis<i>. before each round a worker reads the earlier rounds of all the
+   other shards, so later portals can reuse the earlier information like they do
+   in a single process. the master merges the shards by portal number.
+
+   shards are keyed by an md5 of the .prt and the vis options, so shards left
+   behind by a crashed run are resumed from their last complete round. workers
+   only talk through the shard files, so they can also be started by hand on
+   machines sharing the map directory and merged by a later vis -shards run
+
+   ------------------------------------------------------------------------------- */
+
+#define VISSHARD_IDENT          ( ( 'D' << 24 ) + ( 'H' << 16 ) + ( 'S' << 8 ) + 'V' )
+#define VISSHARD_VERSION        1
+
+#define MAX_VIS_SHARDS          64      /* WaitForMultipleObjects limit */
+#define VISSHARD_ROUND_PORTALS  32      /* portals per shard per round */
+#define VISSHARD_POLL_MSEC      50
+
+typedef struct visShardHeader_s
+{
+	int ident, version;
+	byte key[ 16 ];
+	int shard, numShards;
+	int numPortals, portalBytes;
+	int numRounds;
+}
+visShardHeader_t;
+
+/* each round is a header followed by numRecords of an int portal number and portalBytes of portalvis */
+typedef struct visShardRound_s
+{
+	int round, numRecords;
+}
+visShardRound_t;
+
+static byte visShardPortalDigest[ 16 ];
+static byte visShardKey[ 16 ];
+static int visShardRoundSize, numVisShardRounds;
+
+static long visShardOffsets[ MAX_VIS_SHARDS ];
+static int visShardRounds[ MAX_VIS_SHARDS ];        /* complete rounds read from each shard */
+static FILE                 *visShardFile;          /* this worker's shard */
+
+static void ( *visShardFlow )( int portalnum );
+static int visShardFlowStart;
+
+
+
+/*
+   VisShardFileName()
+   gets the name of a shard file
+ */
+
+static void VisShardFileName( int shard, char *filename ){
+	strcpy( filename, source );
+	StripExtension( filename );
+	sprintf( filename + strlen( filename ), ".vis%d", shard );
+}
+
+
+
+/*
+   SetupVisShards()
+   hashes the portal file, must be called before it is removed
+ */
+
+void SetupVisShards( const char *portalFile ){
+	int length;
+	void        *buffer;
+	md5_state_t mh;
+
+
+	/* dummy check */
+	if ( numVisShards <= 1 ) {
+		return;
+	}
+	if ( numVisShards > MAX_VIS_SHARDS ) {
+		Error( "Too many vis shards (%d > %d)", numVisShards, MAX_VIS_SHARDS );
+	}
+
+	/* hash it */
+	length = LoadFile( portalFile, &buffer );
+	md5_init( &mh );
+	md5_append( &mh, buffer, length );
+	md5_finish( &mh, visShardPortalDigest );
+	free( buffer );
+}
+
+
+
+/*
+   SetupVisShardRounds()
+   keys the shards on the portal file and every option that changes the portal flow
+ */
+
+static void SetupVisShardRounds( void ){
+	md5_state_t mh;
+	int options[ 7 ];
+
+
+	options[ 0 ] = noPassageVis;
+	options[ 1 ] = passageVisOnly;
+	options[ 2 ] = mergevis;
+	options[ 3 ] = mergevisportals;
+	options[ 4 ] = hint;
+	options[ 5 ] = nosort;
+	options[ 6 ] = numVisShards;
+
+	md5_init( &mh );
+	md5_append( &mh, visShardPortalDigest, sizeof( visShardPortalDigest ) );
+	md5_append( &mh, (md5_byte_t*) options, sizeof( options ) );
+	md5_append( &mh, (md5_byte_t*) &farPlaneDist, sizeof( farPlaneDist ) );
+	md5_finish( &mh, visShardKey );
+
+	/* split the sorted portals into rounds */
+	visShardRoundSize = numVisShards * VISSHARD_ROUND_PORTALS;
+	numVisShardRounds = ( numportals * 2 + visShardRoundSize - 1 ) / visShardRoundSize;
+
+	memset( visShardOffsets, 0, sizeof( visShardOffsets ) );
+	memset( visShardRounds, 0, sizeof( visShardRounds ) );
+}
+
+
+
+/*
+   ReadVisShard()
+   copies the complete rounds of a shard that haven't been read yet into the portals,
+   up to maxRounds. returns qfalse if the shard is missing or stale
+ */
+
+static qboolean ReadVisShard( int shard, int maxRounds ){
+	int i, pnum, size;
+	byte                *buffer, *record;
+	visShardHeader_t header;
+	visShardRound_t round;
+	vportal_t           *p;
+	char filename[ 1024 ];
+	FILE                *file;
+
+
+	/* open it */
+	VisShardFileName( shard, filename );
+	file = fopen( filename, "rb" );
+	if ( file == NULL ) {
+		return qfalse;
+	}
+
+	/* check the header */
+	if ( visShardOffsets[ shard ] == 0 ) {
+		if ( fread( &header, sizeof( header ), 1, file ) != 1 ||
+			 LittleLong( header.ident ) != VISSHARD_IDENT || LittleLong( header.version ) != VISSHARD_VERSION ||
+			 memcmp( header.key, visShardKey, sizeof( header.key ) ) ||
+			 LittleLong( header.shard ) != shard || LittleLong( header.numShards ) != numVisShards ||
+			 LittleLong( header.numPortals ) != numportals * 2 || LittleLong( header.portalBytes ) != portalbytes ||
+			 LittleLong( header.numRounds ) != numVisShardRounds ) {
+			fclose( file );
+			return qfalse;
+		}
+		visShardOffsets[ shard ] = sizeof( header );
+	}
+
+	/* read the complete rounds */
+	buffer = safe_malloc( VISSHARD_ROUND_PORTALS * ( sizeof( int ) + portalbytes ) );
+	while ( visShardRounds[ shard ] < maxRounds )
+	{
+		/* get the round header */
+		if ( fseek( file, visShardOffsets[ shard ], SEEK_SET ) || fread( &round, sizeof( round ), 1, file ) != 1 ) {
+			break;
+		}
+		round.round = LittleLong( round.round );
+		round.numRecords = LittleLong( round.numRecords );
+		if ( round.round != visShardRounds[ shard ] || round.numRecords < 0 || round.numRecords > VISSHARD_ROUND_PORTALS ) {
+			Error( "Vis shard %s is corrupt", filename );
+		}
+
+		/* a worker may still be writing it */
+		size = round.numRecords * ( sizeof( int ) + portalbytes );
+		if ( (int) fread( buffer, 1, size, file ) != size ) {
+			break;
+		}
+
+		/* copy the portalvis */
+		for ( i = 0, record = buffer; i < round.numRecords; i++, record += sizeof( int ) + portalbytes )
+		{
+			memcpy( &pnum, record, sizeof( pnum ) );
+			pnum = LittleLong( pnum );
+			if ( pnum < 0 || pnum >= numportals * 2 ) {
+				Error( "Vis shard %s references portal %d of %d", filename, pnum, numportals * 2 );
+			}
+			p = &portals[ pnum ];
+			if ( p->portalvis == NULL ) {
+				p->portalvis = safe_malloc( portalbytes );
+			}
+			memcpy( p->portalvis, record + sizeof( int ), portalbytes );
+			p->status = stat_done;
+		}
+
+		visShardOffsets[ shard ] += sizeof( round ) + size;
+		visShardRounds[ shard ]++;
+	}
+
+	free( buffer );
+	fclose( file );
+	return qtrue;
+}
+
+
+
+/*
+   OpenVisShard()
+   picks up the complete rounds of this worker's shard and reopens it for appending
+ */
+
+static void OpenVisShard( void ){
+	int length;
+	byte                *buffer;
+	visShardHeader_t header;
+	char filename[ 1024 ], tempname[ 1024 ];
+	FILE                *file;
+
+
+	VisShardFileName( visShard, filename );
+	sprintf( tempname, "%s.tmp", filename );
+
+	/* resume from the last complete round */
+	if ( ReadVisShard( visShard, numVisShardRounds ) ) {
+		Sys_Printf( "Resuming %s from round %d of %d\n", filename, visShardRounds[ visShard ], numVisShardRounds );
+
+		/* drop a partially written round */
+		length = visShardOffsets[ visShard ];
+		buffer = safe_malloc( length );
+		file = SafeOpenRead( filename );
+		SafeRead( file, buffer, length );
+		fclose( file );
+		file = SafeOpenWrite( tempname );
+		SafeWrite( file, buffer, length );
+		fclose( file );
+		free( buffer );
+	}
+
+	/* start a new one */
+	else
+	{
+		memset( &header, 0, sizeof( header ) );
+		header.ident = LittleLong( VISSHARD_IDENT );
+		header.version = LittleLong( VISSHARD_VERSION );
+		memcpy( header.key, visShardKey, sizeof( header.key ) );
+		header.shard = LittleLong( visShard );
+		header.numShards = LittleLong( numVisShards );
+		header.numPortals = LittleLong( numportals * 2 );
+		header.portalBytes = LittleLong( portalbytes );
+		header.numRounds = LittleLong( numVisShardRounds );
+		file = SafeOpenWrite( tempname );
+		SafeWrite( file, &header, sizeof( header ) );
+		fclose( file );
+		visShardOffsets[ visShard ] = sizeof( header );
+	}
+
+	/* move it into place, other workers only ever see complete rounds */
+	remove( filename );
+	if ( rename( tempname, filename ) ) {
+		Error( "Unable to rename %s to %s", tempname, filename );
+	}
+	visShardFile = fopen( filename, "ab" );
+	if ( visShardFile == NULL ) {
+		Error( "Unable to append to %s", filename );
+	}
+}
+
+
+
+/*
+   WriteVisShardRound()
+   appends the portalvis this worker computed in a round to its shard
+ */
+
+static void WriteVisShardRound( int round, int start, int end ){
+	int i, pnum;
+	visShardRound_t header;
+	vportal_t           *p;
+
+
+	/* count the records */
+	header.numRecords = 0;
+	for ( i = start; i < end; i += numVisShards )
+	{
+		if ( !sorted_portals[ i ]->removed ) {
+			header.numRecords++;
+		}
+	}
+
+	/* write them */
+	header.round = LittleLong( round );
+	header.numRecords = LittleLong( header.numRecords );
+	SafeWrite( visShardFile, &header, sizeof( header ) );
+	for ( i = start; i < end; i += numVisShards )
+	{
+		p = sorted_portals[ i ];
+		if ( p->removed ) {
+			continue;
+		}
+		pnum = LittleLong( (int) ( p - portals ) );
+		SafeWrite( visShardFile, &pnum, sizeof( pnum ) );
+		SafeWrite( visShardFile, p->portalvis, portalbytes );
+	}
+	fflush( visShardFile );
+	visShardRounds[ visShard ]++;
+}
+
+
+
+/*
+   WaitVisShards()
+   waits until every other shard has finished the rounds before this one
+ */
+
+static void WaitVisShards( int round ){
+	int i, numWaiting;
+
+
+	while ( 1 )
+	{
+		numWaiting = 0;
+		for ( i = 0; i < numVisShards; i++ )
+		{
+			if ( i == visShard || visShardRounds[ i ] >= round ) {
+				continue;
+			}
+			ReadVisShard( i, round );
+			if ( visShardRounds[ i ] < round ) {
+				numWaiting++;
+			}
+		}
+		if ( numWaiting == 0 ) {
+			return;
+		}
+		Sys_Sleep( VISSHARD_POLL_MSEC );
+	}
+}
+
+
+
+/*
+   RunVisShardFlow()
+   runs a flow over this worker's portals, round by round
+ */
+
+static void ShardPortalFlow( int num ){
+	visShardFlow( visShardFlowStart + num * numVisShards );
+}
+
+void RunVisShardFlow( void ( *flow )( int portalnum ) ){
+	int round, start, end;
+
+
+	/* note it */
+	Sys_Printf( "\n--- RunVisShardFlow (shard %d of %d) ---\n", visShard, numVisShards );
+	SetupVisShardRounds();
+	OpenVisShard();
+
+	/* flow the rounds */
+	visShardFlow = flow;
+	for ( round = 0; round < numVisShardRounds; round++ )
+	{
+		WaitVisShards( round );
+		if ( round < visShardRounds[ visShard ] ) {
+			continue;
+		}
+
+		start = round * visShardRoundSize + visShard;
+		end = MIN( ( round + 1 ) * visShardRoundSize, numportals * 2 );
+		visShardFlowStart = start;
+		if ( start < end ) {
+			RunThreadsOnIndividual( ( end - start + numVisShards - 1 ) / numVisShards, qfalse, ShardPortalFlow );
+		}
+		WriteVisShardRound( round, start, end );
+		Sys_FPrintf( SYS_VRB, "round %d of %d\n", round + 1, numVisShardRounds );
+	}
+
+	fclose( visShardFile );
+	visShardFile = NULL;
+}
+
+
+
+/*
+   SpawnVisShard()
+   starts a worker process for a shard, using the command line q3map2 was started with
+ */
+
+static intptr_t SpawnVisShard( int shard ){
+	int i, numArgs, threads;
+	char        **args, threadString[ 16 ], shardString[ 16 ], numShardsString[ 16 ];
+	intptr_t pid;
+	const char  *arg;
+
+
+	/* split the threads between the workers */
+	threads = numthreads / numVisShards;
+	if ( threads < 1 ) {
+		threads = 1;
+	}
+	sprintf( threadString, "%d", threads );
+	sprintf( shardString, "%d", shard );
+	sprintf( numShardsString, "%d", numVisShards );
+
+	/* copy the command line, replacing -shards and -threads and dropping -connect and -profile */
+	args = safe_malloc( ( commandArgc + 8 ) * sizeof( *args ) );
+	numArgs = 0;
+	args[ numArgs++ ] = commandArgv[ 0 ];
+	args[ numArgs++ ] = "-threads";
+	args[ numArgs++ ] = threadString;
+	for ( i = 1; i < commandArgc - 1; i++ )
+	{
+		arg = commandArgv[ i ];
+		if ( !strcmp( arg, "-shards" ) || !strcmp( arg, "-threads" ) || !strcmp( arg, "-connect" ) || !strcmp( arg, "-profile" ) ) {
+			i++;
+			continue;
+		}
+		args[ numArgs++ ] = commandArgv[ i ];
+	}
+	args[ numArgs++ ] = "-shard";
+	args[ numArgs++ ] = shardString;
+	args[ numArgs++ ] = numShardsString;
+	args[ numArgs++ ] = commandArgv[ commandArgc - 1 ];
+	args[ numArgs ] = NULL;
+
+	/* don't let the worker inherit unflushed output */
+	fflush( stdout );
+	fflush( stderr );
+
+#ifdef WIN32
+	/* _spawnv doesn't quote arguments */
+	for ( i = 0; i < numArgs; i++ )
+	{
+		if ( strchr( args[ i ], ' ' ) != NULL ) {
+			arg = args[ i ];
+			args[ i ] = safe_malloc( strlen( arg ) + 3 );
+			sprintf( args[ i ], "\"%s\"", arg );
+		}
+	}
+	pid = _spawnv( _P_NOWAIT, commandArgv[ 0 ], (const char * const *) args );
+#else
+	pid = fork();
+	if ( pid == 0 ) {
+		execvp( args[ 0 ], args );
+		_exit( 127 );
+	}
+#endif
+
+	if ( pid == -1 ) {
+		Error( "Unable to start vis shard %d", shard );
+	}
+	Sys_Printf( "Started vis shard %d of %d (%d threads)\n", shard, numVisShards, threads );
+
+	/* the few quoted copies on win32 are left to the os */
+	free( args );
+	return pid;
+}
+
+
+
+/*
+   WaitAnyVisShard()
+   waits for one of the workers to exit, returns its shard
+ */
+
+static int WaitAnyVisShard( intptr_t *pids, qboolean *ok ){
+	int i;
+
+
+#ifdef WIN32
+	HANDLE handles[ MAX_VIS_SHARDS ];
+	int shards[ MAX_VIS_SHARDS ], numHandles;
+	DWORD result, exitCode;
+
+	numHandles = 0;
+	for ( i = 0; i < numVisShards; i++ )
+	{
+		if ( pids[ i ] != 0 ) {
+			handles[ numHandles ] = (HANDLE) pids[ i ];
+			shards[ numHandles++ ] = i;
+		}
+	}
+	result = WaitForMultipleObjects( numHandles, handles, FALSE, INFINITE );
+	if ( result >= WAIT_OBJECT_0 + numHandles ) {
+		Error( "Unable to wait for the vis shards" );
+	}
+	i = shards[ result - WAIT_OBJECT_0 ];
+	*ok = GetExitCodeProcess( handles[ result - WAIT_OBJECT_0 ], &exitCode ) && exitCode == 0;
+	CloseHandle( handles[ result - WAIT_OBJECT_0 ] );
+	return i;
+#else
+	pid_t pid;
+	int status;
+
+	while ( 1 )
+	{
+		pid = waitpid( -1, &status, 0 );
+		if ( pid == -1 ) {
+			Error( "Unable to wait for the vis shards" );
+		}
+		for ( i = 0; i < numVisShards; i++ )
+		{
+			if ( pids[ i ] == pid ) {
+				*ok = WIFEXITED( status ) && WEXITSTATUS( status ) == 0;
+				return i;
+			}
+		}
+	}
+#endif
+}
+
+
+
+/*
+   KillVisShards()
+   stops the remaining workers, they would wait on a failed shard forever
+ */
+
+static void KillVisShards( intptr_t *pids ){
+	int i;
+
+
+	for ( i = 0; i < numVisShards; i++ )
+	{
+		if ( pids[ i ] == 0 ) {
+			continue;
+		}
+#ifdef WIN32
+		TerminateProcess( (HANDLE) pids[ i ], 1 );
+		CloseHandle( (HANDLE) pids[ i ] );
+#else
+		kill( (pid_t) pids[ i ], SIGTERM );
+		waitpid( (pid_t) pids[ i ], NULL, 0 );
+#endif
+		pids[ i ] = 0;
+	}
+}
+
+
+
+/*
+   RunVisShards()
+   reuses the complete shards, runs workers for the rest and merges them into portalvis
+ */
+
+void RunVisShards( void ){
+	int i, numRunning, numReused;
+	intptr_t        *pids;
+	qboolean ok;
+	vportal_t       *p;
+
+
+	/* note it */
+	Sys_Printf( "\n--- RunVisShards (%d) ---\n", numVisShards );
+	SetupVisShardRounds();
+
+	/* reuse the complete shards, start workers for the rest */
+	pids = safe_malloc( numVisShards * sizeof( *pids ) );
+	numRunning = 0;
+	for ( i = 0; i < numVisShards; i++ )
+	{
+		ReadVisShard( i, numVisShardRounds );
+		if ( visShardRounds[ i ] == numVisShardRounds ) {
+			pids[ i ] = 0;
+		}
+		else
+		{
+			pids[ i ] = SpawnVisShard( i );
+			numRunning++;
+		}
+	}
+	numReused = numVisShards - numRunning;
+
+	/* wait for them */
+	while ( numRunning > 0 )
+	{
+		i = WaitAnyVisShard( pids, &ok );
+		pids[ i ] = 0;
+		numRunning--;
+		if ( !ok ) {
+			KillVisShards( pids );
+			Error( "Vis shard %d failed, rerun to resume from the completed rounds", i );
+		}
+	}
+	free( pids );
+
+	/* merge them, each portal comes from exactly one shard */
+	for ( i = 0; i < numVisShards; i++ )
+	{
+		ReadVisShard( i, numVisShardRounds );
+		if ( visShardRounds[ i ] != numVisShardRounds ) {
+			Error( "Vis shard %d is incomplete", i );
+		}
+	}
+	for ( i = 0, p = portals; i < numportals * 2; i++, p++ )
+	{
+		if ( p->removed ) {
+			p->status = stat_done;
+		}
+		else if ( p->status != stat_done ) {
+			Error( "Portal %d missing from the vis shards", i );
+		}
+	}
+
+	/* emit some statistics */
+	Sys_Printf( "%9d vis shards reused\n", numReused );
+	Sys_Printf( "%9d vis shards computed\n", numVisShards - numReused );
+}
+
+
+
+/*
+   DeleteVisShards()
+   removes the shard files once the bsp is written
+ */
+
+void DeleteVisShards( void ){
+	int i;
+	char filename[ 1024 ];
+
+
+	for ( i = 0; i < numVisShards; i++ )
+	{
+		VisShardFileName( i, filename );
+		remove( filename );
+	}
+}
@@ -58,12 +58,48 @@
    void CalcMightSee (leaf_t *leaf,
  */
 
+/*
+   vis bit vectors
+
+   mightsee/cansee/portalvis are padded to 64 bits (see LoadPortals) and are
+   combined a visWord_t at a time, four at a time on avx2 builds
+ */
+
+#if defined( __AVX2__ )
+	#define VIS_AVX2
+	#include <immintrin.h>
+#endif
+
+#if defined( __GNUC__ )
+	#define VisWordBits( w )        __builtin_popcountll( w )
+	#define VisWordFirstBit( w )    __builtin_ctzll( w )
+#else
+static int VisWordBits( visWord_t w ){
+	w = w - ( ( w >> 1 ) & 0x5555555555555555ULL );
+	w = ( w & 0x3333333333333333ULL ) + ( ( w >> 2 ) & 0x3333333333333333ULL );
+	w = ( w + ( w >> 4 ) ) & 0x0F0F0F0F0F0F0F0FULL;
+	return (int) ( ( w * 0x0101010101010101ULL ) >> 56 );
+}
+
+static int VisWordFirstBit( visWord_t w ){
+	return VisWordBits( ( w & ( ~w + 1 ) ) - 1 );
+}
+#endif
+
 int CountBits( byte *bits, int numbits ){
-	int i;
-	int c;
+	int i, c, numWords;
+	const visWord_t *words;
+
 
+	/* whole words */
 	c = 0;
-	for ( i = 0 ; i < numbits ; i++ )
+	words = (const visWord_t *) bits;
+	numWords = numbits >> 6;
+	for ( i = 0; i < numWords; i++ )
+		c += VisWordBits( words[ i ] );
+
+	/* trailing bits */
+	for ( i = numWords << 6; i < numbits; i++ )
 		if ( bits[i >> 3] & ( 1 << ( i & 7 ) ) ) {
 			c++;
 		}
@@ -71,6 +107,67 @@ int CountBits( byte *bits, int numbits ){
 	return c;
 }
 
+/*
+   MightSeeMore()
+   might = prevmight & test [& test2], returns true if might has any bits that are not in vis
+ */
+
+static qboolean MightSeeMore( byte *might, const byte *prevmight, const byte *test, const byte *test2, const byte *vis ){
+	int j;
+	visWord_t more, w;
+	visWord_t           *m;
+	const visWord_t     *pm, *t, *t2, *v;
+
+
+	m = (visWord_t *) might;
+	pm = (const visWord_t *) prevmight;
+	t = (const visWord_t *) test;
+	t2 = (const visWord_t *) test2;
+	v = (const visWord_t *) vis;
+	j = 0;
+	more = 0;
+	PROFILE_COUNT( PROFILE_VIS_TESTS, 1 );
+	PROFILE_COUNT( PROFILE_VIS_BITS, portallongs * 64 );
+
+#ifdef VIS_AVX2
+	{
+		__m256i mw, mmore;
+
+		mmore = _mm256_setzero_si256();
+		for ( ; j + 4 <= portallongs; j += 4 )
+		{
+			mw = _mm256_and_si256( _mm256_loadu_si256( (const __m256i *) &pm[ j ] ), _mm256_loadu_si256( (const __m256i *) &t[ j ] ) );
+			if ( t2 != NULL ) {
+				mw = _mm256_and_si256( mw, _mm256_loadu_si256( (const __m256i *) &t2[ j ] ) );
+			}
+			_mm256_storeu_si256( (__m256i *) &m[ j ], mw );
+			mmore = _mm256_or_si256( mmore, _mm256_andnot_si256( _mm256_loadu_si256( (const __m256i *) &v[ j ] ), mw ) );
+		}
+		more = !_mm256_testz_si256( mmore, mmore );
+	}
+#endif
+
+	if ( t2 != NULL ) {
+		for ( ; j < portallongs; j++ )
+		{
+			w = pm[ j ] & t[ j ] & t2[ j ];
+			m[ j ] = w;
+			more |= w & ~v[ j ];
+		}
+	}
+	else
+	{
+		for ( ; j < portallongs; j++ )
+		{
+			w = pm[ j ] & t[ j ];
+			m[ j ] = w;
+			more |= w & ~v[ j ];
+		}
+	}
+
+	return more != 0;
+}
+
 int c_fullskip;
 
 int c_chop, c_nochop;
@@ -424,8 +521,8 @@ void RecursiveLeafFlow( int leafnum, threaddata_t *thread, pstack_t *prevstack )
 	vportal_t   *p;
 	visPlane_t backplane;
 	leaf_t      *leaf;
-	int i, j, n;
-	long        *test, *might, *prevmight, *vis, more;
+	int i, n;
+	byte        *test;
 	int pnum;
 
 	thread->c_chains++;
@@ -445,9 +542,6 @@ void RecursiveLeafFlow( int leafnum, threaddata_t *thread, pstack_t *prevstack )
 	stack.numseperators[1] = 0;
 #endif
 
-	might = (long *)stack.mightsee;
-	vis = (long *)thread->base->portalvis;
-
 	// check all portals for flowing into other leafs
 	for ( i = 0; i < leaf->numportals; i++ )
 	{
@@ -482,22 +576,14 @@ void RecursiveLeafFlow( int leafnum, threaddata_t *thread, pstack_t *prevstack )
 
 		// if the portal can't see anything we haven't allready seen, skip it
 		if ( p->status == stat_done ) {
-			test = (long *)p->portalvis;
+			test = p->portalvis;
 		}
 		else
 		{
-			test = (long *)p->portalflood;
+			test = p->portalflood;
 		}
 
-		more = 0;
-		prevmight = (long *)prevstack->mightsee;
-		for ( j = 0 ; j < portallongs ; j++ )
-		{
-			might[j] = prevmight[j] & test[j];
-			more |= ( might[j] & ~vis[j] );
-		}
-
-		if ( !more &&
+		if ( !MightSeeMore( stack.mightsee, prevstack->mightsee, test, NULL, thread->base->portalvis ) &&
 			 ( thread->base->portalvis[pnum >> 3] & ( 1 << ( pnum & 7 ) ) ) ) { // can't see anything new
 			continue;
 		}
@@ -648,7 +734,6 @@ void RecursiveLeafFlow( int leafnum, threaddata_t *thread, pstack_t *prevstack )
  */
 void PortalFlow( int portalnum ){
 	threaddata_t data;
-	int i;
 	vportal_t       *p;
 	int c_might, c_can;
 
@@ -674,8 +759,7 @@ void PortalFlow( int portalnum ){
 	data.pstack_head.source = p->winding;
 	data.pstack_head.portalplane = p->plane;
 	data.pstack_head.depth = 0;
-	for ( i = 0 ; i < portallongs ; i++ )
-		( (long *)data.pstack_head.mightsee )[i] = ( (long *)p->portalflood )[i];
+	memcpy( data.pstack_head.mightsee, p->portalflood, portalbytes );
 
 	RecursiveLeafFlow( p->leaf, &data, &data.pstack_head );
 
@@ -697,8 +781,8 @@ void RecursivePassageFlow( vportal_t *portal, threaddata_t *thread, pstack_t *pr
 	vportal_t   *p;
 	leaf_t      *leaf;
 	passage_t   *passage, *nextpassage;
-	int i, j;
-	long        *might, *vis, *prevmight, *cansee, *portalvis, more;
+	int i;
+	byte        *portalvis;
 	int pnum;
 
 	leaf = &leafs[portal->leaf];
@@ -708,8 +792,6 @@ void RecursivePassageFlow( vportal_t *portal, threaddata_t *thread, pstack_t *pr
 	stack.next = NULL;
 	stack.depth = prevstack->depth + 1;
 
-	vis = (long *)thread->base->portalvis;
-
 	passage = portal->passages;
 	nextpassage = passage;
 	// check all portals for flowing into other leafs
@@ -729,32 +811,14 @@ void RecursivePassageFlow( vportal_t *portal, threaddata_t *thread, pstack_t *pr
 		// mark the portal as visible
 		thread->base->portalvis[pnum >> 3] |= ( 1 << ( pnum & 7 ) );
 
-		prevmight = (long *)prevstack->mightsee;
-		cansee = (long *)passage->cansee;
-		might = (long *)stack.mightsee;
-		memcpy( might, prevmight, portalbytes );
 		if ( p->status == stat_done ) {
-			portalvis = (long *) p->portalvis;
+			portalvis = p->portalvis;
 		}
 		else{
-			portalvis = (long *) p->portalflood;
-		}
-		more = 0;
-		for ( j = 0; j < portallongs; j++ )
-		{
-			if ( *might ) {
-				*might &= *cansee++ & *portalvis++;
-				more |= ( *might & ~vis[j] );
-			}
-			else
-			{
-				cansee++;
-				portalvis++;
-			}
-			might++;
+			portalvis = p->portalflood;
 		}
 
-		if ( !more ) {
+		if ( !MightSeeMore( stack.mightsee, prevstack->mightsee, passage->cansee, portalvis, thread->base->portalvis ) ) {
 			// can't see anything new
 			continue;
 		}
@@ -773,7 +837,6 @@ void RecursivePassageFlow( vportal_t *portal, threaddata_t *thread, pstack_t *pr
  */
 void PassageFlow( int portalnum ){
 	threaddata_t data;
-	int i;
 	vportal_t       *p;
 //	int				c_might, c_can;
 
@@ -799,8 +862,7 @@ void PassageFlow( int portalnum ){
 	data.pstack_head.source = p->winding;
 	data.pstack_head.portalplane = p->plane;
 	data.pstack_head.depth = 0;
-	for ( i = 0 ; i < portallongs ; i++ )
-		( (long *)data.pstack_head.mightsee )[i] = ( (long *)p->portalflood )[i];
+	memcpy( data.pstack_head.mightsee, p->portalflood, portalbytes );
 
 	RecursivePassageFlow( p, &data, &data.pstack_head );
 
@@ -825,8 +887,8 @@ void RecursivePassagePortalFlow( vportal_t *portal, threaddata_t *thread, pstack
 	leaf_t      *leaf;
 	visPlane_t backplane;
 	passage_t   *passage, *nextpassage;
-	int i, j, n;
-	long        *might, *vis, *prevmight, *cansee, *portalvis, more;
+	int i, n;
+	byte        *portalvis;
 	int pnum;
 
 //	thread->c_chains++;
@@ -846,8 +908,6 @@ void RecursivePassagePortalFlow( vportal_t *portal, threaddata_t *thread, pstack
 	stack.numseperators[1] = 0;
 #endif
 
-	vis = (long *)thread->base->portalvis;
-
 	passage = portal->passages;
 	nextpassage = passage;
 	// check all portals for flowing into other leafs
@@ -864,32 +924,15 @@ void RecursivePassagePortalFlow( vportal_t *portal, threaddata_t *thread, pstack
 			continue;   // can't possibly see it
 
 		}
-		prevmight = (long *)prevstack->mightsee;
-		cansee = (long *)passage->cansee;
-		might = (long *)stack.mightsee;
-		memcpy( might, prevmight, portalbytes );
 		if ( p->status == stat_done ) {
-			portalvis = (long *) p->portalvis;
+			portalvis = p->portalvis;
 		}
 		else{
-			portalvis = (long *) p->portalflood;
-		}
-		more = 0;
-		for ( j = 0; j < portallongs; j++ )
-		{
-			if ( *might ) {
-				*might &= *cansee++ & *portalvis++;
-				more |= ( *might & ~vis[j] );
-			}
-			else
-			{
-				cansee++;
-				portalvis++;
-			}
-			might++;
+			portalvis = p->portalflood;
 		}
 
-		if ( !more && ( thread->base->portalvis[pnum >> 3] & ( 1 << ( pnum & 7 ) ) ) ) { // can't see anything new
+		if ( !MightSeeMore( stack.mightsee, prevstack->mightsee, passage->cansee, portalvis, thread->base->portalvis ) &&
+			 ( thread->base->portalvis[pnum >> 3] & ( 1 << ( pnum & 7 ) ) ) ) { // can't see anything new
 			continue;
 		}
 
@@ -1037,7 +1080,6 @@ void RecursivePassagePortalFlow( vportal_t *portal, threaddata_t *thread, pstack
  */
 void PassagePortalFlow( int portalnum ){
 	threaddata_t data;
-	int i;
 	vportal_t       *p;
 //	int				c_might, c_can;
 
@@ -1063,8 +1105,7 @@ void PassagePortalFlow( int portalnum ){
 	data.pstack_head.source = p->winding;
 	data.pstack_head.portalplane = p->plane;
 	data.pstack_head.depth = 0;
-	for ( i = 0 ; i < portallongs ; i++ )
-		( (long *)data.pstack_head.mightsee )[i] = ( (long *)p->portalflood )[i];
+	memcpy( data.pstack_head.mightsee, p->portalflood, portalbytes );
 
 	RecursivePassagePortalFlow( p, &data, &data.pstack_head );
 
@@ -1333,12 +1374,13 @@ int AddSeperators( fixedWinding_t *source, fixedWinding_t *pass, qboolean flipcl
 void CreatePassages( int portalnum ){
 	int i, j, k, n, numseperators, numsee;
 	float d;
+	visWord_t flood;
 	vportal_t       *portal, *p, *target;
 	leaf_t          *leaf;
 	passage_t       *passage, *lastpassage;
 	visPlane_t seperators[MAX_SEPERATORS * 2];
 	fixedWinding_t  *w;
-	fixedWinding_t in, out, *res;
+	fixedWinding_t windings[ 2 ], *in, *out, *res;
 
 
 #ifdef MREDEBUG
@@ -1379,14 +1421,16 @@ void CreatePassages( int portalnum ){
 		//create the passage->cansee
 		for ( j = 0; j < numportals * 2; j++ )
 		{
-			p = &portals[j];
-			if ( p->removed ) {
+			// skip to the next portal both portals might see
+			flood = ( (visWord_t *)target->portalflood )[j >> 6] & ( (visWord_t *)portal->portalflood )[j >> 6];
+			flood &= ~0ULL << ( j & 63 );
+			if ( !flood ) {
+				j |= 63;
 				continue;
 			}
-			if ( !( target->portalflood[j >> 3] & ( 1 << ( j & 7 ) ) ) ) {
-				continue;
-			}
-			if ( !( portal->portalflood[j >> 3] & ( 1 << ( j & 7 ) ) ) ) {
+			j = ( j & ~63 ) + VisWordFirstBit( flood );
+			p = &portals[j];
+			if ( p->removed ) {
 				continue;
 			}
 			for ( k = 0; k < numseperators; k++ )
@@ -1419,32 +1463,29 @@ void CreatePassages( int portalnum ){
 
 
 			/* ydnar: prefer correctness to stack overflow  */
-			//% memcpy( &in, p->winding, (int)((fixedWinding_t *)0)->points[p->winding->numpoints] );
+			/* chop the portal winding in place, ping-ponging between two buffers */
 			if ( p->winding->numpoints <= MAX_POINTS_ON_FIXED_WINDING ) {
-				memcpy( &in, p->winding, offsetof( fixedWinding_t, points ) + sizeof( *p->winding->points ) * p->winding->numpoints );
+				in = p->winding;
 			}
-			else{
-				memcpy( &in, p->winding, sizeof( fixedWinding_t ) );
+			else
+			{
+				/* ydnar: this is a shitty crutch */
+				memcpy( &windings[ 0 ], p->winding, sizeof( fixedWinding_t ) );
+				windings[ 0 ].numpoints = MAX_POINTS_ON_FIXED_WINDING;
+				in = &windings[ 0 ];
 			}
-
+			out = ( in == &windings[ 0 ] ? &windings[ 1 ] : &windings[ 0 ] );
 
 			for ( k = 0; k < numseperators; k++ )
 			{
-				/* ydnar: this is a shitty crutch */
-				if ( in.numpoints > MAX_POINTS_ON_FIXED_WINDING ) {
-					//% Sys_Printf( "[%d]", p->winding->numpoints );
-					in.numpoints = MAX_POINTS_ON_FIXED_WINDING;
-				}
-
-				res = PassageChopWinding( &in, &out, &seperators[ k ] );
-				if ( res == &out ) {
-					memcpy( &in, &out, sizeof( fixedWinding_t ) );
-				}
-
-
+				res = PassageChopWinding( in, out, &seperators[ k ] );
 				if ( res == NULL ) {
 					break;
 				}
+				if ( res == out ) {
+					in = res;
+					out = ( in == &windings[ 0 ] ? &windings[ 1 ] : &windings[ 0 ] );
+				}
 			}
 			if ( k < numseperators ) {
 				continue;
@@ -1620,6 +1661,17 @@ void BasePortalVis( int portalnum ){
 		}
 
 
+		/* every winding point is within radius of the portal origin, and ON_EPSILON
+		   covers the rounding, so test the spheres before walking the points */
+		d = DotProduct( tp->origin, p->plane.normal ) - p->plane.dist;
+		if ( d + tp->radius < 0.0f ) {
+			continue;   // no points on front
+		}
+		d = DotProduct( p->origin, tp->plane.normal ) - tp->plane.dist;
+		if ( d - p->radius > 0.0f ) {
+			continue;   // no points on back
+		}
+
 		w = tp->winding;
 		for ( k = 0 ; k < w->numpoints ; k++ )
 		{
@@ -1681,8 +1733,7 @@ void BasePortalVis( int portalnum ){
 void RecursiveLeafBitFlow( int leafnum, byte *mightsee, byte *cansee ){
 	vportal_t   *p;
 	leaf_t      *leaf;
-	int i, j;
-	long more;
+	int i;
 	int pnum;
 	byte newmight[MAX_PORTALS / 8];
 
@@ -1703,15 +1754,7 @@ void RecursiveLeafBitFlow( int leafnum, byte *mightsee, byte *cansee ){
 		}
 
 		// if this portal can see some portals we mightsee, recurse
-		more = 0;
-		for ( j = 0 ; j < portallongs ; j++ )
-		{
-			( (long *)newmight )[j] = ( (long *)mightsee )[j]
-									  & ( (long *)p->portalflood )[j];
-			more |= ( (long *)newmight )[j] & ~( (long *)cansee )[j];
-		}
-
-		if ( !more ) {
+		if ( !MightSeeMore( newmight, mightsee, p->portalflood, NULL, cansee ) ) {
 			continue;   // can't see anything new
 
 		}
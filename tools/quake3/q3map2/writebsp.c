@@ -118,6 +118,7 @@ void EmitPlanes( void ){
 	mp = mapplanes;
 	for ( i = 0; i < nummapplanes; i++, mp++ )
 	{
+		AUTOEXPAND_BY_REALLOC_BSP( Planes, 1024 );
 		bp = &bspPlanes[ numBSPPlanes ];
 		VectorCopy( mp->normal, bp->normal );
 		bp->dist = mp->dist;
@@ -141,10 +142,8 @@ void EmitLeaf( node_t *node ){
 	drawSurfRef_t   *dsr;
 
 
-	/* check limits */
-	if ( numBSPLeafs >= MAX_MAP_LEAFS ) {
-		Error( "MAX_MAP_LEAFS" );
-	}
+	/* make room */
+	AUTOEXPAND_BY_REALLOC_BSP( Leafs, 1024 );
 
 	leaf_p = &bspLeafs[numBSPLeafs];
 	numBSPLeafs++;
@@ -168,9 +167,7 @@ void EmitLeaf( node_t *node ){
 		//%	if( b->guard != 0xDEADBEEF )
 		//%		Sys_Printf( "Brush %6d: 0x%08X Guard: 0x%08X Next: 0x%08X Original: 0x%08X Sides: %d\n", b->brushNum, b, b, b->next, b->original, b->numsides );
 
-		if ( numBSPLeafBrushes >= MAX_MAP_LEAFBRUSHES ) {
-			Error( "MAX_MAP_LEAFBRUSHES" );
-		}
+		AUTOEXPAND_BY_REALLOC_BSP( LeafBrushes, 1024 );
 		bspLeafBrushes[ numBSPLeafBrushes ] = b->original->outputNum;
 		numBSPLeafBrushes++;
 	}
@@ -186,9 +183,7 @@ void EmitLeaf( node_t *node ){
 	leaf_p->firstBSPLeafSurface = numBSPLeafSurfaces;
 	for ( dsr = node->drawSurfReferences; dsr; dsr = dsr->nextRef )
 	{
-		if ( numBSPLeafSurfaces >= MAX_MAP_LEAFFACES ) {
-			Error( "MAX_MAP_LEAFFACES" );
-		}
+		AUTOEXPAND_BY_REALLOC_BSP( LeafSurfaces, 1024 );
 		bspLeafSurfaces[ numBSPLeafSurfaces ] = dsr->outputNum;
 		numBSPLeafSurfaces++;
 	}
@@ -204,7 +199,7 @@ void EmitLeaf( node_t *node ){
 
 int EmitDrawNode_r( node_t *node ){
 	bspNode_t   *n;
-	int i;
+	int i, nodeNum, child;
 
 
 	/* check for leafnode */
@@ -214,10 +209,9 @@ int EmitDrawNode_r( node_t *node ){
 	}
 
 	/* emit a node */
-	if ( numBSPNodes == MAX_MAP_NODES ) {
-		Error( "MAX_MAP_NODES" );
-	}
-	n = &bspNodes[ numBSPNodes ];
+	AUTOEXPAND_BY_REALLOC_BSP( Nodes, 1024 );
+	nodeNum = numBSPNodes;
+	n = &bspNodes[ nodeNum ];
 	numBSPNodes++;
 
 	VectorCopy( node->mins, n->mins );
@@ -230,21 +224,23 @@ int EmitDrawNode_r( node_t *node ){
 
 	//
 	// recursively output the other nodes
+	// (bspNodes can be reallocated by the recursion, so index it again)
 	//
 	for ( i = 0 ; i < 2 ; i++ )
 	{
 		if ( node->children[i]->planenum == PLANENUM_LEAF ) {
-			n->children[i] = -( numBSPLeafs + 1 );
+			child = -( numBSPLeafs + 1 );
 			EmitLeaf( node->children[i] );
 		}
 		else
 		{
-			n->children[i] = numBSPNodes;
+			child = numBSPNodes;
 			EmitDrawNode_r( node->children[i] );
 		}
+		bspNodes[ nodeNum ].children[i] = child;
 	}
 
-	return n - bspNodes;
+	return nodeNum;
 }
 
 
@@ -387,6 +383,7 @@ void BeginBSPFile( void ){
 
 	/* ydnar: gs mods: set the first 6 drawindexes to 0 1 2 2 1 3 for triangles and quads */
 	numBSPDrawIndexes = 6;
+	AUTOEXPAND_BY_REALLOC_BSP( DrawIndexes, 1024 );
 	bspDrawIndexes[ 0 ] = 0;
 	bspDrawIndexes[ 1 ] = 1;
 	bspDrawIndexes[ 2 ] = 2;
@@ -447,10 +444,8 @@ void EmitBrushes( brush_t *brushes, int *firstBrush, int *numBrushes ){
 	/* walk list of brushes */
 	for ( b = brushes; b != NULL; b = b->next )
 	{
-		/* check limits */
-		if ( numBSPBrushes == MAX_MAP_BRUSHES ) {
-			Error( "MAX_MAP_BRUSHES (%d)", numBSPBrushes );
-		}
+		/* make room */
+		AUTOEXPAND_BY_REALLOC_BSP( Brushes, 1024 );
 
 		/* get bsp brush */
 		b->outputNum = numBSPBrushes;
@@ -470,10 +465,8 @@ void EmitBrushes( brush_t *brushes, int *firstBrush, int *numBrushes ){
 			/* set output number to bogus initially */
 			b->sides[ j ].outputNum = -1;
 
-			/* check count */
-			if ( numBSPBrushSides == MAX_MAP_BRUSHSIDES ) {
-				Error( "MAX_MAP_BRUSHSIDES " );
-			}
+			/* make room */
+			AUTOEXPAND_BY_REALLOC_BSP( BrushSides, 1024 );
 
 			/* emit side */
 			b->sides[ j ].outputNum = numBSPBrushSides;